@@ -0,0 +1,167 @@
+/**
+ * Stress test of concurrent queries on one shared filter instance, the way
+ * RocksDB readers share a filter block through the block cache.
+ *
+ * Usage: concurrent_bench <max threads, 0 = all cores> <filter> <filter args>
+ *
+ * For 1, 2, 4, ... threads up to the maximum, every thread runs the whole
+ * query workload, starting at a different offset, against the same filter.
+ * Each answer is checked against a single-threaded reference run, and the
+ * aggregate throughput is reported with its speedup over one thread.
+ */
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "test_wrapper/oasis_plus_test_wrapper.hpp"
+#include "test_wrapper/oasis_test_wrapper.hpp"
+#include "test_wrapper/util.hpp"
+
+namespace benchmark {
+enum FilterType { Oasis, OasisPlus };
+
+static std::unordered_map<std::string, FilterType> kName2Type{
+    {"Oasis", FilterType::Oasis}, {"OasisPlus", FilterType::OasisPlus}};
+
+const std::string dataPath = "./my_data/";
+
+const std::string keyFilePath = dataPath + "data0.txt";
+const std::string lQueryFilePath = dataPath + "txn0.txt";
+const std::string uQueryFilePath = dataPath + "upper_bound0.txt";
+
+class ConcurrentExperiment {
+ public:
+  ConcurrentExperiment(std::vector<uint64_t> &keys,
+                       std::vector<std::pair<uint64_t, uint64_t>> &queries,
+                       std::vector<std::string> &argv)
+      : keys_(std::move(keys)), queries_(std::move(queries)) {
+    max_threads_ = strtoul(argv[0].c_str(), nullptr, 10);
+    if (max_threads_ == 0) {
+      max_threads_ = std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    filter_type_ = kName2Type[argv[1]];
+    argv.erase(argv.begin(), argv.begin() + 2);
+    switch (filter_type_) {
+      case FilterType::OasisPlus:
+        assert(argv.size() >= 3);
+        test_wrapper_ = new OasisPlusWrapper();
+        test_wrapper_->init(argv);
+        break;
+      case FilterType::Oasis:
+        assert(argv.size() >= 2);
+        test_wrapper_ = new OasisWrapper();
+        test_wrapper_->init(argv);
+        break;
+    }
+  }
+
+  ~ConcurrentExperiment() { delete test_wrapper_; }
+
+  /* false if any concurrent answer differs from the single-threaded one */
+  auto test() -> bool {
+    test_wrapper_->construct(keys_);
+
+    expected_.resize(queries_.size());
+    for (size_t i = 0; i < queries_.size(); ++i) {
+      expected_[i] = test_wrapper_->query(queries_[i].first,
+                                          queries_[i].second);
+    }
+
+    bool ok = true;
+    double base_qps = 0;
+    printf("Threads\tMQueries/s\tSpeedup\tMismatches\n");
+    for (size_t nthreads = 1; nthreads <= max_threads_;
+         nthreads = nthreads == max_threads_
+                        ? nthreads + 1
+                        : std::min(nthreads * 2, max_threads_)) {
+      size_t mismatches = 0;
+      double qps = run(nthreads, mismatches);
+      if (nthreads == 1) {
+        base_qps = qps;
+      }
+      printf("%zu\t%.3lf\t\t%.2lf\t%zu\n", nthreads, qps / 1e6, qps / base_qps,
+             mismatches);
+      ok &= mismatches == 0;
+    }
+    return ok;
+  }
+
+ private:
+  /* aggregate queries per second of nthreads threads sharing the filter */
+  auto run(size_t nthreads, size_t &mismatches) -> double {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> start{false};
+    std::atomic<size_t> total_mismatches{0};
+
+    std::vector<std::thread> threads;
+    for (size_t tid = 0; tid < nthreads; ++tid) {
+      threads.emplace_back([&, tid]() {
+        size_t n = queries_.size();
+        size_t offset = n * tid / nthreads;
+        size_t local_mismatches = 0;
+
+        ++ready;
+        while (!start.load(std::memory_order_acquire)) {
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+          size_t idx = (offset + i) % n;
+          bool ans = test_wrapper_->query(queries_[idx].first,
+                                          queries_[idx].second);
+          local_mismatches += ans != expected_[idx];
+        }
+        total_mismatches += local_mismatches;
+      });
+    }
+
+    while (ready.load() != nthreads) {
+    }
+    auto begin_time = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    auto end_time = std::chrono::steady_clock::now();
+
+    mismatches = total_mismatches.load();
+    double seconds =
+        std::chrono::duration<double>(end_time - begin_time).count();
+    return static_cast<double>(nthreads * queries_.size()) / seconds;
+  }
+
+ private:
+  /* exp params */
+  FilterType filter_type_;
+  size_t max_threads_;
+  std::vector<uint64_t> keys_;
+  std::vector<std::pair<uint64_t, uint64_t>> queries_;
+
+  /* single-threaded answers */
+  std::vector<uint8_t> expected_;
+
+  TestWrapper *test_wrapper_ = nullptr;
+};
+
+}  // namespace benchmark
+
+int main(int argc, char *argv[]) {
+  using namespace benchmark;
+  std::vector<std::string> v_argv(argc - 1);
+  for (int i = 1; i < argc; ++i) {
+    v_argv[i - 1] = argv[i];
+  }
+
+  std::vector<uint64_t> keys;
+  std::set<uint64_t> keyset;
+  std::vector<std::pair<uint64_t, uint64_t>> queries;
+
+  intLoadKeys(keyFilePath, keys, keyset);
+  intLoadQueries(lQueryFilePath, uQueryFilePath, queries);
+  ConcurrentExperiment exp(keys, queries, v_argv);
+  return exp.test() ? 0 : 1;
+}
@@ -75,6 +75,12 @@ membudg_arr=(8 10 12 14 16 18)
 #######################################
 block_sizes=(150)
 
+## Oasis Search Tree
+#######################################
+# 1 stores S-tree indices over the interval begins and the block biases,
+# 0 keeps plain binary searches. Running both reports the gain.
+search_trees=(0 1)
+
 ##############################################################################################
 
 REPO_DIR="$(pwd)"
@@ -156,9 +162,9 @@ experiment() {
         echo -e "BPK: $membudg; BlockSZ: $block_size" >>$index_file
         echo -ne "$filter,$nkeys,$nqrys,$keylen,$kdist,$qdist,$minrange,$maxrange,$pqratio,$pnratio,$membudg,$block_size," >>$res_csv
     elif [ $filter = "Oasis" ]; then
-        config+="-${membudg}-${block_size}"
-        echo -e "BPK: $membudg; BlockSZ: $block_size" >>$index_file
-        echo -ne "$filter,$nkeys,$nqrys,$keylen,$kdist,$qdist,$minrange,$maxrange,$pqratio,$pnratio,$membudg,$block_size," >>$res_csv
+        config+="-${membudg}-${block_size}-${search_tree}"
+        echo -e "BPK: $membudg; BlockSZ: $block_size; SearchTree: $search_tree" >>$index_file
+        echo -ne "$filter,$nkeys,$nqrys,$keylen,$kdist,$qdist,$minrange,$maxrange,$pqratio,$pnratio,$membudg,$block_size,$search_tree," >>$res_csv
     fi
 
     echo -e "\n" >>$index_file
@@ -167,8 +173,9 @@ experiment() {
     if [ $filter = "Oasis" ]; then
         echo -e "\tFilter Bits-per-Key:\t$membudg" >>./experiment_result
         echo -e "\tBlock Size:\t$block_size" >>./experiment_result
+        echo -e "\tSearch Tree:\t$search_tree" >>./experiment_result
         echo -e "### END EXPERIMENT DESCRIPTION ###\n\n" >>./experiment_result
-        $EXP_BIN "$res_csv" "$filter" "$membudg" "$block_size" >>./experiment_result
+        $EXP_BIN "$res_csv" "$filter" "$membudg" "$block_size" "$search_tree" >>./experiment_result
 
     elif [ $filter = "OasisPlus" ]; then
         echo -e "\tFilter Bits-per-Key:\t$membudg" >>./experiment_result
@@ -199,11 +206,13 @@ for nkeys in "${nkeys_arr[@]}"; do
 
                         for membudg in "${membudg_arr[@]}"; do
                             for block_size in "${block_sizes[@]}"; do
-                                printf -v filecnt "%03d" $file_cnt
-                                expdir=$(mktemp -d $SCRATCH_DIR/$filter.XXXXXXX)
-                                experiment
-                                rm -rf $expdir
-                                ((file_cnt++))
+                                for search_tree in "${search_trees[@]}"; do
+                                    printf -v filecnt "%03d" $file_cnt
+                                    expdir=$(mktemp -d $SCRATCH_DIR/$filter.XXXXXXX)
+                                    experiment
+                                    rm -rf $expdir
+                                    ((file_cnt++))
+                                done
                             done
                         done
                     done
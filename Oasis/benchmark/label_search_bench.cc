@@ -0,0 +1,241 @@
+/**
+ * Microbenchmark of the label searches of Proteus' sparse trie levels.
+ *
+ * Usage: label_search_bench [rounds]
+ *
+ * The trie nodes are those a Proteus trie over the workload's keys has at
+ * every byte: the distinct next bytes of the keys under each key prefix. Each
+ * query's left bound is searched in the node of its prefix at every depth, as
+ * LoudsSparse::lookupKey() and moveToKeyGreaterThan() do, with every search
+ * kernel that takes the node, grouped by node size since the kernels only
+ * differ past a few labels.
+ */
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "proteus/label_vector.h"
+#include "test_wrapper/util.hpp"
+
+namespace benchmark {
+using oasis_plus::label_t;
+using oasis_plus::LabelVector;
+using oasis_plus::position_t;
+
+const std::string dataPath = "./my_data/";
+
+const std::string keyFilePath = dataPath + "data0.txt";
+const std::string lQueryFilePath = dataPath + "txn0.txt";
+const std::string uQueryFilePath = dataPath + "upper_bound0.txt";
+
+/* one label search: target in the node of len labels at pos */
+struct Search {
+  position_t pos;
+  position_t len;
+  label_t target;
+};
+
+class LabelSearchExperiment {
+ public:
+  LabelSearchExperiment(const std::vector<uint64_t> &keys,
+                        const std::vector<std::pair<uint64_t, uint64_t>> &queries,
+                        size_t rounds)
+      : rounds_(rounds) {
+    build_nodes(keys);
+    build_searches(queries);
+    std::vector<std::vector<label_t>> labels_per_level{labels_};
+    label_vector_ = new LabelVector(labels_per_level, 0, 1);
+  }
+
+  ~LabelSearchExperiment() {
+    label_vector_->destroy();
+    delete label_vector_;
+  }
+
+  /* false if any kernel answers differently from the linear search */
+  auto test() -> bool {
+    bool ok = true;
+    const position_t bounds[] = {3, LabelVector::kSimdMinLen, 32, 257};
+    printf("Nodes\t\tSearches\tKernel\t\tEqual ns\tGreater ns\n");
+    for (size_t b = 0; b + 1 < 4; ++b) {
+      std::vector<Search> searches;
+      for (const auto &search : searches_) {
+        if (search.len >= bounds[b] && search.len < bounds[b + 1]) {
+          searches.push_back(search);
+        }
+      }
+      if (searches.empty()) {
+        continue;
+      }
+
+      std::string nodes = "[" + std::to_string(bounds[b]) + ", " +
+                          std::to_string(bounds[b + 1] - 1) + "]";
+      auto expected = run(searches, Kernel::kLinear, nullptr);
+      for (Kernel kernel : {Kernel::kLinear, Kernel::kBinary, Kernel::kSSE2,
+                            Kernel::kAVX2, Kernel::kSearch}) {
+        if (!runs(kernel, bounds[b])) {
+          continue;
+        }
+        double ns[2];
+        ok &= run(searches, kernel, ns) == expected;
+        printf("%-16s%zu\t\t%-16s%.2lf\t\t%.2lf\n", nodes.c_str(),
+               searches.size(), kKernelNames[static_cast<int>(kernel)], ns[0],
+               ns[1]);
+      }
+    }
+    return ok;
+  }
+
+ private:
+  enum class Kernel { kLinear, kBinary, kSSE2, kAVX2, kSearch };
+  static constexpr const char *kKernelNames[] = {"linear", "binary", "sse2",
+                                                 "avx2", "search"};
+
+  /* the distinct next bytes of the keys under every prefix of whole bytes */
+  void build_nodes(const std::vector<uint64_t> &keys) {
+    for (size_t depth = 0; depth < sizeof(uint64_t); ++depth) {
+      size_t shift = 64 - 8 * depth;
+      for (size_t i = 0; i < keys.size();) {
+        uint64_t prefix = depth == 0 ? 0 : keys[i] >> shift;
+        position_t pos = labels_.size();
+        int last = -1;
+        for (; i < keys.size() && (depth == 0 || keys[i] >> shift == prefix);
+             ++i) {
+          int label = (keys[i] >> (shift - 8)) & 0xFF;
+          if (label != last) {
+            labels_.push_back(label);
+            last = label;
+          }
+        }
+        nodes_[depth].push_back({prefix, {pos, labels_.size() - pos}});
+      }
+    }
+  }
+
+  /* the searches of every query's left bound in the nodes of its prefixes */
+  void build_searches(
+      const std::vector<std::pair<uint64_t, uint64_t>> &queries) {
+    for (const auto &query : queries) {
+      for (size_t depth = 0; depth < sizeof(uint64_t); ++depth) {
+        size_t shift = 64 - 8 * depth;
+        uint64_t prefix = depth == 0 ? 0 : query.first >> shift;
+        const auto &nodes = nodes_[depth];
+        auto node = std::lower_bound(
+            nodes.begin(), nodes.end(), prefix,
+            [](const auto &node, uint64_t prefix) {
+              return node.first < prefix;
+            });
+        if (node == nodes.end() || node->first != prefix) {
+          break;
+        }
+        label_t target = (query.first >> (shift - 8)) & 0xFF;
+        searches_.push_back({node->second.first, node->second.second, target});
+      }
+    }
+  }
+
+  auto runs(Kernel kernel, position_t min_len) const -> bool {
+    switch (kernel) {
+      case Kernel::kSSE2:
+        return min_len >= 16;
+      case Kernel::kAVX2:
+        return min_len >= 32 && __builtin_cpu_supports("avx2");
+      default:
+        return true;
+    }
+  }
+
+  /* the answers, 1 + position or 0, and the ns per equal / greater search */
+  auto run(const std::vector<Search> &searches, Kernel kernel, double *ns)
+      -> std::vector<position_t> {
+    std::vector<position_t> answers(2 * searches.size());
+    for (int greater = 0; greater < 2; ++greater) {
+      auto begin_time = std::chrono::steady_clock::now();
+      for (size_t round = 0; round < rounds_; ++round) {
+        for (size_t i = 0; i < searches.size(); ++i) {
+          answers[2 * i + greater] = search(searches[i], kernel, greater);
+        }
+      }
+      auto end_time = std::chrono::steady_clock::now();
+      if (ns != nullptr) {
+        ns[greater] =
+            std::chrono::duration<double, std::nano>(end_time - begin_time)
+                .count() /
+            (rounds_ * searches.size());
+      }
+    }
+    return answers;
+  }
+
+  auto search(const Search &search, Kernel kernel, bool greater) const
+      -> position_t {
+    const label_t *labels = labels_.data() + search.pos;
+    position_t pos = search.pos;
+    bool found = false;
+    switch (kernel) {
+      case Kernel::kLinear:
+        found = greater ? label_vector_->linearSearchGreaterThan(
+                              search.target, pos, search.len)
+                        : label_vector_->linearSearch(search.target, pos,
+                                                      search.len);
+        break;
+      case Kernel::kBinary:
+        found = greater ? label_vector_->binarySearchGreaterThan(
+                              search.target, pos, search.len)
+                        : label_vector_->binarySearch(search.target, pos,
+                                                      search.len);
+        break;
+      case Kernel::kSSE2:
+        pos += greater ? oasis_plus::findLabelGreaterThanSSE2(
+                             labels, search.len, search.target)
+                       : oasis_plus::findLabelSSE2(labels, search.len,
+                                                   search.target);
+        found = pos < search.pos + search.len;
+        break;
+      case Kernel::kAVX2:
+        pos += greater ? oasis_plus::findLabelGreaterThanAVX2(
+                             labels, search.len, search.target)
+                       : oasis_plus::findLabelAVX2(labels, search.len,
+                                                   search.target);
+        found = pos < search.pos + search.len;
+        break;
+      case Kernel::kSearch:
+        found = greater ? label_vector_->searchGreaterThan(search.target, pos,
+                                                           search.len)
+                        : label_vector_->search(search.target, pos,
+                                                search.len);
+        break;
+    }
+    return found ? pos - search.pos + 1 : 0;
+  }
+
+ private:
+  size_t rounds_;
+  /* the labels of all nodes, depth by depth */
+  std::vector<label_t> labels_;
+  /* the prefix, position and size of the nodes at every depth */
+  std::vector<std::pair<uint64_t, std::pair<position_t, position_t>>>
+      nodes_[sizeof(uint64_t)];
+  std::vector<Search> searches_;
+
+  LabelVector *label_vector_ = nullptr;
+};
+
+}  // namespace benchmark
+
+int main(int argc, char *argv[]) {
+  using namespace benchmark;
+  size_t rounds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10;
+
+  std::vector<uint64_t> keys;
+  std::set<uint64_t> keyset;
+  std::vector<std::pair<uint64_t, uint64_t>> queries;
+
+  intLoadKeys(keyFilePath, keys, keyset);
+  intLoadQueries(lQueryFilePath, uQueryFilePath, queries);
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  LabelSearchExperiment exp(keys, queries, rounds);
+  return exp.test() ? 0 : 1;
+}
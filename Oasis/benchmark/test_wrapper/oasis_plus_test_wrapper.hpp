@@ -27,7 +27,8 @@ class OasisPlusWrapper : public TestWrapper {
   auto construct(std::vector<std::uint64_t> &keys) -> clock_t override;
 
   /* [left, right) */
-  auto query(const uint64_t &left, const uint64_t &right) -> bool override {
+  auto query(const uint64_t &left, const uint64_t &right) const
+      -> bool override {
     if (isPointQuery(left, right)) {
       return filter_->query(left);
     }
@@ -18,12 +18,25 @@ class OasisWrapper : public TestWrapper {
   void init(const std::vector<std::string> &argv) override {
     bpk_ = strtod(argv[0].c_str(), nullptr);
     block_sz_ = strtoul(argv[1].c_str(), nullptr, 10);
+    if (argv.size() > 2) {
+      search_tree_ = strtoul(argv[2].c_str(), nullptr, 10) != 0;
+    }
+    if (argv.size() > 3) {
+      build_threads_ = strtoul(argv[3].c_str(), nullptr, 10);
+    }
+    if (argv.size() > 4) {
+      pla_epsilon_ = strtoul(argv[4].c_str(), nullptr, 10);
+    }
+    if (argv.size() > 5) {
+      rice_blocks_ = strtoul(argv[5].c_str(), nullptr, 10) != 0;
+    }
   }
 
   auto construct(std::vector<std::uint64_t> &keys) -> clock_t override;
 
   /* [left, right) */
-  auto query(const uint64_t &left, const uint64_t &right) -> bool override {
+  auto query(const uint64_t &left, const uint64_t &right) const
+      -> bool override {
     if (isPointQuery(left, right)) {
       return filter_->query(left);
     }
@@ -35,6 +48,10 @@ class OasisWrapper : public TestWrapper {
  private:
   double bpk_;
   uint32_t block_sz_;
+  bool search_tree_ = false;
+  size_t build_threads_ = 1;
+  size_t pla_epsilon_ = 0;
+  bool rice_blocks_ = false;
 
   oasis::Oasis *filter_ = nullptr;
 };
@@ -43,7 +60,8 @@ auto OasisWrapper::construct(std::vector<std::uint64_t> &keys) -> clock_t {
   clock_t begin_time;
 
   begin_time = clock();
-  filter_ = new oasis::Oasis(bpk_, block_sz_, keys);
+  filter_ = new oasis::Oasis(bpk_, block_sz_, keys, search_tree_,
+                             build_threads_, pla_epsilon_, rice_blocks_);
   return clock() - begin_time;
 }
 
@@ -12,7 +12,7 @@ class TestWrapper {
   /** Set the int bench as default option */
   TestWrapper() = default;
 
-  ~TestWrapper() {}
+  virtual ~TestWrapper() = default;
 
   virtual void init(const std::vector<std::string> &argv) {}
   virtual void init(const std::vector<std::pair<uint64_t, uint64_t>> &queries,
@@ -20,8 +20,9 @@ class TestWrapper {
 
   virtual auto construct(std::vector<std::uint64_t> &keys) -> clock_t = 0;
 
-  /* [left, right) */
-  virtual auto query(const uint64_t &left, const uint64_t &right) -> bool = 0;
+  /* [left, right), must be safe to call from concurrent threads */
+  virtual auto query(const uint64_t &left, const uint64_t &right) const
+      -> bool = 0;
 
   auto query_time(const std::vector<std::pair<uint64_t, uint64_t>> &queries)
       -> clock_t;
@@ -1,29 +1,52 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <vector>
 
+#include "query_stats.hpp"
 #include "util.hpp"
 
 namespace oasis {
 
+/**
+ * Elias-Fano coded block of sorted keys. The lower bits of all keys come
+ * first, packed nkeys x lower_bit_len, then the upper bits as a run of 1s per
+ * bucket step and a 0 per key, closed by a final 1. Queries decode whole
+ * 64-bit words: the bucket is found with popcount/select and the keys in it
+ * are read with one or two word loads each.
+ *
+ * Blocks spanning at least kSelectSample buckets store, after the bit array,
+ * the start of every kSelectSample-th bucket as a uint32_t, so the select
+ * scan never covers more than kSelectSample 1s.
+ */
 class BitSet {
  public:
-  BitSet(size_t nkeys, uint64_t max_range, uint8_t *data);
+  /* # buckets between two select samples */
+  static constexpr uint64_t kSelectSample = 512;
+
+ public:
+  inline BitSet(size_t nkeys, uint64_t max_range, const uint8_t *data);
 
   ~BitSet() = default;
 
-  auto query(uint64_t query) -> bool;
+  inline auto query(uint64_t query) const -> bool;
   /* [left, right] */
-  auto query(uint64_t left, uint64_t right) -> bool;
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  /* fetch the upper bits, where every query starts */
+  inline void prefetch() const;
 
-  auto size() const -> size_t;
+  inline auto size() const -> size_t;
 
-  static auto size(size_t nkeys, uint64_t max_range) -> size_t;
-  static auto build(const std::vector<uint64_t> &keys, uint64_t max_range)
-      -> std::vector<uint8_t>;
+  /* the keys, in order */
+  inline auto decode() const -> std::vector<uint64_t>;
+
+  inline static auto size(size_t nkeys, uint64_t max_range) -> size_t;
+  inline static auto build(const std::vector<uint64_t> &keys,
+                           uint64_t max_range) -> std::vector<uint8_t>;
 
  private:
   inline static auto get_lower_bit_length(uint64_t nkeys, uint64_t max_range)
@@ -32,11 +55,25 @@ class BitSet {
   inline static auto bit_array_bsize(uint64_t nkeys, uint64_t max_range,
                                      uint64_t lower_bit_len) -> size_t;
 
+  inline static auto nsamples(uint64_t max_range, uint64_t lower_bit_len)
+      -> size_t;
+
   inline auto get_lower_bit_length(uint64_t max_range) -> uint64_t;
 
   inline auto bit_array_bsize(uint64_t max_range) -> size_t;
 
-  inline auto find_next_set_bit(size_t idx) -> size_t;
+  /* smallest key >= key, false if there is none */
+  inline auto successor(uint64_t key, uint64_t &result) const -> bool;
+
+  /* idx-th 64-bit word of the bit array, bits past b_size_ read as 0 */
+  inline auto get_word(size_t idx) const -> uint64_t;
+  /* lower bits of the idx-th key */
+  inline auto get_lower(size_t idx) const -> uint64_t;
+
+  /* position right after the rank-th 1 at or after idx, b_size_ if none */
+  inline auto select_one(size_t idx, uint64_t rank) const -> size_t;
+  inline auto find_next_set_bit(size_t idx) const -> size_t;
+  inline auto find_next_unset_bit(size_t idx) const -> size_t;
 
  private:
   uint64_t lower_bit_len_;
@@ -44,145 +81,69 @@ class BitSet {
   size_t nkeys_;
 
   // need to be serialized
-  uint8_t *data_;
+  const uint8_t *data_;
 };
 
-BitSet::BitSet(size_t nkeys, uint64_t max_range, uint8_t *data)
+BitSet::BitSet(size_t nkeys, uint64_t max_range, const uint8_t *data)
     : nkeys_(nkeys) {
   lower_bit_len_ = get_lower_bit_length(max_range);
   b_size_ = bit_array_bsize(max_range);
   data_ = data;
 }
 
-auto BitSet::query(uint64_t query) -> bool {
-  size_t up_idx = lower_bit_len_ * nkeys_;
-  uint64_t up_query = query >> lower_bit_len_;
-
-  // upper bit search
-  size_t zero_cnt = 0;
-  size_t range = 0;
-  uint64_t upper = 0;
-  while (upper <= up_query && up_idx < b_size_) {
-    if (data_[up_idx >> 3] & (1U << (up_idx & 0x7ULL))) {
-      ++up_idx;
-      ++upper;
-    } else {
-      size_t next_idx = find_next_set_bit(up_idx);
-      size_t delta = next_idx - up_idx;
-      if (upper == up_query) {
-        range = delta;
-        break;
-      }
-      zero_cnt += delta;
-      up_idx = next_idx;
-    }
-  }
-
-  if (range == 0) {
-    return false;
-  } else if (lower_bit_len_ == 0) {
-    return true;
-  }
-
-  // lower bit search
-  uint64_t low_query = query & ((1 << lower_bit_len_) - 1);
-  size_t low_idx = zero_cnt * lower_bit_len_;
-  while (low_idx < (zero_cnt + range) * lower_bit_len_) {
-    uint64_t low_key = 0;
-    uint64_t bit_cnt = 0;
-    while (bit_cnt < lower_bit_len_) {
-      uint64_t byte_bias = low_idx & 0x7ULL;
-      uint64_t delta = std::min((8 - byte_bias), lower_bit_len_ - bit_cnt);
-      uint64_t tmp_mask = (1 << delta) - 1;
-      uint64_t cur_data = (data_[low_idx >> 3] >> byte_bias) & tmp_mask;
-      low_key |= cur_data << bit_cnt;
-      bit_cnt += delta;
-      low_idx += delta;
-    }
-    if (low_key >= low_query) {
-      return low_key == low_query;
-    }
-  }
-  return false;
+auto BitSet::query(uint64_t query) const -> bool {
+  uint64_t key;
+  return successor(query, key) && key == query;
 }
 
-auto BitSet::query(uint64_t left, uint64_t right) -> bool {
-  size_t up_idx = lower_bit_len_ * nkeys_;
-  uint64_t up_left = left >> lower_bit_len_;
-  uint64_t up_right = right >> lower_bit_len_;
-
-  // upper bit search
-  size_t zero_cnt = 0;
-  size_t range = 0;
-  uint64_t upper = 0;
-  std::vector<std::pair<uint64_t, size_t>> upper_keys;
-  while (upper <= up_right && up_idx < b_size_) {
-    if (data_[up_idx >> 3] & (1U << (up_idx & 0x7ULL))) {
-      ++up_idx;
-      ++upper;
-    } else {
-      size_t next_idx = find_next_set_bit(up_idx);
-      size_t delta = next_idx - up_idx;
-      if (upper >= up_left && upper <= up_right) {
-        if (range > 0 && upper < up_right) {
-          return true;
-        }
-
-        upper_keys.emplace_back(upper << lower_bit_len_, delta);
-        range += delta;
-      }
-      zero_cnt += range > 0 ? 0 : delta;
-      up_idx = next_idx;
-    }
-  }
-
-  if (range == 0) {
-    return false;
-  } else if (lower_bit_len_ == 0) {
-    return true;
-  }
+auto BitSet::query(uint64_t left, uint64_t right) const -> bool {
+  uint64_t key;
+  return successor(left, key) && key <= right;
+}
 
-  size_t key_begin_idx = zero_cnt;
-  size_t low_idx = key_begin_idx * lower_bit_len_;
-  for (const auto &[up_key, n] : upper_keys) {
-    key_begin_idx += n;
-    while (low_idx < key_begin_idx * lower_bit_len_) {
-      uint64_t low_key = 0;
-      uint64_t bit_cnt = 0;
-      while (bit_cnt < lower_bit_len_) {
-        uint64_t byte_bias = low_idx & 0x7ULL;
-        uint64_t delta = std::min((8 - byte_bias), lower_bit_len_ - bit_cnt);
-        uint64_t tmp_mask = (1 << delta) - 1;
-        uint64_t cur_data = (data_[low_idx >> 3] >> byte_bias) & tmp_mask;
-        low_key |= cur_data << bit_cnt;
-        bit_cnt += delta;
-        low_idx += delta;
-      }
-      uint64_t key = low_key | up_key;
-      if (key >= left && key <= right) {
-        return true;
-      }
-      if (key > right) {
-        return false;
-      }
-    }
-  }
-  return false;
+void BitSet::prefetch() const {
+  __builtin_prefetch(data_ + ((lower_bit_len_ * nkeys_) >> 3));
 }
 
 auto BitSet::size() const -> size_t {
-  return align_bit2byte(b_size_);  // data_ size
+  uint64_t total_quotient = b_size_ - nkeys_ * (1U + lower_bit_len_) - 1;
+  return align_bit2byte(b_size_) +
+         total_quotient / kSelectSample * sizeof(uint32_t);
 }
 
 auto BitSet::size(size_t nkeys, uint64_t max_range) -> size_t {
   uint64_t lower_bit_len = get_lower_bit_length(nkeys, max_range);
   size_t b_size_ = bit_array_bsize(nkeys, max_range, lower_bit_len);
-  return align_bit2byte(b_size_);
+  return align_bit2byte(b_size_) +
+         nsamples(max_range, lower_bit_len) * sizeof(uint32_t);
+}
+
+auto BitSet::decode() const -> std::vector<uint64_t> {
+  std::vector<uint64_t> keys;
+  keys.reserve(nkeys_);
+  size_t pos = lower_bit_len_ * nkeys_;
+  uint64_t upper = 0;
+  while (keys.size() < nkeys_) {
+    size_t next_one = find_next_set_bit(pos);
+    for (; pos < next_one && keys.size() < nkeys_; ++pos) {
+      keys.emplace_back((upper << lower_bit_len_) | get_lower(keys.size()));
+    }
+    if (next_one >= b_size_) {
+      break;
+    }
+    pos = next_one + 1;
+    ++upper;
+  }
+  return keys;
 }
 
 /** Helping Method */
 auto BitSet::get_lower_bit_length(uint64_t nkeys, uint64_t max_range)
     -> uint64_t {
+  // __builtin_clzl(0) is undefined; an empty range needs no lower bits
+  if (nkeys == 0 || max_range == 0) {
+    return 0;
+  }
   return __builtin_clzl(nkeys) > __builtin_clzl(max_range)
              ? __builtin_clzl(nkeys) - __builtin_clzl(max_range)
              : 0;
@@ -202,17 +163,126 @@ auto BitSet::bit_array_bsize(uint64_t max_range) -> size_t {
   return bit_array_bsize(nkeys_, max_range, lower_bit_len_);
 }
 
-auto BitSet::find_next_set_bit(size_t idx) -> size_t {
-  if (!(data_[idx >> 3] >> (idx & 0x7U))) {
-    idx = (idx & (~static_cast<size_t>(0x7U))) + 8U;
+auto BitSet::nsamples(uint64_t max_range, uint64_t lower_bit_len) -> size_t {
+  return (max_range >> lower_bit_len) / kSelectSample;
+}
+
+auto BitSet::successor(uint64_t key, uint64_t &result) const -> bool {
+  size_t up_begin = lower_bit_len_ * nkeys_;
+  uint64_t up_key = key >> lower_bit_len_;
+  uint64_t total_quotient = b_size_ - up_begin - nkeys_ - 1;
+  if (up_key > total_quotient) {
+    return false;
+  }
+
+  // bucket up_key starts right after the up_key-th 1
+  size_t from = up_begin;
+  uint64_t rank = up_key;
+  if (up_key >= kSelectSample) {
+    uint32_t sample;
+    memcpy(&sample,
+           data_ + align_bit2byte(b_size_) +
+               (up_key / kSelectSample - 1) * sizeof(uint32_t),
+           sizeof(uint32_t));
+    from += sample;
+    rank = up_key % kSelectSample;
+  }
+  size_t bucket_begin = select_one(from, rank);
+  if (bucket_begin >= b_size_) {
+    return false;
+  }
+
+  // the 0s up to here are the keys of the lower buckets, the ones after the
+  // last key only pad the bit array
+  size_t key_idx = bucket_begin - up_begin - up_key;
+  size_t bucket_end = find_next_set_bit(bucket_begin);
+  uint64_t low_key = key & ((1ULL << lower_bit_len_) - 1);
+  for (size_t pos = bucket_begin; pos < bucket_end && key_idx < nkeys_;
+       ++pos, ++key_idx) {
+    uint64_t lower = get_lower(key_idx);
+    if (lower >= low_key) {
+      result = (up_key << lower_bit_len_) | lower;
+      return true;
+    }
+  }
+
+  // otherwise the first key of the next non-empty bucket
+  if (key_idx >= nkeys_) {
+    return false;
+  }
+  size_t next_key = find_next_unset_bit(bucket_end);
+  up_key += next_key - bucket_end;
+  result = (up_key << lower_bit_len_) | get_lower(key_idx);
+  return true;
+}
+
+auto BitSet::get_word(size_t idx) const -> uint64_t {
+  uint64_t word = load_word(data_, align_bit2byte(b_size_), idx);
+  if ((idx + 1) * 64 > b_size_) {
+    word &= (1ULL << (b_size_ & 63)) - 1;
+  }
+  return word;
+}
+
+auto BitSet::get_lower(size_t idx) const -> uint64_t {
+  if (lower_bit_len_ == 0) {
+    return 0;
+  }
+  OASIS_STAT_ADD(lower_entries, 1);
+  size_t pos = idx * lower_bit_len_;
+  size_t shift = pos & 63;
+  uint64_t lower = get_word(pos >> 6) >> shift;
+  if (shift + lower_bit_len_ > 64) {
+    lower |= get_word((pos >> 6) + 1) << (64 - shift);
+  }
+  return lower & ((1ULL << lower_bit_len_) - 1);
+}
+
+auto BitSet::select_one(size_t idx, uint64_t rank) const -> size_t {
+  if (rank == 0) {
+    return idx;
   }
+  size_t word_idx = idx >> 6;
+  uint64_t word = get_word(word_idx) & (~0ULL << (idx & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (true) {
+    uint64_t cnt = __builtin_popcountll(word);
+    if (rank <= cnt) {
+      return word_idx * 64 + select64(word, rank - 1) + 1;
+    }
+    rank -= cnt;
+    if (++word_idx * 64 >= b_size_) {
+      return b_size_;
+    }
+    word = get_word(word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
+  }
+}
 
-  while (data_[idx >> 3] == 0) {
-    idx += 8U;
+auto BitSet::find_next_set_bit(size_t idx) const -> size_t {
+  size_t word_idx = idx >> 6;
+  uint64_t word = get_word(word_idx) & (~0ULL << (idx & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (word == 0) {
+    if (++word_idx * 64 >= b_size_) {
+      return b_size_;
+    }
+    word = get_word(word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
   }
+  return word_idx * 64 + __builtin_ctzll(word);
+}
 
-  idx += __builtin_ctz(data_[idx >> 3] >> (idx & 0x7U));
-  return idx;
+auto BitSet::find_next_unset_bit(size_t idx) const -> size_t {
+  size_t word_idx = idx >> 6;
+  /* bits past b_size_ read as 0 and stop the scan */
+  uint64_t word = ~get_word(word_idx) & (~0ULL << (idx & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (word == 0) {
+    word = ~get_word(++word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
+  }
+  return std::min(word_idx * 64 + __builtin_ctzll(word), b_size_);
 }
 
 auto BitSet::build(const std::vector<uint64_t> &keys, uint64_t max_range)
@@ -225,11 +295,23 @@ auto BitSet::build(const std::vector<uint64_t> &keys, uint64_t max_range)
   std::vector<uint8_t> data(data_size, 0);
 
   size_t low_idx = 0;
-  size_t up_idx = lower_bit_len * nkeys;
+  size_t up_begin = lower_bit_len * nkeys;
+  size_t up_idx = up_begin;
+
+  // buckets past the last 1 start at the end of the bit array
+  std::vector<uint32_t> samples(nsamples(max_range, lower_bit_len),
+                                b_size_ - up_begin);
+  auto set_one = [&](uint64_t upper) {
+    data[up_idx >> 3] |= 1 << (up_idx & 0x7ULL);
+    ++up_idx;
+    if (upper % kSelectSample == 0 && upper / kSelectSample <= samples.size()) {
+      samples[upper / kSelectSample - 1] = up_idx - up_begin;
+    }
+  };
 
   uint64_t pre_upper = 0;
   for (size_t i = 0; i < keys.size(); ++i) {
-    uint64_t lower_key = keys[i] & ((1 << lower_bit_len) - 1);
+    uint64_t lower_key = keys[i] & ((1ULL << lower_bit_len) - 1);
     uint64_t bit_cnt = 0;
     while (bit_cnt < lower_bit_len) {
       uint64_t byte_bias = low_idx & 0x7ULL;
@@ -242,14 +324,16 @@ auto BitSet::build(const std::vector<uint64_t> &keys, uint64_t max_range)
     }
 
     while (pre_upper < (keys[i] >> lower_bit_len)) {
-      data[up_idx >> 3] |= 1 << (up_idx & 0x7ULL);
-      ++pre_upper;
-      ++up_idx;
+      set_one(++pre_upper);
     }
     ++up_idx;
   }
-  data[up_idx >> 3] |= 1 << (up_idx & 0x7ULL);
+  set_one(++pre_upper);
+  assert(up_idx <= b_size_);
 
+  const auto *sample_bytes = reinterpret_cast<const uint8_t *>(samples.data());
+  data.insert(data.end(), sample_bytes,
+              sample_bytes + samples.size() * sizeof(uint32_t));
   return data;
 }
 
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#include "bitset.hpp"
+#include "dense_block.hpp"
+#include "rice_block.hpp"
+
+namespace oasis {
+
+/**
+ * A block of Oasis positions in whichever encoding the builder picked for it.
+ * Queries go through a table of the encodings' query paths, each instantiated
+ * from query_as() at compile time, so every encoding keeps its own inlined
+ * decoder and a probe costs one indirect call.
+ */
+class Block {
+ public:
+  enum Encoding : uint8_t {
+    kEliasFano = 0, /* BitSet */
+    kDense = 1,     /* DenseBlock */
+    kRice = 2,      /* RiceBlock */
+  };
+
+ public:
+  /* nbytes: the size of the block, only needed by kRice */
+  Block(uint8_t encoding, size_t nkeys, uint64_t max_range, const uint8_t *data,
+        size_t nbytes)
+      : encoding_(encoding),
+        nkeys_(nkeys),
+        max_range_(max_range),
+        data_(data),
+        nbytes_(nbytes) {}
+
+  inline auto query(uint64_t query) const -> bool;
+  /* [left, right] */
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  inline void prefetch() const;
+
+  /* the keys, in order, repeated ones possibly once */
+  inline auto decode() const -> std::vector<uint64_t>;
+
+  /* size of the smaller of kEliasFano and kDense, the ones not coding gaps */
+  inline static auto size(size_t nkeys, uint64_t max_range) -> size_t;
+
+  /**
+   * The encoding taking the fewest bytes for keys, the faster one on a tie,
+   * and its size in `size`. kRice only if rice, since it saves about half a
+   * bit per key but decodes the keys one by one.
+   */
+  inline static auto choose(const std::vector<uint64_t> &keys,
+                            uint64_t max_range, bool rice, size_t &size)
+      -> uint8_t;
+  inline static auto build(uint8_t encoding, const std::vector<uint64_t> &keys,
+                           uint64_t max_range) -> std::vector<uint8_t>;
+
+ private:
+  template <typename Codec>
+  inline auto open() const -> Codec;
+
+  template <typename Codec>
+  static auto query_as(const Block &block, uint64_t left, uint64_t right)
+      -> bool {
+    Codec codec = block.open<Codec>();
+    return left == right ? codec.query(left) : codec.query(left, right);
+  }
+
+  template <typename Codec>
+  static void prefetch_as(const Block &block) {
+    block.open<Codec>().prefetch();
+  }
+
+  template <typename Codec>
+  static auto decode_as(const Block &block) -> std::vector<uint64_t> {
+    return block.open<Codec>().decode();
+  }
+
+ private:
+  uint8_t encoding_;
+  size_t nkeys_;
+  uint64_t max_range_;
+  const uint8_t *data_;
+  size_t nbytes_;
+};
+
+template <typename Codec>
+auto Block::open() const -> Codec {
+  if constexpr (std::is_same_v<Codec, RiceBlock>) {
+    return {nkeys_, data_, nbytes_};
+  } else {
+    return {nkeys_, max_range_, data_};
+  }
+}
+
+auto Block::query(uint64_t query) const -> bool {
+  return this->query(query, query);
+}
+
+auto Block::query(uint64_t left, uint64_t right) const -> bool {
+  using QueryFn = bool (*)(const Block &, uint64_t, uint64_t);
+  /* indexed by Encoding */
+  static constexpr QueryFn kQuery[] = {&query_as<BitSet>,
+                                       &query_as<DenseBlock>,
+                                       &query_as<RiceBlock>};
+  assert(encoding_ < std::size(kQuery));
+  return kQuery[encoding_](*this, left, right);
+}
+
+void Block::prefetch() const {
+  using PrefetchFn = void (*)(const Block &);
+  static constexpr PrefetchFn kPrefetch[] = {&prefetch_as<BitSet>,
+                                             &prefetch_as<DenseBlock>,
+                                             &prefetch_as<RiceBlock>};
+  assert(encoding_ < std::size(kPrefetch));
+  kPrefetch[encoding_](*this);
+}
+
+auto Block::decode() const -> std::vector<uint64_t> {
+  using DecodeFn = std::vector<uint64_t> (*)(const Block &);
+  static constexpr DecodeFn kDecode[] = {&decode_as<BitSet>,
+                                         &decode_as<DenseBlock>,
+                                         &decode_as<RiceBlock>};
+  assert(encoding_ < std::size(kDecode));
+  return kDecode[encoding_](*this);
+}
+
+auto Block::size(size_t nkeys, uint64_t max_range) -> size_t {
+  return std::min(BitSet::size(nkeys, max_range),
+                  DenseBlock::size(nkeys, max_range));
+}
+
+auto Block::choose(const std::vector<uint64_t> &keys, uint64_t max_range,
+                   bool rice, size_t &size) -> uint8_t {
+  uint8_t encoding = kDense;
+  size = DenseBlock::size(keys.size(), max_range);
+  size_t ef_size = BitSet::size(keys.size(), max_range);
+  if (ef_size < size) {
+    encoding = kEliasFano;
+    size = ef_size;
+  }
+  /* a dense block has no gap worth coding */
+  if (rice && encoding == kEliasFano) {
+    size_t rice_size = RiceBlock::size(keys, max_range);
+    if (rice_size < size) {
+      encoding = kRice;
+      size = rice_size;
+    }
+  }
+  return encoding;
+}
+
+auto Block::build(uint8_t encoding, const std::vector<uint64_t> &keys,
+                  uint64_t max_range) -> std::vector<uint8_t> {
+  switch (encoding) {
+    case kDense:
+      return DenseBlock::build(keys, max_range);
+    case kRice:
+      return RiceBlock::build(keys, max_range);
+    default:
+      return BitSet::build(keys, max_range);
+  }
+}
+
+}  // namespace oasis
@@ -5,22 +5,68 @@
 #include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <limits>
+#include <numeric>
 #include <queue>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
+#include "key_spill.hpp"
+#include "stree.hpp"
+#include "util.hpp"
+
 namespace oasis {
 
+class CDFModelView;
+
 class CDFModel {
  private:
-  static const uint64_t kCost = 3 * sizeof(uint64_t) * 8;
+  /* least bits an interval is charged, bounding the # intervals to consider */
+  static constexpr double kMinCost = 64;
 
  public:
   enum QueryPosStatus { OUT_OF_SCOPE, EXIST, NO_IDEA };
 
+  /**
+   * Serialized formats, stored in the top byte of the # intervals.
+   * kPlainFormat: begins, ends and accumulated # positions as uint64_t arrays,
+   * with positions rounded in long double. Only read, and written back.
+   * kFixedFormat: every kGroup intervals share a header with their first
+   * begin, the # positions before them and the bit widths of their fields,
+   * and store begin - first begin, end - begin and the # positions since the
+   * group start bit-packed at these widths. A key is positioned by a
+   * fixed-point multiplier per interval rather than a division, see
+   * CDFModelView::get_location(), which batches of keys share.
+   */
+  static constexpr uint8_t kPlainFormat = 0;
+  static constexpr uint8_t kFixedFormat = 1;
+  static constexpr size_t kGroup = 16;
+
+ private:
+  /* # keys of an interval for_each_location() positions at once */
+  static constexpr size_t kLocationBatch = 64;
+
  public:
-  CDFModel(double bpk, size_t elem_per_block,
-           const std::vector<uint64_t> &keys);
+  /**
+   * keys: sorted std::vector<uint64_t> or KeySpill, read sequentially
+   * nthreads: # threads splitting the key scans, the model is the same
+   * pla_epsilon: if not 0, cut every interval further into linear pieces that
+   * estimate the rank of their keys within pla_epsilon, and spread positions
+   * by # keys rather than by key range, see split_pla()
+   */
+  template <typename Keys>
+  CDFModel(double bpk, size_t elem_per_block, const Keys &keys,
+           size_t nthreads = 1, size_t pla_epsilon = 0)
+      : CDFModel(bpk, elem_per_block, keys,
+                 top_gaps(keys, max_intervals(bpk, keys.size()), nthreads),
+                 nthreads, pla_epsilon) {}
+
+  /* gaps: the largest gaps between adjacent keys, max_intervals() at most */
+  template <typename Keys>
+  CDFModel(double bpk, size_t elem_per_block, const Keys &keys,
+           std::vector<uint64_t> gaps, size_t nthreads = 1,
+           size_t pla_epsilon = 0);
 
   CDFModel(std::vector<uint64_t> &begins, std::vector<uint64_t> &ends,
            std::vector<uint64_t> &accumulate_nkeys)
@@ -31,66 +77,272 @@ class CDFModel {
     assert(accumulate_nkeys_.size() == begins_.size() + 1);
   }
 
-  /* return the estimate distribution of all the key */
-  auto get_locations(const std::vector<uint64_t> &keys) -> std::vector<size_t>;
+  /**
+   * Spread the interval positions over factor times as many bits, i.e. spend
+   * about log2(factor) more bits per key in the blocks. The intervals stay.
+   * Only valid on a model built from keys.
+   */
+  inline void scale(double factor);
+
+  /* # positions the intervals are spread over, before rounding */
+  auto position_range() const -> uint64_t { return bit_array_range_; }
+  /* # positions of all intervals, every position is below */
+  auto npositions() const -> uint64_t { return accumulate_nkeys_.back(); }
+  /* the key range the intervals cover, what queries may match */
+  auto covered_range() const -> uint64_t {
+    uint64_t range = 0;
+    for (size_t i = 0; i < begins_.size(); ++i) {
+      range += ends_[i] - begins_[i];
+    }
+    return range;
+  }
+
+  /**
+   * The intervals of models one after the other, the positions of each model
+   * past those of the ones before, nullptr unless mergeable(models).
+   */
+  inline static auto merge(const std::vector<const CDFModel *> &models)
+      -> CDFModel *;
+  /**
+   * Whether every model ends before the next one begins, empty ones aside,
+   * and they share a format, so their positions keep their rounding
+   */
+  inline static auto mergeable(const std::vector<const CDFModel *> &models)
+      -> bool;
+
+  /* # intervals the budget affords, bounding the gaps to keep */
+  static auto max_intervals(double bpk, size_t nkeys) -> size_t {
+    return static_cast<size_t>(bpk * nkeys / kMinCost);
+  }
+
+  /**
+   * Call f(i, position) for every keys[i], i in [begin, end), strictly inside
+   * an interval, in key order, until f returns false. Interval bounds are
+   * stored exactly and get no position.
+   */
+  template <typename Keys, typename F>
+  void for_each_location(const Keys &keys, size_t begin, size_t end,
+                         F &&f) const;
+  /* # keys in keys[begin, end) for_each_location() gives a position */
+  template <typename Keys>
+  auto count_locations(const Keys &keys, size_t begin, size_t end) const
+      -> size_t;
 
   /**
    * For given query (point/range), return the (slope, bias) of the model
    * return (-1, 0): query crosses the models
    * return (0, 2): query out of scop;
    */
-  auto query(const uint64_t &key, size_t &result) -> QueryPosStatus;
+  inline auto query(const uint64_t &key, size_t &result) const
+      -> QueryPosStatus;
   /* [l_key, r_key], and return [l_pos, r_pos] */
-  auto query(const uint64_t &l_key, const uint64_t &r_key,
-             std::pair<size_t, size_t> &result) -> QueryPosStatus;
+  inline auto query(const uint64_t &l_key, const uint64_t &r_key,
+                    std::pair<size_t, size_t> &result) const -> QueryPosStatus;
+
+  /* borrow the model without copying, valid as long as this object lives */
+  inline auto view() const -> CDFModelView;
 
-  auto size() const -> size_t;
+  /* # keys find_interval() searches once serialized, see search_keys() */
+  auto nsearch_keys() const -> size_t {
+    return format_ == kPlainFormat ? begins_.size()
+                                   : (begins_.size() + kGroup - 1) / kGroup;
+  }
+
+  inline auto size() const -> size_t;
 
-  auto serialize() const -> std::pair<uint8_t *, size_t>;
+  /* in kFixedFormat, or the format it was read from */
+  inline auto serialize() const -> std::pair<uint8_t *, size_t>;
 
-  static auto deserialize(uint8_t *ser) -> CDFModel *;
+  /* either format, `ser` is moved past the model */
+  inline static auto deserialize(const uint8_t *&ser) -> CDFModel *;
 
  private:
+  template <typename Keys>
   inline void build_indices(const uint64_t threshold, const double bpk,
-                            const std::vector<uint64_t> &keys);
-  /* idx range in [0, index_.size() - 1] */
-  inline auto get_params(size_t idx)
-      -> std::tuple<uint64_t, uint64_t, long double>;
-  /* idx range in [0, index_.size() - 2] */
-  inline auto get_location(
-      const uint64_t &key,
-      const std::tuple<uint64_t, uint64_t, long double> &params) -> uint64_t;
-
-  auto get_threshold(double bpk, uint64_t delta_sum, size_t nkeys,
-                     std::queue<uint64_t> &threshold_set) -> uint64_t;
+                            const Keys &keys, size_t nthreads);
+
+  /**
+   * Replace the intervals, whose first and last keys are keys[key_idx[i]], by
+   * pieces joined at keys, so that the line through the bounds of a piece
+   * gives the rank of every key inside within epsilon. Each piece is extended
+   * as far as the bound allows. epsilon is doubled while the pieces would take
+   * more than half of max_intervals(). spans_ gets the # keys inside each.
+   */
+  template <typename Keys>
+  inline void split_pla(const Keys &keys,
+                        const std::vector<std::pair<size_t, size_t>> &key_idx,
+                        size_t epsilon, double bpk, size_t nthreads);
+
+  /* accumulate_nkeys_ from spans_ and bit_array_range_ */
+  inline void build_alphas();
+
+  /* the M largest gaps between adjacent keys, as a multiset */
+  template <typename Keys>
+  inline static auto top_gaps(const Keys &keys, size_t M, size_t nthreads)
+      -> std::vector<uint64_t>;
+
+  inline auto get_threshold(double bpk, uint64_t delta_sum, size_t nkeys,
+                            std::queue<uint64_t> &threshold_set) -> uint64_t;
+
+  /**
+   * Estimated bits of each of m intervals once packed, at least kMinCost:
+   * begins and ends take the log of the key range per group and per interval,
+   * the # positions that of the positions per group, 2^bpk per key at most.
+   */
+  inline auto interval_cost(size_t m, size_t nkeys, double bpk) const
+      -> double;
+
+  /* the header word of every group, see CDFModelView::group_word() */
+  inline auto pack_groups(size_t &nbits) const -> std::vector<uint64_t>;
 
  private:
   std::vector<uint64_t> begins_;
   std::vector<uint64_t> ends_;
 
   std::vector<uint64_t> accumulate_nkeys_;
+
+  uint8_t format_ = kFixedFormat;
+
+  /* construction only, not serialized */
+  /* what positions are spread by: the range of each interval, or its # keys
+   * with pla_epsilon, 0 for the intervals with no key inside */
+  std::vector<uint64_t> spans_;
+  uint64_t span_sum_ = 0;
+  uint64_t bit_array_range_ = 0;
+  uint64_t key_range_ = 0;
+  size_t pla_epsilon_ = 0;
+};
+
+/**
+ * Read-only CDFModel over borrowed memory: either the vectors of a CDFModel
+ * or a serialized CDFModel, which is queried in place. Holds no state besides
+ * the pointers, so it is cheap to copy and safe to share between threads.
+ */
+class CDFModelView {
+ public:
+  CDFModelView() = default;
+
+  /**
+   * accumulate_nkeys[i] is the # positions of interval [0, i]
+   * format: the CDFModel format whose positions to compute, see get_location()
+   */
+  CDFModelView(const uint64_t *begins, const uint64_t *ends,
+               const uint64_t *accumulate_nkeys, size_t nintervals,
+               uint8_t format)
+      : begins_(begins),
+        nsearch_(nintervals),
+        ends_(ends),
+        accumulate_nkeys_(accumulate_nkeys),
+        nintervals_(nintervals),
+        format_(format) {}
+
+  /* parse the output of CDFModel::serialize(), `ser` is moved past it */
+  inline static auto view(const uint8_t *&ser) -> CDFModelView;
+
+  /* search through STree(search_keys(), nsearch_keys(), index) */
+  void set_search_tree(const uint64_t *index) {
+    begins_tree_ = STree(begins_, nsearch_, index);
+    use_tree_ = true;
+  }
+
+  /* what find_interval() searches: the interval begins, or the first begin of
+   * every group once packed */
+  auto search_keys() const -> const uint64_t * { return begins_; }
+  auto nsearch_keys() const -> size_t { return nsearch_; }
+  auto nintervals() const -> size_t { return nintervals_; }
+  auto format() const -> uint8_t { return format_; }
+
+  inline auto query(uint64_t key, size_t &result) const
+      -> CDFModel::QueryPosStatus;
+  /* [l_key, r_key], and return [l_pos, r_pos] */
+  inline auto query(uint64_t l_key, uint64_t r_key,
+                    std::pair<size_t, size_t> &result) const
+      -> CDFModel::QueryPosStatus;
+
+  /* same as above, with idx = find_interval(key) / find_interval(l_key) */
+  inline auto query(uint64_t key, size_t idx, size_t &result) const
+      -> CDFModel::QueryPosStatus;
+  inline auto query(uint64_t l_key, uint64_t r_key, size_t idx,
+                    std::pair<size_t, size_t> &result) const
+      -> CDFModel::QueryPosStatus;
+
+  /* the interval whose begin is the last one <= key, or -1 for none */
+  inline auto find_interval(uint64_t key) const -> size_t;
+  /* find_interval() of a batch, every level is prefetched before probing */
+  inline void find_interval(const uint64_t *keys, size_t n,
+                            size_t *result) const;
+  /* fetch what query(key, idx, result) reads besides the search keys */
+  inline void prefetch(size_t idx) const;
+
+  /* (begin, end - begin, first position, # positions) of an interval */
+  using Params = std::tuple<uint64_t, uint64_t, uint64_t, uint64_t>;
+
+  /* idx range in [0, nintervals_ - 1] */
+  inline auto get_params(size_t idx) const -> Params;
+  /* key in [begin, end] of the interval */
+  inline auto get_location(const uint64_t &key, const Params &params) const
+      -> uint64_t;
+  /* out[i] = get_location(keys[i], params), vectorized where possible */
+  inline void get_locations(const uint64_t *keys, size_t n,
+                            const Params &params, uint64_t *out) const;
+
+  /**
+   * In kFixedFormat, key is at first position + floor((key - begin) *
+   * multiplier / 2^64), about (key - begin) * # positions / (end - begin).
+   */
+  static auto multiplier(uint64_t len, uint64_t nlocations) -> uint64_t {
+    return pos_multiplier(len, nlocations);
+  }
+
+  /* the header word of a group in kFixedFormat */
+  static auto group_word(uint64_t bit_pos, uint8_t begin_width,
+                         uint8_t len_width, uint8_t pos_width) -> uint64_t {
+    assert(bit_pos < (1ULL << 40));
+    return bit_pos << 24 | uint64_t{begin_width} << 16 |
+           uint64_t{len_width} << 8 | pos_width;
+  }
+
+ private:
+  auto packed() const -> bool { return packed_ != nullptr; }
+  /* field 0, 1 or 2 (begin, length, # positions) of interval idx, packed */
+  inline auto packed_read(size_t idx, size_t field) const -> uint64_t;
+  /* the last interval of group g whose begin is <= key */
+  inline auto find_in_group(size_t g, uint64_t key) const -> size_t;
+  inline auto end(size_t idx) const -> uint64_t;
+
+ private:
+  /* the search keys, see search_keys() */
+  const uint64_t *begins_ = nullptr;
+  size_t nsearch_ = 0;
+
+  /* kPlainFormat */
+  const uint64_t *ends_ = nullptr;
+  const uint64_t *accumulate_nkeys_ = nullptr;
+
+  /* kFixedFormat, the # positions before each group and its header word */
+  const uint64_t *group_positions_ = nullptr;
+  const uint64_t *group_words_ = nullptr;
+  const uint64_t *packed_ = nullptr;
+
+  size_t nintervals_ = 0;
+  uint8_t format_ = CDFModel::kFixedFormat;
+
+  bool use_tree_ = false;
+  STree begins_tree_;
 };
 
-CDFModel::CDFModel(double bpk, size_t elem_per_block,
-                   const std::vector<uint64_t> &keys) {
+template <typename Keys>
+CDFModel::CDFModel(double bpk, size_t elem_per_block, const Keys &keys,
+                   std::vector<uint64_t> gaps, size_t nthreads,
+                   size_t pla_epsilon)
+    : pla_epsilon_(pla_epsilon) {
   size_t nkeys = keys.size();
-  double kMemBudget = bpk * nkeys;
-  size_t M = static_cast<size_t>(kMemBudget / kCost);
+  assert(gaps.size() <= max_intervals(bpk, nkeys));
 
   std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>>
-      min_heap;
-  for (size_t i = 0; i < nkeys - 1; ++i) {
-    uint64_t diff = keys[i + 1] - keys[i];
-    if (min_heap.size() >= M) {
-      if (min_heap.top() > diff) {
-        continue;
-      }
-      min_heap.pop();
-    }
-    min_heap.push(diff);
-  }
+      min_heap(std::greater<uint64_t>(), std::move(gaps));
 
-  uint64_t threshold = min_heap.top();
+  uint64_t threshold = min_heap.empty() ? UINT64_MAX : min_heap.top();
   while (!min_heap.empty() && min_heap.top() == threshold) {
     min_heap.pop();
   }
@@ -105,228 +357,496 @@ CDFModel::CDFModel(double bpk, size_t elem_per_block,
     delta_sum += tmp;
   }
 
-  delta_sum = keys.back() - keys[0] - delta_sum;
-  double remain_bpk = bpk - 2 - 64.0L / elem_per_block;
+  key_range_ = keys.back() - keys.front();
+  delta_sum = key_range_ - delta_sum;
+  /* every block stores its 64-bit bias and 32-bit offset */
+  double remain_bpk = bpk - 2 - 96.0L / elem_per_block;
 
-  threshold = get_threshold(remain_bpk, delta_sum, nkeys, threshold_set);
+  if (!threshold_set.empty()) {
+    threshold = get_threshold(remain_bpk, delta_sum, nkeys, threshold_set);
+  }
 
-  build_indices(threshold, remain_bpk, keys);
+  build_indices(threshold, remain_bpk, keys, nthreads);
 }
 
-auto CDFModel::get_locations(const std::vector<uint64_t> &keys)
-    -> std::vector<size_t> {
-  size_t nkeys = keys.size();
-
-  std::vector<size_t> positions;
+template <typename Keys, typename F>
+void CDFModel::for_each_location(const Keys &keys, size_t begin, size_t end,
+                                 F &&f) const {
+  if (begin >= end) {
+    return;
+  }
+  /* built from keys, so positioned by multipliers, see get_location() */
+  assert(format_ == kFixedFormat);
+  CDFModelView model = view();
+  auto cursor = key_cursor(keys, begin);
+  uint64_t key = cursor.next();
+  size_t idx_iter =
+      std::upper_bound(begins_.begin(), begins_.end(), key) - begins_.begin() -
+      1;
+  CDFModelView::Params params = model.get_params(idx_iter);
+
+  if constexpr (std::is_same_v<Keys, std::vector<uint64_t>>) {
+    /* the keys inside an interval are contiguous, positioned in batches */
+    uint64_t locations[kLocationBatch];
+    for (size_t i = begin; i < end;) {
+      if (keys[i] >= ends_[idx_iter]) {
+        if (++idx_iter == begins_.size()) {
+          return;
+        }
+        params = model.get_params(idx_iter);
+        ++i;
+        continue;
+      }
+      if (keys[i] <= begins_[idx_iter]) {
+        ++i;
+        continue;
+      }
+      size_t run_begin = i;
+      size_t run_end = std::min(end, i + kLocationBatch);
+      while (i < run_end && keys[i] < ends_[idx_iter]) {
+        ++i;
+      }
+      model.get_locations(keys.data() + run_begin, i - run_begin, params,
+                          locations);
+      for (size_t j = run_begin; j < i; ++j) {
+        if (!f(j, locations[j - run_begin])) {
+          return;
+        }
+      }
+    }
+    return;
+  }
 
-  std::tuple<uint64_t, uint64_t, long double> params = get_params(0);
-  size_t idx_iter = 0;
-  for (size_t i = 1; i < nkeys - 1; ++i) {
-    if (keys[i] >= ends_[idx_iter]) {
-      params = get_params(++idx_iter);
-    } else if (keys[i] > begins_[idx_iter]) {
-      positions.emplace_back(get_location(keys[i], params));
+  /* decoding the keys one by one, the multiplier is only computed once */
+  uint64_t multiplier =
+      CDFModelView::multiplier(std::get<1>(params), std::get<3>(params));
+  for (size_t i = begin;;) {
+    if (key >= ends_[idx_iter]) {
+      /* the end of an interval, the next key begins the next one */
+      if (++idx_iter == begins_.size()) {
+        return;
+      }
+      params = model.get_params(idx_iter);
+      multiplier =
+          CDFModelView::multiplier(std::get<1>(params), std::get<3>(params));
+    } else if (key > begins_[idx_iter] &&
+               !f(i, std::get<2>(params) +
+                         mul_hi(key - std::get<0>(params), multiplier))) {
+      return;
+    }
+    if (++i == end) {
+      return;
     }
+    key = cursor.next();
   }
-  return positions;
 }
 
-auto CDFModel::query(const uint64_t &key, size_t &result)
-    -> CDFModel::QueryPosStatus {
-  if (key < begins_[0] || key > ends_.back()) {
-    return QueryPosStatus::OUT_OF_SCOPE;
+template <typename Keys>
+auto CDFModel::count_locations(const Keys &keys, size_t begin,
+                               size_t end) const -> size_t {
+  if (begin >= end) {
+    return 0;
   }
-
-  size_t idx =
-      std::distance(begins_.begin(),
-                    std::upper_bound(begins_.begin(), begins_.end(), key)) -
+  size_t cnt = 0;
+  auto cursor = key_cursor(keys, begin);
+  uint64_t key = cursor.next();
+  size_t idx_iter =
+      std::upper_bound(begins_.begin(), begins_.end(), key) - begins_.begin() -
       1;
-  if (ends_[idx] < key) {
-    return QueryPosStatus::OUT_OF_SCOPE;
-  }
-  if (begins_[idx] == key || ends_[idx] == key) {
-    return QueryPosStatus::EXIST;
-  }
-
-  auto params = get_params(idx);
-  if (std::get<1>(params) == 0) {
-    return QueryPosStatus::OUT_OF_SCOPE;
+  for (size_t i = begin;;) {
+    if (key >= ends_[idx_iter]) {
+      if (++idx_iter == begins_.size()) {
+        return cnt;
+      }
+    } else {
+      cnt += key > begins_[idx_iter];
+    }
+    if (++i == end) {
+      return cnt;
+    }
+    key = cursor.next();
   }
+}
 
-  result = get_location(key, params);
-  return QueryPosStatus::NO_IDEA;
+auto CDFModel::query(const uint64_t &key, size_t &result) const
+    -> CDFModel::QueryPosStatus {
+  return view().query(key, result);
 }
 
 auto CDFModel::query(const uint64_t &l_key, const uint64_t &r_key,
-                     std::pair<size_t, size_t> &result)
+                     std::pair<size_t, size_t> &result) const
     -> CDFModel::QueryPosStatus {
-  assert(l_key < r_key);
-
-  if (l_key > ends_.back() || r_key < begins_[0]) {
-    return QueryPosStatus::OUT_OF_SCOPE;
-  }
-
-  size_t idx =
-      std::distance(begins_.begin(),
-                    std::upper_bound(begins_.begin(), begins_.end(), l_key)) -
-      1;
-
-  if (r_key < begins_[idx + 1] && l_key > ends_[idx]) {
-    return QueryPosStatus::OUT_OF_SCOPE;
-  }
-
-  if (!(l_key > begins_[idx] && r_key < ends_[idx])) {
-    return QueryPosStatus::EXIST;
-  }
-
-  auto params = get_params(idx);
-  if (std::get<1>(params) == 0) {
-    return QueryPosStatus::OUT_OF_SCOPE;
-  }
+  return view().query(l_key, r_key, result);
+}
 
-  result.first = get_location(l_key, params);
-  result.second = get_location(r_key, params);
-  return QueryPosStatus::NO_IDEA;
+auto CDFModel::view() const -> CDFModelView {
+  return {begins_.data(), ends_.data(), accumulate_nkeys_.data() + 1,
+          begins_.size(), format_};
 }
 
 auto CDFModel::size() const -> size_t {
-  size_t meta_sz = sizeof(size_t); /* # elements in index_ */
-  sizeAlign(meta_sz);
-  return meta_sz +
-         3 * sizeof(uint64_t) *
-             begins_.size(); /* begins_ + ends_ + # keys in each interval*/
+  if (format_ == kPlainFormat) {
+    return sizeof(uint64_t) + 3 * sizeof(uint64_t) * begins_.size();
+  }
+  size_t nbits;
+  size_t ngroups = pack_groups(nbits).size();
+  return sizeof(uint64_t)                     /* # intervals and format */
+         + 3 * sizeof(uint64_t) * ngroups      /* group headers */
+         + sizeof(uint64_t) * ((nbits + 63) / 64); /* packed fields */
 }
 
 auto CDFModel::serialize() const -> std::pair<uint8_t *, size_t> {
-  size_t meta_sz = sizeof(size_t); /* # elements in index_ */
-  sizeAlign(meta_sz);
-
-  size_t size =
-      meta_sz +
-      3 * sizeof(uint64_t) *
-          begins_.size(); /* begins_ + ends_ + # keys in each interval*/
-
-  uint8_t *out = new uint8_t[size];
-  uint8_t *pos = out;
+  size_t nintervals = begins_.size();
+  size_t size = this->size();
+  /* zeroed, the fields are or-ed in */
+  auto *out = new uint64_t[size / sizeof(uint64_t)]();
+  uint64_t *pos = out;
+
+  *pos++ = nintervals | uint64_t{format_} << 56;
+  if (format_ == kPlainFormat) {
+    pos = std::copy(begins_.begin(), begins_.end(), pos);
+    pos = std::copy(ends_.begin(), ends_.end(), pos);
+    std::copy(accumulate_nkeys_.begin() + 1, accumulate_nkeys_.end(), pos);
+    return {reinterpret_cast<uint8_t *>(out), size};
+  }
 
-  size_t idx_sz = begins_.size();
-  memcpy(pos, &idx_sz, sizeof(size_t));
-  pos += sizeof(size_t);
+  size_t nbits;
+  std::vector<uint64_t> group_words = pack_groups(nbits);
+  size_t ngroups = group_words.size();
+  uint64_t *group_begins = pos;
+  uint64_t *group_positions = group_begins + ngroups;
+  std::copy(group_words.begin(), group_words.end(), group_positions + ngroups);
+  uint64_t *packed = group_positions + 2 * ngroups;
+
+  for (size_t g = 0; g < ngroups; ++g) {
+    size_t first = g * kGroup;
+    size_t last = std::min(first + kGroup, nintervals);
+    group_begins[g] = begins_[first];
+    group_positions[g] = accumulate_nkeys_[first];
+
+    size_t bit_pos = group_words[g] >> 24;
+    uint8_t begin_width = group_words[g] >> 16 & 0xFF;
+    uint8_t len_width = group_words[g] >> 8 & 0xFF;
+    uint8_t pos_width = group_words[g] & 0xFF;
+    for (size_t i = first; i < last; ++i) {
+      write_bits(packed, bit_pos, begin_width, begins_[i] - begins_[first]);
+      bit_pos += begin_width;
+      write_bits(packed, bit_pos, len_width, ends_[i] - begins_[i]);
+      bit_pos += len_width;
+      write_bits(packed, bit_pos, pos_width,
+                 accumulate_nkeys_[i + 1] - accumulate_nkeys_[first]);
+      bit_pos += pos_width;
+    }
+  }
 
-  align(pos);
+  return {reinterpret_cast<uint8_t *>(out), size};
+}
 
-  memcpy(pos, begins_.data(), sizeof(uint64_t) * idx_sz);
-  pos += sizeof(uint64_t) * idx_sz;
+auto CDFModel::merge(const std::vector<const CDFModel *> &models)
+    -> CDFModel * {
+  if (!mergeable(models)) {
+    return nullptr;
+  }
 
-  memcpy(pos, ends_.data(), sizeof(uint64_t) * idx_sz);
-  pos += sizeof(uint64_t) * idx_sz;
+  std::vector<uint64_t> begins;
+  std::vector<uint64_t> ends;
+  std::vector<uint64_t> accumulate_nkeys(1, 0);
+  const CDFModel *prev = nullptr;
+  for (const CDFModel *model : models) {
+    if (model->begins_.empty()) {
+      continue;
+    }
+    begins.insert(begins.end(), model->begins_.begin(), model->begins_.end());
+    ends.insert(ends.end(), model->ends_.begin(), model->ends_.end());
+    uint64_t shift = accumulate_nkeys.back();
+    for (size_t i = 1; i < model->accumulate_nkeys_.size(); ++i) {
+      accumulate_nkeys.emplace_back(model->accumulate_nkeys_[i] + shift);
+    }
+    prev = model;
+  }
 
-  memcpy(pos, accumulate_nkeys_.data() + 1, sizeof(uint64_t) * idx_sz);
+  auto *result = new CDFModel(begins, ends, accumulate_nkeys);
+  if (prev != nullptr) {
+    result->format_ = prev->format_;
+  }
+  return result;
+}
 
-  return {out, size};
+auto CDFModel::mergeable(const std::vector<const CDFModel *> &models)
+    -> bool {
+  const CDFModel *prev = nullptr;
+  for (const CDFModel *model : models) {
+    if (model->begins_.empty()) {
+      continue;
+    }
+    if (prev != nullptr && (model->format_ != prev->format_ ||
+                            model->begins_.front() <= prev->ends_.back())) {
+      return false;
+    }
+    prev = model;
+  }
+  return true;
 }
 
-auto CDFModel::deserialize(uint8_t *ser) -> CDFModel * {
+auto CDFModel::deserialize(const uint8_t *&ser) -> CDFModel * {
   assert(ser != nullptr);
 
-  size_t idx_len;
-  memcpy(&idx_len, ser, sizeof(size_t));
-  ser += sizeof(size_t);
-
-  align(ser);
-
-  size_t index_sz = sizeof(uint64_t) * idx_len;
-  std::vector<uint64_t> begins(idx_len);
-  memcpy(begins.data(), ser, index_sz);
-  ser += index_sz;
-
-  std::vector<uint64_t> ends(idx_len);
-  memcpy(ends.data(), ser, index_sz);
-  ser += index_sz;
+  CDFModelView model = CDFModelView::view(ser);
+  size_t nintervals = model.nintervals();
+  std::vector<uint64_t> begins(nintervals);
+  std::vector<uint64_t> ends(nintervals);
+  std::vector<uint64_t> accumulate_nkeys(nintervals + 1, 0);
+  for (size_t i = 0; i < nintervals; ++i) {
+    auto [begin, len, low_location, nlocations] = model.get_params(i);
+    begins[i] = begin;
+    ends[i] = begin + len;
+    accumulate_nkeys[i + 1] = low_location + nlocations;
+  }
 
-  std::vector<uint64_t> accumulate_nkeys(idx_len + 1, 0);
-  memcpy(accumulate_nkeys.data() + 1, ser, index_sz);
+  auto *result = new CDFModel(begins, ends, accumulate_nkeys);
+  result->format_ = model.format();
+  return result;
+}
 
-  return {new CDFModel(begins, ends, accumulate_nkeys)};
+auto CDFModel::pack_groups(size_t &nbits) const -> std::vector<uint64_t> {
+  size_t nintervals = begins_.size();
+  std::vector<uint64_t> group_words;
+  group_words.reserve(nsearch_keys());
+  nbits = 0;
+  for (size_t first = 0; first < nintervals; first += kGroup) {
+    size_t last = std::min(first + kGroup, nintervals);
+    uint64_t max_len = 0;
+    for (size_t i = first; i < last; ++i) {
+      max_len = std::max(max_len, ends_[i] - begins_[i]);
+    }
+    /* the fields grow within a group, but for the lengths */
+    uint8_t begin_width = bit_width(begins_[last - 1] - begins_[first]);
+    uint8_t len_width = bit_width(max_len);
+    uint8_t pos_width =
+        bit_width(accumulate_nkeys_[last] - accumulate_nkeys_[first]);
+    group_words.emplace_back(
+        CDFModelView::group_word(nbits, begin_width, len_width, pos_width));
+    nbits += (last - first) * (begin_width + len_width + pos_width);
+  }
+  return group_words;
 }
 
 /** Helping Function */
+template <typename Keys>
 void CDFModel::build_indices(const uint64_t threshold, const double bpk,
-                             const std::vector<uint64_t> &keys) {
+                             const Keys &keys, size_t nthreads) {
   size_t nkeys = keys.size();
-  uint64_t avg_range = 0;
 
   begins_.clear();
   ends_.clear();
-
-  std::vector<bool> interval_sz;
-  uint32_t cnt = 0;
+  spans_.clear();
+
+  /* gaps i, i.e. (keys[i], keys[i + 1]), reaching the threshold */
+  std::vector<std::vector<std::tuple<size_t, uint64_t, uint64_t>>> chunks(
+      std::max<size_t>(nthreads, 1));
+  parallel_for(nkeys - 1, nthreads, [&](size_t chunk, size_t begin,
+                                        size_t end) {
+    auto cursor = key_cursor(keys, begin);
+    uint64_t key = cursor.next();
+    for (size_t i = begin; i < end; ++i) {
+      uint64_t next = cursor.next();
+      if (next - key >= threshold) {
+        chunks[chunk].emplace_back(i, key, next);
+      }
+      key = next;
+    }
+  });
+
+  /* the key index of the first and last key of every interval */
+  std::vector<std::pair<size_t, size_t>> key_idx;
+  /* the first gap scanned in the current interval, the one behind its begin
+   * is skipped, so an interval keeps two keys unless it is the first one */
+  size_t first_gap = 0;
+  uint64_t cnt;
   /** build the indices */
-  begins_.emplace_back(keys[0]);
-  for (size_t i = 0; i < nkeys - 1; ++i) {
-    if (keys[i + 1] - keys[i] >= threshold) {
-      ends_.emplace_back(keys[i++]);
-
-      interval_sz.emplace_back(cnt == 0);
-      avg_range += cnt == 0 ? 0 : ends_.back() - begins_.back();
-      cnt = 0;
-      begins_.emplace_back(keys[i]);
-    } else {
-      ++cnt;
+  begins_.emplace_back(keys.front());
+  key_idx.emplace_back(0, 0);
+  for (const auto &chunk : chunks) {
+    for (const auto &[i, key, next] : chunk) {
+      if (i < first_gap) {
+        continue;
+      }
+      ends_.emplace_back(key);
+      key_idx.back().second = i;
+
+      cnt = i - first_gap;
+      spans_.emplace_back(cnt == 0 ? 0 : ends_.back() - begins_.back());
+      first_gap = i + 2;
+      begins_.emplace_back(next);
+      key_idx.emplace_back(i + 1, 0);
     }
   }
 
   ends_.emplace_back(keys.back());
-  interval_sz.emplace_back(cnt == 0);
-  avg_range += cnt == 0 ? 0 : ends_.back() - begins_.back();
+  key_idx.back().second = nkeys - 1;
+  cnt = nkeys - 1 > first_gap ? nkeys - 1 - first_gap : 0;
+  spans_.emplace_back(cnt == 0 ? 0 : ends_.back() - begins_.back());
+
+  if (pla_epsilon_ != 0) {
+    split_pla(keys, key_idx, pla_epsilon_, bpk, nthreads);
+  }
 
+  span_sum_ = std::accumulate(spans_.begin(), spans_.end(), uint64_t{0});
+  bit_array_range_ =
+      pow(2, bpk - interval_cost(ends_.size(), nkeys, bpk) / nkeys *
+                       ends_.size()) *
+      nkeys;
+  build_alphas();
+}
+
+template <typename Keys>
+void CDFModel::split_pla(const Keys &keys,
+                         const std::vector<std::pair<size_t, size_t>> &key_idx,
+                         size_t epsilon, double bpk, size_t nthreads) {
+  using Piece = std::tuple<uint64_t, uint64_t, uint64_t>;
+  size_t nkeys = keys.size();
+  std::vector<std::vector<Piece>> chunks(std::max<size_t>(nthreads, 1));
+  size_t npieces = 0;
+  do {
+    /* the intervals are independent, a chunk of them scans its keys in order */
+    parallel_for(key_idx.size(), nthreads, [&](size_t chunk, size_t begin,
+                                               size_t end) {
+      std::vector<Piece> &pieces = chunks[chunk];
+      pieces.clear();
+      if (begin == end) {
+        return;
+      }
+      auto cursor = key_cursor(keys, key_idx[begin].first);
+      for (size_t iv = begin; iv < end; ++iv) {
+        auto [first, last] = key_idx[iv];
+        /* the piece starts at the anchor, the key of rank a */
+        size_t a = first;
+        uint64_t anchor = cursor.next();
+        uint64_t prev = anchor;
+        /* the slopes of the lines from the anchor within epsilon of every key
+         * scanned since */
+        double lo = 0;
+        double hi = std::numeric_limits<double>::infinity();
+        for (size_t j = first + 1; j <= last; ++j) {
+          uint64_t key = cursor.next();
+          double dx = static_cast<double>(key - anchor);
+          double slope = (j - a) / dx;
+          if (slope < lo || slope > hi) {
+            /* the previous key still ended a piece, it anchors the next one */
+            pieces.emplace_back(anchor, prev, j - a - 2);
+            a = j - 1;
+            anchor = prev;
+            lo = 0;
+            hi = std::numeric_limits<double>::infinity();
+            dx = static_cast<double>(key - anchor);
+          }
+          lo = std::max(lo, ((j - a) - static_cast<double>(epsilon)) / dx);
+          hi = std::min(hi, ((j - a) + static_cast<double>(epsilon)) / dx);
+          prev = key;
+        }
+        pieces.emplace_back(anchor, prev, last > a ? last - a - 1 : 0);
+      }
+    });
+
+    npieces = 0;
+    for (const auto &pieces : chunks) {
+      npieces += pieces.size();
+    }
+    epsilon *= 2;
+  } while (npieces > key_idx.size() &&
+           2 * npieces > max_intervals(bpk, nkeys));
+
+  begins_.clear();
+  ends_.clear();
+  spans_.clear();
+  for (const auto &pieces : chunks) {
+    for (const auto &[begin, end, inner] : pieces) {
+      begins_.emplace_back(begin);
+      ends_.emplace_back(end);
+      spans_.emplace_back(inner);
+    }
+  }
+}
+
+void CDFModel::build_alphas() {
   accumulate_nkeys_.clear();
   accumulate_nkeys_.emplace_back(0);
 
   /** Build the alpha array */
-
-  uint64_t bit_array_range =
-      pow(2, bpk - kCost * 1.0L / nkeys * ends_.size()) * nkeys;
-  for (size_t i = 0; i < begins_.size(); ++i) {
-    if (interval_sz[i]) {
+  for (size_t i = 0; i < spans_.size(); ++i) {
+    uint64_t span = spans_[i];
+    if (span == 0) {
       accumulate_nkeys_.emplace_back(accumulate_nkeys_.back());
       continue;
     }
-    uint64_t alpha = std::ceil(static_cast<double>(ends_[i] - begins_[i]) /
-                               avg_range * bit_array_range);
-    if (alpha == 0) {
-      alpha = 1;
-    }
+    uint64_t alpha = std::ceil(static_cast<double>(span) / span_sum_ *
+                               bit_array_range_);
+    /* more positions than keys in the range would stay unused */
+    alpha = std::min(std::max<uint64_t>(alpha, 1), ends_[i] - begins_[i]);
     accumulate_nkeys_.emplace_back(accumulate_nkeys_.back() + alpha);
   }
 }
 
-auto CDFModel::get_params(size_t idx)
-    -> std::tuple<uint64_t, uint64_t, long double> {
-  uint64_t begin = begins_[idx];
-  uint64_t end = ends_[idx];
-  uint64_t low_location = accumulate_nkeys_[idx];
-  uint64_t high_location = accumulate_nkeys_[idx + 1];
-  return {end - begin, high_location - low_location,
-          (end * 1.0L) * low_location - (begin * 1.0L) * high_location};
+void CDFModel::scale(double factor) {
+  bit_array_range_ = static_cast<uint64_t>(bit_array_range_ * factor);
+  build_alphas();
 }
 
-auto CDFModel::get_location(
-    const uint64_t &key,
-    const std::tuple<uint64_t, uint64_t, long double> &params) -> uint64_t {
-  return static_cast<uint64_t>(
-      (static_cast<double>(std::get<1>(params)) * key + std::get<2>(params)) /
-      std::get<0>(params));
+template <typename Keys>
+auto CDFModel::top_gaps(const Keys &keys, size_t M, size_t nthreads)
+    -> std::vector<uint64_t> {
+  /* too few keys to afford a second interval when M == 0 */
+  if (M == 0 || keys.size() < 2) {
+    return {};
+  }
+
+  /* the M largest gaps of every chunk, whose union holds the M largest */
+  std::vector<std::vector<uint64_t>> chunks(std::max<size_t>(nthreads, 1));
+  parallel_for(keys.size() - 1, nthreads, [&](size_t chunk, size_t begin,
+                                              size_t end) {
+    std::priority_queue<uint64_t, std::vector<uint64_t>,
+                        std::greater<uint64_t>>
+        min_heap;
+    auto cursor = key_cursor(keys, begin);
+    uint64_t key = cursor.next();
+    for (size_t i = begin; i < end; ++i) {
+      uint64_t next = cursor.next();
+      uint64_t diff = next - key;
+      key = next;
+      if (min_heap.size() >= M) {
+        if (min_heap.top() > diff) {
+          continue;
+        }
+        min_heap.pop();
+      }
+      min_heap.push(diff);
+    }
+    while (!min_heap.empty()) {
+      chunks[chunk].emplace_back(min_heap.top());
+      min_heap.pop();
+    }
+  });
+
+  std::vector<uint64_t> gaps = std::move(chunks[0]);
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    gaps.insert(gaps.end(), chunks[i].begin(), chunks[i].end());
+  }
+  if (gaps.size() > M) {
+    std::nth_element(gaps.begin(), gaps.begin() + (gaps.size() - M),
+                     gaps.end());
+    gaps.erase(gaps.begin(), gaps.begin() + (gaps.size() - M));
+  }
+  return gaps;
 }
 
 auto CDFModel::get_threshold(double bpk, uint64_t delta_sum, size_t nkeys,
                              std::queue<uint64_t> &threshold_set) -> uint64_t {
-  double param = kCost * 1.0L / nkeys;
   double min_rho = std::numeric_limits<double>::max();
   uint64_t m = threshold_set.size();
   uint64_t best_threshold = threshold_set.front();
   while (!threshold_set.empty()) {
-    uint64_t mp_sz = std::ceil(std::pow(2, bpk - param * (m + 1)) * nkeys);
+    double cost = interval_cost(m + 1, nkeys, bpk) * (m + 1) / nkeys;
+    uint64_t mp_sz = std::ceil(std::pow(2, bpk - cost) * nkeys);
     double rho = static_cast<double>(delta_sum) * delta_sum / mp_sz;
     if (rho <= min_rho) {
       min_rho = rho;
@@ -344,4 +864,257 @@ auto CDFModel::get_threshold(double bpk, uint64_t delta_sum, size_t nkeys,
   return best_threshold;
 }
 
+auto CDFModel::interval_cost(size_t m, size_t nkeys, double bpk) const
+    -> double {
+  double spacing = static_cast<double>(key_range_) / m;
+  double positions = std::pow(2, bpk) * nkeys / m;
+  double cost = 3.0 * 64 / kGroup                  /* group header */
+                + std::log2(kGroup * spacing + 1)   /* begin */
+                + std::log2(spacing + 1)            /* end - begin */
+                + std::log2(kGroup * positions + 1); /* # positions */
+  return std::max(kMinCost, cost);
+}
+
+auto CDFModelView::view(const uint8_t *&ser) -> CDFModelView {
+  assert(ser != nullptr);
+
+  uint64_t header;
+  memcpy(&header, ser, sizeof(uint64_t));
+  ser += sizeof(uint64_t);
+
+  align(ser);
+
+  size_t nintervals = header & ((1ULL << 56) - 1);
+  auto *index = reinterpret_cast<const uint64_t *>(ser);
+  if (header >> 56 == CDFModel::kPlainFormat) {
+    ser += 3 * sizeof(uint64_t) * nintervals;
+    return {index, index + nintervals, index + 2 * nintervals, nintervals,
+            CDFModel::kPlainFormat};
+  }
+
+  assert(header >> 56 == CDFModel::kFixedFormat);
+  CDFModelView model;
+  model.format_ = header >> 56;
+  size_t ngroups = (nintervals + CDFModel::kGroup - 1) / CDFModel::kGroup;
+  model.begins_ = index;
+  model.nsearch_ = ngroups;
+  model.group_positions_ = index + ngroups;
+  model.group_words_ = index + 2 * ngroups;
+  model.packed_ = index + 3 * ngroups;
+  model.nintervals_ = nintervals;
+
+  size_t nbits = 0;
+  if (ngroups > 0) {
+    /* the fields of the last group end the packed ones */
+    uint64_t word = model.group_words_[ngroups - 1];
+    size_t stride = (word >> 16 & 0xFF) + (word >> 8 & 0xFF) + (word & 0xFF);
+    nbits = (word >> 24) + (nintervals - (ngroups - 1) * CDFModel::kGroup) *
+                               stride;
+  }
+  ser += sizeof(uint64_t) * (3 * ngroups + (nbits + 63) / 64);
+  return model;
+}
+
+auto CDFModelView::query(uint64_t key, size_t &result) const
+    -> CDFModel::QueryPosStatus {
+  return query(key, find_interval(key), result);
+}
+
+auto CDFModelView::query(uint64_t l_key, uint64_t r_key,
+                         std::pair<size_t, size_t> &result) const
+    -> CDFModel::QueryPosStatus {
+  return query(l_key, r_key, find_interval(l_key), result);
+}
+
+auto CDFModelView::query(uint64_t key, size_t idx, size_t &result) const
+    -> CDFModel::QueryPosStatus {
+  /* idx is -1 when key < the first begin */
+  if (idx >= nintervals_) {
+    return CDFModel::OUT_OF_SCOPE;
+  }
+  auto params = get_params(idx);
+  uint64_t begin = std::get<0>(params);
+  uint64_t end = begin + std::get<1>(params);
+  if (end < key) {
+    return CDFModel::OUT_OF_SCOPE;
+  }
+  if (begin == key || end == key) {
+    return CDFModel::EXIST;
+  }
+
+  if (std::get<3>(params) == 0) {
+    return CDFModel::OUT_OF_SCOPE;
+  }
+
+  result = get_location(key, params);
+  return CDFModel::NO_IDEA;
+}
+
+auto CDFModelView::query(uint64_t l_key, uint64_t r_key, size_t idx,
+                         std::pair<size_t, size_t> &result) const
+    -> CDFModel::QueryPosStatus {
+  assert(l_key < r_key);
+
+  /* the first begin is also the first search key */
+  if (r_key < begins_[0] || l_key > end(nintervals_ - 1)) {
+    return CDFModel::OUT_OF_SCOPE;
+  }
+
+  /* r_key >= the first begin, so the first key is covered */
+  if (idx >= nintervals_) {
+    return CDFModel::EXIST;
+  }
+
+  auto params = get_params(idx);
+  uint64_t begin = std::get<0>(params);
+  uint64_t end = begin + std::get<1>(params);
+  /* l_key falls into the gap behind interval idx, which is never the last */
+  if (l_key > end) {
+    return r_key < std::get<0>(get_params(idx + 1)) ? CDFModel::OUT_OF_SCOPE
+                                                    : CDFModel::EXIST;
+  }
+
+  if (!(l_key > begin && r_key < end)) {
+    return CDFModel::EXIST;
+  }
+
+  if (std::get<3>(params) == 0) {
+    return CDFModel::OUT_OF_SCOPE;
+  }
+
+  result.first = get_location(l_key, params);
+  result.second = get_location(r_key, params);
+  return CDFModel::NO_IDEA;
+}
+
+auto CDFModelView::find_interval(uint64_t key) const -> size_t {
+  size_t idx;
+  if (use_tree_) {
+    idx = begins_tree_.upper_bound(key) - 1;
+  } else {
+    idx = std::distance(begins_,
+                        std::upper_bound(begins_, begins_ + nsearch_, key)) -
+          1;
+  }
+  return packed() && idx < nsearch_ ? find_in_group(idx, key) : idx;
+}
+
+void CDFModelView::find_interval(const uint64_t *keys, size_t n,
+                                 size_t *result) const {
+  if (use_tree_) {
+    begins_tree_.upper_bound(keys, n, result);
+  } else {
+    batch_upper_bound(begins_, nsearch_, keys, n, result);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    --result[i];
+  }
+  if (packed()) {
+    for (size_t i = 0; i < n; ++i) {
+      if (result[i] < nsearch_) {
+        __builtin_prefetch(group_words_ + result[i]);
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (result[i] < nsearch_) {
+        result[i] = find_in_group(result[i], keys[i]);
+      }
+    }
+  }
+}
+
+void CDFModelView::prefetch(size_t idx) const {
+  if (idx >= nintervals_) {
+    return;
+  }
+  if (packed()) {
+    /* the fields were read by find_in_group() */
+    __builtin_prefetch(group_positions_ + idx / CDFModel::kGroup);
+  } else {
+    __builtin_prefetch(ends_ + idx);
+    __builtin_prefetch(accumulate_nkeys_ + idx);
+  }
+}
+
+auto CDFModelView::get_params(size_t idx) const -> Params {
+  if (!packed()) {
+    uint64_t begin = begins_[idx];
+    uint64_t low_location = idx == 0 ? 0 : accumulate_nkeys_[idx - 1];
+    return {begin, ends_[idx] - begin, low_location,
+            accumulate_nkeys_[idx] - low_location};
+  }
+
+  size_t g = idx / CDFModel::kGroup;
+  uint64_t low_location =
+      idx % CDFModel::kGroup == 0 ? 0 : packed_read(idx - 1, 2);
+  return {begins_[g] + packed_read(idx, 0), packed_read(idx, 1),
+          group_positions_[g] + low_location,
+          packed_read(idx, 2) - low_location};
+}
+
+auto CDFModelView::end(size_t idx) const -> uint64_t {
+  auto params = get_params(idx);
+  return std::get<0>(params) + std::get<1>(params);
+}
+
+auto CDFModelView::packed_read(size_t idx, size_t field) const -> uint64_t {
+  uint64_t word = group_words_[idx / CDFModel::kGroup];
+  uint8_t widths[3] = {static_cast<uint8_t>(word >> 16 & 0xFF),
+                       static_cast<uint8_t>(word >> 8 & 0xFF),
+                       static_cast<uint8_t>(word & 0xFF)};
+  size_t bit_pos = (word >> 24) + (idx % CDFModel::kGroup) *
+                                      (widths[0] + widths[1] + widths[2]);
+  for (size_t i = 0; i < field; ++i) {
+    bit_pos += widths[i];
+  }
+  return read_bits(packed_, bit_pos, widths[field]);
+}
+
+auto CDFModelView::find_in_group(size_t g, uint64_t key) const -> size_t {
+  /* the begins of a group are sorted, and the first one is <= key */
+  size_t low = g * CDFModel::kGroup;
+  size_t high = std::min(low + CDFModel::kGroup, nintervals_);
+  uint64_t offset = key - begins_[g];
+  while (high - low > 1) {
+    size_t mid = (low + high) / 2;
+    if (packed_read(mid, 0) <= offset) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/**
+ * In integers, so that positions never decrease as keys increase and are the
+ * same wherever they are computed. kPlainFormat models keep the long double
+ * rounding their blocks were built with.
+ */
+auto CDFModelView::get_location(const uint64_t &key,
+                                const Params &params) const -> uint64_t {
+  auto [begin, len, low_location, nlocations] = params;
+  if (format_ == CDFModel::kFixedFormat) {
+    return low_location + mul_hi(key - begin, multiplier(len, nlocations));
+  }
+  uint64_t end = begin + len;
+  uint64_t high_location = low_location + nlocations;
+  return static_cast<uint64_t>(
+      (static_cast<double>(nlocations) * key +
+       ((end * 1.0L) * low_location - (begin * 1.0L) * high_location)) /
+      len);
+}
+
+void CDFModelView::get_locations(const uint64_t *keys, size_t n,
+                                 const Params &params, uint64_t *out) const {
+  if (format_ != CDFModel::kFixedFormat) {
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = get_location(keys[i], params);
+    }
+    return;
+  }
+  auto [begin, len, low_location, nlocations] = params;
+  mul_hi_batch(keys, n, begin, multiplier(len, nlocations), low_location, out);
+}
+
 }  // namespace oasis
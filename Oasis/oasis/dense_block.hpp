@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "query_stats.hpp"
+#include "util.hpp"
+
+namespace oasis {
+
+/**
+ * Plain bitmap block: bit key is set for every key in [0, max_range]. It
+ * takes fewer bits than Elias-Fano while the range is below about 4 bits per
+ * key, and a query is a scan for the next set bit over a few words at most.
+ */
+class DenseBlock {
+ public:
+  inline DenseBlock(size_t nkeys, uint64_t max_range, const uint8_t *data);
+
+  ~DenseBlock() = default;
+
+  inline auto query(uint64_t query) const -> bool;
+  /* [left, right] */
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  inline void prefetch() const;
+
+  /* the keys, in order, repeated ones once */
+  inline auto decode() const -> std::vector<uint64_t>;
+
+  inline static auto size(size_t nkeys, uint64_t max_range) -> size_t;
+  inline static auto build(const std::vector<uint64_t> &keys,
+                           uint64_t max_range) -> std::vector<uint8_t>;
+
+ private:
+  uint64_t max_range_;
+  size_t nbytes_;
+
+  const uint8_t *data_;
+};
+
+DenseBlock::DenseBlock(size_t nkeys, uint64_t max_range, const uint8_t *data)
+    : max_range_(max_range), nbytes_(size(nkeys, max_range)), data_(data) {}
+
+auto DenseBlock::query(uint64_t query) const -> bool {
+  OASIS_STAT_ADD(upper_words, 1);
+  return query <= max_range_ &&
+         (load_word(data_, nbytes_, query >> 6) >> (query & 63)) & 1;
+}
+
+auto DenseBlock::query(uint64_t left, uint64_t right) const -> bool {
+  if (left > max_range_) {
+    return false;
+  }
+  size_t word_idx = left >> 6;
+  uint64_t word = load_word(data_, nbytes_, word_idx) & (~0ULL << (left & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (word == 0) {
+    if (++word_idx * 64 > right) {
+      return false;
+    }
+    word = load_word(data_, nbytes_, word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
+  }
+  return word_idx * 64 + __builtin_ctzll(word) <= right;
+}
+
+void DenseBlock::prefetch() const { __builtin_prefetch(data_); }
+
+auto DenseBlock::decode() const -> std::vector<uint64_t> {
+  std::vector<uint64_t> keys;
+  for (size_t word_idx = 0; word_idx * 64 <= max_range_; ++word_idx) {
+    for (uint64_t word = load_word(data_, nbytes_, word_idx); word != 0;
+         word &= word - 1) {
+      keys.emplace_back(word_idx * 64 + __builtin_ctzll(word));
+    }
+  }
+  return keys;
+}
+
+auto DenseBlock::size(size_t, uint64_t max_range) -> size_t {
+  return align_bit2byte(max_range + 1);
+}
+
+auto DenseBlock::build(const std::vector<uint64_t> &keys, uint64_t max_range)
+    -> std::vector<uint8_t> {
+  std::vector<uint8_t> data(size(keys.size(), max_range), 0);
+  for (uint64_t key : keys) {
+    assert(key <= max_range);
+    data[key >> 3] |= 1 << (key & 0x7ULL);
+  }
+  return data;
+}
+
+}  // namespace oasis
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <set>
+
+#include "key_spill.hpp"
+#include "oasis.hpp"
+
+namespace oasis {
+
+/**
+ * Oasis taking inserts and deletes, e.g. as the range filter of a memtable or
+ * of a small L0 file whose keys still change. An immutable base filter covers
+ * the keys as of the last rebuild, kept in a KeySpill, and an ordered delta
+ * absorbs the changes since, each in O(log n): inserts are answered from the
+ * delta exactly, deletes only leave a tombstone, so a deleted key stays a
+ * false positive of the base until the next rebuild. Once the delta outgrows
+ * delta_ratio of the base, rebuild() folds it into the keys and builds the
+ * base again.
+ *
+ * Not thread-safe: there is a single writer, and the caller serializes its
+ * updates with the queries. Queries alone may run concurrently, since they
+ * only read.
+ */
+class DynamicOasis {
+ public:
+  /* the delta may always hold this many keys before a rebuild */
+  static constexpr size_t kMinDelta = 1024;
+  /* bytes of a delta entry, a tree node of a key, a color and 3 links */
+  static constexpr size_t kDeltaEntrySz =
+      sizeof(uint64_t) + 4 * sizeof(void *);
+
+ public:
+  /* see Oasis::Oasis() */
+  DynamicOasis(double bit_per_key, size_t elements_per_block,
+               double delta_ratio = 0.125, size_t pla_epsilon = 0)
+      : bpk_(bit_per_key),
+        block_sz_(elements_per_block),
+        delta_ratio_(delta_ratio),
+        pla_epsilon_(pla_epsilon) {}
+
+  inline void insert(uint64_t key);
+  inline void erase(uint64_t key);
+
+  inline auto query(uint64_t query_key) const -> bool;
+  /* [left, right] */
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  /* fold the delta into the keys and rebuild the base filter over them */
+  inline void rebuild();
+
+  /* # live keys, exact if inserts add new keys and erases existing ones */
+  auto nkeys() const -> size_t {
+    return keys_.size() + inserts_.size() - deletes_.size();
+  }
+
+  /* bytes of the base filter and the delta, what queries read */
+  inline auto size() const -> size_t;
+  /* size() and the part of the keys kept for rebuilds that is in memory */
+  inline auto memory_usage() const -> size_t;
+
+ private:
+  inline void maybe_rebuild();
+
+ private:
+  double bpk_;
+  size_t block_sz_;
+  double delta_ratio_;
+  size_t pla_epsilon_;
+
+  /* the keys of base_, which is nullptr while there are none */
+  KeySpill keys_;
+  std::unique_ptr<Oasis> base_;
+
+  /* disjoint: a key is either inserted or deleted since the rebuild */
+  std::set<uint64_t> inserts_;
+  std::set<uint64_t> deletes_;
+};
+
+void DynamicOasis::insert(uint64_t key) {
+  deletes_.erase(key);
+  inserts_.insert(key);
+  maybe_rebuild();
+}
+
+void DynamicOasis::erase(uint64_t key) {
+  inserts_.erase(key);
+  /* the key may be in the base as well, the tombstone drops it on rebuild */
+  deletes_.insert(key);
+  maybe_rebuild();
+}
+
+auto DynamicOasis::query(uint64_t query_key) const -> bool {
+  return query(query_key, query_key);
+}
+
+auto DynamicOasis::query(uint64_t left, uint64_t right) const -> bool {
+  auto iter = inserts_.lower_bound(left);
+  if (iter != inserts_.end() && *iter <= right) {
+    return true;
+  }
+  return base_ != nullptr && base_->query(left, right);
+}
+
+void DynamicOasis::rebuild() {
+  KeySpill keys;
+  auto cursor = key_cursor(keys_, 0);
+  size_t nbase = keys_.size();
+  auto next_insert = inserts_.begin();
+  auto next_delete = deletes_.begin();
+  for (size_t i = 0; i < nbase; ++i) {
+    uint64_t key = cursor.next();
+    for (; next_insert != inserts_.end() && *next_insert <= key;
+         ++next_insert) {
+      if (*next_insert != key) {
+        keys.append(*next_insert);
+      }
+    }
+    while (next_delete != deletes_.end() && *next_delete < key) {
+      ++next_delete;
+    }
+    if (next_delete == deletes_.end() || *next_delete != key) {
+      keys.append(key);
+    }
+  }
+  for (; next_insert != inserts_.end(); ++next_insert) {
+    keys.append(*next_insert);
+  }
+
+  keys_ = std::move(keys);
+  inserts_.clear();
+  deletes_.clear();
+  base_.reset(keys_.empty() ? nullptr
+                            : new Oasis(bpk_, block_sz_, keys_, false, 1,
+                                        pla_epsilon_));
+}
+
+auto DynamicOasis::size() const -> size_t {
+  return (base_ == nullptr ? 0 : base_->size()) +
+         (inserts_.size() + deletes_.size()) * kDeltaEntrySz;
+}
+
+auto DynamicOasis::memory_usage() const -> size_t {
+  return size() + keys_.memory_usage();
+}
+
+void DynamicOasis::maybe_rebuild() {
+  size_t limit = std::max<size_t>(kMinDelta, keys_.size() * delta_ratio_);
+  if (inserts_.size() + deletes_.size() > limit) {
+    rebuild();
+  }
+}
+
+}  // namespace oasis
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "util.hpp"
+
+namespace oasis {
+
+/**
+ * Append-only store of sorted keys, kept as the gaps between neighbours:
+ * every kChunk keys share one bit width, the one of their largest gap, and
+ * are bit-packed at that width. Dense keys take a few bits each instead of
+ * 64. Once more than kBufferWords words are packed, the full words go to an
+ * unnamed temporary file, so that memory holds the chunk headers and a
+ * bounded tail only. Without a temporary file the words stay in memory.
+ *
+ * Keys are read back in order through a Cursor, which starts at any key
+ * from the header of its chunk, so that disjoint ranges can be scanned by
+ * different threads. A Cursor reads the file kReadWords words at a time.
+ */
+class KeySpill {
+ public:
+  /* # keys sharing a bit width and a header */
+  static constexpr size_t kChunk = 128;
+  /* # packed words held in memory before they are written out */
+  static constexpr size_t kBufferWords = 8192;
+  /* # words a Cursor reads from the file at once */
+  static constexpr size_t kReadWords = 4096;
+
+  class Cursor {
+   public:
+    inline auto next() -> uint64_t;
+
+   private:
+    friend class KeySpill;
+    inline Cursor(const KeySpill *spill, size_t idx);
+
+    /* the width bits at bit_pos_ of the packed words */
+    inline auto read(uint8_t width) -> uint64_t;
+    /* the idx-th packed word, from the file or the tail in memory */
+    inline auto word(size_t idx) -> uint64_t;
+
+    const KeySpill *spill_;
+    size_t chunk_;
+    size_t in_chunk_; /* # keys of the chunk already read */
+    size_t bit_pos_;
+    uint64_t key_;
+
+    /* words [buffer_begin_, buffer_begin_ + buffer_.size()) of the file */
+    std::vector<uint64_t> buffer_;
+    size_t buffer_begin_ = 0;
+  };
+
+ public:
+  KeySpill() = default;
+  KeySpill(const KeySpill &) = delete;
+  auto operator=(const KeySpill &) -> KeySpill & = delete;
+  KeySpill(KeySpill &&other) noexcept { *this = std::move(other); }
+  inline auto operator=(KeySpill &&other) noexcept -> KeySpill &;
+  ~KeySpill() { clear(); }
+
+  /* key >= back(), every key is stored, repeated ones included */
+  inline void append(uint64_t key);
+
+  auto size() const -> size_t { return nkeys_; }
+  auto empty() const -> bool { return nkeys_ == 0; }
+  auto front() const -> uint64_t { return front_; }
+  auto back() const -> uint64_t { return back_; }
+
+  /* read the keys from the idx-th one on */
+  auto cursor(size_t idx) const -> Cursor { return {this, idx}; }
+
+  /* bytes held in memory, the open chunk included, not the file */
+  inline auto memory_usage() const -> size_t;
+
+  inline void clear();
+
+ private:
+  struct ChunkHeader {
+    uint64_t base;    /* the key before the chunk, 0 for the first one */
+    uint64_t bit_pos; /* where the gaps start in data_ */
+    uint8_t width;
+  };
+
+  /* bit-pack the gaps of the open chunk */
+  inline void seal();
+  /* write the full words of data_ to the file, see kBufferWords */
+  inline void flush();
+
+ private:
+  std::vector<ChunkHeader> headers_;
+  /* the packed words from flushed_words_ on, the ones before are in file_ */
+  std::vector<uint64_t> data_;
+  size_t data_bits_ = 0;
+  size_t flushed_words_ = 0;
+  std::FILE *file_ = nullptr;
+  /* no temporary file could be written, keep every word in memory */
+  bool in_memory_ = false;
+
+  /* gaps of the chunk being filled, packed once it is full or read */
+  std::vector<uint64_t> open_;
+  uint64_t open_base_ = 0;
+
+  size_t nkeys_ = 0;
+  uint64_t front_ = 0;
+  uint64_t back_ = 0;
+};
+
+void KeySpill::append(uint64_t key) {
+  assert(nkeys_ == 0 || key >= back_);
+  if (nkeys_ == 0) {
+    front_ = key;
+  }
+  open_.emplace_back(key - (nkeys_ == 0 ? 0 : back_));
+  back_ = key;
+  ++nkeys_;
+  if (open_.size() == kChunk) {
+    seal();
+  }
+}
+
+auto KeySpill::operator=(KeySpill &&other) noexcept -> KeySpill & {
+  if (this != &other) {
+    clear();
+    headers_ = std::move(other.headers_);
+    data_ = std::move(other.data_);
+    data_bits_ = other.data_bits_;
+    flushed_words_ = other.flushed_words_;
+    file_ = std::exchange(other.file_, nullptr);
+    in_memory_ = other.in_memory_;
+    open_ = std::move(other.open_);
+    open_base_ = other.open_base_;
+    nkeys_ = other.nkeys_;
+    front_ = other.front_;
+    back_ = other.back_;
+    other.clear();
+  }
+  return *this;
+}
+
+void KeySpill::seal() {
+  uint64_t max_gap = 0;
+  for (uint64_t gap : open_) {
+    max_gap |= gap;
+  }
+  uint8_t width = bit_width(max_gap);
+  headers_.push_back({open_base_, data_bits_, width});
+
+  size_t bit_pos = data_bits_ - flushed_words_ * 64;
+  data_.resize((bit_pos + open_.size() * width + 63) / 64 + 1, 0);
+  for (uint64_t gap : open_) {
+    write_bits(data_.data(), bit_pos, width, gap);
+    bit_pos += width;
+  }
+  data_bits_ += open_.size() * width;
+
+  open_base_ = back_;
+  open_.clear();
+  if (data_.size() > kBufferWords && !in_memory_) {
+    flush();
+  }
+}
+
+void KeySpill::flush() {
+  if (file_ == nullptr) {
+    file_ = std::tmpfile();
+    if (file_ == nullptr) {
+      in_memory_ = true;
+      return;
+    }
+  }
+  size_t nwords = data_bits_ / 64 - flushed_words_;
+  size_t nbytes = nwords * sizeof(uint64_t);
+  auto written = pwrite(fileno(file_), data_.data(), nbytes,
+                        flushed_words_ * sizeof(uint64_t));
+  if (written < 0 || static_cast<size_t>(written) != nbytes) {
+    in_memory_ = true;
+    return;
+  }
+  data_.erase(data_.begin(), data_.begin() + nwords);
+  flushed_words_ += nwords;
+}
+
+auto KeySpill::memory_usage() const -> size_t {
+  return headers_.capacity() * sizeof(ChunkHeader) +
+         data_.capacity() * sizeof(uint64_t) +
+         open_.capacity() * sizeof(uint64_t);
+}
+
+void KeySpill::clear() {
+  headers_.clear();
+  data_.clear();
+  data_bits_ = 0;
+  flushed_words_ = 0;
+  if (file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+  in_memory_ = false;
+  open_.clear();
+  open_base_ = 0;
+  nkeys_ = 0;
+  front_ = 0;
+  back_ = 0;
+}
+
+KeySpill::Cursor::Cursor(const KeySpill *spill, size_t idx)
+    : spill_(spill), chunk_(idx / kChunk), in_chunk_(0) {
+  if (chunk_ < spill_->headers_.size()) {
+    const ChunkHeader &header = spill_->headers_[chunk_];
+    key_ = header.base;
+    bit_pos_ = header.bit_pos;
+  } else {
+    key_ = spill_->open_base_;
+    bit_pos_ = 0;
+  }
+  for (size_t i = idx % kChunk; i > 0; --i) {
+    next();
+  }
+}
+
+auto KeySpill::Cursor::next() -> uint64_t {
+  if (in_chunk_ == kChunk) {
+    in_chunk_ = 0;
+    if (++chunk_ < spill_->headers_.size()) {
+      bit_pos_ = spill_->headers_[chunk_].bit_pos;
+    }
+  }
+
+  if (chunk_ < spill_->headers_.size()) {
+    key_ += read(spill_->headers_[chunk_].width);
+  } else {
+    key_ += spill_->open_[in_chunk_];
+  }
+  ++in_chunk_;
+  return key_;
+}
+
+auto KeySpill::Cursor::read(uint8_t width) -> uint64_t {
+  if (width == 0) {
+    return 0;
+  }
+  size_t idx = bit_pos_ >> 6;
+  size_t shift = bit_pos_ & 63;
+  uint64_t value = word(idx) >> shift;
+  if (shift + width > 64) {
+    value |= word(idx + 1) << (64 - shift);
+  }
+  bit_pos_ += width;
+  return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+auto KeySpill::Cursor::word(size_t idx) -> uint64_t {
+  if (idx >= spill_->flushed_words_) {
+    return spill_->data_[idx - spill_->flushed_words_];
+  }
+  if (idx < buffer_begin_ || idx >= buffer_begin_ + buffer_.size()) {
+    buffer_begin_ = idx;
+    buffer_.resize(std::min(kReadWords, spill_->flushed_words_ - idx));
+    size_t nbytes = buffer_.size() * sizeof(uint64_t);
+    auto nread = pread(fileno(spill_->file_), buffer_.data(), nbytes,
+                       idx * sizeof(uint64_t));
+    assert(nread >= 0 && static_cast<size_t>(nread) == nbytes);
+    (void)nread;
+  }
+  return buffer_[idx - buffer_begin_];
+}
+
+/* sequential reader over a sorted std::vector, with the Cursor interface */
+class VectorCursor {
+ public:
+  explicit VectorCursor(const uint64_t *pos) : pos_(pos) {}
+  auto next() -> uint64_t { return *pos_++; }
+
+ private:
+  const uint64_t *pos_;
+};
+
+inline auto key_cursor(const std::vector<uint64_t> &keys, size_t idx)
+    -> VectorCursor {
+  return VectorCursor(keys.data() + idx);
+}
+
+inline auto key_cursor(const KeySpill &keys, size_t idx) -> KeySpill::Cursor {
+  return keys.cursor(idx);
+}
+
+}  // namespace oasis
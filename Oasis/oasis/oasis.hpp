@@ -1,25 +1,67 @@
 #pragma once
 
-#include "bitset.hpp"
+#include <cmath>
+#include <numeric>
+
+#include "block.hpp"
 #include "cdf_model.hpp"
+#include "oasis_view.hpp"
+#include "query_stats.hpp"
 
 namespace oasis {
 
 class Oasis {
+ private:
+  /* max # times the positions are rescaled towards the bpk budget */
+  static constexpr size_t kScaleRounds = 4;
+  /* bits per key over the budget should_merge() accepts */
+  static constexpr double kMergeSlack = 0.5;
+  /* times the false positives of a rebuild should_merge() accepts */
+  static constexpr double kMergeFprLoss = 1.5;
+  /* passes of a rebuild over the keys: gaps, intervals, layout and blocks */
+  static constexpr size_t kRebuildPasses = 4;
+
  public:
-  Oasis(double bit_per_key, size_t elements_per_block,
-        const std::vector<uint64_t> &keys);
+  /**
+   * search_tree: also store STree indices over the interval begins and the
+   * block biases, trading a few bits per key for fewer cache misses per query
+   * nthreads: # threads sharing the construction, the filter is byte-identical
+   * to the one built by a single thread
+   * keys: sorted std::vector<uint64_t> or KeySpill, only read sequentially, the
+   * positions are computed block by block and never materialized
+   * pla_epsilon: if not 0, model the keys by pieces within pla_epsilon of
+   * their rank, see CDFModel::CDFModel(), for skewed keys
+   * rice_blocks: also Golomb-Rice code the blocks where it is smaller, see
+   * Block::choose(), for a lower FPR at a slower block probe
+   */
+  template <typename Keys>
+  Oasis(double bit_per_key, size_t elements_per_block, const Keys &keys,
+        bool search_tree = false, size_t nthreads = 1, size_t pla_epsilon = 0,
+        bool rice_blocks = false)
+      : Oasis(bit_per_key, elements_per_block,
+              new CDFModel(bit_per_key, elements_per_block, keys, nthreads,
+                           pla_epsilon),
+              keys, search_tree, nthreads, rice_blocks) {}
+
+  /* take over cdf_model, trained on keys, e.g. by OasisBuilder */
+  template <typename Keys>
+  Oasis(double bit_per_key, size_t elements_per_block, CDFModel *cdf_model,
+        const Keys &keys, bool search_tree, size_t nthreads, bool rice_blocks);
 
   Oasis(size_t bitmap_sz, uint16_t block_sz, uint16_t last_block_sz,
         CDFModel *cdf_model, uint8_t *bitmap_ptr,
-        std::vector<uint64_t> &block_bias, std::vector<BitSet> &block_list)
+        std::vector<uint64_t> &block_bias,
+        std::vector<uint32_t> &block_offsets, bool search_tree,
+        bool block_encodings)
       : cdf_model_(cdf_model),
         bitmap_ptr_(bitmap_ptr),
         block_bias_(std::move(block_bias)),
-        block_list_(std::move(block_list)) {
+        block_offsets_(std::move(block_offsets)) {
     bitmap_sz_ = bitmap_sz;
+    block_encodings_ = block_encodings;
     block_sz_ = block_sz;
     last_block_sz_ = last_block_sz;
+    init_view(search_tree);
   }
 
   ~Oasis() {
@@ -27,17 +69,90 @@ class Oasis {
     delete[] bitmap_ptr_;
   }
 
-  auto query(uint64_t query_key) -> bool;
+  inline auto query(uint64_t query_key) const -> bool;
   /* [left, right] */
-  auto query(uint64_t left, uint64_t right) -> bool;
-
-  auto serialize() const -> std::pair<uint8_t *, size_t>;
-  static auto deserialize(uint8_t *ser) -> Oasis *;
-
-  auto size() const -> size_t;
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  /* out[i] = query(keys[i]), see OasisView::query_batch() */
+  inline void query_batch(const uint64_t *keys, size_t n, bool *out) const;
+  /* out[i] = query(lefts[i], rights[i]) */
+  inline void query_batch(const uint64_t *lefts, const uint64_t *rights,
+                          size_t n, bool *out) const;
+
+  /* the costs of this filter's queries, all 0 without OASIS_QUERY_STATS */
+  auto query_stats() const -> QueryStats { return stats_.load_atomic(); }
+
+  /* borrow the filter without copying, valid as long as this object lives */
+  auto view() const -> const OasisView & { return view_; }
+
+  inline auto serialize() const -> std::pair<uint8_t *, size_t>;
+  inline static auto deserialize(uint8_t *ser) -> Oasis *;
+
+  /**
+   * One filter over the keys of parts, whose key ranges are disjoint and in
+   * order, e.g. the files of a compaction's input that survive unchanged.
+   * The parts' intervals and blocks are copied with their positions shifted
+   * past the previous part's; only the last block of every part followed by
+   * another one is decoded and re-encoded, since it takes the part's last
+   * position and is filled up to the block size. A part without blocks has a
+   * single position at most, which joins the blocks re-encoded around it.
+   * nullptr if the parts overlap, differ in block size or model format, or
+   * the blocks need more than kOffsetMask bytes without all being Elias-Fano.
+   */
+  inline static auto merge(const std::vector<const Oasis *> &parts) -> Oasis *;
+
+  /**
+   * Whether merge(parts) should replace a rebuild from their nkeys keys at
+   * bit_per_key, by their estimated work and false positives. A merge copies
+   * the parts' words and decodes and encodes again about a block per part,
+   * while a rebuild makes kRebuildPasses over the keys. A merge also keeps
+   * each part's intervals and positions, which the parts chose for their own
+   * keys: with D the key range a model covers and P its # positions, the
+   * false positives of a model are taken as D^2 / P, as CDFModel picks its
+   * intervals by, and the merged filter has the sum of those of the parts. A
+   * rebuild is taken to keep the same intervals, spread its positions at one
+   * density and scale them to bit_per_key, see CDFModel::scale(), which it
+   * can only improve on. The merge must do less work, have at most
+   * kMergeFprLoss times the false positives and take at most kMergeSlack bits
+   * per key more than bit_per_key.
+   */
+  inline static auto should_merge(const std::vector<const Oasis *> &parts,
+                                  double bit_per_key, size_t nkeys) -> bool;
+
+  inline auto size() const -> size_t;
 
  private:
-  inline void build_block_list(const std::vector<uint64_t> &keys);
+  /**
+   * Block biases, offsets and sizes over the positions of keys, without any
+   * bitmap, in one pass; first_keys gets the index of the key at the start of
+   * each block. Returns the # positions.
+   */
+  template <typename Keys>
+  inline auto layout_blocks(const Keys &keys, size_t nthreads,
+                            std::vector<size_t> &first_keys) -> size_t;
+  /* fill bitmap_ptr_ with the blocks laid out by layout_blocks() */
+  template <typename Keys>
+  inline void build_blocks(const Keys &keys,
+                           const std::vector<size_t> &first_keys, size_t npos,
+                           size_t nthreads);
+  /**
+   * f(i, positions) for every block i laid out by layout_blocks(), positions
+   * relative to its bias, with the blocks split over nthreads
+   */
+  template <typename Keys, typename F>
+  inline void for_each_block(const Keys &keys,
+                             const std::vector<size_t> &first_keys,
+                             size_t npos, size_t nthreads, F &&f) const;
+  /* [begin, end) of block idx in bitmap_ptr_ */
+  inline auto block_extent(size_t idx) const -> std::pair<uint32_t, uint32_t>;
+  inline auto block_encoding(size_t idx) const -> uint8_t;
+  /**
+   * The largest factor to CDFModel::scale() whose blocks take at most budget
+   * bytes, estimated by scaling the ranges of the current layout.
+   */
+  inline auto solve_scale(size_t npos, double budget) const -> double;
+  /* point view_ at the members, (re)building the STree indices if asked */
+  inline void init_view(bool search_tree);
 
  private:
   size_t bitmap_sz_ = 0;
@@ -47,141 +162,365 @@ class Oasis {
   CDFModel *cdf_model_ = nullptr;
   uint8_t *bitmap_ptr_ = nullptr;
   std::vector<uint64_t> block_bias_;
+  /**
+   * byte offset of each block in bitmap_ptr_, plus the end of the last one,
+   * tagged with the blocks' encoding if block_encodings_, see OasisView
+   */
+  std::vector<uint32_t> block_offsets_;
+  bool block_encodings_ = true;
+  /* construction only */
+  bool rice_blocks_ = false;
+
+  /* STree indices, empty unless built with search_tree */
+  std::vector<uint64_t> interval_index_;
+  std::vector<uint64_t> block_index_;
 
   /* Do not need serialize */
-  std::vector<BitSet> block_list_;
+  OasisView view_;
+  mutable QueryStats stats_;
 };
 
+template <typename Keys>
 Oasis::Oasis(double bit_per_key, size_t elements_per_block,
-             const std::vector<uint64_t> &keys) {
+             CDFModel *cdf_model, const Keys &keys, bool search_tree,
+             size_t nthreads, bool rice_blocks)
+    : cdf_model_(cdf_model), rice_blocks_(rice_blocks) {
   assert(elements_per_block != 0);
   assert(elements_per_block <= UINT16_MAX);
   block_sz_ = elements_per_block;
-  cdf_model_ = new CDFModel(bit_per_key, block_sz_, keys);
-  build_block_list(keys);
-
-  double bpk = size() * 8.0 / keys.size();
-  bpk = bit_per_key - bpk;
-  if (bpk < 0.2) {
-    return;
+  std::vector<size_t> first_keys;
+  size_t npos = layout_blocks(keys, nthreads, first_keys);
+
+  /**
+   * The layout gives the exact size before any block is built. While it
+   * exceeds the budget, whose model part is only estimated up front, or
+   * misses it by 0.2 bits per key or more, the positions are spread narrower
+   * or wider to fit the blocks to the rest, rather than building everything
+   * again. The estimate is coarse while few positions are spread over many
+   * keys, so it is refined from the new positions a few times.
+   */
+  size_t nkeys = keys.size();
+  size_t index_sz = 0;
+  if (search_tree) {
+    index_sz = (STree::size(cdf_model_->nsearch_keys()) +
+                STree::size(block_bias_.size())) *
+               sizeof(uint64_t);
+  }
+  double budget = bit_per_key * nkeys / 8 - index_sz;
+  for (size_t round = 0;
+       round < kScaleRounds &&
+       (size() > budget || budget - size() >= 0.2 * nkeys / 8);
+       ++round) {
+    double factor = solve_scale(npos, budget - (size() - bitmap_sz_));
+    if (factor == 1) {
+      break;
+    }
+    size_t prev_sz = size();
+    cdf_model_->scale(factor);
+    npos = layout_blocks(keys, nthreads, first_keys);
+    if (size() == prev_sz) {
+      /* every interval already has a position per key */
+      break;
+    }
   }
-  bit_per_key += bpk;
-  delete cdf_model_;
-  delete[] bitmap_ptr_;
 
-  block_bias_.clear();
-  block_list_.clear();
-  cdf_model_ = new CDFModel(bit_per_key, elements_per_block, keys);
-  build_block_list(keys);
+  build_blocks(keys, first_keys, npos, nthreads);
+  init_view(search_tree);
 }
 
-void Oasis::build_block_list(const std::vector<uint64_t> &keys) {
-  std::vector<uint64_t> keys_pos = cdf_model_->get_locations(keys);
-  last_block_sz_ = keys_pos.size() % block_sz_;
+template <typename Keys>
+auto Oasis::layout_blocks(const Keys &keys, size_t nthreads,
+                          std::vector<size_t> &first_keys) -> size_t {
+  size_t nkeys = keys.size();
+  nthreads = std::max<size_t>(1, std::min(nthreads, nkeys));
+
+  /**
+   * Block i holds positions [i * block_sz_, (i + 1) * block_sz_) relative to
+   * its bias, its first position, and ends at the next block's bias, or at
+   * the last position. Chunks of keys are scanned in parallel, once counted
+   * to know at which position each of them starts.
+   */
+  std::vector<size_t> offsets(nthreads, 0);
+  if (nthreads > 1) {
+    parallel_for(nkeys, nthreads, [&](size_t chunk, size_t begin, size_t end) {
+      if (chunk + 1 < nthreads) {
+        offsets[chunk + 1] = cdf_model_->count_locations(keys, begin, end);
+      }
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  }
+
+  struct ChunkLayout {
+    std::vector<uint64_t> bias;
+    std::vector<size_t> first_keys;
+    size_t npos = 0;
+    uint64_t last_pos = 0;
+  };
+  std::vector<ChunkLayout> chunks(nthreads);
+  parallel_for(nkeys, nthreads, [&](size_t chunk, size_t begin, size_t end) {
+    ChunkLayout &layout = chunks[chunk];
+    cdf_model_->for_each_location(keys, begin, end, [&](size_t i,
+                                                        uint64_t pos) {
+      if ((offsets[chunk] + layout.npos) % block_sz_ == 0) {
+        layout.bias.emplace_back(pos);
+        layout.first_keys.emplace_back(i);
+      }
+      ++layout.npos;
+      layout.last_pos = pos;
+      return true;
+    });
+  });
 
-  std::vector<uint8_t> compressed_bitmap;
+  size_t npos = 0;
+  uint64_t last_pos = 0;
+  block_bias_.clear();
+  first_keys.clear();
+  for (const auto &layout : chunks) {
+    assert(npos == offsets[&layout - chunks.data()]);
+    block_bias_.insert(block_bias_.end(), layout.bias.begin(),
+                       layout.bias.end());
+    first_keys.insert(first_keys.end(), layout.first_keys.begin(),
+                      layout.first_keys.end());
+    npos += layout.npos;
+    last_pos = layout.npos == 0 ? last_pos : layout.last_pos;
+  }
 
-  uint64_t low_bound = keys_pos[0];
-  block_bias_.emplace_back(low_bound);
-  for (size_t idx = 1; idx < keys_pos.size();) {
-    std::vector<uint64_t> cur_batch;
-    cur_batch.emplace_back(0);
-    for (size_t cnt = 1; cnt < block_sz_ && idx < keys_pos.size(); ++cnt) {
-      cur_batch.emplace_back(keys_pos[idx++] - low_bound);
-    }
-    if (idx < keys_pos.size()) {
-      block_bias_.emplace_back(keys_pos[idx++]);
+  last_block_sz_ = 0;
+  if (npos == 0) {
+    /* every key is an interval bound, the model alone answers queries */
+    block_bias_.assign(1, 0);
+    block_offsets_.assign(1, 0);
+    bitmap_sz_ = 0;
+    first_keys.clear();
+    return 0;
+  }
+
+  /* the last position is the end of the last block, rather than in a block */
+  size_t nblocks = (npos - 1 + block_sz_ - 1) / block_sz_;
+  block_bias_.resize(nblocks + 1);
+  block_bias_[nblocks] = last_pos;
+  first_keys.resize(nblocks);
+
+  /**
+   * Every block takes its smallest encoding, whose size depends on the gaps
+   * between its positions once Rice coded, so the blocks are scanned again.
+   * Past kOffsetMask bytes the offsets have no room left for the tags, and all
+   * blocks fall back to Elias-Fano.
+   */
+  std::vector<uint8_t> encodings(nblocks);
+  std::vector<size_t> sizes(nblocks);
+  for_each_block(keys, first_keys, npos, nthreads,
+                 [&](size_t i, const std::vector<uint64_t> &positions) {
+                   encodings[i] = Block::choose(
+                       positions, block_bias_[i + 1] - block_bias_[i],
+                       rice_blocks_, sizes[i]);
+                 });
+  block_encodings_ = std::accumulate(sizes.begin(), sizes.end(), size_t{0}) <=
+                     OasisView::kOffsetMask;
+
+  block_offsets_.resize(nblocks + 1);
+  uint64_t offset = 0;
+  for (size_t i = 0; i < nblocks; ++i) {
+    size_t block_nkeys = std::min<size_t>(block_sz_, npos - i * block_sz_);
+    if (block_encodings_) {
+      block_offsets_[i] =
+          offset | (uint32_t{encodings[i]} << OasisView::kEncodingShift);
+      offset += sizes[i];
     } else {
-      block_bias_.emplace_back(keys_pos.back());
+      block_offsets_[i] = offset;
+      offset += BitSet::size(block_nkeys, block_bias_[i + 1] - block_bias_[i]);
     }
-    std::vector<uint8_t> batch_block =
-        BitSet::build(cur_batch, block_bias_.back() - low_bound);
-    compressed_bitmap.insert(compressed_bitmap.end(), batch_block.begin(),
-                             batch_block.end());
-    low_bound = block_bias_.back();
+    assert(offset <= UINT32_MAX);
+    /* a full block may be the last one as well */
+    last_block_sz_ = block_nkeys;
   }
+  block_offsets_[nblocks] = offset;
 
-  bitmap_sz_ = compressed_bitmap.size();
+  bitmap_sz_ = offset;
+  return npos;
+}
+
+template <typename Keys>
+void Oasis::build_blocks(const Keys &keys,
+                         const std::vector<size_t> &first_keys, size_t npos,
+                         size_t nthreads) {
+  /* the blocks are independent and built in place */
   bitmap_ptr_ = new uint8_t[bitmap_sz_];
-  memcpy(bitmap_ptr_, compressed_bitmap.data(), bitmap_sz_ * sizeof(uint8_t));
+  for_each_block(keys, first_keys, npos, nthreads,
+                 [&](size_t i, const std::vector<uint64_t> &positions) {
+                   std::pair<uint32_t, uint32_t> extent = block_extent(i);
+                   std::vector<uint8_t> block =
+                       Block::build(block_encoding(i), positions,
+                                    block_bias_[i + 1] - block_bias_[i]);
+                   assert(block.size() == extent.second - extent.first);
+                   std::copy(block.begin(), block.end(),
+                             bitmap_ptr_ + extent.first);
+                 });
+}
 
-  size_t nbatches = block_bias_.size() - 1;
-  uint8_t *pos = bitmap_ptr_;
-  for (size_t i = 0; i < nbatches; ++i) {
-    block_list_.emplace_back(i == nbatches - 1 ? last_block_sz_ : block_sz_,
-                             block_bias_[i + 1] - block_bias_[i], pos);
-    pos += block_list_.back().size();
-  }
+template <typename Keys, typename F>
+void Oasis::for_each_block(const Keys &keys,
+                           const std::vector<size_t> &first_keys, size_t npos,
+                           size_t nthreads, F &&f) const {
+  size_t nblocks = block_bias_.size() - 1;
+  parallel_for(nblocks, nthreads, [&](size_t, size_t begin, size_t end) {
+    if (begin == end) {
+      return;
+    }
+    std::vector<uint64_t> positions;
+    size_t i = begin;
+    cdf_model_->for_each_location(keys, first_keys[begin], keys.size(),
+                                  [&](size_t, uint64_t pos) {
+      positions.emplace_back(pos - block_bias_[i]);
+      size_t block_nkeys = std::min<size_t>(block_sz_, npos - i * block_sz_);
+      if (positions.size() < block_nkeys) {
+        return true;
+      }
+      f(i, positions);
+      positions.clear();
+      return ++i < end;
+    });
+    assert(i == end);
+  });
 }
 
-auto Oasis::query(uint64_t query_key) -> bool {
-  size_t pos;
-  CDFModel::QueryPosStatus status = cdf_model_->query(query_key, pos);
-  switch (status) {
-    case CDFModel::EXIST:
-      return true;
-    case CDFModel::OUT_OF_SCOPE:
-      return false;
-    default:
-      break;
+auto Oasis::block_extent(size_t idx) const -> std::pair<uint32_t, uint32_t> {
+  uint32_t mask = block_encodings_ ? OasisView::kOffsetMask : UINT32_MAX;
+  return {block_offsets_[idx] & mask, block_offsets_[idx + 1] & mask};
+}
+
+auto Oasis::block_encoding(size_t idx) const -> uint8_t {
+  return block_encodings_ ? block_offsets_[idx] >> OasisView::kEncodingShift
+                          : uint8_t{Block::kEliasFano};
+}
+
+auto Oasis::solve_scale(size_t npos, double budget) const -> double {
+  size_t nblocks = block_bias_.size() - 1;
+  if (nblocks == 0) {
+    return 1;
   }
 
-  if (pos < block_bias_[0] || pos > block_bias_.back()) {
-    return false;
+  /* a Rice coded block is assumed to keep saving as much as it does now */
+  auto blocks_sz = [&](double factor) {
+    double total = 0;
+    for (size_t i = 0; i < nblocks; ++i) {
+      size_t block_nkeys = std::min<size_t>(block_sz_, npos - i * block_sz_);
+      uint64_t range = block_bias_[i + 1] - block_bias_[i];
+      if (!block_encodings_) {
+        total += BitSet::size(block_nkeys, range * factor);
+        continue;
+      }
+      std::pair<uint32_t, uint32_t> extent = block_extent(i);
+      double saving = static_cast<double>(Block::size(block_nkeys, range)) -
+                      (extent.second - extent.first);
+      total += std::max(
+          1.0, Block::size(block_nkeys, range * factor) - std::max(saving, 0.0));
+    }
+    return total;
+  };
+
+  /* interval sizes are computed in double precision and must stay exact */
+  double max_factor =
+      static_cast<double>(1ULL << 52) /
+      std::max({cdf_model_->position_range(), block_bias_.back(),
+                uint64_t{1}});
+  double low = 1;
+  double high = 2;
+  if (blocks_sz(1) > budget) {
+    /* the model took more than estimated, narrow the positions instead */
+    for (high = 1, low = 0.5; low > 1.0 / 1024 && blocks_sz(low) > budget;) {
+      high = low;
+      low /= 2;
+    }
+  } else {
+    while (high < max_factor && blocks_sz(high) <= budget) {
+      low = high;
+      high *= 2;
+    }
+    high = std::min(high, max_factor);
   }
-  auto iter = std::upper_bound(block_bias_.begin(), block_bias_.end(), pos) - 1;
-  if (*iter == pos) {
-    return true;
+  for (size_t iter = 0; iter < 16 && low < high; ++iter) {
+    double mid = (low + high) / 2;
+    if (blocks_sz(mid) <= budget) {
+      low = mid;
+    } else {
+      high = mid;
+    }
   }
-
-  size_t block_idx = iter - block_bias_.begin();
-
-  return block_list_[block_idx].query(static_cast<uint32_t>(pos - *iter));
+  return low;
 }
 
-auto Oasis::query(uint64_t left, uint64_t right) -> bool {
-  std::pair<size_t, size_t> pos;
-  CDFModel::QueryPosStatus status = cdf_model_->query(left, right, pos);
-  switch (status) {
-    case CDFModel::EXIST:
-      return true;
-    case CDFModel::OUT_OF_SCOPE:
-      return false;
-    default:
-      break;
+void Oasis::init_view(bool search_tree) {
+  view_ = OasisView(cdf_model_->view(), block_bias_.data(),
+                    block_offsets_.data(), bitmap_ptr_, block_bias_.size() - 1,
+                    block_sz_, last_block_sz_, block_encodings_);
+  interval_index_.clear();
+  block_index_.clear();
+  if (search_tree) {
+    CDFModelView model = cdf_model_->view();
+    interval_index_ = STree::build(model.search_keys(), model.nsearch_keys());
+    block_index_ = STree::build(block_bias_.data(), block_bias_.size());
+    view_.set_search_tree(interval_index_.data(), block_index_.data());
   }
+}
 
-  if (pos.second < block_bias_[0] || pos.first > block_bias_.back()) {
-    return false;
-  }
+auto Oasis::query(uint64_t query_key) const -> bool {
+  QueryStatsScope scope(stats_);
+  return view().query(query_key);
+}
 
-  auto iter =
-      std::upper_bound(block_bias_.begin(), block_bias_.end(), pos.second);
-  if (iter == block_bias_.end() || *(--iter) == pos.second ||
-      pos.first <= *iter) {
-    return true;
-  }
+auto Oasis::query(uint64_t left, uint64_t right) const -> bool {
+  QueryStatsScope scope(stats_);
+  return view().query(left, right);
+}
 
-  size_t block_idx = iter - block_bias_.begin();
-  return block_list_[block_idx].query(pos.first - *iter, pos.second - *iter);
+void Oasis::query_batch(const uint64_t *keys, size_t n, bool *out) const {
+  QueryStatsScope scope(stats_);
+  view().query_batch(keys, n, out);
+}
+
+void Oasis::query_batch(const uint64_t *lefts, const uint64_t *rights,
+                        size_t n, bool *out) const {
+  QueryStatsScope scope(stats_);
+  view().query_batch(lefts, rights, n, out);
 }
 
 auto Oasis::serialize() const -> std::pair<uint8_t *, size_t> {
-  size_t nbatches = block_list_.size();
+  size_t nbatches = block_bias_.size() - 1;
   size_t bias_list_sz = (nbatches + 1) * sizeof(uint64_t);
+  size_t offset_list_sz = (nbatches + 1) * sizeof(uint32_t);
+  sizeAlign(offset_list_sz);
 
-  size_t meta_sz = sizeof(size_t)          /* block_list_ size */
-                   + sizeof(size_t)        /* bitmap_sz_ */
-                   + sizeof(uint16_t) * 2; /* block_sz */
+  size_t meta_sz = sizeof(size_t)         /* # blocks */
+                   + sizeof(size_t)       /* bitmap_sz_ */
+                   + sizeof(uint16_t) * 2 /* block_sz */
+                   + sizeof(uint8_t);     /* flags */
   sizeAlign(meta_sz);
 
   std::pair<uint8_t *, size_t> cdf_ser = cdf_model_->serialize();
 
+  uint8_t flags = block_index_.empty() ? 0 : OasisView::kSearchTree;
+  if (block_encodings_) {
+    flags |= OasisView::kBlockEncodings;
+  }
+  /* the serialized model is packed, so is searched through other keys */
+  std::vector<uint64_t> interval_index;
+  if (flags & OasisView::kSearchTree) {
+    const uint8_t *cdf_pos = cdf_ser.first;
+    CDFModelView model = CDFModelView::view(cdf_pos);
+    interval_index = STree::build(model.search_keys(), model.nsearch_keys());
+  }
+  size_t index_sz =
+      (interval_index.size() + block_index_.size()) * sizeof(uint64_t);
+
   size_t size = meta_sz + bias_list_sz /* block_bias_ */
+                + offset_list_sz       /* block_offsets_ */
                 + cdf_ser.second       /* cdf model */
-                + bitmap_sz_;          /* block_list_ */
+                + index_sz             /* STree indices */
+                + bitmap_sz_;          /* blocks */
 
-  uint8_t *ser = new uint8_t[size];
+  /* zeroed, so that the padding and the output are deterministic */
+  uint8_t *ser = new uint8_t[size]();
   uint8_t *pos = ser;
 
   memcpy(pos, &nbatches, sizeof(size_t));
@@ -196,15 +535,29 @@ auto Oasis::serialize() const -> std::pair<uint8_t *, size_t> {
   memcpy(pos, &last_block_sz_, sizeof(uint16_t));
   pos += sizeof(uint16_t);
 
+  *pos = flags;
+  pos += sizeof(uint8_t);
+
   align(pos);
 
   memcpy(pos, block_bias_.data(), bias_list_sz);
   pos += bias_list_sz;
 
+  memset(pos, 0, offset_list_sz);
+  memcpy(pos, block_offsets_.data(), (nbatches + 1) * sizeof(uint32_t));
+  pos += offset_list_sz;
+
   memcpy(pos, cdf_ser.first, cdf_ser.second);
   pos += cdf_ser.second;
   delete[] cdf_ser.first;
 
+  pos = reinterpret_cast<uint8_t *>(std::copy(
+      interval_index.begin(), interval_index.end(),
+      reinterpret_cast<uint64_t *>(pos)));
+  pos = reinterpret_cast<uint8_t *>(std::copy(
+      block_index_.begin(), block_index_.end(),
+      reinterpret_cast<uint64_t *>(pos)));
+
   memcpy(pos, bitmap_ptr_, bitmap_sz_);
 
   return {ser, size};
@@ -227,6 +580,9 @@ auto Oasis::deserialize(uint8_t *ser) -> Oasis * {
   memcpy(&last_block_sz, ser, sizeof(uint16_t));
   ser += sizeof(uint16_t);
 
+  uint8_t flags = *ser;
+  ser += sizeof(uint8_t);
+
   align(ser);
 
   std::vector<uint64_t> block_bias(nbatches + 1);
@@ -234,36 +590,280 @@ auto Oasis::deserialize(uint8_t *ser) -> Oasis * {
   memcpy(block_bias.data(), ser, bias_sz);
   ser += bias_sz;
 
-  CDFModel *model = CDFModel::deserialize(ser);
-  ser += model->size();
+  std::vector<uint32_t> block_offsets(nbatches + 1);
+  size_t offset_sz = block_offsets.size() * sizeof(uint32_t);
+  memcpy(block_offsets.data(), ser, offset_sz);
+  sizeAlign(offset_sz);
+  ser += offset_sz;
+
+  /* the format of the model decides which keys the STree index covers */
+  const uint8_t *cdf_pos = ser;
+  size_t nsearch_keys = CDFModelView::view(cdf_pos).nsearch_keys();
+  cdf_pos = ser;
+  CDFModel *model = CDFModel::deserialize(cdf_pos);
+  ser += cdf_pos - ser;
+
+  /* the indices are rebuilt rather than copied */
+  bool search_tree = flags & OasisView::kSearchTree;
+  if (search_tree) {
+    ser += (STree::size(nsearch_keys) + STree::size(nbatches + 1)) *
+           sizeof(uint64_t);
+  }
 
   uint8_t *bitmap_ptr = new uint8_t[bitmap_sz];
   memcpy(bitmap_ptr, ser, bitmap_sz);
 
-  std::vector<BitSet> block_list;
-  block_list.reserve(nbatches);
+  return {new Oasis(bitmap_sz, block_sz, last_block_sz, model, bitmap_ptr,
+                    block_bias, block_offsets, search_tree,
+                    flags & OasisView::kBlockEncodings)};
+}
+
+auto Oasis::merge(const std::vector<const Oasis *> &parts) -> Oasis * {
+  if (parts.empty()) {
+    return nullptr;
+  }
+  std::vector<const CDFModel *> models;
+  for (const Oasis *part : parts) {
+    if (part->block_sz_ != parts[0]->block_sz_) {
+      return nullptr;
+    }
+    models.emplace_back(part->cdf_model_);
+  }
+  CDFModel *cdf_model = CDFModel::merge(models);
+  if (cdf_model == nullptr) {
+    return nullptr;
+  }
 
-  uint8_t *pos = bitmap_ptr;
-  for (size_t i = 0; i < nbatches; ++i) {
-    block_list.emplace_back(i == nbatches - 1 ? last_block_sz : block_sz,
-                            block_bias[i + 1] - block_bias[i], pos);
-    pos += block_list.back().size();
+  uint16_t block_sz = parts[0]->block_sz_;
+  std::vector<uint64_t> block_bias;
+  std::vector<uint8_t> encodings;
+  std::vector<size_t> offsets;
+  std::vector<uint8_t> bitmap;
+  auto add_block = [&](uint64_t bias, uint8_t encoding, const uint8_t *begin,
+                       const uint8_t *end) {
+    block_bias.emplace_back(bias);
+    encodings.emplace_back(encoding);
+    offsets.emplace_back(bitmap.size());
+    bitmap.insert(bitmap.end(), begin, end);
+  };
+
+  /**
+   * Blocks of positions, from the first one on, each of them up to the next
+   * block's bias or to next_bias for the last one.
+   */
+  auto add_blocks = [&](const std::vector<uint64_t> &positions,
+                        size_t nblocks, uint64_t next_bias) {
+    for (size_t i = 0; i < nblocks; ++i) {
+      size_t first = i * block_sz;
+      size_t end = std::min(first + block_sz, positions.size());
+      std::vector<uint64_t> keys(positions.begin() + first,
+                                 positions.begin() + end);
+      uint64_t bias = keys[0];
+      uint64_t range =
+          (end < positions.size() ? positions[end] : next_bias) - bias;
+      for (uint64_t &key : keys) {
+        key -= bias;
+      }
+      /* repeating the last position adds none */
+      keys.resize(block_sz, keys.back());
+      size_t size;
+      uint8_t encoding = Block::choose(keys, range, false, size);
+      std::vector<uint8_t> data = Block::build(encoding, keys, range);
+      add_block(bias, encoding, data.data(), data.data() + data.size());
+    }
+  };
+
+  /**
+   * The last part with blocks so far, whose last block is still to come, and
+   * the positions of the parts without blocks since. Such a part has at most
+   * one position, its block bias, which its own queries match.
+   */
+  const Oasis *tail = nullptr;
+  uint64_t tail_shift = 0;
+  std::vector<uint64_t> singles;
+  /* the positions past the blocks added so far, in order and distinct */
+  auto pending = [&]() -> std::vector<uint64_t> {
+    std::vector<uint64_t> positions;
+    if (tail != nullptr) {
+      size_t last = tail->block_bias_.size() - 2;
+      std::pair<uint32_t, uint32_t> extent = tail->block_extent(last);
+      uint64_t tail_bias = tail->block_bias_[last];
+      positions = Block(tail->block_encoding(last), tail->last_block_sz_,
+                        tail->block_bias_[last + 1] - tail_bias,
+                        tail->bitmap_ptr_ + extent.first,
+                        extent.second - extent.first)
+                      .decode();
+      for (uint64_t &pos : positions) {
+        pos += tail_bias + tail_shift;
+      }
+      positions.emplace_back(tail->block_bias_[last + 1] + tail_shift);
+    }
+    positions.insert(positions.end(), singles.begin(), singles.end());
+    positions.erase(std::unique(positions.begin(), positions.end()),
+                    positions.end());
+    return positions;
+  };
+
+  uint64_t shift = 0;
+  for (const Oasis *part : parts) {
+    size_t nblocks = part->block_bias_.size() - 1;
+    if (nblocks == 0) {
+      if (part->cdf_model_->npositions() > 0) {
+        singles.emplace_back(part->block_bias_[0] + shift);
+      }
+      shift += part->cdf_model_->npositions();
+      continue;
+    }
+
+    /* the pending positions end at this part's first position */
+    std::vector<uint64_t> positions = pending();
+    add_blocks(positions, (positions.size() + block_sz - 1) / block_sz,
+               part->block_bias_[0] + shift);
+
+    for (size_t i = 0; i + 1 < nblocks; ++i) {
+      std::pair<uint32_t, uint32_t> extent = part->block_extent(i);
+      add_block(part->block_bias_[i] + shift, part->block_encoding(i),
+                part->bitmap_ptr_ + extent.first,
+                part->bitmap_ptr_ + extent.second);
+    }
+    tail = part;
+    tail_shift = shift;
+    singles.clear();
+    shift += part->cdf_model_->npositions();
   }
 
-  return {new Oasis(bitmap_sz, block_sz, last_block_sz, model, bitmap_ptr,
-                    block_bias, block_list)};
+  uint16_t last_block_sz = 0;
+  if (tail != nullptr && singles.empty()) {
+    /* the last part's last block stays as it is */
+    size_t last = tail->block_bias_.size() - 2;
+    std::pair<uint32_t, uint32_t> extent = tail->block_extent(last);
+    add_block(tail->block_bias_[last] + tail_shift, tail->block_encoding(last),
+              tail->bitmap_ptr_ + extent.first,
+              tail->bitmap_ptr_ + extent.second);
+    block_bias.emplace_back(tail->block_bias_[last + 1] + tail_shift);
+    last_block_sz = tail->last_block_sz_;
+  } else {
+    /**
+     * Laid out as by layout_blocks(): the last position ends the last block,
+     * and is only in it if the block has room left.
+     */
+    std::vector<uint64_t> positions = pending();
+    if (positions.size() > 1) {
+      add_blocks(positions, (positions.size() - 2) / block_sz + 1,
+                 positions.back());
+      last_block_sz = block_sz;
+    }
+    block_bias.emplace_back(positions.empty() ? 0 : positions.back());
+  }
+
+  bool block_encodings = bitmap.size() <= OasisView::kOffsetMask;
+  bool elias_fano = std::all_of(encodings.begin(), encodings.end(),
+                                [](uint8_t e) { return e == Block::kEliasFano; });
+  if (bitmap.size() > UINT32_MAX || (!block_encodings && !elias_fano)) {
+    delete cdf_model;
+    return nullptr;
+  }
+  std::vector<uint32_t> block_offsets(encodings.size() + 1);
+  for (size_t i = 0; i < encodings.size(); ++i) {
+    block_offsets[i] = offsets[i];
+    if (block_encodings) {
+      block_offsets[i] |= uint32_t{encodings[i]} << OasisView::kEncodingShift;
+    }
+  }
+  block_offsets.back() = bitmap.size();
+
+  auto *bitmap_ptr = new uint8_t[bitmap.size()];
+  std::copy(bitmap.begin(), bitmap.end(), bitmap_ptr);
+  bool search_tree = !parts[0]->block_index_.empty();
+  return new Oasis(bitmap.size(), block_sz, last_block_sz, cdf_model,
+                   bitmap_ptr, block_bias, block_offsets, search_tree,
+                   block_encodings);
+}
+
+auto Oasis::should_merge(const std::vector<const Oasis *> &parts,
+                         double bit_per_key, size_t nkeys) -> bool {
+  if (parts.empty() || nkeys == 0) {
+    return false;
+  }
+  std::vector<const CDFModel *> models;
+  size_t size = 0;
+  for (const Oasis *part : parts) {
+    if (part->block_sz_ != parts[0]->block_sz_) {
+      return false;
+    }
+    models.emplace_back(part->cdf_model_);
+    size += part->size();
+  }
+  double merged_bpk = 8.0 * size / nkeys;
+  if (!CDFModel::mergeable(models) ||
+      merged_bpk > bit_per_key + kMergeSlack) {
+    return false;
+  }
+
+  /**
+   * The blocks merge() encodes again: those of the positions pending after
+   * a part with blocks or a part without, when another part with blocks
+   * follows, or at the end if they are not the last part's own last block.
+   */
+  size_t reencoded = 0;
+  bool tail = false;
+  bool singles = false;
+  double merged_fp = 0;
+  double range = 0;
+  double npositions = 0;
+  for (const Oasis *part : parts) {
+    const CDFModel *model = part->cdf_model_;
+    if (model->npositions() > 0) {
+      double d = model->covered_range();
+      merged_fp += d * d / model->npositions();
+      range += d;
+      npositions += model->npositions();
+    }
+    if (part->block_bias_.size() == 1) {
+      singles = singles || model->npositions() > 0;
+      continue;
+    }
+    reencoded += tail || singles;
+    tail = true;
+    singles = false;
+  }
+  reencoded += singles;
+
+  double merge_work = 1.0 * reencoded * parts[0]->block_sz_ + size / 8.0;
+  double rebuild_work = 1.0 * kRebuildPasses * nkeys;
+  if (merge_work >= rebuild_work) {
+    return false;
+  }
+  if (npositions == 0) {
+    return true;
+  }
+  double rebuild_fp =
+      range * range / (npositions * std::pow(2, bit_per_key - merged_bpk));
+  return merged_fp <= kMergeFprLoss * rebuild_fp;
 }
 
 auto Oasis::size() const -> size_t {
-  size_t meta_sz = sizeof(size_t)          /* block_list_ size */
-                   + sizeof(size_t)        /* bitmap_sz_ */
-                   + sizeof(uint16_t) * 2; /* block_sz */
+  size_t meta_sz = sizeof(size_t)         /* # blocks */
+                   + sizeof(size_t)       /* bitmap_sz_ */
+                   + sizeof(uint16_t) * 2 /* block_sz */
+                   + sizeof(uint8_t);     /* flags */
   sizeAlign(meta_sz);
 
+  size_t offset_list_sz = block_offsets_.size() * sizeof(uint32_t);
+  sizeAlign(offset_list_sz);
+
+  size_t index_sz = 0;
+  if (!block_index_.empty()) {
+    index_sz = (STree::size(cdf_model_->nsearch_keys()) + block_index_.size()) *
+               sizeof(uint64_t);
+  }
+
   size_t cdf_sz = cdf_model_->size();
   return meta_sz + cdf_sz                        /* cdf model */
          + block_bias_.size() * sizeof(uint64_t) /* bias size */
-         + bitmap_sz_;                           /* block_list_ */
+         + offset_list_sz                        /* block offsets */
+         + index_sz                              /* STree indices */
+         + bitmap_sz_;                           /* blocks */
 }
 
 }  // namespace oasis
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "key_spill.hpp"
+#include "oasis.hpp"
+
+namespace oasis {
+
+/**
+ * Builds an Oasis from keys arriving one at a time in ascending order, e.g.
+ * through a RocksDB FilterBitsBuilder, without a std::vector of all of them:
+ * keys go to a bit-packed KeySpill, which writes them out to a temporary
+ * file as it grows, and the gaps the model needs are picked on the fly.
+ * finish() then reads the keys back from the file to lay out and fill the
+ * blocks one after another. Memory grows with the # gaps kept, and with the
+ * KeySpill chunk headers, a few bytes per KeySpill::kChunk keys.
+ *
+ * The gaps kept are the largest ones seen while their bound, which grows with
+ * the # keys, was smaller: a gap evicted early may be missing at the end. The
+ * model then picks its intervals among slightly smaller gaps, it stays exact.
+ */
+class OasisBuilder {
+ public:
+  /* see Oasis::Oasis() */
+  OasisBuilder(double bit_per_key, size_t elements_per_block,
+               bool search_tree = false, size_t nthreads = 1,
+               size_t pla_epsilon = 0, bool rice_blocks = false)
+      : bpk_(bit_per_key),
+        block_sz_(elements_per_block),
+        search_tree_(search_tree),
+        nthreads_(nthreads),
+        pla_epsilon_(pla_epsilon),
+        rice_blocks_(rice_blocks) {}
+
+  /* key >= every key added so far, repeated keys are dropped */
+  inline void add(uint64_t key);
+
+  auto nkeys() const -> size_t { return keys_.size(); }
+
+  /* bytes held in memory by the keys and gaps added so far */
+  inline auto memory_usage() const -> size_t;
+
+  /* the filter over the keys added so far, the builder is empty afterwards */
+  inline auto finish() -> Oasis *;
+
+ private:
+  double bpk_;
+  size_t block_sz_;
+  bool search_tree_;
+  size_t nthreads_;
+  size_t pla_epsilon_;
+  bool rice_blocks_;
+
+  KeySpill keys_;
+  /* the largest gaps between adjacent keys, CDFModel::max_intervals() many */
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>>
+      gaps_;
+};
+
+void OasisBuilder::add(uint64_t key) {
+  if (!keys_.empty()) {
+    if (key == keys_.back()) {
+      return;
+    }
+    uint64_t gap = key - keys_.back();
+    size_t max_gaps = CDFModel::max_intervals(bpk_, keys_.size() + 1);
+    if (gaps_.size() < max_gaps) {
+      gaps_.push(gap);
+    } else if (!gaps_.empty() && gaps_.top() <= gap) {
+      gaps_.pop();
+      gaps_.push(gap);
+    }
+  }
+  keys_.append(key);
+}
+
+auto OasisBuilder::memory_usage() const -> size_t {
+  return keys_.memory_usage() + gaps_.size() * sizeof(uint64_t);
+}
+
+auto OasisBuilder::finish() -> Oasis * {
+  /* no accessor to the heap's vector, the gaps are drained in any order */
+  std::vector<uint64_t> gaps;
+  gaps.reserve(gaps_.size());
+  for (; !gaps_.empty(); gaps_.pop()) {
+    gaps.emplace_back(gaps_.top());
+  }
+
+  auto *cdf_model = new CDFModel(bpk_, block_sz_, keys_, std::move(gaps),
+                                 nthreads_, pla_epsilon_);
+  auto *filter = new Oasis(bpk_, block_sz_, cdf_model, keys_, search_tree_,
+                           nthreads_, rice_blocks_);
+  keys_.clear();
+  return filter;
+}
+
+}  // namespace oasis
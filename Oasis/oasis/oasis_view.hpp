@@ -0,0 +1,371 @@
+#pragma once
+
+#include "block.hpp"
+#include "cdf_model.hpp"
+#include "query_stats.hpp"
+#include "stree.hpp"
+
+namespace oasis {
+
+/**
+ * Read-only Oasis over borrowed memory. It is either taken from an Oasis with
+ * Oasis::view(), or built over the output of Oasis::serialize() and queried in
+ * place, e.g. over a filter block pinned in the block cache. Nothing is copied
+ * or allocated: blocks are located through the stored offset table and their
+ * Block is materialized on the stack for the probe.
+ *
+ * With kBlockEncodings, the top kEncodingBits of each block offset but the
+ * last hold the Block::Encoding of the block, otherwise every block is a
+ * BitSet, as in filters written before blocks had encodings.
+ */
+class OasisView {
+ public:
+  /* # queries whose cache misses are overlapped by query_batch() */
+  static constexpr size_t kQueryBatch = 32;
+
+  /* serialized flags */
+  static constexpr uint8_t kSearchTree = 1; /* STree indices are stored */
+  static constexpr uint8_t kBlockEncodings = 2; /* offsets are tagged */
+
+  static constexpr uint32_t kEncodingBits = 2;
+  static constexpr uint32_t kEncodingShift = 32 - kEncodingBits;
+  /* the offset part of a tagged block offset */
+  static constexpr uint32_t kOffsetMask = (1U << kEncodingShift) - 1;
+
+ public:
+  OasisView() = default;
+
+  OasisView(const CDFModelView &cdf_model, const uint64_t *block_bias,
+            const uint32_t *block_offsets, const uint8_t *bitmap,
+            size_t nblocks, uint16_t block_sz, uint16_t last_block_sz,
+            bool block_encodings)
+      : cdf_model_(cdf_model),
+        block_bias_(block_bias),
+        block_offsets_(block_offsets),
+        bitmap_(bitmap),
+        nblocks_(nblocks),
+        block_sz_(block_sz),
+        last_block_sz_(last_block_sz),
+        block_encodings_(block_encodings) {}
+
+  /**
+   * `ser` must be 8-byte aligned, since the tables are read in place, and
+   * outlive the view.
+   */
+  inline explicit OasisView(const uint8_t *ser);
+
+  /* search intervals and block biases through their STree indices */
+  inline void set_search_tree(const uint64_t *interval_index,
+                              const uint64_t *block_index);
+
+  inline auto query(uint64_t query_key) const -> bool;
+  /* [left, right] */
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  /**
+   * out[i] = query(keys[i]). The model search, the block search and the block
+   * probe run as separate stages over kQueryBatch keys at a time, and each
+   * stage prefetches what it reads for all of them before using any.
+   */
+  inline void query_batch(const uint64_t *keys, size_t n, bool *out) const;
+  /* out[i] = query(lefts[i], rights[i]), staged like the point version */
+  inline void query_batch(const uint64_t *lefts, const uint64_t *rights,
+                          size_t n, bool *out) const;
+
+ private:
+  inline auto get_block(size_t block_idx) const -> Block;
+  /* upper_bound() of pos over block_bias_[0, nblocks_] */
+  inline auto find_block(uint64_t pos) const -> size_t;
+
+  /* last two stages of query_batch() for out[active[i]], n <= kQueryBatch */
+  inline void probe_blocks(const std::pair<size_t, size_t> *pos,
+                           const size_t *active, size_t n, bool *out) const;
+
+ private:
+  CDFModelView cdf_model_;
+  const uint64_t *block_bias_ = nullptr;
+  const uint32_t *block_offsets_ = nullptr;
+  const uint8_t *bitmap_ = nullptr;
+  size_t nblocks_ = 0;
+  uint16_t block_sz_ = 0;
+  uint16_t last_block_sz_ = 0;
+  bool block_encodings_ = false;
+
+  bool use_tree_ = false;
+  STree block_tree_;
+};
+
+OasisView::OasisView(const uint8_t *ser) {
+  assert(reinterpret_cast<uintptr_t>(ser) % sizeof(uint64_t) == 0);
+
+  memcpy(&nblocks_, ser, sizeof(size_t));
+  ser += sizeof(size_t);
+
+  size_t bitmap_sz;
+  memcpy(&bitmap_sz, ser, sizeof(size_t));
+  ser += sizeof(size_t);
+
+  memcpy(&block_sz_, ser, sizeof(uint16_t));
+  ser += sizeof(uint16_t);
+
+  memcpy(&last_block_sz_, ser, sizeof(uint16_t));
+  ser += sizeof(uint16_t);
+
+  uint8_t flags = *ser;
+  ser += sizeof(uint8_t);
+  block_encodings_ = flags & kBlockEncodings;
+
+  align(ser);
+
+  block_bias_ = reinterpret_cast<const uint64_t *>(ser);
+  ser += (nblocks_ + 1) * sizeof(uint64_t);
+
+  block_offsets_ = reinterpret_cast<const uint32_t *>(ser);
+  ser += (nblocks_ + 1) * sizeof(uint32_t);
+  align(ser);
+
+  cdf_model_ = CDFModelView::view(ser);
+
+  if (flags & kSearchTree) {
+    auto *interval_index = reinterpret_cast<const uint64_t *>(ser);
+    ser += STree::size(cdf_model_.nsearch_keys()) * sizeof(uint64_t);
+    auto *block_index = reinterpret_cast<const uint64_t *>(ser);
+    ser += STree::size(nblocks_ + 1) * sizeof(uint64_t);
+    set_search_tree(interval_index, block_index);
+  }
+
+  bitmap_ = ser;
+  assert((block_offsets_[nblocks_] &
+          (block_encodings_ ? kOffsetMask : UINT32_MAX)) == bitmap_sz);
+}
+
+void OasisView::set_search_tree(const uint64_t *interval_index,
+                                const uint64_t *block_index) {
+  cdf_model_.set_search_tree(interval_index);
+  block_tree_ = STree(block_bias_, nblocks_ + 1, block_index);
+  use_tree_ = true;
+}
+
+auto OasisView::query(uint64_t query_key) const -> bool {
+  size_t pos;
+  CDFModel::QueryPosStatus status = cdf_model_.query(query_key, pos);
+  switch (status) {
+    case CDFModel::EXIST:
+      OASIS_STAT_STAGE(QueryStats::kModelExist);
+      return true;
+    case CDFModel::OUT_OF_SCOPE:
+      OASIS_STAT_STAGE(QueryStats::kModelOutOfScope);
+      return false;
+    default:
+      break;
+  }
+
+  if (pos < block_bias_[0] || pos > block_bias_[nblocks_]) {
+    OASIS_STAT_STAGE(QueryStats::kBlockBias);
+    return false;
+  }
+  const uint64_t *iter = block_bias_ + find_block(pos) - 1;
+  if (*iter == pos) {
+    OASIS_STAT_STAGE(QueryStats::kBlockBias);
+    return true;
+  }
+
+  size_t block_idx = iter - block_bias_;
+  OASIS_STAT_STAGE(QueryStats::kBlockProbe);
+  return get_block(block_idx).query(pos - *iter);
+}
+
+auto OasisView::query(uint64_t left, uint64_t right) const -> bool {
+  if (left == right) {
+    return query(left);
+  }
+
+  std::pair<size_t, size_t> pos;
+  CDFModel::QueryPosStatus status = cdf_model_.query(left, right, pos);
+  switch (status) {
+    case CDFModel::EXIST:
+      OASIS_STAT_STAGE(QueryStats::kModelExist);
+      return true;
+    case CDFModel::OUT_OF_SCOPE:
+      OASIS_STAT_STAGE(QueryStats::kModelOutOfScope);
+      return false;
+    default:
+      break;
+  }
+
+  if (pos.second < block_bias_[0] || pos.first > block_bias_[nblocks_]) {
+    OASIS_STAT_STAGE(QueryStats::kBlockBias);
+    return false;
+  }
+
+  const uint64_t *bias_end = block_bias_ + nblocks_ + 1;
+  const uint64_t *iter = block_bias_ + find_block(pos.second);
+  if (iter == bias_end || *(--iter) == pos.second || pos.first <= *iter) {
+    OASIS_STAT_STAGE(QueryStats::kBlockBias);
+    return true;
+  }
+
+  size_t block_idx = iter - block_bias_;
+  OASIS_STAT_STAGE(QueryStats::kBlockProbe);
+  return get_block(block_idx).query(pos.first - *iter, pos.second - *iter);
+}
+
+void OasisView::query_batch(const uint64_t *keys, size_t n,
+                            bool *out) const {
+  size_t idx[kQueryBatch];
+  std::pair<size_t, size_t> pos[kQueryBatch];
+  size_t active[kQueryBatch];
+
+  for (size_t begin = 0; begin < n; begin += kQueryBatch) {
+    size_t cnt = std::min(kQueryBatch, n - begin);
+    const uint64_t *batch = keys + begin;
+    bool *result = out + begin;
+
+    cdf_model_.find_interval(batch, cnt, idx);
+    for (size_t i = 0; i < cnt; ++i) {
+      cdf_model_.prefetch(idx[i]);
+    }
+
+    size_t nactive = 0;
+    for (size_t i = 0; i < cnt; ++i) {
+      size_t p;
+      switch (cdf_model_.query(batch[i], idx[i], p)) {
+        case CDFModel::EXIST:
+          OASIS_STAT_STAGE(QueryStats::kModelExist);
+          result[i] = true;
+          break;
+        case CDFModel::OUT_OF_SCOPE:
+          OASIS_STAT_STAGE(QueryStats::kModelOutOfScope);
+          result[i] = false;
+          break;
+        default:
+          if (p < block_bias_[0] || p > block_bias_[nblocks_]) {
+            OASIS_STAT_STAGE(QueryStats::kBlockBias);
+            result[i] = false;
+          } else {
+            pos[nactive] = {p, p};
+            active[nactive++] = i;
+          }
+      }
+    }
+
+    probe_blocks(pos, active, nactive, result);
+  }
+}
+
+void OasisView::query_batch(const uint64_t *lefts, const uint64_t *rights,
+                            size_t n, bool *out) const {
+  size_t idx[kQueryBatch];
+  std::pair<size_t, size_t> pos[kQueryBatch];
+  size_t active[kQueryBatch];
+
+  for (size_t begin = 0; begin < n; begin += kQueryBatch) {
+    size_t cnt = std::min(kQueryBatch, n - begin);
+    const uint64_t *left = lefts + begin;
+    const uint64_t *right = rights + begin;
+    bool *result = out + begin;
+
+    cdf_model_.find_interval(left, cnt, idx);
+    for (size_t i = 0; i < cnt; ++i) {
+      cdf_model_.prefetch(idx[i]);
+    }
+
+    size_t nactive = 0;
+    for (size_t i = 0; i < cnt; ++i) {
+      CDFModel::QueryPosStatus status;
+      if (left[i] == right[i]) {
+        status = cdf_model_.query(left[i], idx[i], pos[nactive].first);
+        pos[nactive].second = pos[nactive].first;
+      } else {
+        status = cdf_model_.query(left[i], right[i], idx[i], pos[nactive]);
+      }
+
+      switch (status) {
+        case CDFModel::EXIST:
+          OASIS_STAT_STAGE(QueryStats::kModelExist);
+          result[i] = true;
+          break;
+        case CDFModel::OUT_OF_SCOPE:
+          OASIS_STAT_STAGE(QueryStats::kModelOutOfScope);
+          result[i] = false;
+          break;
+        default:
+          if (pos[nactive].second < block_bias_[0] ||
+              pos[nactive].first > block_bias_[nblocks_]) {
+            OASIS_STAT_STAGE(QueryStats::kBlockBias);
+            result[i] = false;
+          } else {
+            active[nactive++] = i;
+          }
+      }
+    }
+
+    probe_blocks(pos, active, nactive, result);
+  }
+}
+
+void OasisView::probe_blocks(const std::pair<size_t, size_t> *pos,
+                             const size_t *active, size_t n,
+                             bool *out) const {
+  uint64_t upper[kQueryBatch] = {};
+  size_t iter[kQueryBatch];
+  for (size_t i = 0; i < n; ++i) {
+    upper[i] = pos[i].second;
+  }
+  if (use_tree_) {
+    block_tree_.upper_bound(upper, n, iter);
+  } else {
+    batch_upper_bound(block_bias_, nblocks_ + 1, upper, n, iter);
+  }
+
+  /* resolve the queries covering a block bias, prefetch the others' offset */
+  size_t probe[kQueryBatch];
+  size_t nprobe = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (iter[i] == nblocks_ + 1 || block_bias_[iter[i] - 1] == pos[i].second ||
+        pos[i].first <= block_bias_[iter[i] - 1]) {
+      OASIS_STAT_STAGE(QueryStats::kBlockBias);
+      out[active[i]] = true;
+    } else {
+      OASIS_STAT_STAGE(QueryStats::kBlockProbe);
+      __builtin_prefetch(block_offsets_ + iter[i] - 1);
+      probe[nprobe++] = i;
+    }
+  }
+
+  for (size_t j = 0; j < nprobe; ++j) {
+    get_block(iter[probe[j]] - 1).prefetch();
+  }
+
+  for (size_t j = 0; j < nprobe; ++j) {
+    size_t i = probe[j];
+    size_t block_idx = iter[i] - 1;
+    uint64_t bias = block_bias_[block_idx];
+    out[active[i]] = get_block(block_idx).query(pos[i].first - bias,
+                                                pos[i].second - bias);
+  }
+}
+
+auto OasisView::find_block(uint64_t pos) const -> size_t {
+  if (use_tree_) {
+    return block_tree_.upper_bound(pos);
+  }
+  return std::upper_bound(block_bias_, block_bias_ + nblocks_ + 1, pos) -
+         block_bias_;
+}
+
+auto OasisView::get_block(size_t block_idx) const -> Block {
+  uint32_t offset = block_offsets_[block_idx];
+  uint32_t end = block_offsets_[block_idx + 1];
+  uint8_t encoding = Block::kEliasFano;
+  if (block_encodings_) {
+    encoding = offset >> kEncodingShift;
+    offset &= kOffsetMask;
+    end &= kOffsetMask;
+  }
+  return {encoding, block_idx == nblocks_ - 1 ? last_block_sz_ : block_sz_,
+          block_bias_[block_idx + 1] - block_bias_[block_idx],
+          bitmap_ + offset, end - offset};
+}
+
+}  // namespace oasis
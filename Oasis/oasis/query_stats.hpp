@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace oasis {
+
+/**
+ * Costs of filter queries: the stage that gave each answer, the words and
+ * entries the block probes went through and the lookups of Proteus' prefix
+ * Bloom filter. They are only counted when built with OASIS_QUERY_STATS,
+ * through OASIS_STAT_STAGE() and OASIS_STAT_ADD(), which add to the calling
+ * thread's local() stats. A filter keeps its own as the difference of
+ * local() across each of its queries, see QueryStatsScope.
+ */
+struct QueryStats {
+  enum Stage : uint8_t {
+    kModelOutOfScope = 0, /* no interval of the model holds the query */
+    kModelExist = 1,      /* an interval bound is in the query */
+    kBlockBias = 2, /* outside every block, or a block bias is in the query */
+    kBlockProbe = 3, /* the block holding the query was probed */
+    kTrie = 4,       /* Proteus' trie, without its prefix Bloom filter */
+    kPrefixBF = 5,   /* Proteus, after a prefix Bloom filter lookup */
+    kNumStages = 6,
+  };
+
+  uint64_t answered[kNumStages] = {};
+  /* words of upper bits, of the bitmap of a dense block, of Rice codes */
+  uint64_t upper_words = 0;
+  /* lower bits read, or keys decoded from Rice codes */
+  uint64_t lower_entries = 0;
+  uint64_t pbf_probes = 0;
+
+  inline auto operator+=(const QueryStats &other) -> QueryStats &;
+  inline auto operator-(const QueryStats &other) const -> QueryStats;
+
+  /* += with atomic adds, for the stats of a filter shared by threads */
+  inline void add_atomic(const QueryStats &other);
+  /* a copy read with atomic loads, while add_atomic() may run */
+  inline auto load_atomic() const -> QueryStats;
+
+  /* the queries of the calling thread, across all filters */
+  static auto local() -> QueryStats & {
+    static thread_local QueryStats stats;
+    return stats;
+  }
+};
+
+#ifdef OASIS_QUERY_STATS
+#define OASIS_STAT_STAGE(stage) (++::oasis::QueryStats::local().answered[stage])
+#define OASIS_STAT_ADD(field, n) (::oasis::QueryStats::local().field += (n))
+#else
+#define OASIS_STAT_STAGE(stage) ((void)0)
+#define OASIS_STAT_ADD(field, n) ((void)0)
+#endif
+
+/* adds the costs the calling thread counts while it lives to stats */
+class QueryStatsScope {
+ public:
+#ifdef OASIS_QUERY_STATS
+  explicit QueryStatsScope(QueryStats &stats)
+      : stats_(stats), begin_(QueryStats::local()) {}
+  ~QueryStatsScope() { stats_.add_atomic(QueryStats::local() - begin_); }
+
+ private:
+  QueryStats &stats_;
+  QueryStats begin_;
+#else
+  explicit QueryStatsScope(QueryStats &) {}
+#endif
+};
+
+auto QueryStats::operator+=(const QueryStats &other) -> QueryStats & {
+  for (size_t i = 0; i < kNumStages; ++i) {
+    answered[i] += other.answered[i];
+  }
+  upper_words += other.upper_words;
+  lower_entries += other.lower_entries;
+  pbf_probes += other.pbf_probes;
+  return *this;
+}
+
+auto QueryStats::operator-(const QueryStats &other) const -> QueryStats {
+  QueryStats diff;
+  for (size_t i = 0; i < kNumStages; ++i) {
+    diff.answered[i] = answered[i] - other.answered[i];
+  }
+  diff.upper_words = upper_words - other.upper_words;
+  diff.lower_entries = lower_entries - other.lower_entries;
+  diff.pbf_probes = pbf_probes - other.pbf_probes;
+  return diff;
+}
+
+void QueryStats::add_atomic(const QueryStats &other) {
+  for (size_t i = 0; i < kNumStages; ++i) {
+    __atomic_fetch_add(&answered[i], other.answered[i], __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&upper_words, other.upper_words, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&lower_entries, other.lower_entries, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&pbf_probes, other.pbf_probes, __ATOMIC_RELAXED);
+}
+
+auto QueryStats::load_atomic() const -> QueryStats {
+  QueryStats stats;
+  for (size_t i = 0; i < kNumStages; ++i) {
+    stats.answered[i] = __atomic_load_n(&answered[i], __ATOMIC_RELAXED);
+  }
+  stats.upper_words = __atomic_load_n(&upper_words, __ATOMIC_RELAXED);
+  stats.lower_entries = __atomic_load_n(&lower_entries, __ATOMIC_RELAXED);
+  stats.pbf_probes = __atomic_load_n(&pbf_probes, __ATOMIC_RELAXED);
+  return stats;
+}
+
+}  // namespace oasis
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "query_stats.hpp"
+#include "util.hpp"
+
+namespace oasis {
+
+/**
+ * Golomb-Rice coded block of sorted keys. The first byte holds rice_bits,
+ * then every key's gap to the previous one, the first key's to 0, follows as
+ * its quotient by 2^rice_bits in unary, 0s closed by a 1, and its rice_bits
+ * low bits. rice_bits is chosen from the gaps themselves, so it saves the
+ * bucket rounding of Elias-Fano, about half a bit per key, but queries decode
+ * the keys in order, without select.
+ *
+ * The size is not a function of # keys and range, so the block is given its
+ * size to never read past it.
+ */
+class RiceBlock {
+ public:
+  /* low bits fit in a peek along with the closing 1 of the quotient */
+  static constexpr uint8_t kMaxRiceBits = 56;
+
+ public:
+  RiceBlock(size_t nkeys, const uint8_t *data, size_t nbytes)
+      : nkeys_(nkeys),
+        rice_bits_(nbytes == 0 ? 0 : data[0]),
+        nbytes_(nbytes == 0 ? 0 : nbytes - 1),
+        data_(data + 1) {}
+
+  ~RiceBlock() = default;
+
+  inline auto query(uint64_t query) const -> bool;
+  /* [left, right] */
+  inline auto query(uint64_t left, uint64_t right) const -> bool;
+
+  inline void prefetch() const;
+
+  /* the keys, in order */
+  inline auto decode() const -> std::vector<uint64_t>;
+
+  /* the size build() gives keys */
+  inline static auto size(const std::vector<uint64_t> &keys,
+                          uint64_t max_range) -> size_t;
+  inline static auto build(const std::vector<uint64_t> &keys,
+                           uint64_t max_range) -> std::vector<uint8_t>;
+
+ private:
+  /* the rice_bits taking the fewest bits for keys */
+  inline static auto get_rice_bits(const std::vector<uint64_t> &keys,
+                                   uint64_t max_range) -> uint8_t;
+  inline static auto bit_array_bsize(const std::vector<uint64_t> &keys,
+                                     uint8_t rice_bits) -> size_t;
+
+  /* the bits from pos on, nvalid of them, bytes past the block read as 0 */
+  inline auto peek(size_t pos, size_t &nvalid) const -> uint64_t;
+
+  /**
+   * Decode keys in order, from key 0 at bit 0, until f(key) returns false.
+   * Returns false if the keys run out first.
+   */
+  template <typename F>
+  inline auto scan(F &&f) const -> bool;
+
+ private:
+  size_t nkeys_;
+  uint8_t rice_bits_;
+  /* bytes of the coded gaps */
+  size_t nbytes_;
+
+  const uint8_t *data_;
+};
+
+auto RiceBlock::query(uint64_t query) const -> bool {
+  return this->query(query, query);
+}
+
+auto RiceBlock::query(uint64_t left, uint64_t right) const -> bool {
+  bool found = false;
+  scan([&](uint64_t key) {
+    if (key < left) {
+      return true;
+    }
+    found = key <= right;
+    return false;
+  });
+  return found;
+}
+
+auto RiceBlock::decode() const -> std::vector<uint64_t> {
+  std::vector<uint64_t> keys;
+  keys.reserve(nkeys_);
+  scan([&](uint64_t key) {
+    keys.emplace_back(key);
+    return true;
+  });
+  return keys;
+}
+
+template <typename F>
+auto RiceBlock::scan(F &&f) const -> bool {
+  uint64_t low_mask = (1ULL << rice_bits_) - 1;
+  uint64_t key = 0;
+  size_t pos = 0;
+  for (size_t i = 0; i < nkeys_; ++i) {
+    /* a peek holds at least 57 bits, a whole gap unless the quotient is big */
+    size_t nvalid;
+    uint64_t word = peek(pos, nvalid);
+    uint64_t quotient = 0;
+    while (word == 0) {
+      if (pos + nvalid >= nbytes_ * 8) {
+        return false;
+      }
+      quotient += nvalid;
+      pos += nvalid;
+      word = peek(pos, nvalid);
+    }
+    size_t nzeros = __builtin_ctzll(word);
+    quotient += nzeros;
+    pos += nzeros + 1;
+
+    uint64_t low;
+    if (nzeros + 1 + rice_bits_ <= nvalid) {
+      low = (word >> nzeros >> 1) & low_mask;
+    } else {
+      low = peek(pos, nvalid) & low_mask;
+    }
+    pos += rice_bits_;
+
+    key += (quotient << rice_bits_) | low;
+    OASIS_STAT_ADD(lower_entries, 1);
+    if (!f(key)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto RiceBlock::peek(size_t pos, size_t &nvalid) const -> uint64_t {
+  OASIS_STAT_ADD(upper_words, 1);
+  size_t byte = pos >> 3;
+  nvalid = 64 - (pos & 7);
+  uint64_t word = 0;
+  if (byte + sizeof(uint64_t) <= nbytes_) {
+    memcpy(&word, data_ + byte, sizeof(uint64_t));
+  } else {
+    /* the block may end the buffer, do not read past it */
+    for (size_t i = byte; i < nbytes_; ++i) {
+      word |= static_cast<uint64_t>(data_[i]) << ((i - byte) << 3);
+    }
+  }
+  return word >> (pos & 7);
+}
+
+void RiceBlock::prefetch() const { __builtin_prefetch(data_); }
+
+auto RiceBlock::size(const std::vector<uint64_t> &keys, uint64_t max_range)
+    -> size_t {
+  return 1 + align_bit2byte(
+                 bit_array_bsize(keys, get_rice_bits(keys, max_range)));
+}
+
+auto RiceBlock::get_rice_bits(const std::vector<uint64_t> &keys,
+                              uint64_t max_range) -> uint8_t {
+  if (keys.empty()) {
+    return 0;
+  }
+  /* the # bits is convex in rice_bits, walk down from the mean gap */
+  uint8_t rice_bits = std::min<uint8_t>(
+      std::max<uint8_t>(bit_width(max_range / keys.size()), 1) - 1,
+      kMaxRiceBits);
+  size_t cost = bit_array_bsize(keys, rice_bits);
+  while (rice_bits > 0) {
+    size_t lower = bit_array_bsize(keys, rice_bits - 1);
+    if (lower >= cost) {
+      break;
+    }
+    cost = lower;
+    --rice_bits;
+  }
+  while (rice_bits < kMaxRiceBits) {
+    size_t upper = bit_array_bsize(keys, rice_bits + 1);
+    if (upper >= cost) {
+      break;
+    }
+    cost = upper;
+    ++rice_bits;
+  }
+  return rice_bits;
+}
+
+auto RiceBlock::bit_array_bsize(const std::vector<uint64_t> &keys,
+                                uint8_t rice_bits) -> size_t {
+  size_t nbits = keys.size() * (1U + rice_bits);
+  uint64_t prev = 0;
+  for (uint64_t key : keys) {
+    nbits += (key - prev) >> rice_bits;
+    prev = key;
+  }
+  return nbits;
+}
+
+auto RiceBlock::build(const std::vector<uint64_t> &keys, uint64_t max_range)
+    -> std::vector<uint8_t> {
+  uint8_t rice_bits = get_rice_bits(keys, max_range);
+  size_t nbits = bit_array_bsize(keys, rice_bits);
+  std::vector<uint64_t> words((nbits + 63) / 64 + 1, 0);
+
+  size_t pos = 0;
+  uint64_t prev = 0;
+  for (uint64_t key : keys) {
+    assert(key >= prev);
+    uint64_t gap = key - prev;
+    pos += gap >> rice_bits;
+    write_bits(words.data(), pos++, 1, 1);
+    write_bits(words.data(), pos, rice_bits, gap & ((1ULL << rice_bits) - 1));
+    pos += rice_bits;
+    prev = key;
+  }
+  assert(pos == nbits);
+
+  std::vector<uint8_t> data(1 + align_bit2byte(nbits));
+  data[0] = rice_bits;
+  memcpy(data.data() + 1, words.data(), data.size() - 1);
+  return data;
+}
+
+}  // namespace oasis
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+namespace oasis {
+
+/**
+ * Static B+-tree (S-tree) over a sorted uint64_t array, answering
+ * upper_bound() with one node, i.e. one cache line, per level instead of one
+ * miss per binary search step.
+ *
+ * The array itself is the leaf level and is not copied. Every upper level
+ * keeps the first key of each node of the level below, padded to whole nodes
+ * with UINT64_MAX, and the levels are laid out root first in a single index.
+ * The index is built once with build() and only read through this view.
+ */
+class STree {
+ public:
+  /* # keys per node, 8 x 64 bits fill one cache line */
+  static constexpr size_t kNodeSize = 8;
+
+ public:
+  STree() = default;
+
+  /* arr[0, n) is the leaf level, index the output of build(arr, n) */
+  inline STree(const uint64_t *arr, size_t n, const uint64_t *index);
+
+  /* same as std::upper_bound(arr, arr + n, key) - arr */
+  inline auto upper_bound(uint64_t key) const -> size_t;
+  /* upper_bound() of a batch, every level is prefetched before probing */
+  inline void upper_bound(const uint64_t *keys, size_t nkeys,
+                          size_t *result) const;
+
+  inline static auto build(const uint64_t *arr, size_t n)
+      -> std::vector<uint64_t>;
+  /* # uint64_t in the index of a n-element array */
+  inline static auto size(size_t n) -> size_t;
+
+ private:
+  static constexpr size_t kMaxLevel = 24;
+
+  /* # keys <= key in a full node */
+  inline static auto count_le(const uint64_t *node, uint64_t key) -> size_t;
+  /* # keys <= key in the leaf node holding arr_[pos] */
+  inline auto count_leaf(size_t pos, uint64_t key) const -> size_t;
+
+  inline static auto nnodes(size_t nkeys) -> size_t {
+    return (nkeys + kNodeSize - 1) / kNodeSize;
+  }
+
+ private:
+  const uint64_t *arr_ = nullptr;
+  size_t n_ = 0;
+
+  /* level i holds the first key of each node of level i - 1, level 0 is
+   * arr_, level nlevel_ - 1 is the root */
+  size_t nlevel_ = 1;
+  const uint64_t *levels_[kMaxLevel] = {};
+  size_t level_keys_[kMaxLevel] = {};
+};
+
+STree::STree(const uint64_t *arr, size_t n, const uint64_t *index)
+    : arr_(arr), n_(n) {
+  assert(n > 0);
+  levels_[0] = arr;
+  level_keys_[0] = n;
+  for (size_t nkeys = n; nkeys > kNodeSize; nkeys = nnodes(nkeys)) {
+    assert(nlevel_ < kMaxLevel);
+    level_keys_[nlevel_++] = nnodes(nkeys);
+  }
+
+  const uint64_t *pos = index;
+  for (size_t level = nlevel_ - 1; level > 0; --level) {
+    levels_[level] = pos;
+    pos += nnodes(level_keys_[level]) * kNodeSize;
+  }
+}
+
+auto STree::upper_bound(uint64_t key) const -> size_t {
+  size_t node = 0;
+  for (size_t level = nlevel_ - 1; level > 0; --level) {
+    size_t cnt = count_le(levels_[level] + node * kNodeSize, key);
+    if (cnt == 0) {
+      /* only possible at the root, key is below arr_[0] */
+      return 0;
+    }
+    /* ignore the UINT64_MAX padding */
+    node = std::min(node * kNodeSize + cnt, level_keys_[level]) - 1;
+  }
+  return node * kNodeSize + count_leaf(node * kNodeSize, key);
+}
+
+void STree::upper_bound(const uint64_t *keys, size_t nkeys,
+                        size_t *result) const {
+  std::fill(result, result + nkeys, 0);
+  for (size_t level = nlevel_ - 1; level > 0; --level) {
+    const uint64_t *base = levels_[level];
+    for (size_t i = 0; i < nkeys; ++i) {
+      __builtin_prefetch(base + result[i] * kNodeSize);
+      __builtin_prefetch(base + result[i] * kNodeSize + kNodeSize - 1);
+    }
+    for (size_t i = 0; i < nkeys; ++i) {
+      size_t cnt = count_le(base + result[i] * kNodeSize, keys[i]);
+      if (cnt == 0) {
+        /* a key below arr_[0] stays at node 0 and counts 0 in the leaf */
+        result[i] = 0;
+      } else {
+        result[i] = std::min(result[i] * kNodeSize + cnt, level_keys_[level]);
+        --result[i];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < nkeys; ++i) {
+    __builtin_prefetch(arr_ + result[i] * kNodeSize);
+    __builtin_prefetch(
+        arr_ + std::min(result[i] * kNodeSize + kNodeSize, n_) - 1);
+  }
+  for (size_t i = 0; i < nkeys; ++i) {
+    size_t pos = result[i] * kNodeSize;
+    result[i] = pos + count_leaf(pos, keys[i]);
+  }
+}
+
+auto STree::build(const uint64_t *arr, size_t n) -> std::vector<uint64_t> {
+  assert(n > 0);
+  std::vector<std::vector<uint64_t>> levels;
+  std::vector<uint64_t> below(arr, arr + n);
+  while (below.size() > kNodeSize) {
+    std::vector<uint64_t> level;
+    for (size_t i = 0; i < below.size(); i += kNodeSize) {
+      level.emplace_back(below[i]);
+    }
+    below = level;
+    level.resize(nnodes(level.size()) * kNodeSize, UINT64_MAX);
+    levels.emplace_back(std::move(level));
+  }
+
+  std::vector<uint64_t> index;
+  index.reserve(size(n));
+  for (auto iter = levels.rbegin(); iter != levels.rend(); ++iter) {
+    index.insert(index.end(), iter->begin(), iter->end());
+  }
+  assert(index.size() == size(n));
+  return index;
+}
+
+auto STree::size(size_t n) -> size_t {
+  size_t total = 0;
+  for (size_t nkeys = n; nkeys > kNodeSize; nkeys = nnodes(nkeys)) {
+    total += nnodes(nnodes(nkeys)) * kNodeSize;
+  }
+  return total;
+}
+
+auto STree::count_le(const uint64_t *node, uint64_t key) -> size_t {
+#if defined(__AVX2__)
+  /* there is no unsigned 64-bit compare, flip the sign bits instead */
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  __m256i x = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+  __m256i lo = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(node)), sign);
+  __m256i hi = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(node + 4)), sign);
+  __m256d gt_lo = _mm256_castsi256_pd(_mm256_cmpgt_epi64(lo, x));
+  __m256d gt_hi = _mm256_castsi256_pd(_mm256_cmpgt_epi64(hi, x));
+  int gt = _mm256_movemask_pd(gt_lo) | (_mm256_movemask_pd(gt_hi) << 4);
+  return kNodeSize - __builtin_popcount(gt);
+#elif defined(__SSE4_2__)
+  const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+  __m128i x = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+  int gt = 0;
+  for (size_t i = 0; i < kNodeSize; i += 2) {
+    __m128i v = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(node + i)), sign);
+    gt |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, x))) << i;
+  }
+  return kNodeSize - __builtin_popcount(gt);
+#else
+  size_t cnt = 0;
+  for (size_t i = 0; i < kNodeSize; ++i) {
+    cnt += node[i] <= key;
+  }
+  return cnt;
+#endif
+}
+
+auto STree::count_leaf(size_t pos, uint64_t key) const -> size_t {
+  if (pos + kNodeSize <= n_) {
+    return count_le(arr_ + pos, key);
+  }
+  /* the last leaf node is not padded */
+  size_t cnt = 0;
+  for (size_t i = pos; i < n_; ++i) {
+    cnt += arr_[i] <= key;
+  }
+  return cnt;
+}
+
+}  // namespace oasis
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+namespace oasis {
+
+/**
+ * Order-preserving map of variable-length keys to uint64_t, so that the
+ * integer filters serve whole byte strings rather than their first 8 bytes.
+ *
+ * The sorted keys are cut into segments of a fixed # keys. Segment i keeps
+ * its boundary, the shortest prefix of its first key above the last key of
+ * segment i - 1 (empty for segment 0), the common prefix of its keys and,
+ * past it, which bits differ among them (keys are padded with 0 bytes). A key
+ * q in [boundary i, boundary i + 1) maps to i in the top bits followed by the
+ * bits of q at those positions, from the most significant on. Where q leaves
+ * the bits all keys share, it sorts below / above all keys agreeing with it so
+ * far, and the rest is filled with 0s / 1s; a q that never does is followed by
+ * a single 1, so that it maps between the two. Only the varying bits of
+ * composite keys such as tenant|table|ts are spent, wherever they are.
+ *
+ * The map never decreases, so a filter over the mapped keys answers mapped
+ * queries without false negatives; keys agreeing on the first 64 varying bits
+ * map to one value and only add false positives. UINT64_MAX is never
+ * produced, so that closed ranges may end at r + 1.
+ */
+class StringKeyView {
+ public:
+  StringKeyView() = default;
+
+  /* parse the output of StringKeyBuilder::finish(), `ser` is moved past it */
+  inline explicit StringKeyView(const uint8_t *&ser);
+
+  inline auto encode(const char *key, size_t len) const -> uint64_t;
+
+  auto nsegments() const -> size_t { return nsegments_; }
+
+  /**
+   * The bits of key under masks[i] for its byte from + i, left-aligned, with
+   * the 0s / 1s / single 1 described above; consts holds the other bits.
+   */
+  static inline auto suffix(const char *key, size_t len, size_t from,
+                            const uint8_t *masks, const uint8_t *consts,
+                            size_t tail_len) -> uint64_t;
+  /* suffix of segment idx in the top bits, out of id_bits */
+  static inline auto combine(size_t idx, uint64_t suffix, uint8_t id_bits)
+      -> uint64_t;
+
+ private:
+  /* <0, 0, >0 as key sorts below, with, above the len bytes of segment idx */
+  inline auto compare(const char *key, size_t len, size_t idx,
+                      size_t prefix_len) const -> int;
+
+ private:
+  size_t nsegments_ = 0;
+  uint8_t id_bits_ = 0;
+  /**
+   * Per segment: where its bytes start, with one more for the end. They are
+   * its boundary or prefix, whichever is longer, then tail_len masks and as
+   * many constant bytes.
+   */
+  const uint32_t *offsets_ = nullptr;
+  const uint32_t *boundary_lens_ = nullptr;
+  const uint32_t *prefix_lens_ = nullptr;
+  const uint32_t *tail_lens_ = nullptr;
+  const char *bytes_ = nullptr;
+};
+
+/**
+ * Collects sorted keys one at a time and cuts them into the segments of a
+ * StringKeyView. Only the open segment is kept as strings, every other key
+ * as its 64-bit suffix until finish() knows how many bits the segment ids
+ * take.
+ */
+class StringKeyBuilder {
+ public:
+  static constexpr size_t kSegmentKeys = 4096;
+
+  explicit StringKeyBuilder(size_t segment_keys = kSegmentKeys)
+      : segment_keys_(segment_keys) {
+    assert(segment_keys_ > 0);
+  }
+
+  /* key >= every key added so far, repeated keys are dropped */
+  inline void add(const char *key, size_t len);
+
+  auto nkeys() const -> size_t { return suffixes_.size() + open_.size(); }
+
+  /**
+   * The serialized map, of a multiple of 8 bytes and allocated with new[],
+   * and in `keys` the mapped keys, sorted and without repeats.
+   */
+  inline auto finish(std::vector<uint64_t> &keys)
+      -> std::pair<uint8_t *, size_t>;
+
+ private:
+  /* record the open segment and map its keys */
+  inline void seal();
+
+ private:
+  size_t segment_keys_;
+
+  std::vector<std::string> open_;
+  /* last key of the sealed segments */
+  std::string last_;
+
+  std::vector<uint32_t> offsets_{0};
+  std::vector<uint32_t> boundary_lens_;
+  std::vector<uint32_t> prefix_lens_;
+  std::vector<uint32_t> tail_lens_;
+  std::string bytes_;
+
+  std::vector<uint64_t> suffixes_;
+};
+
+StringKeyView::StringKeyView(const uint8_t *&ser) {
+  uint64_t nsegments;
+  memcpy(&nsegments, ser, sizeof(uint64_t));
+  ser += sizeof(uint64_t);
+  nsegments_ = nsegments;
+
+  id_bits_ = *ser;
+  ser += sizeof(uint64_t);
+
+  offsets_ = reinterpret_cast<const uint32_t *>(ser);
+  boundary_lens_ = offsets_ + nsegments_ + 1;
+  prefix_lens_ = boundary_lens_ + nsegments_;
+  tail_lens_ = prefix_lens_ + nsegments_;
+  ser = reinterpret_cast<const uint8_t *>(tail_lens_ + nsegments_);
+  align(ser);
+
+  bytes_ = reinterpret_cast<const char *>(ser);
+  ser += offsets_[nsegments_];
+  align(ser);
+}
+
+auto StringKeyView::encode(const char *key, size_t len) const -> uint64_t {
+  assert(nsegments_ > 0);
+  /* the last segment whose boundary is <= key, segment 0 has an empty one */
+  size_t low = 0;
+  size_t high = nsegments_;
+  while (high - low > 1) {
+    size_t mid = (low + high) / 2;
+    if (compare(key, len, mid, boundary_lens_[mid]) >= 0) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+
+  size_t prefix_len = prefix_lens_[low];
+  int order = compare(key, len, low, prefix_len);
+  if (order != 0) {
+    return combine(low, order < 0 ? 0 : UINT64_MAX, id_bits_);
+  }
+  size_t head_len = std::max<size_t>(boundary_lens_[low], prefix_len);
+  const auto *masks =
+      reinterpret_cast<const uint8_t *>(bytes_ + offsets_[low] + head_len);
+  size_t tail_len = tail_lens_[low];
+  return combine(low,
+                 suffix(key, len, prefix_len, masks, masks + tail_len,
+                        tail_len),
+                 id_bits_);
+}
+
+auto StringKeyView::suffix(const char *key, size_t len, size_t from,
+                           const uint8_t *masks, const uint8_t *consts,
+                           size_t tail_len) -> uint64_t {
+  uint64_t value = 0;
+  size_t nbits = 0;
+  for (size_t i = 0; i < tail_len; ++i) {
+    uint8_t byte = from + i < len ? key[from + i] : 0;
+    uint8_t diff = (byte ^ consts[i]) & ~masks[i];
+    /* the shared bit where key turns away, 0 if it does not */
+    uint8_t stop = diff == 0 ? 0 : 0x80 >> (__builtin_clz(diff) - 24);
+    for (uint8_t bit = 0x80; bit > stop; bit >>= 1) {
+      if ((masks[i] & bit) != 0) {
+        value = value << 1 | ((byte & bit) != 0);
+        if (++nbits == 64) {
+          return value;
+        }
+      }
+    }
+    if (stop != 0) {
+      uint64_t fill = (byte & stop) != 0 ? UINT64_MAX >> nbits : 0;
+      return (nbits == 0 ? 0 : value << (64 - nbits)) | fill;
+    }
+  }
+  return (value << 1 | 1) << (63 - nbits);
+}
+
+auto StringKeyView::combine(size_t idx, uint64_t suffix, uint8_t id_bits)
+    -> uint64_t {
+  uint64_t value =
+      id_bits == 0 ? suffix
+                   : static_cast<uint64_t>(idx) << (64 - id_bits) |
+                         suffix >> id_bits;
+  return std::min(value, UINT64_MAX - 1);
+}
+
+auto StringKeyView::compare(const char *key, size_t len, size_t idx,
+                            size_t prefix_len) const -> int {
+  size_t cmp_len = std::min(len, prefix_len);
+  int order = cmp_len == 0 ? 0 : memcmp(key, bytes_ + offsets_[idx], cmp_len);
+  if (order != 0) {
+    return order;
+  }
+  /* a proper prefix of the bytes sorts below them */
+  return len < prefix_len ? -1 : 0;
+}
+
+void StringKeyBuilder::add(const char *key, size_t len) {
+  const std::string *back =
+      open_.empty() ? (suffixes_.empty() ? nullptr : &last_) : &open_.back();
+  if (back != nullptr && back->compare(0, back->size(), key, len) == 0) {
+    return;
+  }
+  assert(back == nullptr || back->compare(0, back->size(), key, len) < 0);
+  open_.emplace_back(key, len);
+  if (open_.size() == segment_keys_) {
+    seal();
+  }
+}
+
+void StringKeyBuilder::seal() {
+  if (open_.empty()) {
+    return;
+  }
+  const std::string &first = open_.front();
+  const std::string &last = open_.back();
+  auto common = [](const std::string &a, const std::string &b) -> size_t {
+    size_t len = std::min(a.size(), b.size());
+    return std::mismatch(a.begin(), a.begin() + len, b.begin()).first -
+           a.begin();
+  };
+
+  /* first > last_, so it is longer than their common prefix */
+  uint32_t boundary_len =
+      boundary_lens_.empty() ? 0 : common(last_, first) + 1;
+  uint32_t prefix_len = common(first, last);
+
+  /* the bits differing from first, up to the 64th of them */
+  size_t max_len = 0;
+  for (const std::string &key : open_) {
+    max_len = std::max(max_len, key.size());
+  }
+  std::string masks;
+  size_t nbits = 0;
+  for (size_t pos = prefix_len; pos < max_len && nbits < 64; ++pos) {
+    uint8_t first_byte = pos < first.size() ? first[pos] : 0;
+    uint8_t mask = 0;
+    for (const std::string &key : open_) {
+      mask |= (pos < key.size() ? key[pos] : 0) ^ first_byte;
+    }
+    masks.push_back(mask);
+    nbits += __builtin_popcount(mask);
+  }
+  while (!masks.empty() && masks.back() == 0) {
+    masks.pop_back();
+  }
+  std::string consts;
+  for (size_t i = 0; i < masks.size(); ++i) {
+    size_t pos = prefix_len + i;
+    consts.push_back((pos < first.size() ? first[pos] : 0) & ~masks[i]);
+  }
+
+  bytes_.append(first, 0, std::max(boundary_len, prefix_len));
+  bytes_.append(masks);
+  bytes_.append(consts);
+  offsets_.emplace_back(bytes_.size());
+  boundary_lens_.emplace_back(boundary_len);
+  prefix_lens_.emplace_back(prefix_len);
+  tail_lens_.emplace_back(masks.size());
+
+  const auto *tail = reinterpret_cast<const uint8_t *>(masks.data());
+  const auto *tail_consts = reinterpret_cast<const uint8_t *>(consts.data());
+  for (const std::string &key : open_) {
+    suffixes_.emplace_back(StringKeyView::suffix(key.data(), key.size(),
+                                                 prefix_len, tail, tail_consts,
+                                                 masks.size()));
+  }
+  last_ = last;
+  open_.clear();
+}
+
+auto StringKeyBuilder::finish(std::vector<uint64_t> &keys)
+    -> std::pair<uint8_t *, size_t> {
+  seal();
+  if (boundary_lens_.empty()) {
+    /* one empty segment, everything maps to 0 */
+    offsets_.emplace_back(0);
+    boundary_lens_.emplace_back(0);
+    prefix_lens_.emplace_back(0);
+    tail_lens_.emplace_back(0);
+  }
+
+  size_t nsegments = boundary_lens_.size();
+  uint8_t id_bits = bit_width(nsegments - 1);
+  keys.resize(suffixes_.size());
+  for (size_t i = 0; i < suffixes_.size(); ++i) {
+    keys[i] = StringKeyView::combine(i / segment_keys_, suffixes_[i], id_bits);
+  }
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  uint64_t header_sz = 2 * sizeof(uint64_t) +
+                       (4 * nsegments + 1) * sizeof(uint32_t);
+  sizeAlign(header_sz);
+  uint64_t bytes_sz = bytes_.size();
+  sizeAlign(bytes_sz);
+
+  /* zeroed, so that the padding and the output are deterministic */
+  uint8_t *out = new uint8_t[header_sz + bytes_sz]();
+  uint8_t *pos = out;
+  uint64_t nsegments_word = nsegments;
+  memcpy(pos, &nsegments_word, sizeof(uint64_t));
+  pos += sizeof(uint64_t);
+  *pos = id_bits;
+  pos += sizeof(uint64_t);
+  for (const auto *lens :
+       {&offsets_, &boundary_lens_, &prefix_lens_, &tail_lens_}) {
+    memcpy(pos, lens->data(), lens->size() * sizeof(uint32_t));
+    pos += lens->size() * sizeof(uint32_t);
+  }
+  memcpy(out + header_sz, bytes_.data(), bytes_.size());
+
+  *this = StringKeyBuilder(segment_keys_);
+  return {out, header_sz + bytes_sz};
+}
+
+}  // namespace oasis
@@ -1,19 +1,279 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <thread>
 #include <vector>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace oasis {
 
 inline auto align_bit2byte(uint64_t b_size) -> size_t {
   return (b_size + 7ULL) >> 3;
 }
 
+/* position of the rank-th (from 0) set bit of word, rank < popcount(word) */
+inline auto select64(uint64_t word, uint64_t rank) -> size_t {
+#if defined(__BMI2__)
+  return __builtin_ctzll(_pdep_u64(1ULL << rank, word));
+#else
+  for (; rank > 0; --rank) {
+    word &= word - 1;
+  }
+  return __builtin_ctzll(word);
+#endif
+}
+
+/* floor(a * b / 2^64) */
+inline auto mul_hi(uint64_t a, uint64_t b) -> uint64_t {
+  return static_cast<uint64_t>((static_cast<unsigned __int128>(a) * b) >> 64);
+}
+
+/* floor(a * 2^64 / c), a < c */
+inline auto div_frac(uint64_t a, uint64_t c) -> uint64_t {
+  assert(a < c);
+#if defined(__x86_64__)
+  uint64_t quotient;
+  uint64_t remainder;
+  __asm__("divq %4"
+          : "=a"(quotient), "=d"(remainder)
+          : "a"(uint64_t{0}), "d"(a), "rm"(c));
+  return quotient;
+#else
+  return static_cast<uint64_t>((static_cast<unsigned __int128>(a) << 64) / c);
+#endif
+}
+
+/**
+ * m such that mul_hi(key - begin, m) is about (key - begin) * nlocations / len
+ * and below nlocations for every key in [begin, begin + len)
+ */
+inline auto pos_multiplier(uint64_t len, uint64_t nlocations) -> uint64_t {
+  return nlocations >= len ? UINT64_MAX : div_frac(nlocations, len);
+}
+
+/**
+ * out[i] = low + mul_hi(keys[i] - base, m) for i in [0, n), keys[i] >= base.
+ * The SIMD kernels split the 64 x 64-bit products into 32-bit halves, whose
+ * floor sums to the same result, so every path is bit-identical to mul_hi().
+ */
+inline void mul_hi_scalar(const uint64_t *keys, size_t n, uint64_t base,
+                          uint64_t m, uint64_t low, uint64_t *out) {
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = low + mul_hi(keys[i] - base, m);
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) inline void mul_hi_avx2(
+    const uint64_t *keys, size_t n, uint64_t base, uint64_t m, uint64_t low,
+    uint64_t *out) {
+  const __m256i vbase = _mm256_set1_epi64x(base);
+  const __m256i vlow = _mm256_set1_epi64x(low);
+  const __m256i m_lo = _mm256_set1_epi64x(m);
+  const __m256i m_hi = _mm256_set1_epi64x(m >> 32);
+  const __m256i mask = _mm256_set1_epi64x(0xFFFFFFFF);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_sub_epi64(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i)), vbase);
+    __m256i x_hi = _mm256_srli_epi64(x, 32);
+    /* _mm256_mul_epu32() multiplies the low halves of the lanes */
+    __m256i ll = _mm256_mul_epu32(x, m_lo);
+    __m256i lh = _mm256_mul_epu32(x, m_hi);
+    __m256i hl = _mm256_mul_epu32(x_hi, m_lo);
+    __m256i hh = _mm256_mul_epu32(x_hi, m_hi);
+    __m256i mid = _mm256_add_epi64(
+        _mm256_srli_epi64(ll, 32),
+        _mm256_add_epi64(_mm256_and_si256(lh, mask),
+                         _mm256_and_si256(hl, mask)));
+    __m256i result = _mm256_add_epi64(
+        _mm256_add_epi64(hh, _mm256_srli_epi64(mid, 32)),
+        _mm256_add_epi64(_mm256_srli_epi64(lh, 32), _mm256_srli_epi64(hl, 32)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_add_epi64(result, vlow));
+  }
+  mul_hi_scalar(keys + i, n - i, base, m, low, out + i);
+}
+
+/* gcc flags the _mm512_undefined_epi32() the shift intrinsics start from */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f"))) inline void mul_hi_avx512(
+    const uint64_t *keys, size_t n, uint64_t base, uint64_t m, uint64_t low,
+    uint64_t *out) {
+  const __m512i vbase = _mm512_set1_epi64(base);
+  const __m512i vlow = _mm512_set1_epi64(low);
+  const __m512i m_lo = _mm512_set1_epi64(m);
+  const __m512i m_hi = _mm512_set1_epi64(m >> 32);
+  const __m512i mask = _mm512_set1_epi64(0xFFFFFFFF);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i x = _mm512_sub_epi64(_mm512_loadu_si512(keys + i), vbase);
+    __m512i x_hi = _mm512_srli_epi64(x, 32);
+    __m512i ll = _mm512_mul_epu32(x, m_lo);
+    __m512i lh = _mm512_mul_epu32(x, m_hi);
+    __m512i hl = _mm512_mul_epu32(x_hi, m_lo);
+    __m512i hh = _mm512_mul_epu32(x_hi, m_hi);
+    __m512i mid = _mm512_add_epi64(
+        _mm512_srli_epi64(ll, 32),
+        _mm512_add_epi64(_mm512_and_si512(lh, mask),
+                         _mm512_and_si512(hl, mask)));
+    __m512i result = _mm512_add_epi64(
+        _mm512_add_epi64(hh, _mm512_srli_epi64(mid, 32)),
+        _mm512_add_epi64(_mm512_srli_epi64(lh, 32), _mm512_srli_epi64(hl, 32)));
+    _mm512_storeu_si512(out + i, _mm512_add_epi64(result, vlow));
+  }
+  mul_hi_scalar(keys + i, n - i, base, m, low, out + i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+/* mul_hi_scalar() on the widest kernel the CPU runs, checked once */
+inline void mul_hi_batch(const uint64_t *keys, size_t n, uint64_t base,
+                         uint64_t m, uint64_t low, uint64_t *out) {
+#if defined(__x86_64__)
+  using Kernel = void (*)(const uint64_t *, size_t, uint64_t, uint64_t,
+                          uint64_t, uint64_t *);
+  static const Kernel kernel = __builtin_cpu_supports("avx512f")
+                                   ? mul_hi_avx512
+                               : __builtin_cpu_supports("avx2")
+                                   ? mul_hi_avx2
+                                   : mul_hi_scalar;
+  kernel(keys, n, base, m, low, out);
+#else
+  mul_hi_scalar(keys, n, base, m, low, out);
+#endif
+}
+
+/* the width bits at bit_pos of words, width <= 64 */
+inline auto read_bits(const uint64_t *words, size_t bit_pos, uint8_t width)
+    -> uint64_t {
+  if (width == 0) {
+    return 0;
+  }
+  size_t word = bit_pos >> 6;
+  size_t shift = bit_pos & 63;
+  uint64_t value = words[word] >> shift;
+  if (shift + width > 64) {
+    value |= words[word + 1] << (64 - shift);
+  }
+  return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+/* or value < 2^width into zeroed words at bit_pos, width <= 64 */
+inline void write_bits(uint64_t *words, size_t bit_pos, uint8_t width,
+                       uint64_t value) {
+  if (width == 0) {
+    return;
+  }
+  size_t word = bit_pos >> 6;
+  size_t shift = bit_pos & 63;
+  words[word] |= value << shift;
+  if (shift + width > 64) {
+    words[word + 1] |= value >> (64 - shift);
+  }
+}
+
+/**
+ * The idx-th little-endian 64-bit word of data[0, nbytes), bytes past nbytes
+ * read as 0, so a block at the end of a buffer is never read past.
+ */
+inline auto load_word(const uint8_t *data, size_t nbytes, size_t idx)
+    -> uint64_t {
+  size_t offset = idx * sizeof(uint64_t);
+  if (offset >= nbytes) {
+    return 0;
+  }
+
+  uint64_t word = 0;
+  if (offset + sizeof(uint64_t) <= nbytes) {
+    memcpy(&word, data + offset, sizeof(uint64_t));
+  } else {
+    for (size_t i = offset; i < nbytes; ++i) {
+      word |= static_cast<uint64_t>(data[i]) << ((i - offset) << 3);
+    }
+  }
+  return word;
+}
+
+/* # bits of value, 0 for 0 */
+inline auto bit_width(uint64_t value) -> uint8_t {
+  return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
 inline void align(uint8_t *&ptr) {
   ptr = reinterpret_cast<uint8_t *>((reinterpret_cast<uint64_t>(ptr) + 7ULL) &
                                     ~(7ULL));
 }
 
+inline void align(const uint8_t *&ptr) {
+  ptr = reinterpret_cast<const uint8_t *>(
+      (reinterpret_cast<uint64_t>(ptr) + 7ULL) & ~(7ULL));
+}
+
+/**
+ * std::upper_bound() of every key over the sorted arr[0, len), as an index.
+ * The searches advance in lockstep, one level at a time, and each level's
+ * probes are prefetched for the whole batch before any of them is compared,
+ * so the cache misses of different keys overlap instead of adding up.
+ */
+inline void batch_upper_bound(const uint64_t *arr, size_t len,
+                              const uint64_t *keys, size_t nkeys,
+                              size_t *result) {
+  assert(len > 0);
+  std::fill(result, result + nkeys, 0);
+  while (len > 1) {
+    size_t half = len >> 1;
+    for (size_t i = 0; i < nkeys; ++i) {
+      __builtin_prefetch(arr + result[i] + half);
+    }
+    for (size_t i = 0; i < nkeys; ++i) {
+      result[i] += arr[result[i] + half] <= keys[i] ? half : 0;
+    }
+    len -= half;
+  }
+  for (size_t i = 0; i < nkeys; ++i) {
+    result[i] += arr[result[i]] <= keys[i];
+  }
+}
+
+/**
+ * Call f(chunk, begin, end) on at most nthreads contiguous chunks of [0, n),
+ * one thread each, and wait for all of them; nthreads <= 1 runs f(0, 0, n)
+ * inline. Chunk boundaries only depend on n and nthreads, so per-chunk results
+ * concatenated in chunk order do not depend on scheduling.
+ */
+template <typename F>
+inline void parallel_for(size_t n, size_t nthreads, F &&f) {
+  nthreads = std::max<size_t>(1, std::min(nthreads, n));
+  if (nthreads == 1) {
+    f(size_t{0}, size_t{0}, n);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (size_t tid = 1; tid < nthreads; ++tid) {
+    threads.emplace_back([&f, n, nthreads, tid]() {
+      f(tid, n * tid / nthreads, n * (tid + 1) / nthreads);
+    });
+  }
+  f(size_t{0}, size_t{0}, n / nthreads);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
 inline void sizeAlign(uint32_t &size) { size = (size + 7UL) & ~(7UL); }
 inline void sizeAlign(uint64_t &size) { size = (size + 7ULL) & ~(7ULL); }
 
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cassert>
 #include <cmath>
 #include <limits>
 #include <numeric>
@@ -23,44 +24,49 @@ FilterBuilder::FilterBuilder(double bpk, uint32_t block_size,
       proteus_(nullptr),
       learned_rf_(nullptr) {}
 
-void FilterBuilder::build_block_lists(const std::vector<uint64_t>& locations) {
-  last_block_sz_ = locations.size() % block_sz_;
-
-  std::vector<uint8_t> compressed_bitmap;
+void FilterBuilder::layout_block_lists(const std::vector<uint64_t>& locations) {
+  // block i holds locations[i * block_sz_, (i + 1) * block_sz_) and ends at
+  // the next block's bias, or at the last location
+  size_t npos = locations.size();
+  size_t nbatches = (npos - 1 + block_sz_ - 1) / block_sz_;
+  last_block_sz_ = 0;
+  bitmap_sz_ = 0;
 
   block_bias_.clear();
-  uint64_t low_bound = locations[0];
-  block_bias_.emplace_back(low_bound);
-  std::vector<uint64_t> cur_batch;
-  for (size_t idx = 1; idx < locations.size();) {
-    cur_batch.clear();
-    cur_batch.emplace_back(0);
-    for (size_t cnt = 1; cnt < block_sz_ && idx < locations.size(); ++cnt) {
-      cur_batch.emplace_back(locations[idx++] - low_bound);
-    }
-    if (idx < locations.size()) {
-      block_bias_.emplace_back(locations[idx++]);
-    } else {
-      block_bias_.emplace_back(locations.back());
-    }
-    std::vector<uint8_t> batch_block =
-        BitSet::build(cur_batch, block_bias_.back() - low_bound);
-    compressed_bitmap.insert(compressed_bitmap.end(), batch_block.begin(),
-                             batch_block.end());
-    low_bound = block_bias_.back();
+  block_bias_.emplace_back(locations[0]);
+  for (size_t i = 0; i < nbatches; ++i) {
+    size_t first = i * block_sz_;
+    size_t nkeys = std::min<size_t>(block_sz_, npos - first);
+    block_bias_.emplace_back(locations[std::min(first + block_sz_, npos - 1)]);
+    bitmap_sz_ += BitSet::size(nkeys, block_bias_[i + 1] - block_bias_[i]);
+    last_block_sz_ = nkeys;
   }
+}
 
-  bitmap_sz_ = compressed_bitmap.size();
+void FilterBuilder::build_block_lists(const std::vector<uint64_t>& locations) {
+  size_t npos = locations.size();
+  size_t nbatches = block_bias_.size() - 1;
   bitmap_ptr_ = new uint8_t[bitmap_sz_];
-  memcpy(bitmap_ptr_, compressed_bitmap.data(), bitmap_sz_ * sizeof(uint8_t));
 
-  size_t nbatches = block_bias_.size() - 1;
+  block_lists_.clear();
   uint8_t* pos = bitmap_ptr_;
+  std::vector<uint64_t> cur_batch;
   for (size_t i = 0; i < nbatches; ++i) {
-    block_lists_.emplace_back(i == nbatches - 1 ? last_block_sz_ : block_sz_,
-                              block_bias_[i + 1] - block_bias_[i], pos);
-    pos += block_lists_.back().size();
+    size_t first = i * block_sz_;
+    size_t nkeys = std::min<size_t>(block_sz_, npos - first);
+    cur_batch.assign(locations.begin() + first,
+                     locations.begin() + first + nkeys);
+    for (auto& location : cur_batch) {
+      location -= block_bias_[i];
+    }
+    uint64_t max_range = block_bias_[i + 1] - block_bias_[i];
+    std::vector<uint8_t> batch_block = BitSet::build(cur_batch, max_range);
+    memcpy(pos, batch_block.data(), batch_block.size());
+
+    block_lists_.emplace_back(nkeys, max_range, pos);
+    pos += batch_block.size();
   }
+  assert(pos == bitmap_ptr_ + bitmap_sz_);
 }
 
 void FilterBuilder::shink_index(const uint64_t threshold,
@@ -111,18 +117,25 @@ auto FilterBuilder::cal_mp_sz(double bpk, size_t key_sz, size_t m) -> uint64_t {
   return pow(2, bpk - 1.0L * kMeta_LRF * m / key_sz) * key_sz;
 }
 
+auto FilterBuilder::min_position_bpk(size_t nkeys, size_t lrf_sz,
+                                     size_t lrf_interval_num) const -> double {
+  // the bits get_positions() takes off before cal_mp_sz(), which then gives
+  // one position per key
+  return 1.0L * kCost * ends_.size() / nkeys + 2 +
+         kMeta_Biset * 1.0L / block_sz_ +
+         1.0L * kMeta_LRF * lrf_interval_num / lrf_sz;
+}
+
 auto FilterBuilder::cal_proteus_fpr(double mem_budget, size_t trie_len,
                                     size_t bf_len) -> long double {
   size_t empty_queries = key_prefixes_[max_klen_];
   size_t solved_in_trie = trie_len == 0 ? 0 : key_prefixes_[trie_len - 1];
 
-  size_t n = key_prefixes_[bf_len - 1];
-  size_t nhf = static_cast<size_t>(round(M_LN2 * mem_budget / n));
-  nhf = (nhf == 0 ? 1 : nhf);
-  nhf = std::min(static_cast<size_t>(MAX_PBF_HASH_FUNCS), nhf);
-
+  // a trie-only Proteus has no prefix Bloom filter and no keys in it
   long double prefix_query_fpr =
-      pow((1.0L - exp(-((nhf * n * 1.0L) / mem_budget))), nhf);
+      bf_len == 0 ? 0
+                  : pbfProbeFPR(mem_budget, key_prefixes_, bf_len, pbf_levels_,
+                                pbf_blocked_);
 
   size_t resolved_in_bf = bf_len == 0 ? 0 : key_prefixes_[bf_len - 1];
   resolved_in_bf -= solved_in_trie;
@@ -133,13 +146,14 @@ auto FilterBuilder::cal_proteus_fpr(double mem_budget, size_t trie_len,
     size_t query_times = 1 << (bf_len - trie_len + 1);
     cumulative_fpp +=
         base * static_cast<long double>(trie_len - max_klen_ + max_qlen_ + 1) *
-        (1.0L - pow(1.0L - prefix_query_fpr, query_times));
+        pbfRangeFPR(prefix_query_fpr, pbf_levels_, query_times);
   }
   for (size_t q_len = 0; q_len <= max_qlen_ && max_klen_ - q_len > trie_len;
        ++q_len) {
     size_t query_times =
         max_klen_ - q_len >= bf_len ? 1 : 1 << (bf_len + q_len - max_klen_);
-    cumulative_fpp += base * (1.0L - pow(1.0L - prefix_query_fpr, query_times));
+    cumulative_fpp +=
+        base * pbfRangeFPR(prefix_query_fpr, pbf_levels_, query_times);
   }
 
   return cumulative_fpp;
@@ -150,6 +164,9 @@ auto FilterBuilder::cal_proteus_fpr(double mem_budget, size_t trie_len,
  */
 void FilterBuilder::build(const std::vector<uint64_t>& keys) {
   segmentation(keys);
+  prepare_samples(keys);
+  // with a sample, costs are expected false positives over its empty queries
+  bool sampled = !sample_queries_.empty();
 
   uint64_t delta_sum =
       keys.back() - keys[0] -
@@ -166,6 +183,15 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
     double bpk_slash = bpk - 1.0L * kCost * m / nkeys;
     uint64_t mp_sz = cal_mp_sz(bpk_slash, nkeys, m);
     double rho = static_cast<double>(delta_sum) * delta_sum / mp_sz;
+    if (sampled) {
+      // queries in gaps of at least the threshold are left to the index
+      rho = 0;
+      for (const auto& q : sample_gaps_) {
+        if (q.gap < threshold_set_[set_idx]) {
+          rho += sampled_lrf_fp(q, nkeys, delta_sum, mp_sz);
+        }
+      }
+    }
     if (rho <= min_rho) {
       min_rho = rho;
       best_lrf_idx = set_idx;
@@ -173,14 +199,8 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
     }
 
     // Update set idx
-    size_t pre_idx = set_idx;
-    uint64_t cur_threshold = threshold_set_[set_idx];
-    while (set_idx < threshold_set_.size() &&
-           threshold_set_[set_idx] == cur_threshold) {
-      ++set_idx;
-    }
+    delta_sum += next_threshold(set_idx, sampled ? m / kSampleSteps : 0);
     m = nkeys - set_idx;
-    delta_sum += (set_idx - pre_idx) * cur_threshold;
   }
 
   std::vector<size_t> interval_sz;
@@ -194,12 +214,16 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
    */
   ProteusModeling proteus_model(max_klen_, max_qlen_);
   proteus_model.set_key_prefixes(key_prefixes_);
+  proteus_model.set_pbf_levels(pbf_levels_);
+  proteus_model.set_pbf_blocked(pbf_blocked_);
   std::tuple<size_t, size_t, size_t> single_proteus_conf =
-      proteus_model.modeling(keys, bpk_);
+      proteus_model.modeling(keys, sample_queries_, bpk_);
 
   std::tuple<size_t, size_t, size_t> best_pro_conf = single_proteus_conf;
   std::vector<bool> best_indicator(1, false);
-  double min_fpr = proteus_model.get_min_fpp() * (keys.back() - keys[0]);
+  double min_fpr = sampled
+                       ? proteus_model.get_min_fpp()
+                       : proteus_model.get_min_fpp() * (keys.back() - keys[0]);
   size_t best_idx = best_lrf_idx;
   size_t best_lrf_sz = nkeys;
 
@@ -210,8 +234,11 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
   size_t pre_bpk_slash_1 = std::floor(bpk_slash);
   double pre_bpk_slash_2 = bpk_slash;
   std::tuple<size_t, size_t, size_t> cur_pro_conf =
-      proteus_model.modeling(keys, bpk_slash);
-  long double proteus_fpr = proteus_model.get_min_fpp();
+      proteus_model.modeling(keys, sample_queries_, bpk_slash);
+  // with a sample, the rate per empty sampled query
+  long double proteus_fpr =
+      sampled ? proteus_model.get_min_fpp() / sample_empty_
+              : proteus_model.get_min_fpp();
   for (size_t set_idx = best_lrf_idx; set_idx < threshold_set_.size();) {
     bpk_slash -= 2 + kMeta_Biset * 1.0L / block_sz_;
     size_t lrf_key_sz = nkeys;
@@ -227,6 +254,19 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
                          : key_prefixes_.back() - key_prefixes_[rho_len];
     double cur_fpr = lrf_fpr * batch_sum;
 
+    // sampled queries in each interval; their false positives are taken at
+    // the positions of this threshold, moving intervals out only refines them
+    std::vector<double> nqueries;
+    std::vector<double> lrf_fp;
+    double learned_fpr = 0;
+    double moved_nqueries = 0;
+    if (sampled) {
+      sample_load(begins, ends, lrf_key_sz, delta_sum, mp_sz, nqueries,
+                  lrf_fp);
+      learned_fpr = std::accumulate(lrf_fp.begin(), lrf_fp.end(), 0.0);
+      cur_fpr = learned_fpr;
+    }
+
     bool all_proteus = false;
     std::vector<bool> indicator(ends.size(), true);
     std::vector<size_t> order = build_seq(begins, ends, interval_sz);
@@ -250,6 +290,11 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
                                : key_prefixes_.back() - key_prefixes_[rho_len];
       }
       double fpr = delta_sum * lrf_fpr + (batch_sum - delta_sum) * proteus_fpr;
+      if (sampled) {
+        learned_fpr -= lrf_fp[iter];
+        moved_nqueries += nqueries[iter];
+        fpr = learned_fpr + moved_nqueries * proteus_fpr;
+      }
       if (fpr >= cur_fpr) {
         lrf_key_sz += interval_sz[iter];
         break;
@@ -267,29 +312,24 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
       best_lrf_sz = lrf_key_sz;
     }
 
-    size_t pre_idx = set_idx;
-    uint64_t cur_threshold = threshold_set_[set_idx];
-    while (set_idx < threshold_set_.size() &&
-           cur_threshold == threshold_set_[set_idx]) {
-      ++set_idx;
-    }
-
+    batch_sum +=
+        next_threshold(set_idx, sampled ? ends.size() / kSampleSteps : 0);
     if (set_idx >= threshold_set_.size()) {
       break;
     }
 
-    batch_sum += (set_idx - pre_idx) * cur_threshold;
-
     shink_index(threshold_set_[set_idx], begins, ends, interval_sz);
 
     m = ends.size();
     bpk_slash = bpk_ - 1.0L * kCost * m / nkeys;
     if (bpk_slash >= pre_bpk_slash_1 + 1) {
-      cur_pro_conf = proteus_model.modeling(keys, bpk_slash);
-      proteus_fpr = proteus_model.get_min_fpp();
+      cur_pro_conf = proteus_model.modeling(keys, sample_queries_, bpk_slash);
+      proteus_fpr = sampled ? proteus_model.get_min_fpp() / sample_empty_
+                            : proteus_model.get_min_fpp();
       pre_bpk_slash_1 = std::floor(bpk_slash);
       continue;
-    } else if (bpk_slash - 0.1 >= pre_bpk_slash_2) {
+    } else if (!sampled && bpk_slash - 0.1 >= pre_bpk_slash_2) {
+      // cal_proteus_fpr() estimates over key gaps, not over the sample
       double mem_budget =
           std::ceil(nkeys * bpk_slash - proteus_model.get_trie_mem());
       proteus_fpr = cal_proteus_fpr(mem_budget, std::get<0>(cur_pro_conf),
@@ -341,31 +381,62 @@ void FilterBuilder::build(const std::vector<uint64_t>& keys) {
 
   std::vector<uint64_t> learned_pos;
   std::vector<uint64_t> proteus_keys;
-  get_positions(keys, bpk_, best_delta_sum, best_lrf_sz, lrf_interval_num,
+  double min_pos_bpk = min_position_bpk(nkeys, best_lrf_sz, lrf_interval_num);
+  double pos_bpk = std::max(bpk_, min_pos_bpk);
+  get_positions(keys, pos_bpk, best_delta_sum, best_lrf_sz, lrf_interval_num,
                 learned_pos, proteus_keys);
 
   double last_bits = bpk_ * nkeys;
   if (learned_pos.size() > 0) {
-    build_block_lists(learned_pos);
+    // the layout gives the exact size before any block is built, so the
+    // positions are recomputed towards the budget, and the layout closest to
+    // it is built once. Only the blocks shrink with the positions, so the
+    // rounds stop once the size no longer follows them, e.g. for few keys,
+    // whose intervals and model outweigh their blocks.
+    layout_block_lists(learned_pos);
     double used_bits = static_cast<double>(cal_used_bytes()) * 8;
-    double bpk_lrf = used_bits / best_lrf_sz;
-    if (std::abs(bpk_ - bpk_lrf) >= 0.2) {
+    double best_pos_bpk = pos_bpk;
+    double best_used_bits = used_bits;
+    for (size_t round = 0; round < kBudgetRounds; ++round) {
+      double miss = bpk_ - used_bits / best_lrf_sz;
+      double next_pos_bpk = std::max(pos_bpk + miss, min_pos_bpk);
+      if (std::abs(miss) < 0.2 || next_pos_bpk == pos_bpk) {
+        break;
+      }
+      learned_pos.clear();
+      std::vector<uint64_t> _;
+      get_positions(keys, next_pos_bpk, best_delta_sum, best_lrf_sz,
+                    lrf_interval_num, learned_pos, _);
+      layout_block_lists(learned_pos);
+      double next_used_bits = static_cast<double>(cal_used_bytes()) * 8;
+      if (std::abs(bpk_ * best_lrf_sz - next_used_bits) <
+          std::abs(bpk_ * best_lrf_sz - best_used_bits)) {
+        best_pos_bpk = next_pos_bpk;
+        best_used_bits = next_used_bits;
+      }
+      bool responds = std::abs(next_used_bits - used_bits) >=
+                      0.5 * std::abs(next_pos_bpk - pos_bpk) * best_lrf_sz;
+      pos_bpk = next_pos_bpk;
+      used_bits = next_used_bits;
+      if (!responds) {
+        break;
+      }
+    }
+    if (best_pos_bpk != pos_bpk) {
       learned_pos.clear();
-      block_lists_.clear();
-
-      delete[] bitmap_ptr_;
-
       std::vector<uint64_t> _;
-      get_positions(keys, 2 * bpk_ - bpk_lrf, best_delta_sum, best_lrf_sz,
+      get_positions(keys, best_pos_bpk, best_delta_sum, best_lrf_sz,
                     lrf_interval_num, learned_pos, _);
-      build_block_lists(learned_pos);
-      used_bits = static_cast<double>(cal_used_bytes()) * 8;
+      layout_block_lists(learned_pos);
+      used_bits = best_used_bits;
     }
+    build_block_lists(learned_pos);
 
     last_bits -= used_bits;
     learned_rf_ =
         new LearnedRF(block_sz_, last_block_sz_, bitmap_sz_, bitmap_ptr_,
-                      accumulate_interval_sz_, block_lists_, block_bias_);
+                      accumulate_interval_sz_, block_lists_, block_bias_,
+                      true);
   } else {
     learned_rf_ = nullptr;
   }
@@ -416,6 +487,22 @@ void FilterBuilder::segmentation(const std::vector<uint64_t>& keys) {
   threshold_set_ = std::move(neigh_dists);
 }
 
+auto FilterBuilder::next_threshold(size_t& set_idx, size_t min_step) const
+    -> uint64_t {
+  size_t pre_idx = set_idx;
+  uint64_t gap_sum = 0;
+  do {
+    uint64_t cur_threshold = threshold_set_[set_idx];
+    size_t run_begin = set_idx;
+    while (set_idx < threshold_set_.size() &&
+           threshold_set_[set_idx] == cur_threshold) {
+      ++set_idx;
+    }
+    gap_sum += (set_idx - run_begin) * cur_threshold;
+  } while (set_idx < threshold_set_.size() && set_idx - pre_idx < min_step);
+  return gap_sum;
+}
+
 void FilterBuilder::build_index(const uint64_t threshold,
                                 const std::vector<uint64_t>& keys,
                                 std::vector<uint64_t>& begins,
@@ -440,6 +527,83 @@ void FilterBuilder::build_index(const uint64_t threshold,
   interval_sz.emplace_back(inter_sz);
 }
 
+void FilterBuilder::prepare_samples(const std::vector<uint64_t>& keys) {
+  sample_empty_ = 0;
+  sample_gaps_.clear();
+  if (sample_queries_.empty()) {
+    return;
+  }
+
+  std::sort(sample_queries_.begin(), sample_queries_.end());
+  if (size_t nsamples = sample_queries_.size(); nsamples > kMaxSampleQueries) {
+    for (size_t i = 0; i < kMaxSampleQueries; ++i) {
+      sample_queries_[i] = sample_queries_[i * nsamples / kMaxSampleQueries];
+    }
+    sample_queries_.resize(kMaxSampleQueries);
+  }
+
+  auto kstart = keys.begin();
+  for (auto& [l_key, r_key] : sample_queries_) {
+    kstart = std::lower_bound(kstart, keys.end(), l_key);
+    bool empty = kstart == keys.end() || *kstart > r_key;
+    uint64_t r_incl = r_key;
+    // Proteus takes the right bound as exclusive
+    r_key += r_key < UINT64_MAX;
+    if (!empty) {
+      continue;
+    }
+    ++sample_empty_;
+    // queries around the keys are rejected by the index
+    if (kstart == keys.begin() || kstart == keys.end()) {
+      continue;
+    }
+    uint64_t anchor = *(kstart - 1);
+    sample_gaps_.push_back({anchor, *kstart - anchor, l_key - anchor,
+                            *kstart - r_incl,
+                            static_cast<double>(r_incl - l_key) + 1});
+  }
+
+  if (sample_empty_ == 0) {
+    // nothing can be a false positive, the sample gives no weights
+    sample_queries_.clear();
+  }
+}
+
+auto FilterBuilder::sampled_lrf_fp(const SampleQuery& q, size_t lrf_keys,
+                                   uint64_t delta_sum, uint64_t mp_sz)
+    -> double {
+  if (mp_sz == 0 || delta_sum == 0) {
+    return 1;
+  }
+  // positions are delta_sum / mp_sz wide, a query shares one with a key at
+  // distance dist with probability 1 - dist / width, and covers others that
+  // are set with probability lrf_keys / mp_sz
+  double width = static_cast<double>(delta_sum) / mp_sz;
+  double fp = std::max(0.0, 1 - q.left_dist / width) +
+              std::max(0.0, 1 - q.right_dist / width) +
+              (1 + q.len / width) * lrf_keys / mp_sz;
+  return std::min(fp, 1.0);
+}
+
+void FilterBuilder::sample_load(const std::vector<uint64_t>& begins,
+                                const std::vector<uint64_t>& ends,
+                                size_t lrf_keys, uint64_t delta_sum,
+                                uint64_t mp_sz, std::vector<double>& nqueries,
+                                std::vector<double>& lrf_fp) const {
+  nqueries.assign(begins.size(), 0);
+  lrf_fp.assign(begins.size(), 0);
+  auto q = sample_gaps_.begin();
+  for (size_t i = 0; i < begins.size(); ++i) {
+    // a query inside [begins[i], ends[i]] follows a key of [begins[i], ends[i])
+    for (; q != sample_gaps_.end() && q->anchor < ends[i]; ++q) {
+      if (q->anchor >= begins[i]) {
+        nqueries[i] += 1;
+        lrf_fp[i] += sampled_lrf_fp(*q, lrf_keys, delta_sum, mp_sz);
+      }
+    }
+  }
+}
+
 auto FilterBuilder::build_seq(const std::vector<uint64_t>& begins,
                               const std::vector<uint64_t>& ends,
                               const std::vector<size_t>& interval_sz)
@@ -482,8 +646,8 @@ void FilterBuilder::build_proteus(
       "\tTrie Depth: %lu; Sparse-Dense Cutoff (bytes): %lu; BF Prefix "
       "Length: %lu\n",
       trie_depth, sparse_dense_cutoff, prefix_length);
-  proteus_ =
-      new Proteus(keys, trie_depth, sparse_dense_cutoff, prefix_length, bpk);
+  proteus_ = new Proteus(keys, trie_depth, sparse_dense_cutoff, prefix_length,
+                         bpk, pbf_levels_, pbf_blocked_);
 }
 
 void FilterBuilder::get_positions(const std::vector<uint64_t>& keys, double bpk,
@@ -512,11 +676,15 @@ void FilterBuilder::get_positions(const std::vector<uint64_t>& keys, double bpk,
       uint64_t alpha = std::ceil(1.0L * best_mp_sz * param_1 / delta_sum);
       size_t pre_idx = key_idx;
       while (key_idx < nkeys && keys[key_idx] < end) {
-        uint64_t pos = static_cast<uint64_t>(
-            static_cast<double>(keys[key_idx++] - begin) * alpha / param_1 +
-            param_2);
-        learned_pos.emplace_back(pos);
+        ++key_idx;
       }
+      /* the keys of an interval are contiguous, positioned in one batch as
+       * LearnedRF::get_location() does one by one */
+      size_t npos = learned_pos.size();
+      learned_pos.resize(npos + key_idx - pre_idx);
+      oasis::mul_hi_batch(keys.data() + pre_idx, key_idx - pre_idx, begin,
+                          oasis::pos_multiplier(param_1, alpha), param_2,
+                          learned_pos.data() + npos);
       if (key_idx - pre_idx > 0) {
         accumulate_interval_sz_.emplace_back(param_2 + alpha);
       } else {
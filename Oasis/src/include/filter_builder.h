@@ -13,15 +13,45 @@
 namespace oasis_plus {
 class FilterBuilder {
  private:
+  /* an empty sampled query [l, r] between the keys anchor and anchor + gap */
+  struct SampleQuery {
+    uint64_t anchor;
+    uint64_t gap;
+    uint64_t left_dist;  /* l - anchor */
+    uint64_t right_dist; /* anchor + gap - r */
+    double len;
+  };
+
   static const uint64_t kCost = 129;
   static const uint64_t kMeta_LRF = 64;
   static const uint64_t kMeta_Biset = 32;
   static constexpr long double LN2_2 = -M_LN2 * M_LN2;
+  /* max # times the positions are recomputed towards the bpk budget */
+  static const size_t kBudgetRounds = 4;
+  /* larger query samples are thinned evenly, to bound the modeling time */
+  static const size_t kMaxSampleQueries = 4096;
+  /* with a sample, each threshold step merges >= 1 / kSampleSteps intervals */
+  static const size_t kSampleSteps = 256;
 
  public:
   FilterBuilder(double bpk, uint32_t block_size, const size_t max_qlen = 10);
   ~FilterBuilder() = default;
 
+  /**
+   * Range queries [l, r] the filter is expected to serve. build() then weighs
+   * false positives by where the empty ones land, instead of by key span, to
+   * choose the segments, the split between the learned filter and Proteus,
+   * and the Proteus configuration.
+   */
+  void set_sample_queries(std::vector<std::pair<uint64_t, uint64_t>> queries) {
+    sample_queries_ = std::move(queries);
+  }
+
+  /* levels of Proteus' prefix Bloom filter, see PrefixBF::PrefixBF() */
+  void set_pbf_levels(uint32_t levels) { pbf_levels_ = levels; }
+  /* cache-line-blocked prefix Bloom filter, see PrefixBF::PrefixBF() */
+  void set_pbf_blocked(bool blocked) { pbf_blocked_ = blocked; }
+
   auto get_filter_types() -> std::vector<uint32_t>&& {
     return std::move(filter_types_);
   }
@@ -32,6 +62,9 @@ class FilterBuilder {
   auto get_proteus() -> Proteus* { return proteus_; }
 
  private:
+  /* block biases and sizes over locations, without building any block */
+  void layout_block_lists(const std::vector<uint64_t>& locations);
+  /* build the blocks laid out by layout_block_lists(locations) */
   void build_block_lists(const std::vector<uint64_t>& locations);
 
   auto cal_proteus_fpr(double mem_budget, size_t trie_len, size_t bf_len)
@@ -39,11 +72,39 @@ class FilterBuilder {
   auto cal_used_bytes() const -> size_t;
 
   inline auto cal_mp_sz(double mem_budget, size_t key_sz, size_t m) -> uint64_t;
+  /**
+   * The least bpk to get_positions() that still gives every learned interval
+   * holding keys its positions: below it, cal_mp_sz() rounds to no position,
+   * and LearnedRF::query() misses the keys of the empty intervals.
+   */
+  auto min_position_bpk(size_t nkeys, size_t lrf_sz,
+                        size_t lrf_interval_num) const -> double;
   inline void shink_index(const uint64_t threshold,
                           std::vector<uint64_t>& begins,
                           std::vector<uint64_t>& ends,
                           std::vector<size_t>& interval_sz);
 
+  /**
+   * Move set_idx past the gaps equal to threshold_set_[set_idx], and past at
+   * least min_step gaps, returning the sum of the gaps passed.
+   */
+  auto next_threshold(size_t& set_idx, size_t min_step) const -> uint64_t;
+  /* locate the empty sampled queries among keys */
+  void prepare_samples(const std::vector<uint64_t>& keys);
+  /**
+   * Probability that q is a false positive of a learned filter of lrf_keys
+   * keys spanning delta_sum over mp_sz positions: its positions may be those
+   * of the keys around it, or be set by others.
+   */
+  static auto sampled_lrf_fp(const SampleQuery& q, size_t lrf_keys,
+                             uint64_t delta_sum, uint64_t mp_sz) -> double;
+  /* # empty sampled queries in each interval and their false positives */
+  void sample_load(const std::vector<uint64_t>& begins,
+                   const std::vector<uint64_t>& ends, size_t lrf_keys,
+                   uint64_t delta_sum, uint64_t mp_sz,
+                   std::vector<double>& nqueries,
+                   std::vector<double>& lrf_fp) const;
+
   // experiment function
  public:
   void build(const std::vector<uint64_t>& keys);
@@ -76,6 +137,15 @@ class FilterBuilder {
   std::vector<size_t> key_prefixes_;
   std::vector<uint64_t> threshold_set_;
 
+  // sampled queries, [l, r) sorted by l as Proteus models them
+  std::vector<std::pair<uint64_t, uint64_t>> sample_queries_;
+  size_t sample_empty_ = 0;
+  // the empty ones between two keys, by anchor
+  std::vector<SampleQuery> sample_gaps_;
+
+  uint32_t pbf_levels_ = 1;
+  bool pbf_blocked_ = false;
+
   // OasisPlus metadata
   std::vector<uint32_t> filter_types_;
   std::vector<uint64_t> begins_;
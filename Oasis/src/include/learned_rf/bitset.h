@@ -1,19 +1,35 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 namespace oasis_plus {
 
+/**
+ * Elias-Fano coded block of sorted keys. The lower bits of all keys come
+ * first, packed nkeys x lower_bit_len, then the upper bits as a run of 1s per
+ * bucket step and a 0 per key, closed by a final 1. Queries decode whole
+ * 64-bit words: the bucket is found with popcount/select and the keys in it
+ * are read with one or two word loads each.
+ *
+ * Blocks spanning at least kSelectSample buckets store, after the bit array,
+ * the start of every kSelectSample-th bucket as a uint32_t, so the select
+ * scan never covers more than kSelectSample 1s.
+ */
 class BitSet {
  public:
-  BitSet(size_t nkeys, uint64_t max_range, uint8_t *data);
+  /* # buckets between two select samples */
+  static constexpr uint64_t kSelectSample = 512;
+
+ public:
+  BitSet(size_t nkeys, uint64_t max_range, const uint8_t *data);
 
   ~BitSet() = default;
 
-  auto query(uint64_t query) -> bool;
+  auto query(uint64_t query) const -> bool;
   /* [left, right] */
-  auto query(uint64_t left, uint64_t right) -> bool;
+  auto query(uint64_t left, uint64_t right) const -> bool;
 
   auto size() const -> size_t;
 
@@ -28,18 +44,32 @@ class BitSet {
   inline static auto bit_array_bsize(uint64_t nkeys, uint64_t max_range,
                                      uint64_t lower_bit_len) -> size_t;
 
+  inline static auto nsamples(uint64_t max_range, uint64_t lower_bit_len)
+      -> size_t;
+
   inline auto get_lower_bit_length(uint64_t max_range) -> uint64_t;
 
   inline auto bit_array_bsize(uint64_t max_range) -> size_t;
 
-  inline auto find_next_set_bit(size_t idx) -> size_t;
+  /* smallest key >= key, false if there is none */
+  inline auto successor(uint64_t key, uint64_t &result) const -> bool;
+
+  /* idx-th 64-bit word of the bit array, bits past b_size_ read as 0 */
+  inline auto get_word(size_t idx) const -> uint64_t;
+  /* lower bits of the idx-th key */
+  inline auto get_lower(size_t idx) const -> uint64_t;
+
+  /* position right after the rank-th 1 at or after idx, b_size_ if none */
+  inline auto select_one(size_t idx, uint64_t rank) const -> size_t;
+  inline auto find_next_set_bit(size_t idx) const -> size_t;
+  inline auto find_next_unset_bit(size_t idx) const -> size_t;
 
  private:
   uint64_t lower_bit_len_;
   size_t b_size_;
   size_t nkeys_;
 
-  uint8_t *data_;
+  const uint8_t *data_;
 };
 
 }  // namespace oasis_plus
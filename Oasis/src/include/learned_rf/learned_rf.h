@@ -4,57 +4,79 @@
 #include <vector>
 
 #include "learned_rf/bitset.h"
+#include "oasis/util.hpp"
 
 namespace oasis_plus {
 class LearnedRF {
  public:
   LearnedRF(uint16_t block_sz, uint16_t last_block_sz, size_t bitmap_sz,
             uint8_t *bitmap_ptr, std::vector<uint64_t> &accumulate_interval_sz,
-            std::vector<BitSet> &block_lists, std::vector<uint64_t> block_bias)
+            std::vector<BitSet> &block_lists, std::vector<uint64_t> block_bias,
+            bool fixed)
       : block_sz_(block_sz),
         last_block_sz_(last_block_sz),
         bitmap_sz_(bitmap_sz),
         bitmap_ptr_(bitmap_ptr),
         accumulate_interval_sz_(std::move(accumulate_interval_sz)),
         block_lists_(std::move(block_lists)),
-        block_bias_(std::move(block_bias)) {}
+        block_bias_(std::move(block_bias)),
+        fixed_(fixed) {}
   ~LearnedRF();
 
-  auto query(uint64_t key, size_t interval_idx, uint64_t low, uint64_t up)
+  auto query(uint64_t key, size_t interval_idx, uint64_t low, uint64_t up) const
       -> bool;
   auto query(uint64_t l_key, uint64_t r_key, size_t interval_idx, uint64_t low,
-             uint64_t up) -> bool;
+             uint64_t up) const -> bool;
 
+  /* writes size() bytes at dst, which is 8-byte aligned */
+  void serialize_into(uint8_t *dst) const;
   auto serialize() const -> std::pair<uint8_t *, size_t>;
-  static auto deserialize(uint8_t *ser) -> std::pair<LearnedRF *, size_t>;
+  /* with borrowed, the bitmap is read in ser, which must outlive the filter */
+  static auto deserialize(uint8_t *ser, bool borrowed = false)
+      -> std::pair<LearnedRF *, size_t>;
 
   auto size() const -> size_t;
 
  private:
   /** Helping Methods */
-  auto get_params(uint64_t low, uint64_t up, size_t interval_idx)
+  auto get_params(uint64_t low, uint64_t up, size_t interval_idx) const
       -> std::pair<uint64_t, uint64_t> {
     return {static_cast<uint64_t>(accumulate_interval_sz_[interval_idx] -
                                   accumulate_interval_sz_[interval_idx - 1]),
             up - low};
   }
 
-  auto get_location(double delta_key, size_t interval_idx,
-                    const std::pair<uint64_t, uint64_t> &params) -> uint64_t {
-    return delta_key * params.first / params.second +
+  auto get_location(uint64_t delta_key, size_t interval_idx,
+                    const std::pair<uint64_t, uint64_t> &params) const
+      -> uint64_t {
+    if (fixed_) {
+      return accumulate_interval_sz_[interval_idx - 1] +
+             oasis::mul_hi(delta_key,
+                           oasis::pos_multiplier(params.second, params.first));
+    }
+    return static_cast<double>(delta_key) * params.first / params.second +
            accumulate_interval_sz_[interval_idx - 1];
   }
 
+ private:
+  /* set in the serialized # intervals for fixed_ */
+  static constexpr uint32_t kFixedFlag = 1U << 31;
+
  private:
   uint16_t block_sz_;
   uint16_t last_block_sz_;
   size_t bitmap_sz_ = 0;
 
   uint8_t *bitmap_ptr_ = nullptr;
+  /* bitmap_ptr_ points into a serialized filter, which owns it */
+  bool borrowed_ = false;
 
   std::vector<uint64_t> accumulate_interval_sz_;
 
   std::vector<BitSet> block_lists_;
   std::vector<uint64_t> block_bias_;
+  /* keys positioned by oasis::pos_multiplier() rather than in double, as
+   * FilterBuilder::get_positions() builds them; unset in older filters */
+  bool fixed_;
 };
 }  // namespace oasis_plus
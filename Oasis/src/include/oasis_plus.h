@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 #include "learned_rf/learned_rf.h"
+#include "oasis/query_stats.hpp"
 #include "proteus/proteus.h"
 
 namespace oasis_plus {
@@ -12,9 +14,23 @@ class OasisPlus {
   static const uint8_t LEARNED_EXIST_BIT = 1U;
   static const uint8_t PROTEUS_EXIST_BIT = 2U;
 
+  /* the answer of the segments and the learned filter, unless Proteus has it */
+  enum Answer : uint8_t { kNo, kYes, kAskProteus };
+
  public:
+  /**
+   * sample_queries: range queries [l, r] to tune the filter for, if any
+   * pbf_levels: levels of Proteus' prefix Bloom filter, > 1 to bound the
+   * probes of wide ranges at the bits the other levels take, which the
+   * Proteus modeling accounts for, see PrefixBF::PrefixBF()
+   * pbf_blocked: one cache line per prefix in Proteus' prefix Bloom filter,
+   * fewer misses per probe at a slightly higher FPR, which the Proteus
+   * modeling accounts for as well
+   */
   OasisPlus(double bpk, uint32_t block_size, const std::vector<uint64_t> &keys,
-            const size_t max_qlen = 10);
+            const size_t max_qlen = 10,
+            std::vector<std::pair<uint64_t, uint64_t>> sample_queries = {},
+            uint32_t pbf_levels = 1, bool pbf_blocked = false);
 
   OasisPlus(std::vector<uint64_t> &begins, std::vector<uint64_t> &ends,
             std::vector<uint32_t> &filter_types, LearnedRF *learned_rf,
@@ -30,15 +46,44 @@ class OasisPlus {
     delete proteus_;
   }
 
-  auto query(uint64_t key) -> bool;
-  auto query(uint64_t l_key, uint64_t r_key) -> bool;
+  /* read-only, one instance may serve concurrent queries */
+  auto query(uint64_t key) const -> bool;
+  auto query(uint64_t l_key, uint64_t r_key) const -> bool;
+
+  /**
+   * out[i] = query(keys[i]). The keys Proteus answers are collected and looked
+   * up together with Proteus::QueryBatch(), so that their cache misses
+   * overlap, e.g. for a MultiGet.
+   */
+  void query_batch(const uint64_t *keys, size_t n, bool *out) const;
+
+  /* the costs of this filter's queries, all 0 without OASIS_QUERY_STATS */
+  auto query_stats() const -> oasis::QueryStats {
+    return stats_.load_atomic();
+  }
 
+  /* the bytes serialize_into() writes */
+  auto serialized_size() const -> size_t;
+  /* writes the filter at dst, which is 8-byte aligned, with no allocation */
+  void serialize_into(uint8_t *dst) const;
   auto serialize() const -> std::pair<uint8_t *, size_t>;
-  static auto deserialize(uint8_t *ser) -> OasisPlus *;
+  /**
+   * borrowed: the filters read ser in place instead of copying it, so ser
+   * must be 8-byte aligned and outlive the result
+   */
+  static auto deserialize(uint8_t *ser, bool borrowed = false) -> OasisPlus *;
 
   auto size() const -> size_t;
 
  private:
+  auto answer(uint64_t key) const -> Answer;
+  auto answer(uint64_t l_key, uint64_t r_key) const -> Answer;
+
+  /* LEARNED_EXIST_BIT and PROTEUS_EXIST_BIT of the filters this holds */
+  auto filter_bitmap() const -> uint8_t;
+  /* bytes of the interval count, filter bitmap and filter types, aligned */
+  auto meta_size() const -> size_t;
+
   /* Indices of the Intervals */
   std::vector<uint64_t> begins_;
   std::vector<uint64_t> ends_;
@@ -47,6 +92,8 @@ class OasisPlus {
 
   LearnedRF *learned_rf_;
   Proteus *proteus_;
+
+  mutable oasis::QueryStats stats_;
 };
 
 }  // namespace oasis_plus
\ No newline at end of file
@@ -45,6 +45,9 @@ class Bitvector {
  protected:
   position_t num_bits_;
   word_t* bits_;
+  // bits_ and the look-up tables point into the serialized filter, which
+  // owns them
+  bool borrowed_ = false;
 };
 
 }  // namespace oasis_plus
\ No newline at end of file
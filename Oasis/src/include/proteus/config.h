@@ -20,6 +20,8 @@ static const position_t kMaxPos = UINT32_MAX;
 
 using label_t = uint8_t;
 static const position_t kFanout = 256;
+// one trie level per key byte, the bound of the iterators' key buffers
+static const level_t kMaxTrieHeight = sizeof(uint64_t);
 
 using word_t = uint64_t;
 static const unsigned kWordSize = 64;
@@ -32,6 +34,10 @@ static const int kHashShift = 7;
 
 static const int kCouldBePositive = 2018;  // used in suffix comparison
 
+// Outcome of a lookupLevel() step of a trie: the key is absent, may be
+// present, or the lookup continues at the next level
+enum class LookupStep { kNotFound, kFound, kNext };
+
 void align(char*& ptr);
 void sizeAlign(position_t& size);
 void sizeAlign(uint64_t& size);
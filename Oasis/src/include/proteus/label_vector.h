@@ -1,13 +1,27 @@
 #pragma once
 
-#include <emmintrin.h>
-
 #include <vector>
 
 #include "proteus/config.h"
 
 namespace oasis_plus {
 
+// Kernels of LabelVector::simdSearch() and simdSearchGreaterThan(): the index
+// of the first of labels[0, len) equal to / greater than target, or len, with
+// labels sorted for the latter. They load only inside labels[0, len), the
+// last block overlapping the one before it, so len must be at least their
+// width, 16 or 32 labels.
+#if defined(__x86_64__)
+auto findLabelSSE2(const label_t* labels, position_t len, label_t target)
+    -> position_t;
+auto findLabelAVX2(const label_t* labels, position_t len, label_t target)
+    -> position_t;
+auto findLabelGreaterThanSSE2(const label_t* labels, position_t len,
+                              label_t target) -> position_t;
+auto findLabelGreaterThanAVX2(const label_t* labels, position_t len,
+                              label_t target) -> position_t;
+#endif
+
 class LabelVector {
  public:
   LabelVector() : num_bytes_(0), labels_(nullptr){};
@@ -27,6 +41,8 @@ class LabelVector {
 
   auto operator[](const position_t pos) const -> label_t;
 
+  void prefetch(const position_t pos) const { __builtin_prefetch(labels_ + pos); }
+
   auto search(const label_t target, position_t& pos,
               const position_t search_len) const -> bool;
   auto searchGreaterThan(const label_t target, position_t& pos,
@@ -34,6 +50,7 @@ class LabelVector {
 
   auto binarySearch(const label_t target, position_t& pos,
                     const position_t search_len) const -> bool;
+  // search_len >= kSimdMinLen, in 32-byte blocks if the CPU has AVX2
   auto simdSearch(const label_t target, position_t& pos,
                   const position_t search_len) const -> bool;
   auto linearSearch(const label_t target, position_t& pos,
@@ -43,16 +60,28 @@ class LabelVector {
                                const position_t search_len) const -> bool;
   auto linearSearchGreaterThan(const label_t target, position_t& pos,
                                const position_t search_len) const -> bool;
+  auto simdSearchGreaterThan(const label_t target, position_t& pos,
+                             const position_t search_len) const -> bool;
+
+  // The shortest node searched with SIMD, one SSE2 block
+  static const position_t kSimdMinLen = 16;
 
   void serialize(char*& dst) const;
 
-  static auto deSerialize(char*& src) -> LabelVector*;
+  // borrowed: point into src, which must outlive the result, not copy it
+  static auto deSerialize(char*& src, bool borrowed = false) -> LabelVector*;
 
-  void destroy() { delete[] labels_; }
+  void destroy() {
+    if (!borrowed_) {
+      delete[] labels_;
+    }
+  }
 
  private:
   position_t num_bytes_;
   label_t* labels_;
+  // labels_ points into the serialized filter, which owns it
+  bool borrowed_ = false;
 };
 
 }  // namespace oasis_plus
\ No newline at end of file
@@ -24,7 +24,7 @@ class LoudsDense {
           send_out_node_num_(0),
           key_len_(0){};
 
-    Iter(LoudsDense* trie);
+    Iter(const LoudsDense* trie);
 
     void clear();
     auto isValid() const -> bool { return is_valid_; };
@@ -41,7 +41,7 @@ class LoudsDense {
     // PROTEUS
     auto prefixFilterTrue() const -> bool { return prefix_filter_true_; };
     template <typename T>
-    auto compare(const T& key, PrefixBF* prefix_filter) const -> int;
+    auto compare(const T& key, const PrefixBF* prefix_filter) const -> int;
 
     auto getKey() const -> std::string;
     auto getSendOutNodeNum() const -> position_t { return send_out_node_num_; };
@@ -79,12 +79,14 @@ class LoudsDense {
     // If true, immediately return true overall
     bool prefix_filter_true_;
 
-    LoudsDense* trie_;
+    const LoudsDense* trie_;
     position_t send_out_node_num_;
     level_t key_len_;  // Does NOT include suffix
 
-    std::vector<label_t> key_;
-    std::vector<position_t> pos_in_trie_;
+    // fixed size, so that an iterator lives on the caller's stack without
+    // allocating
+    label_t key_[kMaxTrieHeight];
+    position_t pos_in_trie_[kMaxTrieHeight];
 
     friend class LoudsDense;
     friend class Proteus;  // Allow LoudsSparse to get access to key prefix in
@@ -100,13 +102,24 @@ class LoudsDense {
   // Returns whether key exists in the trie so far
   // out_node_num == 0 means search terminates in louds-dense.
   template <typename T>
-  auto lookupKey(const T& key, PrefixBF* prefix_filter,
+  auto lookupKey(const T& key, const PrefixBF* prefix_filter,
                  position_t& out_node_num) const -> bool;
 
+  // One level of lookupKey(), so that the lookups of a batch can take turns:
+  // looks edited_key's byte at level up in node node_num and, on kNext,
+  // moves node_num to its child and prefetches the bits the next level reads
+  template <typename T>
+  auto lookupLevel(const T& key, const std::string& edited_key,
+                   const level_t level, position_t& node_num,
+                   const PrefixBF* prefix_filter) const -> LookupStep;
+
+  // Prefetches the bits of label in node node_num
+  void prefetchLabel(const position_t node_num, const label_t label) const;
+
   // return value indicates potential false positive
   template <typename T>
   auto moveToKeyGreaterThan(const T& lq, const T& rq, LoudsDense::Iter& iter,
-                            PrefixBF* prefix_filter) const -> bool;
+                            const PrefixBF* prefix_filter) const -> bool;
 
   auto getHeight() const -> uint64_t { return height_; };
   auto getTrieDepth() const -> uint32_t { return trie_depth_; };
@@ -115,7 +128,9 @@ class LoudsDense {
 
   void serialize(char*& dst) const;
 
-  static auto deSerialize(char*& src, uint32_t trie_depth) -> LoudsDense*;
+  // borrowed: see BitvectorRank::deSerialize()
+  static auto deSerialize(char*& src, uint32_t trie_depth,
+                          bool borrowed = false) -> LoudsDense*;
 
   void destroy();
 
@@ -129,11 +144,11 @@ class LoudsDense {
   auto compareSuffixGreaterThan(const position_t pos, const level_t level,
                                 const uint64_t lq, const uint64_t rq,
                                 std::string& edited_lq, LoudsDense::Iter& iter,
-                                PrefixBF* prefix_filter) const -> bool;
+                                const PrefixBF* prefix_filter) const -> bool;
   auto compareSuffixGreaterThan(const position_t pos, const level_t level,
                                 const std::string& lq, const std::string& rq,
                                 std::string& edited_lq, LoudsDense::Iter& iter,
-                                PrefixBF* prefix_filter) const -> bool;
+                                const PrefixBF* prefix_filter) const -> bool;
 
  private:
   static const position_t kNodeFanout = 256;
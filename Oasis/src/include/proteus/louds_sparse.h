@@ -25,7 +25,7 @@ class LoudsSparse {
           start_node_num_(0),
           key_len_(0){};
 
-    Iter(LoudsSparse* trie);
+    Iter(const LoudsSparse* trie);
 
     void clear();
     auto isValid() const -> bool { return is_valid_; };
@@ -33,7 +33,7 @@ class LoudsSparse {
 
     // PROTEUS
     template <typename T>
-    auto compare(const T& key, PrefixBF* prefix_filter,
+    auto compare(const T& key, const PrefixBF* prefix_filter,
                  const std::string& dense_prefix) const -> int;
 
     auto getKey() const -> std::string;
@@ -59,14 +59,16 @@ class LoudsSparse {
     // PROTEUS
     bool is_done_;  // True means range query is done and is true overall
 
-    LoudsSparse* trie_;
+    const LoudsSparse* trie_;
     level_t start_level_;
     position_t start_node_num_;  // Passed in by the dense iterator; default = 0
     level_t
         key_len_;  // Start counting from start_level_; does NOT include suffix
 
-    std::vector<label_t> key_;
-    std::vector<position_t> pos_in_trie_;
+    // fixed size, so that an iterator lives on the caller's stack without
+    // allocating
+    label_t key_[kMaxTrieHeight];
+    position_t pos_in_trie_[kMaxTrieHeight];
 
     friend class LoudsSparse;
   };
@@ -80,13 +82,27 @@ class LoudsSparse {
   // point query: trie walk starts at node "in_node_num" instead of root
   // in_node_num is provided by louds-dense's lookupKey function
   template <typename T>
-  auto lookupKey(const T& key, PrefixBF* prefix_filter,
+  auto lookupKey(const T& key, const PrefixBF* prefix_filter,
                  const position_t in_node_num) const -> bool;
 
+  // One level of lookupKey(), so that the lookups of a batch can take turns,
+  // in two steps as a node is found through a select before it is read:
+  // seekNode() returns the position of node node_num and prefetches its
+  // labels, then lookupLevel() looks edited_key's byte at level up in it and,
+  // on kNext, moves node_num to its child, whose select sample it prefetches
+  auto seekNode(const position_t node_num) const -> position_t;
+  template <typename T>
+  auto lookupLevel(const T& key, const std::string& edited_key,
+                   const level_t level, position_t pos, position_t& node_num,
+                   const PrefixBF* prefix_filter) const -> LookupStep;
+
+  // Prefetches the select sample seekNode(node_num) starts from
+  void prefetchNode(const position_t node_num) const;
+
   // return value indicates potential false positive
   template <typename T>
   auto moveToKeyGreaterThan(const T& lq, const T& rq, LoudsSparse::Iter& iter,
-                            PrefixBF* prefix_filter) const -> bool;
+                            const PrefixBF* prefix_filter) const -> bool;
 
   auto getHeight() const -> level_t { return height_; };
   auto getStartLevel() const -> level_t { return start_level_; };
@@ -95,7 +111,9 @@ class LoudsSparse {
   auto getMemoryUsage() const -> uint64_t;
 
   void serialize(char*& dst) const;
-  static auto deSerialize(char*& src, uint32_t trie_depth) -> LoudsSparse*;
+  // borrowed: see BitvectorRank::deSerialize()
+  static auto deSerialize(char*& src, uint32_t trie_depth,
+                          bool borrowed = false) -> LoudsSparse*;
 
   void destroy();
 
@@ -114,11 +132,11 @@ class LoudsSparse {
   auto compareSuffixGreaterThan(const position_t pos, const level_t level,
                                 const uint64_t lq, const uint64_t rq,
                                 std::string& edited_lq, LoudsSparse::Iter& iter,
-                                PrefixBF* prefix_filter) const -> bool;
+                                const PrefixBF* prefix_filter) const -> bool;
   auto compareSuffixGreaterThan(const position_t pos, const level_t level,
                                 const std::string& lq, const std::string& rq,
                                 std::string& edited_lq, LoudsSparse::Iter& iter,
-                                PrefixBF* prefix_filter) const -> bool;
+                                const PrefixBF* prefix_filter) const -> bool;
 
  private:
   static const position_t kRankBasicBlockSize = 512;
@@ -11,6 +11,27 @@ namespace oasis_plus {
 
 typedef std::array<std::pair<size_t, size_t>, 64> bin_array;
 
+// The empty queries each Proteus configuration resolves, see find_best_conf()
+struct ConfCounters {
+  size_t empty_queries = 0;
+  // Queries resolved in the trie, for every trie configuration
+  std::vector<size_t> resolved_in_trie;
+  // Queries resolved in the Bloom filter, binned by the number of prefix
+  // queries, for every trie and Bloom filter configuration
+  std::vector<std::vector<bin_array>> conf_counters;
+  // Bins hold the prefix queries of each of their queries, not their sum
+  bool per_query = false;
+};
+
+// The FPR of a probe of a prefix Bloom filter of nbits and of an empty range
+// query of prefix_queries prefixes in it, levels and blocked as in
+// PrefixBF::PrefixBF()
+auto pbfProbeFPR(long double nbits, const std::vector<size_t>& key_prefixes,
+                 size_t bf_len, uint32_t levels, bool blocked = false)
+    -> long double;
+auto pbfRangeFPR(long double probe_fpr, uint32_t levels,
+                 long double prefix_queries) -> long double;
+
 class ProteusModeling {
  public:
   ProteusModeling(const size_t max_klen, const size_t max_qlen = 10)
@@ -19,6 +40,9 @@ class ProteusModeling {
         key_prefixes_(max_klen_ + 1, 0),
         bf_mem_(max_klen_ + 1, 0.0L) {}
 
+  // Only the integer key modeling is incremental: the trie sizes and the
+  // counters of the queries are computed on the first call and answer every
+  // bits_per_key after it, so keys and sample_queries must not change.
   template <typename T>
   auto modeling(const std::vector<T>& keys,
                 const std::vector<std::pair<T, T>>& sample_queries,
@@ -36,13 +60,22 @@ class ProteusModeling {
     assert(key_prefixes_.size() == key_prefixes.size());
     memcpy(key_prefixes_.data(), key_prefixes.data(),
            key_prefixes.size() * sizeof(size_t));
+    trie_mem_dist_.clear();
+    counted_ = false;
   }
 
   void set_qk_dists(const std::vector<size_t>& qk_dists) {
     qk_dists_.resize(qk_dists.size());
     memcpy(qk_dists_.data(), qk_dists.data(), qk_dists.size() * sizeof(size_t));
+    counted_ = false;
   }
 
+  // the levels of the prefix Bloom filter of integer keys, see
+  // PrefixBF::PrefixBF()
+  void set_pbf_levels(uint32_t levels) { pbf_levels_ = levels; }
+  // whether it is cache-line-blocked, see PrefixBF::PrefixBF()
+  void set_pbf_blocked(bool blocked) { pbf_blocked_ = blocked; }
+
   auto get_bf_mem(size_t trie_depth) const -> long double {
     return bf_mem_[trie_depth];
   }
@@ -57,12 +90,22 @@ class ProteusModeling {
   // Number of unique key prefixes for every prefix length
   std::vector<size_t> key_prefixes_;
   std::vector<size_t> qk_dists_;
+  uint32_t pbf_levels_ = 1;
+  bool pbf_blocked_ = false;
   // Bloom filter memory available for every trie depth
   std::vector<long double> bf_mem_;
-  long double trie_mem_;
+  long double trie_mem_ = 0;
+
+  // Trie memory and best sparse-dense cutoff for every trie depth, they only
+  // depend on key_prefixes_
+  std::vector<size_t> trie_mem_dist_;
+  std::vector<size_t> sd_cutoffs_;
+  // Counters over all integer key configurations, once counted_
+  bool counted_ = false;
+  ConfCounters counters_;
 
   // set when the model find the best config
-  long double min_fpp_;
+  long double min_fpp_ = 0;
 };
 
 }  // namespace oasis_plus
@@ -10,6 +10,18 @@ namespace oasis_plus {
 const uint32_t MAX_PBF_HASH_FUNCS = 32;
 
 class PrefixBF {
+ public:
+  /* bits per line of a blocked filter, one cache line */
+  static const uint32_t kLineShift = 9;
+  static const uint64_t kLineBits = 1ULL << kLineShift;
+
+ private:
+  /* the prefix length word also holds levels - 1 from this bit on */
+  static const uint32_t kLevelShift = 16;
+  static const uint32_t kLevelMask = 0xFF;
+  /* and this flag for blocked filters */
+  static const uint32_t kBlockedFlag = 1U << 24;
+
  public:
   /*
       Hash key prefixes of specified length into the Bloom filter
@@ -18,37 +30,81 @@ class PrefixBF {
       of seeds is generated. We set a maximum of 32 hash functions to bound
       filter latency when the number of filter elements is small. This can
       happen if a shorter prefix length is chosen.
+
+      With levels > 1, integer keys are also hashed by their prefixes 1 to
+      levels - 1 bits shorter, as in Rosetta, so a range query probes the
+      aligned dyadic pieces covering it, O(levels) of them plus its width
+      at the coarsest level, instead of every prefix in it. A positive
+      piece is checked down to full length prefixes, so the FPR stays that
+      of a point query, at the cost of the bits the other levels take.
+
+      With blocked, integer key prefixes are hashed once, by a 64-bit mix,
+      and all their bits are set in the one 64-byte line the upper half of
+      the hash picks, from the lower half by double hashing, as RocksDB's
+      FastLocalBloomImpl does. A probe then reads a single cache line
+      instead of one per hash function, for a slightly higher FPR.
   */
   PrefixBF(uint32_t prefix_len, uint64_t nbits,
-           const std::vector<uint64_t>& keys);
+           const std::vector<uint64_t>& keys, uint32_t levels = 1,
+           bool blocked = false);
 
   PrefixBF(uint32_t prefix_len, uint64_t nbits,
            const std::vector<std::string>& keys);
 
+  /* with borrowed, the bit array is data, which must outlive the filter */
   PrefixBF(uint32_t prefix_len, uint8_t* data, std::vector<uint32_t> seeds32,
-           std::vector<std::pair<uint64_t, uint64_t>> seeds64, uint64_t nmod);
+           std::vector<std::pair<uint64_t, uint64_t>> seeds64, uint64_t nmod,
+           uint32_t levels = 1, bool blocked = false, bool borrowed = false);
 
   ~PrefixBF() { delete[] data_; }
 
   uint32_t getPrefixLen() const { return prefix_len_; }
+  uint32_t getLevels() const { return levels_; }
+  bool isBlocked() const { return blocked_; }
 
-  auto Query(const uint64_t key, bool shift = true) -> bool;
-  auto Query(const uint64_t from, const uint64_t to) -> bool;
+  auto Query(const uint64_t key, bool shift = true) const -> bool;
+  auto Query(const uint64_t from, const uint64_t to) const -> bool;
 
-  auto Query(const std::string& key) -> bool;
-  auto Query(const std::string& from, const std::string& to) -> bool;
+  auto Query(const std::string& key) const -> bool;
+  auto Query(const std::string& from, const std::string& to) const -> bool;
 
+  auto serializedSize() const -> uint64_t;
+  // Writes serializedSize() bytes at dst
+  void serializeInto(uint8_t* dst) const;
   auto serialize() const -> std::pair<uint8_t*, uint64_t>;
-  static auto deserialize(uint8_t* ser) -> std::pair<PrefixBF*, uint64_t>;
+  static auto deserialize(uint8_t* ser, bool borrowed = false)
+      -> std::pair<PrefixBF*, uint64_t>;
 
   auto get(uint64_t i) const -> bool;
   void set(uint64_t i, bool v);
 
-  auto hash(const uint64_t edited_key, const uint32_t& seed) -> uint64_t;
+  auto hash(const uint64_t edited_key, const uint32_t& seed) const -> uint64_t;
+
+ private:
+  /* the seed of the i-th hash function for prefixes `level` bits shorter */
+  auto level_seed(size_t i, uint32_t level) const -> uint32_t {
+    return seeds32_[i] + level * 0x9E3779B9U;
+  }
+  /* prefix, `level` bits shorter than prefix_len_, may be a key's prefix */
+  auto probe(uint64_t prefix, uint32_t level) const -> bool;
+
+  /* zeroed bits_ of nmod_ bits, on a line boundary if blocked_ */
+  void alloc_bits();
+  /* the hash of a prefix in a blocked filter */
+  auto line_hash(uint64_t prefix, uint32_t level) const -> uint64_t;
+  /* byte offset in bits_ of the line of a hash */
+  auto line_offset(uint64_t hash) const -> uint64_t;
+  void set_line(uint64_t prefix, uint32_t level);
+  auto get_line(uint64_t prefix, uint32_t level) const -> bool;
 
  private:
   uint32_t prefix_len_;
-  uint8_t* data_;
+  uint32_t levels_ = 1;
+  bool blocked_ = false;
+  /* nullptr if the bit array is borrowed */
+  uint8_t* data_ = nullptr;
+  /* the bit array in data_ */
+  uint8_t* bits_;
   // Number of hash functions is given by the size of the seed vector
   // (seeds32_ for uint64 keys, and seeds128_ for string keys)
   std::vector<uint32_t> seeds32_;
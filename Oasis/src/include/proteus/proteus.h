@@ -34,7 +34,7 @@ class Proteus {
     // PROTEUS
     template <typename T>
     auto compare(const T& key, bool valid_dense, bool valid_sparse,
-                 PrefixBF* prefix_filter) const -> int;
+                 const PrefixBF* prefix_filter) const -> int;
 
     auto getKey() const -> std::string;
 
@@ -52,33 +52,54 @@ class Proteus {
   };
 
  public:
+  // # lookups QueryBatch() interleaves
+  static const size_t kQueryBatch = 16;
+
   Proteus(){};
 
   //------------------------------------------------------------------
   // Input keys must be SORTED
   //------------------------------------------------------------------
 
+  // pbf_levels, pbf_blocked: see PrefixBF::PrefixBF(), only for integer keys
   template <typename T>
   Proteus(const std::vector<T>& keys, const size_t trie_depth,
           const size_t sparse_dense_cutoff, const size_t prefix_length,
-          const double bpk);
+          const double bpk, const uint32_t pbf_levels = 1,
+          const bool pbf_blocked = false);
 
   ~Proteus();
 
   // PROTEUS
+  // Queries only read the filter: the range query keeps its iterator on the
+  // stack, so concurrent queries on one instance are safe
   template <typename T>
   auto Query(const T& key) const -> bool;
   template <typename T>
-  auto Query(const T& left_key, const T& right_key) -> bool;
+  auto Query(const T& left_key, const T& right_key) const -> bool;
+
+  // out[i] = Query(keys[i]). Up to kQueryBatch lookups walk the trie in turns,
+  // a level each, and each prefetches what its next level reads before the
+  // others run, so that their cache misses overlap. With OASIS_QUERY_STATS,
+  // the stage that answers each lookup is counted, the trie or the prefix
+  // Bloom filter, as OasisPlus counts it for Query()
+  template <typename T>
+  void QueryBatch(const T* keys, const size_t n, bool* out) const;
 
   auto trieSerializedSize() const -> uint64_t;
   auto getMemoryUsage() const -> uint64_t;
   auto getHeight() const -> level_t;
   auto getSparseStartLevel() const -> level_t;
 
+  auto serializedSize() const -> uint64_t;
+  // Writes serializedSize() bytes at dst, which is 8-byte aligned
+  void serializeInto(uint8_t* dst) const;
   auto serialize() const -> std::pair<uint8_t*, size_t>;
 
-  static auto deSerialize(char* src) -> std::pair<Proteus*, size_t>;
+  // With borrowed, the tries and the prefix Bloom filter read src in place
+  // instead of copying it, so src must outlive the result
+  static auto deSerialize(char* src, bool borrowed = false)
+      -> std::pair<Proteus*, size_t>;
 
   void destroy();
 
@@ -92,7 +113,6 @@ class Proteus {
   LoudsDense* louds_dense_;
   LoudsSparse* louds_sparse_;
   SuRFBuilder* builder_;
-  Proteus::Iter iter_;
   PrefixBF* prefix_filter;
   uint32_t trie_depth_;
   uint32_t sparse_dense_cutoff_;
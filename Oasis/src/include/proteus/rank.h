@@ -35,11 +35,14 @@ class BitvectorRank : public Bitvector {
 
   void serialize(char*& dst) const;
 
-  static auto deSerialize(char*& src) -> BitvectorRank*;
+  // borrowed: point into src, which must outlive the result, not copy it
+  static auto deSerialize(char*& src, bool borrowed = false) -> BitvectorRank*;
 
   void destroy() {
-    delete[] bits_;
-    delete[] rank_lut_;
+    if (!borrowed_) {
+      delete[] bits_;
+      delete[] rank_lut_;
+    }
   }
 
  private:
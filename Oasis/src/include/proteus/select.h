@@ -34,11 +34,18 @@ class BitvectorSelect : public Bitvector {
 
   void serialize(char*& dst) const;
 
-  static auto deSerialize(char*& src) -> BitvectorSelect*;
+  // Prefetches the sample select(rank) starts from
+  void prefetch(position_t rank) const;
+
+  // borrowed: point into src, which must outlive the result, not copy it
+  static auto deSerialize(char*& src, bool borrowed = false)
+      -> BitvectorSelect*;
 
   void destroy() {
-    delete[] bits_;
-    delete[] select_lut_;
+    if (!borrowed_) {
+      delete[] bits_;
+      delete[] select_lut_;
+    }
   }
 
  private:
@@ -56,7 +56,9 @@ class BitvectorSuffix : public Bitvector {
 
   void serialize(char*& dst) const;
 
-  static auto deSerialize(char*& src) -> BitvectorSuffix*;
+  // borrowed: point into src, which must outlive the result, not copy it
+  static auto deSerialize(char*& src, bool borrowed = false)
+      -> BitvectorSuffix*;
 
   void destroy();
 };
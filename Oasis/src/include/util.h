@@ -11,6 +11,10 @@
 #include <string>
 #include <vector>
 
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 namespace oasis_plus {
 #define BIT2BYTE(b_size) ((b_size + 7ULL) >> 3)
 
@@ -27,6 +31,18 @@ static const size_t kPopCount[256] = {
     4, 5, 5, 6, 5, 6, 6, 7, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
     4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8};
 
+/* position of the rank-th (from 0) set bit of word, rank < popcount(word) */
+inline size_t select64(uint64_t word, uint64_t rank) {
+#if defined(__BMI2__)
+  return __builtin_ctzll(_pdep_u64(1ULL << rank, word));
+#else
+  for (; rank > 0; --rank) {
+    word &= word - 1;
+  }
+  return __builtin_ctzll(word);
+#endif
+}
+
 inline void size_align(uint32_t& size) { size = (size + 7UL) & ~(7UL); }
 inline void size_align(uint64_t& size) { size = (size + 7ULL) & ~(7ULL); }
 
@@ -3,145 +3,47 @@
 #include <cassert>
 #include <cstring>
 
+#include "oasis/query_stats.hpp"
 #include "util.h"
 
 namespace oasis_plus {
-BitSet::BitSet(size_t nkeys, uint64_t max_range, uint8_t *data)
+BitSet::BitSet(size_t nkeys, uint64_t max_range, const uint8_t *data)
     : nkeys_(nkeys) {
   lower_bit_len_ = get_lower_bit_length(max_range);
   b_size_ = bit_array_bsize(max_range);
   data_ = data;
 }
 
-auto BitSet::query(uint64_t query) -> bool {
-  size_t up_idx = lower_bit_len_ * nkeys_;
-  uint64_t up_query = query >> lower_bit_len_;
-
-  // upper bit search
-  size_t zero_cnt = 0;
-  size_t range = 0;
-  uint64_t upper = 0;
-  while (upper <= up_query && up_idx < b_size_) {
-    if (data_[up_idx >> 3] & (1U << (up_idx & 0x7ULL))) {
-      ++up_idx;
-      ++upper;
-    } else {
-      size_t next_idx = find_next_set_bit(up_idx);
-      size_t delta = next_idx - up_idx;
-      if (upper == up_query) {
-        range = delta;
-        break;
-      }
-      zero_cnt += delta;
-      up_idx = next_idx;
-    }
-  }
-
-  if (range == 0) {
-    return false;
-  } else if (lower_bit_len_ == 0) {
-    return true;
-  }
-
-  // lower bit search
-  uint64_t low_query = query & ((1 << lower_bit_len_) - 1);
-  size_t low_idx = zero_cnt * lower_bit_len_;
-  while (low_idx < (zero_cnt + range) * lower_bit_len_) {
-    uint64_t low_key = 0;
-    uint64_t bit_cnt = 0;
-    while (bit_cnt < lower_bit_len_) {
-      uint64_t byte_bias = low_idx & 0x7ULL;
-      uint64_t delta = std::min((8 - byte_bias), lower_bit_len_ - bit_cnt);
-      uint64_t tmp_mask = (1 << delta) - 1;
-      uint64_t cur_data = (data_[low_idx >> 3] >> byte_bias) & tmp_mask;
-      low_key |= cur_data << bit_cnt;
-      bit_cnt += delta;
-      low_idx += delta;
-    }
-    if (low_key >= low_query) {
-      return low_key == low_query;
-    }
-  }
-  return false;
-}
-
-auto BitSet::query(uint64_t left, uint64_t right) -> bool {
-  size_t up_idx = lower_bit_len_ * nkeys_;
-  uint64_t up_left = left >> lower_bit_len_;
-  uint64_t up_right = right >> lower_bit_len_;
-
-  // upper bit search
-  size_t zero_cnt = 0;
-  size_t range = 0;
-  uint64_t upper = 0;
-  std::vector<std::pair<uint64_t, size_t>> upper_keys;
-  while (upper <= up_right && up_idx < b_size_) {
-    if (data_[up_idx >> 3] & (1U << (up_idx & 0x7ULL))) {
-      ++up_idx;
-      ++upper;
-    } else {
-      size_t next_idx = find_next_set_bit(up_idx);
-      size_t delta = next_idx - up_idx;
-      if (upper >= up_left && upper <= up_right) {
-        if (range > 0 && upper < up_right) {
-          return true;
-        }
-
-        upper_keys.emplace_back(upper << lower_bit_len_, delta);
-        range += delta;
-      }
-      zero_cnt += range > 0 ? 0 : delta;
-      up_idx = next_idx;
-    }
-  }
+auto BitSet::query(uint64_t query) const -> bool {
+  uint64_t key;
+  return successor(query, key) && key == query;
+}
 
-  if (range == 0) {
-    return false;
-  } else if (lower_bit_len_ == 0) {
-    return true;
-  }
-
-  size_t key_begin_idx = zero_cnt;
-  size_t low_idx = key_begin_idx * lower_bit_len_;
-  for (const auto &[up_key, n] : upper_keys) {
-    key_begin_idx += n;
-    while (low_idx < key_begin_idx * lower_bit_len_) {
-      uint64_t low_key = 0;
-      uint64_t bit_cnt = 0;
-      while (bit_cnt < lower_bit_len_) {
-        uint64_t byte_bias = low_idx & 0x7ULL;
-        uint64_t delta = std::min((8 - byte_bias), lower_bit_len_ - bit_cnt);
-        uint64_t tmp_mask = (1 << delta) - 1;
-        uint64_t cur_data = (data_[low_idx >> 3] >> byte_bias) & tmp_mask;
-        low_key |= cur_data << bit_cnt;
-        bit_cnt += delta;
-        low_idx += delta;
-      }
-      uint64_t key = low_key | up_key;
-      if (key >= left && key <= right) {
-        return true;
-      }
-      if (key > right) {
-        return false;
-      }
-    }
-  }
-  return false;
+auto BitSet::query(uint64_t left, uint64_t right) const -> bool {
+  uint64_t key;
+  return successor(left, key) && key <= right;
 }
 
 auto BitSet::size() const -> size_t {
-  return BIT2BYTE(b_size_);  // data_ size
+  uint64_t total_quotient = b_size_ - nkeys_ * (1U + lower_bit_len_) - 1;
+  return BIT2BYTE(b_size_) +
+         total_quotient / kSelectSample * sizeof(uint32_t);
 }
 
 auto BitSet::size(size_t nkeys, uint64_t max_range) -> size_t {
   uint64_t lower_bit_len = get_lower_bit_length(nkeys, max_range);
   size_t b_size_ = bit_array_bsize(nkeys, max_range, lower_bit_len);
-  return BIT2BYTE(b_size_);
+  return BIT2BYTE(b_size_) +
+         nsamples(max_range, lower_bit_len) * sizeof(uint32_t);
 }
 
 /** Helping Method */
 auto BitSet::get_lower_bit_length(uint64_t nkeys, uint64_t max_range)
     -> uint64_t {
+  // __builtin_clzl(0) is undefined; an empty range needs no lower bits
+  if (nkeys == 0 || max_range == 0) {
+    return 0;
+  }
   return __builtin_clzl(nkeys) > __builtin_clzl(max_range)
              ? __builtin_clzl(nkeys) - __builtin_clzl(max_range)
              : 0;
@@ -161,17 +63,140 @@ auto BitSet::bit_array_bsize(uint64_t max_range) -> size_t {
   return bit_array_bsize(nkeys_, max_range, lower_bit_len_);
 }
 
-auto BitSet::find_next_set_bit(size_t idx) -> size_t {
-  if (!(data_[idx >> 3] >> (idx & 0x7U))) {
-    idx = (idx & (~static_cast<size_t>(0x7U))) + 8U;
+auto BitSet::nsamples(uint64_t max_range, uint64_t lower_bit_len) -> size_t {
+  return (max_range >> lower_bit_len) / kSelectSample;
+}
+
+auto BitSet::successor(uint64_t key, uint64_t &result) const -> bool {
+  size_t up_begin = lower_bit_len_ * nkeys_;
+  uint64_t up_key = key >> lower_bit_len_;
+  uint64_t total_quotient = b_size_ - up_begin - nkeys_ - 1;
+  if (up_key > total_quotient) {
+    return false;
+  }
+
+  // bucket up_key starts right after the up_key-th 1
+  size_t from = up_begin;
+  uint64_t rank = up_key;
+  if (up_key >= kSelectSample) {
+    uint32_t sample;
+    memcpy(&sample,
+           data_ + BIT2BYTE(b_size_) +
+               (up_key / kSelectSample - 1) * sizeof(uint32_t),
+           sizeof(uint32_t));
+    from += sample;
+    rank = up_key % kSelectSample;
+  }
+  size_t bucket_begin = select_one(from, rank);
+  if (bucket_begin >= b_size_) {
+    return false;
+  }
+
+  // the 0s up to here are the keys of the lower buckets, the ones after the
+  // last key only pad the bit array
+  size_t key_idx = bucket_begin - up_begin - up_key;
+  size_t bucket_end = find_next_set_bit(bucket_begin);
+  uint64_t low_key = key & ((1ULL << lower_bit_len_) - 1);
+  for (size_t pos = bucket_begin; pos < bucket_end && key_idx < nkeys_;
+       ++pos, ++key_idx) {
+    uint64_t lower = get_lower(key_idx);
+    if (lower >= low_key) {
+      result = (up_key << lower_bit_len_) | lower;
+      return true;
+    }
+  }
+
+  // otherwise the first key of the next non-empty bucket
+  if (key_idx >= nkeys_) {
+    return false;
+  }
+  size_t next_key = find_next_unset_bit(bucket_end);
+  up_key += next_key - bucket_end;
+  result = (up_key << lower_bit_len_) | get_lower(key_idx);
+  return true;
+}
+
+auto BitSet::get_word(size_t idx) const -> uint64_t {
+  size_t nbytes = BIT2BYTE(b_size_);
+  size_t offset = idx * sizeof(uint64_t);
+  if (offset >= nbytes) {
+    return 0;
   }
 
-  while (data_[idx >> 3] == 0) {
-    idx += 8U;
+  uint64_t word = 0;
+  if (offset + sizeof(uint64_t) <= nbytes) {
+    memcpy(&word, data_ + offset, sizeof(uint64_t));
+  } else {
+    /* the block may end the buffer, do not read past it */
+    for (size_t i = offset; i < nbytes; ++i) {
+      word |= static_cast<uint64_t>(data_[i]) << ((i - offset) << 3);
+    }
+  }
+  if ((idx + 1) * 64 > b_size_) {
+    word &= (1ULL << (b_size_ & 63)) - 1;
   }
+  return word;
+}
 
-  idx += __builtin_ctz(data_[idx >> 3] >> (idx & 0x7U));
-  return idx;
+auto BitSet::get_lower(size_t idx) const -> uint64_t {
+  if (lower_bit_len_ == 0) {
+    return 0;
+  }
+  OASIS_STAT_ADD(lower_entries, 1);
+  size_t pos = idx * lower_bit_len_;
+  size_t shift = pos & 63;
+  uint64_t lower = get_word(pos >> 6) >> shift;
+  if (shift + lower_bit_len_ > 64) {
+    lower |= get_word((pos >> 6) + 1) << (64 - shift);
+  }
+  return lower & ((1ULL << lower_bit_len_) - 1);
+}
+
+auto BitSet::select_one(size_t idx, uint64_t rank) const -> size_t {
+  if (rank == 0) {
+    return idx;
+  }
+  size_t word_idx = idx >> 6;
+  uint64_t word = get_word(word_idx) & (~0ULL << (idx & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (true) {
+    uint64_t cnt = __builtin_popcountll(word);
+    if (rank <= cnt) {
+      return word_idx * 64 + select64(word, rank - 1) + 1;
+    }
+    rank -= cnt;
+    if (++word_idx * 64 >= b_size_) {
+      return b_size_;
+    }
+    word = get_word(word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
+  }
+}
+
+auto BitSet::find_next_set_bit(size_t idx) const -> size_t {
+  size_t word_idx = idx >> 6;
+  uint64_t word = get_word(word_idx) & (~0ULL << (idx & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (word == 0) {
+    if (++word_idx * 64 >= b_size_) {
+      return b_size_;
+    }
+    word = get_word(word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
+  }
+  return word_idx * 64 + __builtin_ctzll(word);
+}
+
+auto BitSet::find_next_unset_bit(size_t idx) const -> size_t {
+  size_t word_idx = idx >> 6;
+  /* bits past b_size_ read as 0 and stop the scan */
+  uint64_t word = ~get_word(word_idx) & (~0ULL << (idx & 63));
+  OASIS_STAT_ADD(upper_words, 1);
+  while (word == 0) {
+    word = ~get_word(++word_idx);
+    OASIS_STAT_ADD(upper_words, 1);
+  }
+  return std::min(word_idx * 64 + __builtin_ctzll(word), b_size_);
 }
 
 auto BitSet::build(const std::vector<uint64_t> &keys, uint64_t max_range)
@@ -184,11 +209,23 @@ auto BitSet::build(const std::vector<uint64_t> &keys, uint64_t max_range)
   std::vector<uint8_t> data(data_size, 0);
 
   size_t low_idx = 0;
-  size_t up_idx = lower_bit_len * nkeys;
+  size_t up_begin = lower_bit_len * nkeys;
+  size_t up_idx = up_begin;
+
+  // buckets past the last 1 start at the end of the bit array
+  std::vector<uint32_t> samples(nsamples(max_range, lower_bit_len),
+                                b_size_ - up_begin);
+  auto set_one = [&](uint64_t upper) {
+    data[up_idx >> 3] |= 1 << (up_idx & 0x7ULL);
+    ++up_idx;
+    if (upper % kSelectSample == 0 && upper / kSelectSample <= samples.size()) {
+      samples[upper / kSelectSample - 1] = up_idx - up_begin;
+    }
+  };
 
   uint64_t pre_upper = 0;
   for (size_t i = 0; i < keys.size(); ++i) {
-    uint64_t lower_key = keys[i] & ((1 << lower_bit_len) - 1);
+    uint64_t lower_key = keys[i] & ((1ULL << lower_bit_len) - 1);
     uint64_t bit_cnt = 0;
     while (bit_cnt < lower_bit_len) {
       uint64_t byte_bias = low_idx & 0x7ULL;
@@ -201,14 +238,17 @@ auto BitSet::build(const std::vector<uint64_t> &keys, uint64_t max_range)
     }
 
     while (pre_upper < (keys[i] >> lower_bit_len)) {
-      data[up_idx >> 3] |= 1 << (up_idx & 0x7ULL);
-      ++pre_upper;
-      ++up_idx;
+      set_one(++pre_upper);
     }
     ++up_idx;
   }
-  data[up_idx >> 3] |= 1 << (up_idx & 0x7ULL);
+  set_one(++pre_upper);
+  assert(up_idx <= b_size_);
 
+  const auto *sample_bytes = reinterpret_cast<const uint8_t *>(samples.data());
+  data.insert(data.end(), sample_bytes,
+              sample_bytes + samples.size() * sizeof(uint32_t));
   return data;
 }
-}  // namespace oasis_plus
\ No newline at end of file
+
+}  // namespace oasis_plus
@@ -4,43 +4,54 @@
 #include <cassert>
 #include <cstring>
 
+#include "oasis/query_stats.hpp"
 #include "util.h"
 
 namespace oasis_plus {
 
-LearnedRF::~LearnedRF() { delete[] bitmap_ptr_; }
+LearnedRF::~LearnedRF() {
+  if (!borrowed_) {
+    delete[] bitmap_ptr_;
+  }
+}
 
 auto LearnedRF::query(uint64_t key, size_t interval_idx, uint64_t low,
-                      uint64_t up) -> bool {
+                      uint64_t up) const -> bool {
   auto params = get_params(low, up, interval_idx);
   if (params.first == 0) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelOutOfScope);
     return false;
   }
   uint64_t location = get_location(key - low, interval_idx, params);
 
   if (location < block_bias_[0] || location > block_bias_.back()) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kBlockBias);
     return false;
   }
   auto iter =
       std::upper_bound(block_bias_.begin(), block_bias_.end(), location) - 1;
   if (*iter == location) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kBlockBias);
     return true;
   }
 
   size_t block_idx = iter - block_bias_.begin();
+  OASIS_STAT_STAGE(oasis::QueryStats::kBlockProbe);
   return block_lists_[block_idx].query(location - *iter);
 }
 
 auto LearnedRF::query(uint64_t l_key, uint64_t r_key, size_t interval_idx,
-                      uint64_t low, uint64_t up) -> bool {
+                      uint64_t low, uint64_t up) const -> bool {
   auto params = get_params(low, up, interval_idx);
   if (params.first == 0) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelOutOfScope);
     return false;
   }
   uint64_t l_location = get_location(l_key - low, interval_idx, params);
   uint64_t r_location = get_location(r_key - low, interval_idx, params);
 
   if (r_location < block_bias_[0] || l_location > block_bias_.back()) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kBlockBias);
     return false;
   }
 
@@ -48,31 +59,28 @@ auto LearnedRF::query(uint64_t l_key, uint64_t r_key, size_t interval_idx,
       std::upper_bound(block_bias_.begin(), block_bias_.end(), r_location);
   if (iter == block_bias_.end() || *(--iter) == r_location ||
       l_location <= *iter) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kBlockBias);
     return true;
   }
 
   size_t block_idx = iter - block_bias_.begin();
+  OASIS_STAT_STAGE(oasis::QueryStats::kBlockProbe);
   return block_lists_[block_idx].query(l_location - *iter, r_location - *iter);
 }
 
 auto LearnedRF::serialize() const -> std::pair<uint8_t *, size_t> {
-  size_t meta_sz = sizeof(uint16_t)   /** block_sz_ */
-                   + sizeof(uint16_t) /** last_block_sz_ */
-                   + sizeof(size_t)   /** record size of compressed bitmap */
-                   + sizeof(uint32_t) /** # accumulate_interval_sz_ */
-                   + sizeof(uint32_t) /** # block_lists_ entries */
-                   + bitmap_sz_;      /** size of compressed bitmap  */
-  size_align(meta_sz);
+  size_t size = this->size();
+  uint8_t *ser = new uint8_t[size]();
+  serialize_into(ser);
+  return {ser, size};
+}
 
+void LearnedRF::serialize_into(uint8_t *dst) const {
   uint32_t nintervals = accumulate_interval_sz_.size() - 1;
+  assert(nintervals < kFixedFlag);
+  uint32_t nintervals_word = nintervals | (fixed_ ? kFixedFlag : 0);
   uint32_t nbatches = block_lists_.size();
-  size_t size = meta_sz +
-                sizeof(uint64_t) *
-                    nintervals /** size of accumulate interval size array */
-                + sizeof(uint64_t) * (nbatches + 1); /** size of block_bias_ */
-
-  uint8_t *ser = new uint8_t[size];
-  uint8_t *pos = ser;
+  uint8_t *pos = dst;
 
   memcpy(pos, &block_sz_, sizeof(uint16_t));
   pos += sizeof(uint16_t);
@@ -83,7 +91,7 @@ auto LearnedRF::serialize() const -> std::pair<uint8_t *, size_t> {
   memcpy(pos, &bitmap_sz_, sizeof(size_t));
   pos += sizeof(size_t);
 
-  memcpy(pos, &nintervals, sizeof(uint32_t));
+  memcpy(pos, &nintervals_word, sizeof(uint32_t));
   pos += sizeof(uint32_t);
 
   memcpy(pos, &nbatches, sizeof(uint32_t));
@@ -100,11 +108,11 @@ auto LearnedRF::serialize() const -> std::pair<uint8_t *, size_t> {
 
   memcpy(pos, block_bias_.data(), sizeof(uint64_t) * (nbatches + 1));
   pos += sizeof(uint64_t) * (nbatches + 1);
-
-  return {ser, size};
+  assert(static_cast<size_t>(pos - dst) == size());
 }
 
-auto LearnedRF::deserialize(uint8_t *ser) -> std::pair<LearnedRF *, size_t> {
+auto LearnedRF::deserialize(uint8_t *ser, bool borrowed)
+    -> std::pair<LearnedRF *, size_t> {
   uint8_t *pos = ser;
 
   uint16_t block_sz;
@@ -122,13 +130,18 @@ auto LearnedRF::deserialize(uint8_t *ser) -> std::pair<LearnedRF *, size_t> {
   uint32_t ninterval;
   memcpy(&ninterval, pos, sizeof(uint32_t));
   pos += sizeof(uint32_t);
+  bool fixed = ninterval & kFixedFlag;
+  ninterval &= ~kFixedFlag;
 
   uint32_t nbatches;
   memcpy(&nbatches, pos, sizeof(uint32_t));
   pos += sizeof(uint32_t);
 
-  uint8_t *bitmap_ptr = new uint8_t[bitmap_sz];
-  memcpy(bitmap_ptr, pos, bitmap_sz);
+  uint8_t *bitmap_ptr = pos;
+  if (!borrowed) {
+    bitmap_ptr = new uint8_t[bitmap_sz];
+    memcpy(bitmap_ptr, pos, bitmap_sz);
+  }
   pos += bitmap_sz;
 
   align(pos);
@@ -150,9 +163,11 @@ auto LearnedRF::deserialize(uint8_t *ser) -> std::pair<LearnedRF *, size_t> {
   block_lists.emplace_back(
       last_block_sz, block_bias[nbatches] - block_bias[nbatches - 1], data);
 
-  return {new LearnedRF(block_sz, last_block_sz, bitmap_sz, bitmap_ptr,
-                        accumulate_interval_sz, block_lists, block_bias),
-          pos - ser};
+  auto *learned_rf =
+      new LearnedRF(block_sz, last_block_sz, bitmap_sz, bitmap_ptr,
+                    accumulate_interval_sz, block_lists, block_bias, fixed);
+  learned_rf->borrowed_ = borrowed;
+  return {learned_rf, pos - ser};
 }
 
 auto LearnedRF::size() const -> size_t {
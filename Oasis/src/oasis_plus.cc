@@ -10,9 +10,41 @@
 
 namespace oasis_plus {
 
-OasisPlus::OasisPlus(double bpk, uint32_t block_size,
-                     const std::vector<uint64_t> &keys, const size_t max_qlen) {
+namespace {
+/* proteus->Query(keys...), answered by the prefix Bloom filter if probed */
+template <typename... Keys>
+auto query_proteus(const Proteus *proteus, Keys... keys) -> bool {
+#ifdef OASIS_QUERY_STATS
+  uint64_t pbf_probes = oasis::QueryStats::local().pbf_probes;
+  bool result = proteus->Query(keys...);
+  OASIS_STAT_STAGE(oasis::QueryStats::local().pbf_probes == pbf_probes
+                       ? oasis::QueryStats::kTrie
+                       : oasis::QueryStats::kPrefixBF);
+  return result;
+#else
+  return proteus->Query(keys...);
+#endif
+}
+
+/* out[i] = query_proteus(proteus, keys[i]), looked up together */
+void query_proteus_batch(const Proteus *proteus, const uint64_t *keys,
+                         size_t n, bool *out) {
+  // proteus is nullptr if no segment asks it; QueryBatch() counts the stages
+  if (n > 0) {
+    proteus->QueryBatch(keys, n, out);
+  }
+}
+}  // namespace
+
+OasisPlus::OasisPlus(
+    double bpk, uint32_t block_size, const std::vector<uint64_t> &keys,
+    const size_t max_qlen,
+    std::vector<std::pair<uint64_t, uint64_t>> sample_queries,
+    uint32_t pbf_levels, bool pbf_blocked) {
   FilterBuilder filter_builder(bpk, block_size, max_qlen);
+  filter_builder.set_sample_queries(std::move(sample_queries));
+  filter_builder.set_pbf_levels(pbf_levels);
+  filter_builder.set_pbf_blocked(pbf_blocked);
   filter_builder.build(keys);
   filter_types_ = filter_builder.get_filter_types();
   begins_ = filter_builder.get_begins();
@@ -22,14 +54,53 @@ OasisPlus::OasisPlus(double bpk, uint32_t block_size,
   proteus_ = filter_builder.get_proteus();
 }
 
-auto OasisPlus::query(uint64_t key) -> bool {
+auto OasisPlus::query(uint64_t key) const -> bool {
+  oasis::QueryStatsScope scope(stats_);
+  Answer ans = answer(key);
+  return ans == kAskProteus ? query_proteus(proteus_, key) : ans == kYes;
+}
+
+auto OasisPlus::query(uint64_t l_key, uint64_t r_key) const -> bool {
+  assert(l_key < r_key);
+  oasis::QueryStatsScope scope(stats_);
+  Answer ans = answer(l_key, r_key);
+  return ans == kAskProteus ? query_proteus(proteus_, l_key, r_key + 1)
+                            : ans == kYes;
+}
+
+void OasisPlus::query_batch(const uint64_t *keys, size_t n, bool *out) const {
+  oasis::QueryStatsScope scope(stats_);
+  uint64_t proteus_keys[Proteus::kQueryBatch];
+  size_t active[Proteus::kQueryBatch];
+  bool found[Proteus::kQueryBatch];
+
+  for (size_t begin = 0; begin < n;) {
+    size_t nactive = 0;
+    for (; begin < n && nactive < Proteus::kQueryBatch; ++begin) {
+      Answer ans = answer(keys[begin]);
+      if (ans == kAskProteus) {
+        proteus_keys[nactive] = keys[begin];
+        active[nactive++] = begin;
+      } else {
+        out[begin] = ans == kYes;
+      }
+    }
+    query_proteus_batch(proteus_, proteus_keys, nactive, found);
+    for (size_t i = 0; i < nactive; ++i) {
+      out[active[i]] = found[i];
+    }
+  }
+}
+
+auto OasisPlus::answer(uint64_t key) const -> Answer {
   if (learned_rf_ == nullptr) {
     // single proteus
-    return proteus_->Query(key);
+    return kAskProteus;
   }
 
   if (key < begins_[0] || key > ends_.back()) {
-    return false;
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelOutOfScope);
+    return kNo;
   }
 
   size_t idx =
@@ -38,92 +109,111 @@ auto OasisPlus::query(uint64_t key) -> bool {
       1;
 
   if (ends_[idx] < key) {
-    return false;
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelOutOfScope);
+    return kNo;
   }
   if (begins_[idx] == key || ends_[idx] == key) {
-    return true;
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelExist);
+    return kYes;
   }
 
   if (size_t interval_idx = proteus_ == nullptr ? idx + 1 : filter_types_[idx];
       interval_idx != 0) {
-    return learned_rf_->query(key, interval_idx, begins_[idx], ends_[idx]);
+    return learned_rf_->query(key, interval_idx, begins_[idx], ends_[idx])
+               ? kYes
+               : kNo;
   }
   // return Proteus query
-  return proteus_->Query(key);
+  return kAskProteus;
 }
 
-auto OasisPlus::query(uint64_t l_key, uint64_t r_key) -> bool {
-  assert(l_key < r_key);
-
+auto OasisPlus::answer(uint64_t l_key, uint64_t r_key) const -> Answer {
   if (learned_rf_ == nullptr) {
     // single proteus
-    return proteus_->Query(l_key, r_key + 1);
+    return kAskProteus;
   }
 
   if (l_key > ends_.back() || r_key < begins_[0]) {
-    return false;
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelOutOfScope);
+    return kNo;
+  }
+  // the range holds the first key, and no segment starts before l_key
+  if (l_key <= begins_[0]) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelExist);
+    return kYes;
   }
 
   size_t idx = std::upper_bound(begins_.begin(), begins_.end(), l_key) -
                begins_.begin() - 1;
 
-  if (r_key < begins_[idx + 1] && l_key > ends_[idx]) {
-    return false;
+  if ((idx + 1 == begins_.size() || r_key < begins_[idx + 1]) &&
+      l_key > ends_[idx]) {
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelOutOfScope);
+    return kNo;
   }
   if (!(l_key > begins_[idx] && r_key < ends_[idx])) {
-    return true;
+    OASIS_STAT_STAGE(oasis::QueryStats::kModelExist);
+    return kYes;
   }
 
   if (size_t interval_idx = proteus_ == nullptr ? idx + 1 : filter_types_[idx];
       interval_idx != 0) {
     return learned_rf_->query(l_key, r_key, interval_idx, begins_[idx],
-                              ends_[idx]);
+                              ends_[idx])
+               ? kYes
+               : kNo;
   }
 
   // calling the Proteus
-  return proteus_ != nullptr && proteus_->Query(l_key, r_key + 1);
+  return proteus_ == nullptr ? kNo : kAskProteus;
 }
 
-auto OasisPlus::serialize() const -> std::pair<uint8_t *, size_t> {
+auto OasisPlus::filter_bitmap() const -> uint8_t {
   uint8_t filter_bitmap = 0;
-
-  size_t learned_rf_sz = 0;
-  uint8_t *learned_ptr = nullptr;
   if (learned_rf_ != nullptr) {
     filter_bitmap |= LEARNED_EXIST_BIT;
-    auto data = learned_rf_->serialize();
-    learned_ptr = data.first;
-    learned_rf_sz = data.second;
   }
-
-  size_t proteus_sz = 0;
-  uint8_t *proteus_ptr = nullptr;
   if (proteus_ != nullptr) {
     filter_bitmap |= PROTEUS_EXIST_BIT;
-    auto data = proteus_->serialize();
-    proteus_ptr = data.first;
-    proteus_sz = data.second;
   }
+  return filter_bitmap;
+}
 
+auto OasisPlus::meta_size() const -> size_t {
   size_t meta_sz = sizeof(size_t)     /* # intervals */
                    + sizeof(uint8_t); /* fitler bitmap size*/
-
-  size_t interval_num = begins_.size();
-  size_t bitmap_sz = 0;
-  if (filter_bitmap == (LEARNED_EXIST_BIT | PROTEUS_EXIST_BIT)) {
-    bitmap_sz = BIT2BYTE(interval_num);
-    meta_sz += bitmap_sz;
+  if (filter_bitmap() == (LEARNED_EXIST_BIT | PROTEUS_EXIST_BIT)) {
+    meta_sz += BIT2BYTE(begins_.size());
   }
   size_align(meta_sz);
+  return meta_sz;
+}
 
-  size_t size = meta_sz + learned_rf_sz +
-                2 * sizeof(uint64_t) * interval_num; /* indices size */
+auto OasisPlus::serialized_size() const -> size_t {
+  size_t size = meta_size() + (learned_rf_ == nullptr ? 0 : learned_rf_->size()) +
+                2 * sizeof(uint64_t) * begins_.size(); /* indices size */
   size_align(size);
-  size += proteus_sz;
+  if (proteus_ != nullptr) {
+    size += proteus_->serializedSize();
+  }
+  return size;
+}
+
+auto OasisPlus::serialize() const -> std::pair<uint8_t *, size_t> {
+  size_t size = serialized_size();
+  /* zeroed, so that the alignment padding is deterministic */
+  uint8_t *ser = new uint8_t[size]();
+  serialize_into(ser);
+  return {ser, size};
+}
 
-  uint8_t *ser = new uint8_t[size];
-  uint8_t *pos = ser;
+void OasisPlus::serialize_into(uint8_t *dst) const {
+  uint8_t filter_bitmap = this->filter_bitmap();
+  size_t interval_num = begins_.size();
+  uint8_t *pos = dst;
 
+  /* the filter types are or-ed in */
+  memset(pos, 0, meta_size());
   memcpy(pos, &interval_num, sizeof(size_t));
   pos += sizeof(size_t);
 
@@ -131,41 +221,39 @@ auto OasisPlus::serialize() const -> std::pair<uint8_t *, size_t> {
   pos += sizeof(uint8_t);
 
   if (filter_bitmap == (LEARNED_EXIST_BIT | PROTEUS_EXIST_BIT)) {
-    std::vector<uint8_t> filter_type_bitmap(bitmap_sz, 0);
     for (size_t i = 0; i < interval_num; ++i) {
       if (filter_types_[i] != 0) {
-        filter_type_bitmap[i >> 3] |= 1ULL << (i & 7ULL);
+        pos[i >> 3] |= 1ULL << (i & 7ULL);
       }
     }
-    memcpy(pos, filter_type_bitmap.data(), bitmap_sz);
-    pos += bitmap_sz;
+    pos += BIT2BYTE(interval_num);
   }
 
   align(pos);
 
-  memcpy(pos, begins_.data(), begins_.size() * sizeof(uint64_t));
-  pos += begins_.size() * sizeof(uint64_t);
+  /* a single Proteus has no intervals, and data() may then be null */
+  if (interval_num > 0) {
+    memcpy(pos, begins_.data(), interval_num * sizeof(uint64_t));
+    pos += interval_num * sizeof(uint64_t);
 
-  memcpy(pos, ends_.data(), ends_.size() * sizeof(uint64_t));
-  pos += ends_.size() * sizeof(uint64_t);
+    memcpy(pos, ends_.data(), interval_num * sizeof(uint64_t));
+    pos += interval_num * sizeof(uint64_t);
+  }
 
-  if (learned_ptr != nullptr) {
-    std::memcpy(pos, learned_ptr, learned_rf_sz);
-    pos += learned_rf_sz;
-    delete[] learned_ptr;
+  if (learned_rf_ != nullptr) {
+    learned_rf_->serialize_into(pos);
+    pos += learned_rf_->size();
     align(pos);
   }
 
-  if (proteus_ptr != nullptr) {
-    memcpy(pos, proteus_ptr, proteus_sz);
-    pos += proteus_sz;
-    delete[] proteus_ptr;
+  if (proteus_ != nullptr) {
+    proteus_->serializeInto(pos);
+    pos += proteus_->serializedSize();
   }
-
-  return {ser, size};
+  assert(static_cast<size_t>(pos - dst) == serialized_size());
 }
 
-auto OasisPlus::deserialize(uint8_t *ser) -> OasisPlus * {
+auto OasisPlus::deserialize(uint8_t *ser, bool borrowed) -> OasisPlus * {
   size_t interval_num = 0;
   memcpy(&interval_num, ser, sizeof(size_t));
   ser += sizeof(size_t);
@@ -188,16 +276,18 @@ auto OasisPlus::deserialize(uint8_t *ser) -> OasisPlus * {
   align(ser);
 
   std::vector<uint64_t> begins(interval_num);
-  memcpy(begins.data(), ser, interval_num * sizeof(uint64_t));
-  ser += interval_num * sizeof(uint64_t);
-
   std::vector<uint64_t> ends(interval_num);
-  memcpy(ends.data(), ser, interval_num * sizeof(uint64_t));
-  ser += interval_num * sizeof(uint64_t);
+  if (interval_num > 0) {
+    memcpy(begins.data(), ser, interval_num * sizeof(uint64_t));
+    ser += interval_num * sizeof(uint64_t);
+
+    memcpy(ends.data(), ser, interval_num * sizeof(uint64_t));
+    ser += interval_num * sizeof(uint64_t);
+  }
 
   LearnedRF *learned_rf = nullptr;
   if (bitmap & LEARNED_EXIST_BIT) {
-    auto data = LearnedRF::deserialize(ser);
+    auto data = LearnedRF::deserialize(ser, borrowed);
     learned_rf = data.first;
     ser += data.second;
     align(ser);
@@ -205,7 +295,7 @@ auto OasisPlus::deserialize(uint8_t *ser) -> OasisPlus * {
 
   Proteus *proteus = nullptr;
   if (bitmap & PROTEUS_EXIST_BIT) {
-    auto data = Proteus::deSerialize(reinterpret_cast<char *>(ser));
+    auto data = Proteus::deSerialize(reinterpret_cast<char *>(ser), borrowed);
     proteus = data.first;
     ser += data.second;
   }
@@ -225,9 +315,7 @@ auto OasisPlus::size() const -> size_t {
     size += learned_rf_->size();
   }
   if (proteus_ != nullptr) {
-    auto data = proteus_->serialize();
-    size += data.second;
-    delete[] data.first;
+    size += proteus_->serializedSize();
   }
   return size;
 }
@@ -42,6 +42,8 @@ auto Bitvector::readBit(const position_t pos) const -> bool {
 
 auto Bitvector::distanceToNextSetBit(const position_t pos) const -> position_t {
   assert(pos < num_bits_);
+  // the last bit has no successor, and its next word may lie past bits_
+  if (pos + 1 == num_bits_) return 1;
   position_t distance = 1;
 
   position_t word_id = (pos + 1) / kWordSize;
@@ -1,8 +1,134 @@
 #include "proteus/label_vector.h"
 
+#include <cassert>
 #include <cstring>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace oasis_plus {
+
+namespace {
+#if defined(__x86_64__)
+// Masks of the labels of a block equal to / greater than target
+inline auto maskEqual(const label_t* block, __m128i target) -> unsigned {
+  __m128i labels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(labels, target));
+}
+
+inline auto maskGreaterThan(const label_t* block, __m128i target)
+    -> unsigned {
+  // There is no unsigned byte compare: label <= target iff it is the min
+  __m128i labels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+  __m128i le = _mm_cmpeq_epi8(_mm_min_epu8(labels, target), labels);
+  return ~_mm_movemask_epi8(le) & 0xFFFFU;
+}
+
+__attribute__((target("avx2"))) inline auto maskEqual(const label_t* block,
+                                                      __m256i target)
+    -> unsigned {
+  __m256i labels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(labels, target));
+}
+
+__attribute__((target("avx2"))) inline auto maskGreaterThan(
+    const label_t* block, __m256i target) -> unsigned {
+  __m256i labels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  __m256i le = _mm256_cmpeq_epi8(_mm256_min_epu8(labels, target), labels);
+  return ~_mm256_movemask_epi8(le);
+}
+
+// The first set bit of the mask of the block of width labels ending at len,
+// past the labels [len - width, from) the blocks before it checked, or len
+inline auto lastBlock(unsigned mask, position_t from, position_t len,
+                      position_t width) -> position_t {
+  if (from == len) return len;
+  mask >>= from - (len - width);
+  return mask ? from + __builtin_ctz(mask) : len;
+}
+#endif
+
+// findLabel*() on the widest kernel the CPU runs, checked once
+auto findLabel(const label_t* labels, position_t len, label_t target)
+    -> position_t {
+#if defined(__x86_64__)
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx2 && len >= 32) return findLabelAVX2(labels, len, target);
+  return findLabelSSE2(labels, len, target);
+#else
+  for (position_t i = 0; i < len; i++)
+    if (labels[i] == target) return i;
+  return len;
+#endif
+}
+
+auto findLabelGreaterThan(const label_t* labels, position_t len,
+                          label_t target) -> position_t {
+#if defined(__x86_64__)
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx2 && len >= 32) return findLabelGreaterThanAVX2(labels, len, target);
+  return findLabelGreaterThanSSE2(labels, len, target);
+#else
+  for (position_t i = 0; i < len; i++)
+    if (labels[i] > target) return i;
+  return len;
+#endif
+}
+}  // namespace
+
+#if defined(__x86_64__)
+auto findLabelSSE2(const label_t* labels, position_t len, label_t target)
+    -> position_t {
+  assert(len >= 16);
+  __m128i t = _mm_set1_epi8(static_cast<char>(target));
+  position_t from = 0;
+  for (; from + 16 <= len; from += 16) {
+    unsigned mask = maskEqual(labels + from, t);
+    if (mask) return from + __builtin_ctz(mask);
+  }
+  return lastBlock(maskEqual(labels + len - 16, t), from, len, 16);
+}
+
+__attribute__((target("avx2"))) auto findLabelAVX2(const label_t* labels,
+                                                   position_t len,
+                                                   label_t target)
+    -> position_t {
+  assert(len >= 32);
+  __m256i t = _mm256_set1_epi8(static_cast<char>(target));
+  position_t from = 0;
+  for (; from + 32 <= len; from += 32) {
+    unsigned mask = maskEqual(labels + from, t);
+    if (mask) return from + __builtin_ctz(mask);
+  }
+  return lastBlock(maskEqual(labels + len - 32, t), from, len, 32);
+}
+
+auto findLabelGreaterThanSSE2(const label_t* labels, position_t len,
+                              label_t target) -> position_t {
+  assert(len >= 16);
+  __m128i t = _mm_set1_epi8(static_cast<char>(target));
+  position_t from = 0;
+  for (; from + 16 <= len; from += 16) {
+    unsigned mask = maskGreaterThan(labels + from, t);
+    if (mask) return from + __builtin_ctz(mask);
+  }
+  return lastBlock(maskGreaterThan(labels + len - 16, t), from, len, 16);
+}
+
+__attribute__((target("avx2"))) auto findLabelGreaterThanAVX2(
+    const label_t* labels, position_t len, label_t target) -> position_t {
+  assert(len >= 32);
+  __m256i t = _mm256_set1_epi8(static_cast<char>(target));
+  position_t from = 0;
+  for (; from + 32 <= len; from += 32) {
+    unsigned mask = maskGreaterThan(labels + from, t);
+    if (mask) return from + __builtin_ctz(mask);
+  }
+  return lastBlock(maskGreaterThan(labels + len - 32, t), from, len, 32);
+}
+#endif
+
 LabelVector::LabelVector(
     const std::vector<std::vector<label_t> >& labels_per_level,
     const level_t start_level, level_t end_level /* non-inclusive */) {
@@ -10,9 +136,8 @@ LabelVector::LabelVector(
   for (level_t level = start_level; level < end_level; level++)
     num_bytes_ += labels_per_level[level].size();
 
-  position_t alloc_bytes = num_bytes_ * (num_bytes_ / kWordSize + 1);
-  labels_ = new label_t[alloc_bytes];
-  for (position_t i = 0; i < alloc_bytes; i++) labels_[i] = 0;
+  // The searches read no label past num_bytes_, so it needs no padding
+  labels_ = new label_t[num_bytes_]();
 
   position_t pos = 0;
   for (level_t level = start_level; level < end_level; level++) {
@@ -44,7 +169,7 @@ auto LabelVector::operator[](const position_t pos) const -> label_t {
 auto LabelVector::search(const label_t target, position_t& pos,
                          position_t search_len) const -> bool {
   if (search_len < 3) return linearSearch(target, pos, search_len);
-  if (search_len < 12)
+  if (search_len < kSimdMinLen)
     return binarySearch(target, pos, search_len);
   else
     return simdSearch(target, pos, search_len);
@@ -54,8 +179,10 @@ auto LabelVector::searchGreaterThan(const label_t target, position_t& pos,
                                     position_t search_len) const -> bool {
   if (search_len < 3)
     return linearSearchGreaterThan(target, pos, search_len);
-  else
+  if (search_len < kSimdMinLen)
     return binarySearchGreaterThan(target, pos, search_len);
+  else
+    return simdSearchGreaterThan(target, pos, search_len);
 }
 
 auto LabelVector::binarySearch(const label_t target, position_t& pos,
@@ -78,36 +205,10 @@ auto LabelVector::binarySearch(const label_t target, position_t& pos,
 
 auto LabelVector::simdSearch(const label_t target, position_t& pos,
                              const position_t search_len) const -> bool {
-  position_t num_labels_searched = 0;
-  position_t num_labels_left = search_len;
-  while ((num_labels_left >> 4) > 0) {
-    label_t* start_ptr = labels_ + pos + num_labels_searched;
-    __m128i cmp =
-        _mm_cmpeq_epi8(_mm_set1_epi8(target),
-                       _mm_loadu_si128(reinterpret_cast<__m128i*>(start_ptr)));
-    unsigned check_bits = _mm_movemask_epi8(cmp);
-    if (check_bits) {
-      pos += (num_labels_searched + __builtin_ctz(check_bits));
-      return true;
-    }
-    num_labels_searched += 16;
-    num_labels_left -= 16;
-  }
-
-  if (num_labels_left > 0) {
-    label_t* start_ptr = labels_ + pos + num_labels_searched;
-    __m128i cmp =
-        _mm_cmpeq_epi8(_mm_set1_epi8(target),
-                       _mm_loadu_si128(reinterpret_cast<__m128i*>(start_ptr)));
-    unsigned leftover_bits_mask = (1 << num_labels_left) - 1;
-    unsigned check_bits = _mm_movemask_epi8(cmp) & leftover_bits_mask;
-    if (check_bits) {
-      pos += (num_labels_searched + __builtin_ctz(check_bits));
-      return true;
-    }
-  }
-
-  return false;
+  position_t idx = findLabel(labels_ + pos, search_len, target);
+  if (idx == search_len) return false;
+  pos += idx;
+  return true;
 }
 
 auto LabelVector::linearSearch(const label_t target, position_t& pos,
@@ -160,6 +261,15 @@ auto LabelVector::linearSearchGreaterThan(const label_t target, position_t& pos,
   return false;
 }
 
+auto LabelVector::simdSearchGreaterThan(const label_t target, position_t& pos,
+                                        const position_t search_len) const
+    -> bool {
+  position_t idx = findLabelGreaterThan(labels_ + pos, search_len, target);
+  if (idx == search_len) return false;
+  pos += idx;
+  return true;
+}
+
 void LabelVector::serialize(char*& dst) const {
   memcpy(dst, &num_bytes_, sizeof(num_bytes_));
   dst += sizeof(num_bytes_);
@@ -168,13 +278,18 @@ void LabelVector::serialize(char*& dst) const {
   align(dst);
 }
 
-auto LabelVector::deSerialize(char*& src) -> LabelVector* {
+auto LabelVector::deSerialize(char*& src, bool borrowed) -> LabelVector* {
   LabelVector* lv = new LabelVector();
   memcpy(&(lv->num_bytes_), src, sizeof(lv->num_bytes_));
   src += sizeof(lv->num_bytes_);
 
-  lv->labels_ = new label_t[lv->num_bytes_];
-  memcpy(lv->labels_, src, lv->num_bytes_);
+  lv->borrowed_ = borrowed;
+  if (borrowed) {
+    lv->labels_ = reinterpret_cast<label_t*>(src);
+  } else {
+    lv->labels_ = new label_t[lv->num_bytes_];
+    memcpy(lv->labels_, src, lv->num_bytes_);
+  }
   src += lv->num_bytes_;
 
   align(src);
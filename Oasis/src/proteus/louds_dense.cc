@@ -16,15 +16,17 @@ void LoudsDense::serialize(char*& dst) const {
   align(dst);
 }
 
-auto LoudsDense::deSerialize(char*& src, uint32_t trie_depth) -> LoudsDense* {
+auto LoudsDense::deSerialize(char*& src, uint32_t trie_depth, bool borrowed)
+    -> LoudsDense* {
   LoudsDense* louds_dense = new LoudsDense();
   louds_dense->trie_depth_ = trie_depth;
   memcpy(&(louds_dense->height_), src, sizeof(louds_dense->height_));
   src += sizeof(louds_dense->height_);
   align(src);
-  louds_dense->label_bitmaps_ = BitvectorRank::deSerialize(src);
-  louds_dense->child_indicator_bitmaps_ = BitvectorRank::deSerialize(src);
-  louds_dense->suffixes_ = BitvectorSuffix::deSerialize(src);
+  louds_dense->label_bitmaps_ = BitvectorRank::deSerialize(src, borrowed);
+  louds_dense->child_indicator_bitmaps_ =
+      BitvectorRank::deSerialize(src, borrowed);
+  louds_dense->suffixes_ = BitvectorSuffix::deSerialize(src, borrowed);
   align(src);
   return louds_dense;
 }
@@ -72,7 +74,7 @@ LoudsDense::LoudsDense(const SuRFBuilder* builder) {
 }
 
 template <typename T>
-auto LoudsDense::lookupKey(const T& key, PrefixBF* prefix_filter,
+auto LoudsDense::lookupKey(const T& key, const PrefixBF* prefix_filter,
                            position_t& out_node_num) const -> bool {
   position_t node_num = 0;
   position_t pos = 0;
@@ -103,10 +105,45 @@ auto LoudsDense::lookupKey(const T& key, PrefixBF* prefix_filter,
   return true;
 }
 
+template <typename T>
+auto LoudsDense::lookupLevel(const T& key, const std::string& edited_key,
+                             const level_t level, position_t& node_num,
+                             const PrefixBF* prefix_filter) const
+    -> LookupStep {
+  position_t pos = node_num * kNodeFanout;
+  pos += static_cast<label_t>(edited_key[level]);
+
+  if (!label_bitmaps_->readBit(pos)) {
+    return LookupStep::kNotFound;
+  }
+
+  if (!child_indicator_bitmaps_->readBit(pos)) {
+    return suffixes_->checkEquality(getSuffixPos(pos), edited_key, level + 1,
+                                    trie_depth_) &&
+                   (prefix_filter == nullptr || prefix_filter->Query(key))
+               ? LookupStep::kFound
+               : LookupStep::kNotFound;
+  }
+
+  node_num = getChildNodeNum(pos);
+  if (level + 1 < height_) {
+    prefetchLabel(node_num, static_cast<label_t>(edited_key[level + 1]));
+  }
+  return LookupStep::kNext;
+}
+
+void LoudsDense::prefetchLabel(const position_t node_num,
+                               const label_t label) const {
+  position_t pos = node_num * kNodeFanout + label;
+  label_bitmaps_->prefetch(pos);
+  child_indicator_bitmaps_->prefetch(pos);
+}
+
 template <typename T>
 auto LoudsDense::moveToKeyGreaterThan(const T& lq, const T& rq,
                                       LoudsDense::Iter& iter,
-                                      PrefixBF* prefix_filter) const -> bool {
+                                      const PrefixBF* prefix_filter) const
+    -> bool {
   position_t node_num = 0;
   position_t pos = 0;
   std::string edited_lq = editAndStringify(lq, trie_depth_, true);
@@ -182,7 +219,7 @@ auto LoudsDense::getPrevPos(const position_t pos, bool* is_out_of_bound) const
 auto LoudsDense::compareSuffixGreaterThan(
     const position_t pos, const level_t level, const uint64_t lq,
     const uint64_t rq, std::string& edited_lq, LoudsDense::Iter& iter,
-    PrefixBF* prefix_filter) const -> bool {
+    const PrefixBF* prefix_filter) const -> bool {
   int compare =
       suffixes_->compare(getSuffixPos(pos), edited_lq, level, trie_depth_);
 
@@ -224,7 +261,7 @@ auto LoudsDense::compareSuffixGreaterThan(
 auto LoudsDense::compareSuffixGreaterThan(
     const position_t pos, const level_t level, const std::string& lq,
     const std::string& rq, std::string& edited_lq, LoudsDense::Iter& iter,
-    PrefixBF* prefix_filter) const -> bool {
+    const PrefixBF* prefix_filter) const -> bool {
   int compare =
       suffixes_->compare(getSuffixPos(pos), edited_lq, level, trie_depth_);
 
@@ -276,7 +313,7 @@ auto LoudsDense::compareSuffixGreaterThan(
 
 //============================================================================
 
-LoudsDense::Iter::Iter(LoudsDense* trie)
+LoudsDense::Iter::Iter(const LoudsDense* trie)
     : is_valid_(false),
       is_search_complete_(false),
       is_move_left_complete_(false),
@@ -284,11 +321,10 @@ LoudsDense::Iter::Iter(LoudsDense* trie)
       prefix_filter_true_(false),
       trie_(trie),
       send_out_node_num_(0),
-      key_len_(0) {
-  for (level_t level = 0; level < trie_->getHeight(); level++) {
-    key_.push_back(0);
-    pos_in_trie_.push_back(0);
-  }
+      key_len_(0),
+      key_(),
+      pos_in_trie_() {
+  assert(trie_->getHeight() <= kMaxTrieHeight);
 }
 
 void LoudsDense::Iter::clear() {
@@ -298,8 +334,8 @@ void LoudsDense::Iter::clear() {
 }
 
 template <typename T>
-auto LoudsDense::Iter::compare(const T& key, PrefixBF* prefix_filter) const
-    -> int {
+auto LoudsDense::Iter::compare(const T& key,
+                               const PrefixBF* prefix_filter) const -> int {
   std::string skey = stringify(key);
   std::string iter_key = getKey();
   int compare = iter_key.compare(skey.substr(0, iter_key.length()));
@@ -318,7 +354,11 @@ auto LoudsDense::Iter::compare(const T& key, PrefixBF* prefix_filter) const
     if (std::is_same<T, std::string>::value) {
       res = prefix_filter->Query(iter_key, skey);
     } else if (std::is_same<T, uint64_t>::value) {
-      res = prefix_filter->Query(stringToUint64(iter_key), integerify(key));
+      // key is the prefix of the last key in range, queried up to its end
+      res = prefix_filter->Query(
+          stringToUint64(iter_key),
+          integerify(key) +
+              (__UINT64_C(1) << (64 - prefix_filter->getPrefixLen())));
     } else {
       assert(false);
     }
@@ -332,18 +372,18 @@ auto LoudsDense::Iter::compare(const T& key, PrefixBF* prefix_filter) const
 auto LoudsDense::Iter::getKey() const -> std::string {
   if (!is_valid_) return std::string();
   level_t len = key_len_;
-  return std::string((const char*)key_.data(), (size_t)len);
+  return std::string((const char*)key_, (size_t)len);
 }
 
 void LoudsDense::Iter::append(position_t pos) {
-  assert(key_len_ < key_.size());
+  assert(key_len_ < trie_->getHeight());
   key_[key_len_] = (label_t)(pos % kNodeFanout);
   pos_in_trie_[key_len_] = pos;
   key_len_++;
 }
 
 void LoudsDense::Iter::set(level_t level, position_t pos) {
-  assert(level < key_.size());
+  assert(level < trie_->getHeight());
   key_[level] = (label_t)(pos % kNodeFanout);
   pos_in_trie_[level] = pos;
 }
@@ -481,15 +521,20 @@ void LoudsDense::Iter::operator--(int) {
 }
 
 template auto LoudsDense::lookupKey(const uint64_t& key,
-                                    PrefixBF* prefix_filter,
+                                    const PrefixBF* prefix_filter,
                                     position_t& out_node_num) const -> bool;
 
-template auto LoudsDense::moveToKeyGreaterThan(const uint64_t& lq,
-                                               const uint64_t& rq,
-                                               LoudsDense::Iter& iter,
-                                               PrefixBF* prefix_filter) const
-    -> bool;
+template auto LoudsDense::lookupLevel(const uint64_t& key,
+                                      const std::string& edited_key,
+                                      const level_t level, position_t& node_num,
+                                      const PrefixBF* prefix_filter) const
+    -> LookupStep;
+
+template auto LoudsDense::moveToKeyGreaterThan(
+    const uint64_t& lq, const uint64_t& rq, LoudsDense::Iter& iter,
+    const PrefixBF* prefix_filter) const -> bool;
 
 template auto LoudsDense::Iter::compare(const uint64_t& key,
-                                        PrefixBF* prefix_filter) const -> int;
+                                        const PrefixBF* prefix_filter) const
+    -> int;
 }  // namespace oasis_plus
\ No newline at end of file
@@ -48,7 +48,7 @@ LoudsSparse::LoudsSparse(const SuRFBuilder* builder) {
 }
 
 template <typename T>
-auto LoudsSparse::lookupKey(const T& key, PrefixBF* prefix_filter,
+auto LoudsSparse::lookupKey(const T& key, const PrefixBF* prefix_filter,
                             const position_t in_node_num) const -> bool {
   std::string truncated = editAndStringify(key, trie_depth_, true);
 
@@ -76,10 +76,46 @@ auto LoudsSparse::lookupKey(const T& key, PrefixBF* prefix_filter,
   return false;
 }
 
+auto LoudsSparse::seekNode(const position_t node_num) const -> position_t {
+  position_t pos = getFirstLabelPos(node_num);
+  labels_->prefetch(pos);
+  child_indicator_bits_->prefetch(pos);
+  return pos;
+}
+
+template <typename T>
+auto LoudsSparse::lookupLevel(const T& key, const std::string& edited_key,
+                              const level_t level, position_t pos,
+                              position_t& node_num,
+                              const PrefixBF* prefix_filter) const
+    -> LookupStep {
+  if (!labels_->search(static_cast<label_t>(edited_key[level]), pos,
+                       nodeSize(pos))) {
+    return LookupStep::kNotFound;
+  }
+
+  if (!child_indicator_bits_->readBit(pos)) {
+    return suffixes_->checkEquality(getSuffixPos(pos), edited_key, level + 1,
+                                    trie_depth_) &&
+                   (prefix_filter == nullptr || prefix_filter->Query(key))
+               ? LookupStep::kFound
+               : LookupStep::kNotFound;
+  }
+
+  node_num = getChildNodeNum(pos);
+  prefetchNode(node_num);
+  return LookupStep::kNext;
+}
+
+void LoudsSparse::prefetchNode(const position_t node_num) const {
+  louds_bits_->prefetch(node_num + 1 - node_count_dense_);
+}
+
 template <typename T>
 auto LoudsSparse::moveToKeyGreaterThan(const T& lq, const T& rq,
                                        LoudsSparse::Iter& iter,
-                                       PrefixBF* prefix_filter) const -> bool {
+                                       const PrefixBF* prefix_filter) const
+    -> bool {
   position_t node_num = iter.getStartNodeNum();
   position_t pos = getFirstLabelPos(node_num);
   std::string edited_lq = editAndStringify(lq, trie_depth_, true);
@@ -150,7 +186,8 @@ void LoudsSparse::serialize(char*& dst) const {
   align(dst);
 }
 
-auto LoudsSparse::deSerialize(char*& src, uint32_t trie_depth) -> LoudsSparse* {
+auto LoudsSparse::deSerialize(char*& src, uint32_t trie_depth, bool borrowed)
+    -> LoudsSparse* {
   LoudsSparse* louds_sparse = new LoudsSparse();
   louds_sparse->trie_depth_ = trie_depth;
   memcpy(&(louds_sparse->height_), src, sizeof(louds_sparse->height_));
@@ -165,10 +202,11 @@ auto LoudsSparse::deSerialize(char*& src, uint32_t trie_depth) -> LoudsSparse* {
          sizeof(louds_sparse->child_count_dense_));
   src += sizeof(louds_sparse->child_count_dense_);
   align(src);
-  louds_sparse->labels_ = LabelVector::deSerialize(src);
-  louds_sparse->child_indicator_bits_ = BitvectorRank::deSerialize(src);
-  louds_sparse->louds_bits_ = BitvectorSelect::deSerialize(src);
-  louds_sparse->suffixes_ = BitvectorSuffix::deSerialize(src);
+  louds_sparse->labels_ = LabelVector::deSerialize(src, borrowed);
+  louds_sparse->child_indicator_bits_ =
+      BitvectorRank::deSerialize(src, borrowed);
+  louds_sparse->louds_bits_ = BitvectorSelect::deSerialize(src, borrowed);
+  louds_sparse->suffixes_ = BitvectorSuffix::deSerialize(src, borrowed);
   align(src);
   return louds_sparse;
 }
@@ -228,7 +266,7 @@ void LoudsSparse::moveToLeftInNextSubtrie(position_t pos,
 auto LoudsSparse::compareSuffixGreaterThan(
     const position_t pos, const level_t level, const uint64_t lq,
     const uint64_t rq, std::string& edited_lq, LoudsSparse::Iter& iter,
-    PrefixBF* prefix_filter) const -> bool {
+    const PrefixBF* prefix_filter) const -> bool {
   int compare =
       suffixes_->compare(getSuffixPos(pos), edited_lq, level, trie_depth_);
 
@@ -269,7 +307,7 @@ auto LoudsSparse::compareSuffixGreaterThan(
 auto LoudsSparse::compareSuffixGreaterThan(
     const position_t pos, const level_t level, const std::string& lq,
     const std::string& rq, std::string& edited_lq, LoudsSparse::Iter& iter,
-    PrefixBF* prefix_filter) const -> bool {
+    const PrefixBF* prefix_filter) const -> bool {
   int compare =
       suffixes_->compare(getSuffixPos(pos), edited_lq, level, trie_depth_);
 
@@ -323,17 +361,16 @@ auto LoudsSparse::compareSuffixGreaterThan(
 
 //============================================================================
 
-LoudsSparse::Iter::Iter(LoudsSparse* trie)
+LoudsSparse::Iter::Iter(const LoudsSparse* trie)
     : is_valid_(false),
       is_done_(false),
       trie_(trie),
       start_node_num_(0),
-      key_len_(0) {
+      key_len_(0),
+      key_(),
+      pos_in_trie_() {
   start_level_ = trie_->getStartLevel();
-  for (level_t level = start_level_; level < trie_->getHeight(); level++) {
-    key_.push_back(0);
-    pos_in_trie_.push_back(0);
-  }
+  assert(trie_->getHeight() - start_level_ <= kMaxTrieHeight);
 }
 
 void LoudsSparse::Iter::clear() {
@@ -343,7 +380,7 @@ void LoudsSparse::Iter::clear() {
 }
 
 template <typename T>
-auto LoudsSparse::Iter::compare(const T& key, PrefixBF* prefix_filter,
+auto LoudsSparse::Iter::compare(const T& key, const PrefixBF* prefix_filter,
                                 const std::string& dense_prefix) const -> int {
   std::string str_key = stringify(key);
   std::string iter_key = getKey();
@@ -366,7 +403,11 @@ auto LoudsSparse::Iter::compare(const T& key, PrefixBF* prefix_filter,
   if (std::is_same<T, std::string>::value) {
     res = prefix_filter->Query(left_query, str_key);
   } else if (std::is_same<T, uint64_t>::value) {
-    res = prefix_filter->Query(stringToUint64(left_query), integerify(key));
+    // key is the prefix of the last key in range, queried up to its end
+    res = prefix_filter->Query(
+        stringToUint64(left_query),
+        integerify(key) +
+            (__UINT64_C(1) << (64 - prefix_filter->getPrefixLen())));
   } else {
     assert(false);
   }
@@ -377,25 +418,25 @@ auto LoudsSparse::Iter::compare(const T& key, PrefixBF* prefix_filter,
 auto LoudsSparse::Iter::getKey() const -> std::string {
   if (!is_valid_) return std::string();
   level_t len = key_len_;
-  return std::string((const char*)key_.data(), (size_t)len);
+  return std::string((const char*)key_, (size_t)len);
 }
 
 void LoudsSparse::Iter::append(const position_t pos) {
-  assert(key_len_ < key_.size());
+  assert(key_len_ < trie_->getHeight() - start_level_);
   key_[key_len_] = trie_->labels_->read(pos);
   pos_in_trie_[key_len_] = pos;
   key_len_++;
 }
 
 void LoudsSparse::Iter::append(const label_t label, const position_t pos) {
-  assert(key_len_ < key_.size());
+  assert(key_len_ < trie_->getHeight() - start_level_);
   key_[key_len_] = label;
   pos_in_trie_[key_len_] = pos;
   key_len_++;
 }
 
 void LoudsSparse::Iter::set(const level_t level, const position_t pos) {
-  assert(level < key_.size());
+  assert(level < trie_->getHeight() - start_level_);
   key_[level] = trie_->labels_->read(pos);
   pos_in_trie_[level] = pos;
 }
@@ -515,18 +556,23 @@ void LoudsSparse::Iter::operator--(int) {
 }
 
 template auto LoudsSparse::Iter::compare(const uint64_t& key,
-                                         PrefixBF* prefix_filter,
+                                         const PrefixBF* prefix_filter,
                                          const std::string& dense_prefix) const
     -> int;
 
 template auto LoudsSparse::lookupKey(const uint64_t& key,
-                                     PrefixBF* prefix_filter,
+                                     const PrefixBF* prefix_filter,
                                      const position_t in_node_num) const
     -> bool;
 
-template auto LoudsSparse::moveToKeyGreaterThan(const uint64_t& lq,
-                                                const uint64_t& rq,
-                                                LoudsSparse::Iter& iter,
-                                                PrefixBF* prefix_filter) const
-    -> bool;
+template auto LoudsSparse::lookupLevel(const uint64_t& key,
+                                       const std::string& edited_key,
+                                       const level_t level, position_t pos,
+                                       position_t& node_num,
+                                       const PrefixBF* prefix_filter) const
+    -> LookupStep;
+
+template auto LoudsSparse::moveToKeyGreaterThan(
+    const uint64_t& lq, const uint64_t& rq, LoudsSparse::Iter& iter,
+    const PrefixBF* prefix_filter) const -> bool;
 }  // namespace oasis_plus
\ No newline at end of file
@@ -154,19 +154,22 @@ auto calcTrieMem(size_t sparse_dense_cutoff, uint32_t trie_bit_depth,
 }
 
 /*
+    Calculates the trie memory of every trie depth, with its best
+   sparse-dense cutoff. It only depends on the key prefixes, not on the memory
+   budget.
+
     Doesn't account for (small number of) alignment bits added for serialization
    (underestimate). Assumes that all key bytes are encoded with LOUDS-DS nodes
    but they may actually be encoded more efficiently with suffix bits if the key
    has a short common prefix (overestimate).
 */
-auto calcMemDist(std::vector<long double>& bf_mem,
-                 std::vector<size_t>& sd_cutoffs,
-                 const std::vector<size_t>& key_prefixes, double bits_per_key)
-    -> size_t {
+auto calcTrieMemDist(std::vector<size_t>& sd_cutoffs,
+                     const std::vector<size_t>& key_prefixes)
+    -> std::vector<size_t> {
   // In Bits
   uint32_t DENSE_NODE_SIZE = 256 * 2;  // No D-IsPrefixKey
   uint32_t SPARSE_NODE_SIZE = 8 + 2;
-  uint32_t TRIE_DEPTHS = bf_mem.size();
+  uint32_t TRIE_DEPTHS = sd_cutoffs.size();
 
   // Stores the size of each trie byte level if it is encoded as LOUDS-Dense
   // Note that the size of a LOUDS-Dense node is independent of the number of
@@ -222,6 +225,18 @@ auto calcMemDist(std::vector<long double>& bf_mem,
         (23 + (div8(trie_bit_depth - 1) + 1)) * sizeof(uint32_t) * 8;
   }
 
+  return trie_mem;
+}
+
+/*
+    Gives the Bloom filter the memory budget left by the trie of every trie
+   depth, up to the deepest trie that fits, which is returned.
+*/
+auto calcMemDist(std::vector<long double>& bf_mem,
+                 const std::vector<size_t>& trie_mem,
+                 const std::vector<size_t>& key_prefixes, double bits_per_key)
+    -> size_t {
+  uint32_t TRIE_DEPTHS = bf_mem.size();
   size_t max_trie_depth =
       TRIE_DEPTHS -
       1;  // TRIE_DEPTHS includes the "no trie" option, i.e. depth 0
@@ -325,19 +340,25 @@ auto KQlcp(const std::vector<std::string>& keys, const size_t max_klen,
   return std::make_pair(-1, -1);
 }
 
-auto find_best_conf(const std::vector<size_t>& trconfs,
-                    const std::vector<size_t>& bfconfs,
-                    const std::vector<size_t>& qk_dists,
-                    const std::vector<size_t>& key_prefixes,
-                    const std::vector<long double>& bf_mem,
-                    const size_t max_klen, const size_t max_qlen)
-    -> std::tuple<size_t, size_t, size_t, long double, size_t, size_t,
-                  long double> {
+/*
+    Counts the queries of each Proteus configuration from the distances of
+   queries to keys, rather than sampled queries. Every bin holds the number of
+   prefix queries of each of its queries.
+*/
+auto countConfs(const std::vector<size_t>& trconfs,
+                const std::vector<size_t>& bfconfs,
+                const std::vector<size_t>& qk_dists,
+                const std::vector<size_t>& key_prefixes, const size_t max_klen,
+                const size_t max_qlen) -> ConfCounters {
   const size_t kMaxQLen = max_qlen;
 
-  std::vector<size_t> resolved_in_trie(trconfs.size(), 0);
-  std::vector<std::vector<bin_array>> conf_counters(
-      trconfs.size(), std::vector<bin_array>(bfconfs.size(), bin_array()));
+  ConfCounters counters;
+  counters.per_query = true;
+  std::vector<size_t>& resolved_in_trie = counters.resolved_in_trie;
+  std::vector<std::vector<bin_array>>& conf_counters = counters.conf_counters;
+  resolved_in_trie.assign(trconfs.size(), 0);
+  conf_counters.assign(trconfs.size(),
+                       std::vector<bin_array>(bfconfs.size(), bin_array()));
   for (size_t trconf_idx = 0; trconf_idx < trconfs.size(); ++trconf_idx) {
     size_t trie_len = trconfs[trconf_idx];
     resolved_in_trie[trconf_idx] =
@@ -355,118 +376,41 @@ auto find_best_conf(const std::vector<size_t>& trconfs,
           trie_len == 0 ? 0 : key_prefixes[trie_len - 1];
 
       for (size_t q_len = 0; q_len <= kMaxQLen; ++q_len) {
-        conf_counters[trie_len][bfconf_idx][q_len].second =
+        conf_counters[trconf_idx][bfconf_idx][q_len].second =
             base / (kMaxQLen + 1);
         if (trie_len > max_klen - q_len) {
-          conf_counters[trie_len][bfconf_idx][q_len].first =
+          conf_counters[trconf_idx][bfconf_idx][q_len].first =
               1 << (bf_len - trie_len + 1);
         } else {
-          conf_counters[trie_len][bfconf_idx][q_len].first =
+          conf_counters[trconf_idx][bfconf_idx][q_len].first =
               max_klen - q_len >= bf_len ? 1 : 1 << (bf_len + q_len - max_klen);
         }
       }
     }
   }
 
-  size_t empty_queries = key_prefixes[max_klen];
-  size_t best_trie_depth = 0;
-  size_t best_bflen = 0;
-  long double best_efpr = 1.0L;
-  size_t best_trconf = 0;
-  int32_t best_bfconf = 0;
-  long double min_fpp = empty_queries;
-
-  for (size_t trconf_idx = 0; trconf_idx < trconfs.size(); ++trconf_idx) {
-    size_t trie_len = trconfs[trconf_idx];
-    long double trie_efpr =
-        ((empty_queries - resolved_in_trie[trconf_idx]) * 1.0L) /
-        (empty_queries * 1.0L);
-    if (trie_efpr <= best_efpr) {
-      best_trie_depth =
-          trie_len; /* trie depth = length (in bits) of the prefixes in trie.*/
-      best_bflen = 0;
-      best_efpr = trie_efpr;
-      best_trconf = trconf_idx;
-      best_bfconf = -1;
-      min_fpp = std::min((empty_queries - resolved_in_trie[trconf_idx]) * 1.0L,
-                         min_fpp);
-      if ((empty_queries - resolved_in_trie[trconf_idx]) == 0UL) {
-        // If the trie is awesome, then this is a
-        // heuristic to still include a PBF for robustness:
-        best_bflen = (trie_len + max_klen) / 2;
-        PRINT_EFPR(trie_len, best_bflen, best_efpr)
-        continue;
-      }
-    }
-
-    PRINT_EFPR(i, 0UL, trie_efpr)
-
-    for (auto bfit = std::upper_bound(bfconfs.begin(), bfconfs.end(), trie_len);
-         bfit != bfconfs.end(); ++bfit) {
-      size_t bf_len = *bfit;
-      size_t bfconf_idx = bfit - bfconfs.begin();
-
-      // Determine the Bloom filter modeling parameters
-      size_t n = key_prefixes[bf_len - 1];
-      size_t nhf = static_cast<size_t>(round(M_LN2 * bf_mem[trie_len] / n));
-      nhf = (nhf == 0 ? 1 : nhf);
-      nhf = std::min(static_cast<size_t>(MAX_PBF_HASH_FUNCS), nhf);
-      long double prefix_query_fpr =
-          pow((1.0L - exp(-((nhf * n * 1.0L) / bf_mem[trie_len]))), nhf);
-
-      /** Sum up false positives probabilities for queries resolved in the Bloom
-       * Filter */
-      long double cumulative_fpp = 0.0L;
-      size_t resolved_in_bf = 0;
-      for (size_t q_len = 0; q_len <= kMaxQLen; ++q_len) {
-        const auto& bin = conf_counters[trconf_idx][bfconf_idx][q_len];
-        if (bin.second > 0) {
-          resolved_in_bf += bin.second /* sample query count */;
-          cumulative_fpp +=
-              bin.second *
-              (1.0L - pow((1.0L - prefix_query_fpr),
-                          ((bin.first *
-                            1.0L)) /* average number of BF prefix queries */));
-        }
-      }
-
-      // Add false positive probability for guaranteed false positives
-      cumulative_fpp += 1.0L * (empty_queries - resolved_in_bf -
-                                resolved_in_trie[trconf_idx]);
-      min_fpp = std::min(cumulative_fpp, min_fpp);
-      long double efpr = cumulative_fpp / (empty_queries * 1.0L);
-
-      PRINT_EFPR(trie_len, bf_len, efpr)
-
-      if (efpr <= best_efpr) {
-        best_trie_depth = trie_len;
-        best_bflen = bf_len;
-        best_efpr = efpr;
-        best_trconf = trconf_idx;
-        best_bfconf = bfconf_idx;
-      }
-    }
-  }
-  return std::make_tuple(empty_queries, best_trie_depth, best_bflen, best_efpr,
-                         best_trconf, best_bfconf, min_fpp);
+  counters.empty_queries = key_prefixes[max_klen];
+  return counters;
 }
 
+/*
+    Counts the queries of each Proteus configuration from sampled queries.
+   Every bin holds the sum of the prefix queries of its queries.
+*/
 template <typename T>
-auto find_best_conf(const std::vector<size_t>& trconfs,
-                    const std::vector<size_t>& bfconfs,
-                    const std::vector<T>& keys,
-                    const std::vector<std::pair<T, T>>& sample_queries,
-                    const std::vector<size_t>& key_prefixes,
-                    const std::vector<long double>& bf_mem,
-                    const size_t max_klen)
-    -> std::tuple<size_t, size_t, size_t, long double, size_t, size_t,
-                  long double> {
-  std::vector<size_t> resolved_in_trie(trconfs.size(), 0);
-  std::vector<std::vector<bin_array>> conf_counters(
-      trconfs.size(), std::vector<bin_array>(bfconfs.size(), bin_array()));
+auto countConfs(const std::vector<size_t>& trconfs,
+                const std::vector<size_t>& bfconfs, const std::vector<T>& keys,
+                const std::vector<std::pair<T, T>>& sample_queries,
+                const size_t max_klen) -> ConfCounters {
+  ConfCounters counters;
+  std::vector<size_t>& resolved_in_trie = counters.resolved_in_trie;
+  std::vector<std::vector<bin_array>>& conf_counters = counters.conf_counters;
+  resolved_in_trie.assign(trconfs.size(), 0);
+  conf_counters.assign(trconfs.size(),
+                       std::vector<bin_array>(bfconfs.size(), bin_array()));
   std::vector<size_t> pq_cache(bfconfs.size(), 0);
 
-  size_t empty_queries = 0;
+  size_t& empty_queries = counters.empty_queries;
   typename std::vector<T>::const_iterator kstart = keys.cbegin();
 
   for (auto const& q : sample_queries) {
@@ -679,6 +623,82 @@ auto find_best_conf(const std::vector<size_t>& trconfs,
     }
   }
 
+  return counters;
+}
+
+/*
+    The FPR of a probe of a prefix Bloom filter of nbits with prefix length
+   bf_len, with levels as in PrefixBF::PrefixBF(): the prefixes 1 to
+   levels - 1 bits shorter are hashed into the same bits as well. A blocked
+   filter sets all the bits of a prefix in one line, whose load varies from
+   line to line, so its FPR is taken as RocksDB's
+   BloomMath::CacheLocalFpRate() does: the mean of the FPRs of lines one
+   standard deviation above and below the mean load.
+*/
+auto pbfProbeFPR(long double nbits, const std::vector<size_t>& key_prefixes,
+                 size_t bf_len, uint32_t levels, bool blocked) -> long double {
+  levels = std::max(1U, std::min(levels, static_cast<uint32_t>(bf_len)));
+  size_t n = 0;
+  for (uint32_t level = 0; level < levels; ++level) {
+    n += key_prefixes[bf_len - 1 - level];
+  }
+  size_t nhf = static_cast<size_t>(round(M_LN2 * nbits / n));
+  nhf = (nhf == 0 ? 1 : nhf);
+  nhf = std::min(static_cast<size_t>(MAX_PBF_HASH_FUNCS), nhf);
+
+  // the FPR of bits holding nprefixes
+  auto fpr = [nhf](long double bits, long double nprefixes) {
+    return pow((1.0L - exp(-((nhf * nprefixes) / bits))), nhf);
+  };
+  if (!blocked) {
+    return fpr(nbits, n);
+  }
+  long double line_bits = PrefixBF::kLineBits;
+  long double line_prefixes = line_bits * n / nbits;
+  long double stddev = sqrt(line_prefixes);
+  long double crowded_fpr = fpr(line_bits, line_prefixes + stddev);
+  long double uncrowded_fpr =
+      line_prefixes > stddev ? fpr(line_bits, line_prefixes - stddev) : 0;
+  return (crowded_fpr + uncrowded_fpr) / 2;
+}
+
+/*
+    The FPR of an empty range query of prefix_queries prefixes, given the FPR
+   of a probe. With levels, see PrefixBF::Query(), about one unaligned piece
+   is probed at each level below the coarsest one, which probes the rest of
+   the range, and a piece is only positive if one of its halves is.
+*/
+auto pbfRangeFPR(long double probe_fpr, uint32_t levels,
+                 long double prefix_queries) -> long double {
+  long double piece_fpr = probe_fpr;
+  long double none_positive = 1.0L;
+  for (uint32_t level = 0; level + 1 < levels && prefix_queries > 1; ++level) {
+    none_positive *= 1.0L - piece_fpr;
+    prefix_queries = (prefix_queries - 1) / 2;
+    piece_fpr = probe_fpr * (1.0L - pow(1.0L - piece_fpr, 2));
+  }
+  return 1.0L - none_positive * pow(1.0L - piece_fpr, prefix_queries);
+}
+
+/*
+    Finds the Proteus configuration with the lowest expected FPR among the
+   first ntrconfs trie configurations, those within the memory budget of
+   bf_mem, from the counters of their queries.
+*/
+auto find_best_conf(const std::vector<size_t>& trconfs, const size_t ntrconfs,
+                    const std::vector<size_t>& bfconfs,
+                    const ConfCounters& counters,
+                    const std::vector<size_t>& key_prefixes,
+                    const std::vector<long double>& bf_mem,
+                    const size_t max_klen, const uint32_t pbf_levels,
+                    const bool pbf_blocked)
+    -> std::tuple<size_t, size_t, size_t, long double, size_t, size_t,
+                  long double> {
+  size_t empty_queries = counters.empty_queries;
+  const std::vector<size_t>& resolved_in_trie = counters.resolved_in_trie;
+  const std::vector<std::vector<bin_array>>& conf_counters =
+      counters.conf_counters;
+
   if (empty_queries == 0) {
     return std::make_tuple(0, 0, 0, 0, 0, 0, 0);
   }
@@ -690,7 +710,8 @@ auto find_best_conf(const std::vector<size_t>& trconfs,
   int32_t best_bfconf = 0;
   long double min_fpp = empty_queries;
 
-  for (auto trit = trconfs.begin(); trit != trconfs.end(); ++trit) {
+  for (auto trit = trconfs.begin(); trit != trconfs.begin() + ntrconfs;
+       ++trit) {
     size_t i = *trit;
     size_t trconf_idx = trit - trconfs.begin();
 
@@ -725,12 +746,8 @@ auto find_best_conf(const std::vector<size_t>& trconfs,
       size_t bfconf_idx = bfit - bfconfs.begin();
 
       // Determine the Bloom filter modeling parameters
-      size_t n = key_prefixes[j - 1];
-      size_t nhf = static_cast<size_t>(round(M_LN2 * bf_mem[i] / n));
-      nhf = (nhf == 0 ? 1 : nhf);
-      nhf = std::min(static_cast<size_t>(MAX_PBF_HASH_FUNCS), nhf);
       long double prefix_query_fpr =
-          pow((1.0L - exp(-((nhf * n * 1.0L) / bf_mem[i]))), nhf);
+          pbfProbeFPR(bf_mem[i], key_prefixes, j, pbf_levels, pbf_blocked);
 
       // Sum up false positives probabilities for queries resolved in the Bloom
       // Filter
@@ -739,12 +756,13 @@ auto find_best_conf(const std::vector<size_t>& trconfs,
       for (const auto& bin : conf_counters[trconf_idx][bfconf_idx]) {
         if (bin.second > 0) {
           resolved_in_bf += bin.second /* sample query count */;
+          /* average number of BF prefix queries */
+          long double prefix_queries =
+              counters.per_query ? bin.first * 1.0L
+                                 : (bin.first * 1.0L) / bin.second;
           cumulative_fpp +=
               bin.second *
-              (1.0L -
-               pow((1.0L - prefix_query_fpr),
-                   ((bin.first * 1.0L) /
-                    bin.second) /* average number of BF prefix queries */));
+              pbfRangeFPR(prefix_query_fpr, pbf_levels, prefix_queries);
         }
       }
 
@@ -779,16 +797,22 @@ auto ProteusModeling::modeling(
     -> std::tuple<size_t, size_t, size_t> {
   INIT_MODEL_TIMER
 
-  // Best sparse-dense cutoff for every trie depth
-  std::vector<size_t> sd_cutoffs(max_klen_ + 1, 0);
-
   // START_MODEL_TIMER
   // countUniqueKeyPrefixes(key_prefixes_, keys, max_klen_);
   // STOP_MODEL_TIMER("Count Unique Key Prefixes")
 
   START_MODEL_TIMER
+  if (trie_mem_dist_.empty()) {
+    // Best sparse-dense cutoff for every trie depth
+    sd_cutoffs_.assign(max_klen_ + 1, 0);
+    trie_mem_dist_ = calcTrieMemDist(sd_cutoffs_, key_prefixes_);
+  }
+  const std::vector<size_t>& sd_cutoffs = sd_cutoffs_;
+  // only integer keys are hashed at several levels, or in blocks
+  uint32_t pbf_levels = std::is_same<T, uint64_t>::value ? pbf_levels_ : 1;
+  bool pbf_blocked = std::is_same<T, uint64_t>::value && pbf_blocked_;
   size_t max_trie_depth =
-      calcMemDist(bf_mem_, sd_cutoffs, key_prefixes_, bits_per_key);
+      calcMemDist(bf_mem_, trie_mem_dist_, key_prefixes_, bits_per_key);
   STOP_MODEL_TIMER("Calculate Memory Distribution")
 
 #ifdef PRINT_EFPRS
@@ -802,6 +826,7 @@ auto ProteusModeling::modeling(
   // If there is enough memory for a full trie, just use it
   if (max_trie_depth == max_klen_) {
     printf("Proteus Used Full Trie.\n");
+    min_fpp_ = 0;
     return std::make_tuple(max_klen_, sd_cutoffs[max_klen_], 0);
   }
 
@@ -858,6 +883,8 @@ auto ProteusModeling::modeling(
 
   std::vector<size_t> bfconfs;
   std::vector<size_t> trconfs;
+  // Trie configurations within the budget, a prefix of trconfs
+  size_t ntrconfs = 0;
 
   if (std::is_same<T, std::string>::value) {
     trconfs.reserve(64);
@@ -870,22 +897,34 @@ auto ProteusModeling::modeling(
     for (size_t i = 1; i <= max_klen_; i += bfstep) {
       bfconfs.push_back(i);
     }
+    ntrconfs = trconfs.size();
   } else if (std::is_same<T, uint64_t>::value) {
-    trconfs.resize(max_trie_depth + 1);
+    // Counted for all trie depths once, the budget only bounds the depths
+    trconfs.resize(max_klen_ + 1);
     bfconfs.resize(64);
     std::iota(trconfs.begin(), trconfs.end(), 0);
     std::iota(bfconfs.begin(), bfconfs.end(), 1);
+    ntrconfs = max_trie_depth + 1;
   } else {
     assert(false);
   }
 
+  auto count_confs = [&]() {
+    return sample_queries.empty()
+               ? countConfs(trconfs, bfconfs, qk_dists_, key_prefixes_,
+                            max_klen_, max_qlen_)
+               : countConfs(trconfs, bfconfs, keys, sample_queries, max_klen_);
+  };
+  if (!counted_) {
+    counters_ = count_confs();
+    // String configurations are spread over the budget, count them every time
+    counted_ = std::is_same<T, uint64_t>::value;
+  }
+
   std::tuple<size_t, size_t, size_t, long double, size_t, size_t, long double>
-      best_conf =
-          sample_queries.empty()
-              ? find_best_conf(trconfs, bfconfs, qk_dists_, key_prefixes_,
-                               bf_mem_, max_klen_, max_qlen_)
-              : find_best_conf(trconfs, bfconfs, keys, sample_queries,
-                               key_prefixes_, bf_mem_, max_klen_);
+      best_conf = find_best_conf(trconfs, ntrconfs, bfconfs, counters_,
+                                 key_prefixes_, bf_mem_, max_klen_,
+                                 pbf_levels, pbf_blocked);
 
   STOP_MODEL_TIMER("Find Best Configuration 1")
 
@@ -899,6 +938,7 @@ auto ProteusModeling::modeling(
   // that is half the maximum key length.
   if (std::get<0>(best_conf) == 0) {
     printf("Proteus Used Default Configuration.\n");
+    min_fpp_ = 0;
     return std::make_tuple(0, 0, max_klen_ / 2);
   }
 
@@ -960,14 +1000,12 @@ auto ProteusModeling::modeling(
     bfconfs.resize(nbfconfs);
 
     if (ntrconfs > 1 || nbfconfs > 1) {
+      counters_ = count_confs();
       std::tuple<size_t, size_t, size_t, long double, size_t, size_t,
                  long double>
-          best_conf2 =
-              sample_queries.empty()
-                  ? find_best_conf(trconfs, bfconfs, qk_dists_, key_prefixes_,
-                                   bf_mem_, max_klen_, max_qlen_)
-                  : find_best_conf(trconfs, bfconfs, keys, sample_queries,
-                                   key_prefixes_, bf_mem_, max_klen_);
+          best_conf2 = find_best_conf(trconfs, trconfs.size(), bfconfs,
+                                      counters_, key_prefixes_, bf_mem_,
+                                      max_klen_, pbf_levels, pbf_blocked);
       if (std::get<3>(best_conf2) < std::get<3>(best_conf)) {
         best_conf = best_conf2;
       }
@@ -9,38 +9,48 @@
 #include <memory>
 #include <random>
 
+#include "oasis/query_stats.hpp"
 #include "proteus/clhash.h"
 #include "proteus/MurmurHash3.h"
 
 namespace oasis_plus {
 PrefixBF::PrefixBF(uint32_t prefix_len, uint64_t nbits,
-                   const std::vector<uint64_t>& keys)
+                   const std::vector<uint64_t>& keys, uint32_t levels,
+                   bool blocked)
     : prefix_len_(prefix_len),
+      levels_(std::max(1U, std::min(levels, prefix_len))),
+      blocked_(blocked),
       nmod_(std::min(static_cast<uint64_t>(UINT32_MAX), (nbits + 7) / 8 * 8)) {
   // Filter uses 32-bit MurmurHash function so the number of filter bits
   // cannot be more than UINT32_MAX. Such situations are unlikely to happen
   // in RocksDB as it would entail an extremely high BPK or number of keys.
 
   assert(nbits > 0);
-
-  // Create zeroed out bit array - parentheses value initializes array to 0
-  data_ = new uint8_t[div8(nmod_)]();
-  assert(data_);
-
-  std::vector<size_t> uniq_idxs;
-  uniq_idxs.emplace_back(0);
-  uint64_t prev_key = keys[0] >> (64 - prefix_len_);
-  uint64_t current_key = 0;
-
-  for (size_t i = 0; i < keys.size(); i++) {
-    current_key = keys[i] >> (64 - prefix_len_);
-    if (current_key != prev_key) {
-      uniq_idxs.emplace_back(i);
-      prev_key = current_key;
+  if (blocked_) {
+    nmod_ = (nmod_ + kLineBits - 1) / kLineBits * kLineBits;
+  }
+  alloc_bits();
+
+  // f(prefix) for every distinct prefix of the keys, `level` bits shorter
+  auto for_each_prefix = [&](uint32_t level, auto&& f) {
+    uint32_t shift = 64 - prefix_len_ + level;
+    uint64_t prev_key = keys[0] >> shift;
+    f(prev_key);
+    for (size_t i = 1; i < keys.size(); i++) {
+      uint64_t current_key = keys[i] >> shift;
+      if (current_key != prev_key) {
+        f(current_key);
+        prev_key = current_key;
+      }
     }
+  };
+
+  size_t nprefixes = 0;
+  for (uint32_t level = 0; level < levels_; ++level) {
+    for_each_prefix(level, [&](uint64_t) { ++nprefixes; });
   }
 
-  uint32_t nhf = static_cast<uint32_t>(round(M_LN2 * nmod_ / uniq_idxs.size()));
+  uint32_t nhf = static_cast<uint32_t>(round(M_LN2 * nmod_ / nprefixes));
   nhf = (nhf == 0 ? 1 : nhf);
   nhf = std::min(MAX_PBF_HASH_FUNCS, nhf);
 
@@ -50,12 +60,16 @@ PrefixBF::PrefixBF(uint32_t prefix_len, uint64_t nbits,
     seeds32_[i] = gen();
   }
 
-  uint64_t edited_key = 0ULL;
-  for (auto const& idx : uniq_idxs) {
-    edited_key = keys[idx] >> (64 - prefix_len_);
-    for (uint32_t i = 0; i < nhf; ++i) {
-      set(hash(edited_key, seeds32_[i]), 1);
-    }
+  for (uint32_t level = 0; level < levels_; ++level) {
+    for_each_prefix(level, [&](uint64_t prefix) {
+      if (blocked_) {
+        set_line(prefix, level);
+        return;
+      }
+      for (uint32_t i = 0; i < nhf; ++i) {
+        set(hash(prefix, level_seed(i, level)), 1);
+      }
+    });
   }
 }
 
@@ -64,9 +78,7 @@ PrefixBF::PrefixBF(uint32_t prefix_len, uint64_t nbits,
     : prefix_len_(prefix_len), nmod_((nbits + 7) / 8 * 8) {
   assert(nbits > 0);
 
-  // Create zeroed out bit array - parentheses value initializes array to 0
-  data_ = new uint8_t[(nmod_ / 8)]();
-  assert(data_);
+  alloc_bits();
 
   std::vector<size_t> uniq_prefixes;
   uniq_prefixes.emplace_back(0);
@@ -118,8 +130,11 @@ PrefixBF::PrefixBF(uint32_t prefix_len, uint64_t nbits,
 PrefixBF::PrefixBF(uint32_t prefix_len, uint8_t* data,
                    std::vector<uint32_t> seeds32,
                    std::vector<std::pair<uint64_t, uint64_t>> seeds64,
-                   uint64_t nmod)
+                   uint64_t nmod, uint32_t levels, bool blocked,
+                   bool borrowed)
     : prefix_len_(prefix_len),
+      levels_(levels),
+      blocked_(blocked),
       seeds32_(seeds32),
       seeds64_(seeds64),
       nmod_(nmod) {
@@ -131,13 +146,70 @@ PrefixBF::PrefixBF(uint32_t prefix_len, uint8_t* data,
         get_random_key_for_clhash(seeds64_[i].first, seeds64_[i].second);
   }
 
+  if (borrowed) {
+    bits_ = data;
+    return;
+  }
   // Copy over bit array
-  data_ = new uint8_t[(nmod_ / 8)];
+  alloc_bits();
+  memcpy(reinterpret_cast<void*>(bits_), data, (nmod_ / 8));
+}
+
+void PrefixBF::alloc_bits() {
+  // Create zeroed out bit array - parentheses value initializes array to 0
+  size_t pad = blocked_ ? div8(kLineBits) - 1 : 0;
+  data_ = new uint8_t[div8(nmod_) + pad]();
   assert(data_);
-  memcpy(reinterpret_cast<void*>(data_), data, (nmod_ / 8));
+  bits_ = data_;
+  if (blocked_) {
+    uintptr_t line = div8(kLineBits);
+    bits_ = reinterpret_cast<uint8_t*>(
+        (reinterpret_cast<uintptr_t>(data_) + line - 1) & ~(line - 1));
+  }
+}
+
+auto PrefixBF::line_hash(uint64_t prefix, uint32_t level) const -> uint64_t {
+  // MurmurHash3's 64-bit finalizer, over the prefix salted by the level
+  uint64_t h = prefix + (static_cast<uint64_t>(level_seed(0, level)) << 32);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+auto PrefixBF::line_offset(uint64_t hash) const -> uint64_t {
+  // Upper half of the hash picks the line, see FastRange32
+  return ((hash >> 32) * (nmod_ / kLineBits)) >> 32 << kLineShift >> 3;
+}
+
+void PrefixBF::set_line(uint64_t prefix, uint32_t level) {
+  uint64_t h = line_hash(prefix, level);
+  uint8_t* line = bits_ + line_offset(h);
+  uint32_t h32 = static_cast<uint32_t>(h);
+  for (size_t i = 0; i < seeds32_.size(); ++i) {
+    uint32_t bit = h32 >> (32 - kLineShift);
+    line[div8(bit)] |= 1U << mod8(bit);
+    h32 *= 0x9e3779b9U;
+  }
+}
+
+auto PrefixBF::get_line(uint64_t prefix, uint32_t level) const -> bool {
+  uint64_t h = line_hash(prefix, level);
+  const uint8_t* line = bits_ + line_offset(h);
+  uint32_t h32 = static_cast<uint32_t>(h);
+  for (size_t i = 0; i < seeds32_.size(); ++i) {
+    uint32_t bit = h32 >> (32 - kLineShift);
+    if (!((line[div8(bit)] >> mod8(bit)) & 1)) {
+      return false;
+    }
+    h32 *= 0x9e3779b9U;
+  }
+  return true;
 }
 
-auto PrefixBF::hash(const uint64_t edited_key, const uint32_t& seed)
+auto PrefixBF::hash(const uint64_t edited_key, const uint32_t& seed) const
     -> uint64_t {
   uint32_t h;
   murmur3::MurmurHash3_x86_32(&edited_key, 8, seed, &h);
@@ -145,42 +217,87 @@ auto PrefixBF::hash(const uint64_t edited_key, const uint32_t& seed)
 }
 
 auto PrefixBF::get(uint64_t i) const -> bool {
-  return (data_[div8(i)] >> (7 - mod8(i))) & 1;
+  return (bits_[div8(i)] >> (7 - mod8(i))) & 1;
 }
 
 void PrefixBF::set(uint64_t i, bool v) {
   if (get(i) != v) {
-    data_[div8(i)] ^= (1 << (7 - mod8(i)));
+    bits_[div8(i)] ^= (1 << (7 - mod8(i)));
   }
 }
 
-auto PrefixBF::Query(const uint64_t key, bool shift) -> bool {
-  bool out = true;
-  uint64_t k = shift ? key >> (64 - prefix_len_) : key;
-  for (size_t i = 0; i < seeds32_.size() && out; ++i) {
-    out &= get(hash(k, seeds32_[i]));
+auto PrefixBF::Query(const uint64_t key, bool shift) const -> bool {
+  return probe(shift ? key >> (64 - prefix_len_) : key, 0);
+}
+
+auto PrefixBF::probe(uint64_t prefix, uint32_t level) const -> bool {
+  OASIS_STAT_ADD(pbf_probes, 1);
+  if (blocked_) {
+    if (!get_line(prefix, level)) {
+      return false;
+    }
+  } else {
+    for (size_t i = 0; i < seeds32_.size(); ++i) {
+      if (!get(hash(prefix, level_seed(i, level)))) {
+        return false;
+      }
+    }
   }
-  return out;
+  // a shorter prefix only passes if one of its halves does
+  return level == 0 || probe(prefix << 1, level - 1) ||
+         probe((prefix << 1) | 1, level - 1);
 }
 
 /*
     To execute a range query, we shift the query bounds to the
     specified prefix length and do point queries for all the
     values in the shifted query range.
+
+    With levels, the prefixes at either end of the range that are not
+    aligned to the next level are probed on their own, and the rest of the
+    range moves up a level, until the coarsest one, where all of it is
+    probed.
 */
-auto PrefixBF::Query(const uint64_t from, const uint64_t to) -> bool {
-  uint64_t iterator = from >> (64 - prefix_len_);
-  uint64_t upper_bound = (to - 1) >> (64 - prefix_len_);
-  while (iterator <= upper_bound) {
-    if (Query(iterator, false)) {
+auto PrefixBF::Query(const uint64_t from, const uint64_t to) const -> bool {
+  uint64_t lo = from >> (64 - prefix_len_);
+  uint64_t hi = (to - 1) >> (64 - prefix_len_);
+  if (lo > hi) {
+    return false;
+  }
+  for (uint32_t level = 0; level + 1 < levels_; ++level) {
+    if (lo & 1) {
+      if (probe(lo, level)) {
+        return true;
+      }
+      if (lo == hi) {
+        return false;
+      }
+      ++lo;
+    }
+    if (!(hi & 1)) {
+      if (probe(hi, level)) {
+        return true;
+      }
+      if (lo == hi) {
+        return false;
+      }
+      --hi;
+    }
+    lo >>= 1;
+    hi >>= 1;
+  }
+  for (uint64_t prefix = lo;; ++prefix) {
+    if (probe(prefix, levels_ - 1)) {
       return true;
     }
-    iterator++;
+    if (prefix == hi) {
+      return false;
+    }
   }
-  return false;
 }
 
-auto PrefixBF::Query(const std::string& key) -> bool {
+auto PrefixBF::Query(const std::string& key) const -> bool {
+  OASIS_STAT_ADD(pbf_probes, 1);
   bool out = true;
   uint32_t prefix_byte_len = div8(prefix_len_ + 7);
 
@@ -215,7 +332,8 @@ auto PrefixBF::Query(const std::string& key) -> bool {
    comparisons. Similar to the integer range query, we create a query iterator
    and increment it successively.
 */
-auto PrefixBF::Query(const std::string& from, const std::string& to) -> bool {
+auto PrefixBF::Query(const std::string& from,
+                     const std::string& to) const -> bool {
   uint32_t prefix_byte_len = div8(prefix_len_ + 7);
   uint32_t shift_bits = mod8(8 - mod8(prefix_len_));
 
@@ -269,22 +387,31 @@ auto PrefixBF::Query(const std::string& from, const std::string& to) -> bool {
   return false;
 }
 
-auto PrefixBF::serialize() const -> std::pair<uint8_t*, uint64_t> {
+auto PrefixBF::serializedSize() const -> uint64_t {
   // Size (bytes) of the serialized Prefix BF.
-  uint64_t serlen =
-      sizeof(uint32_t)   /* prefix_len_ */
-      + sizeof(uint64_t) /* nmod_ */
-      + sizeof(size_t) /* size of seeds32_ */ +
-      seeds32_.size() * sizeof(uint32_t) /* actual seeds32_ vector */
-      + sizeof(size_t) /* size of seeds64_ */ +
-      seeds64_.size() *
-          sizeof(std::pair<uint64_t, uint64_t>) /* actual seeds64_ vector */
-      + div8(nmod_);
+  return sizeof(uint32_t)   /* prefix_len_ */
+         + sizeof(uint64_t) /* nmod_ */
+         + sizeof(size_t) /* size of seeds32_ */ +
+         seeds32_.size() * sizeof(uint32_t) /* actual seeds32_ vector */
+         + sizeof(size_t) /* size of seeds64_ */ +
+         seeds64_.size() *
+             sizeof(std::pair<uint64_t, uint64_t>) /* actual seeds64_ vector */
+         + div8(nmod_);
+}
 
+auto PrefixBF::serialize() const -> std::pair<uint8_t*, uint64_t> {
+  uint64_t serlen = serializedSize();
   uint8_t* out = new uint8_t[serlen];
-  uint8_t* pos = out;
+  serializeInto(out);
+  return {out, serlen};
+}
+
+void PrefixBF::serializeInto(uint8_t* dst) const {
+  uint8_t* pos = dst;
 
-  memcpy(pos, &prefix_len_, sizeof(uint32_t));
+  uint32_t prefix_len = prefix_len_ | ((levels_ - 1) << kLevelShift) |
+                        (blocked_ ? kBlockedFlag : 0);
+  memcpy(pos, &prefix_len, sizeof(uint32_t));
   pos += sizeof(uint32_t);
 
   memcpy(pos, &nmod_, sizeof(uint64_t));
@@ -295,23 +422,28 @@ auto PrefixBF::serialize() const -> std::pair<uint8_t*, uint64_t> {
   memcpy(pos, &seeds_sz, sizeof(size_t));
   pos += sizeof(size_t);
 
-  memcpy(pos, seeds32_.data(), seeds32_.size() * sizeof(uint32_t));
-  pos += seeds32_.size() * sizeof(uint32_t);
+  // only one of the seed arrays is set, and data() of the other may be null
+  if (!seeds32_.empty()) {
+    memcpy(pos, seeds32_.data(), seeds32_.size() * sizeof(uint32_t));
+    pos += seeds32_.size() * sizeof(uint32_t);
+  }
 
   // seeds array for string prefixbf
   size_t seeds64_sz = seeds64_.size();
   memcpy(pos, &seeds64_sz, sizeof(size_t));
   pos += sizeof(size_t);
 
-  memcpy(pos, seeds64_.data(),
-         seeds64_.size() * sizeof(std::pair<uint64_t, uint64_t>));
-  pos += seeds64_.size() * sizeof(std::pair<uint64_t, uint64_t>);
+  if (!seeds64_.empty()) {
+    memcpy(pos, seeds64_.data(),
+           seeds64_.size() * sizeof(std::pair<uint64_t, uint64_t>));
+    pos += seeds64_.size() * sizeof(std::pair<uint64_t, uint64_t>);
+  }
 
-  memcpy(pos, data_, div8(nmod_));
-  return {out, serlen};
+  memcpy(pos, bits_, div8(nmod_));
 }
 
-auto PrefixBF::deserialize(uint8_t* ser) -> std::pair<PrefixBF*, uint64_t> {
+auto PrefixBF::deserialize(uint8_t* ser, bool borrowed)
+    -> std::pair<PrefixBF*, uint64_t> {
   uint8_t* pos = ser;
 
   uint32_t prefix_len;
@@ -340,7 +472,12 @@ auto PrefixBF::deserialize(uint8_t* ser) -> std::pair<PrefixBF*, uint64_t> {
   pos += seeds64_sz * sizeof(std::pair<uint64_t, uint64_t>);
 
   size_t len = pos - ser + div8(nmod);
-  return {new PrefixBF(prefix_len, pos, seeds32, seeds64, nmod), len};
+  uint32_t levels = ((prefix_len >> kLevelShift) & kLevelMask) + 1;
+  bool blocked = prefix_len & kBlockedFlag;
+  prefix_len &= (1U << kLevelShift) - 1;
+  return {new PrefixBF(prefix_len, pos, seeds32, seeds64, nmod, levels, blocked,
+                       borrowed),
+          len};
 }
 
 }  // namespace oasis_plus
\ No newline at end of file
@@ -1,13 +1,37 @@
 #include "proteus/proteus.h"
 
 #include <cmath>
+#include <utility>
+
+#include "oasis/query_stats.hpp"
 
 namespace oasis_plus {
 
+namespace {
+// A lookup of Proteus::QueryBatch(), on its way down the trie
+struct TrieLookup {
+  // LoudsSparse nodes are found through a select before their labels are
+  // read, so a sparse level takes two steps
+  enum Stage { kDense, kSparseNode, kSparseLabel };
+
+  size_t idx;
+  std::string edited_key;
+  level_t level;
+  position_t node_num;
+  position_t pos;
+  Stage stage;
+#ifdef OASIS_QUERY_STATS
+  // whether a step of the lookup probed the prefix Bloom filter
+  bool pbf_probed;
+#endif
+};
+}  // namespace
+
 template <typename T>
 Proteus::Proteus(const std::vector<T>& keys, const size_t trie_depth,
                  const size_t sparse_dense_cutoff, const size_t prefix_length,
-                 const double bpk)
+                 const double bpk, const uint32_t pbf_levels,
+                 const bool pbf_blocked)
     : prefix_filter(nullptr),
       trie_depth_(trie_depth),
       sparse_dense_cutoff_(sparse_dense_cutoff) {
@@ -18,23 +42,29 @@ Proteus::Proteus(const std::vector<T>& keys, const size_t trie_depth,
   assert(sparse_dense_cutoff * 8 < trie_depth + 8);
 
   size_t total_bits = static_cast<size_t>(round(bpk * keys.size()));
+  auto new_prefix_filter = [&](uint64_t nbits) {
+    if constexpr (std::is_same_v<T, uint64_t>) {
+      return new PrefixBF(prefix_length, nbits, keys, pbf_levels, pbf_blocked);
+    } else {
+      return new PrefixBF(prefix_length, nbits, keys);
+    }
+  };
   if (trie_depth > 0) {
     builder_ = new SuRFBuilder(sparse_dense_cutoff, trie_depth);
     builder_->build(keys);
     louds_dense_ = validLoudsDense() ? new LoudsDense(builder_) : nullptr;
     louds_sparse_ = validLoudsSparse() ? new LoudsSparse(builder_) : nullptr;
-    iter_ = Proteus::Iter(this);
     delete builder_;
 
     // Initialize prefix filter if there are sufficient bits
     size_t bits_used =
         (trieSerializedSize() + sizeof(uint32_t) + sizeof(char)) * 8;
     if (bits_used < total_bits && (prefix_length > 0 && trie_depth < 64)) {
-      prefix_filter = new PrefixBF(prefix_length, total_bits - bits_used, keys);
+      prefix_filter = new_prefix_filter(total_bits - bits_used);
     }
   } else if (prefix_length > 0) {
     // No trie; Prefix filter gets all the bits
-    prefix_filter = new PrefixBF(prefix_length, total_bits, keys);
+    prefix_filter = new_prefix_filter(total_bits);
   }
 }
 
@@ -94,55 +124,61 @@ auto Proteus::Query(const T& key) const -> bool {
    Bloom filter returns false, we move the iterator to the next trie branch.
     Lastly, we compare the trie iterator to the right bound, which may incur
    further queries in the Bloom filter if the right bound matches the iterator
-   (iter_.compare).
+   (iter.compare).
 */
 template <typename T>
-auto Proteus::Query(const T& left_key, const T& right_key) -> bool {
+auto Proteus::Query(const T& left_key, const T& right_key) const -> bool {
   if (trie_depth_ == 0) {
     return prefix_filter->Query(left_key, right_key);
   }
 
-  iter_.clear(validLoudsDense(), validLoudsSparse());
+  Proteus::Iter iter(this);
 
   if (validLoudsDense()) {
-    louds_dense_->moveToKeyGreaterThan(left_key, right_key, iter_.dense_iter_,
+    louds_dense_->moveToKeyGreaterThan(left_key, right_key, iter.dense_iter_,
                                        prefix_filter);
-    if (!iter_.dense_iter_.isValid()) return false;
-    if (!iter_.dense_iter_.isComplete()) {
-      if (!iter_.dense_iter_.isSearchComplete() && validLoudsSparse()) {
-        iter_.passToSparse();
+    if (!iter.dense_iter_.isValid()) return false;
+    if (!iter.dense_iter_.isComplete()) {
+      if (!iter.dense_iter_.isSearchComplete() && validLoudsSparse()) {
+        iter.passToSparse();
         louds_sparse_->moveToKeyGreaterThan(left_key, right_key,
-                                            iter_.sparse_iter_, prefix_filter);
-        if (!iter_.sparse_iter_.isValid() && validLoudsDense()) {
-          iter_.incrementDenseIter();
+                                            iter.sparse_iter_, prefix_filter);
+        if (!iter.sparse_iter_.isValid() && validLoudsDense()) {
+          iter.incrementDenseIter();
         }
-      } else if (!iter_.dense_iter_.isMoveLeftComplete() &&
+      } else if (!iter.dense_iter_.isMoveLeftComplete() &&
                  validLoudsSparse()) {
-        iter_.passToSparse();
-        iter_.sparse_iter_.moveToLeftMostKey();
+        iter.passToSparse();
+        iter.sparse_iter_.moveToLeftMostKey();
       }
     }
   } else if (validLoudsSparse()) {
-    louds_sparse_->moveToKeyGreaterThan(left_key, right_key, iter_.sparse_iter_,
+    louds_sparse_->moveToKeyGreaterThan(left_key, right_key, iter.sparse_iter_,
                                         prefix_filter);
   }
 
-  if (!iter_.isValid(validLoudsDense(), validLoudsSparse())) {
+  if (!iter.isValid(validLoudsDense(), validLoudsSparse())) {
     return false;
   }
 
   // Return true if Prefix Bloom Filter returned true
-  if (iter_.prefixFilterTrue(validLoudsDense(), validLoudsSparse())) {
+  if (iter.prefixFilterTrue(validLoudsDense(), validLoudsSparse())) {
     return true;
   }
 
   // Return true if prefix filter query returns true or
-  // if there is a key prefix between the two query bounds
-  T rk = prefix_filter != nullptr
-             ? editKey(right_key, prefix_filter->getPrefixLen(), true)
-             : right_key;
+  // if there is a key prefix between the two query bounds.
+  // An integer right bound is exclusive, so with a prefix filter rk is the
+  // prefix of the last key in range, which the iterators query up to its end.
+  T rk = right_key;
+  if (prefix_filter != nullptr) {
+    if constexpr (std::is_same<T, uint64_t>::value) {
+      rk = right_key - 1;
+    }
+    rk = editKey(rk, prefix_filter->getPrefixLen(), true);
+  }
   int compare =
-      iter_.compare(rk, validLoudsDense(), validLoudsSparse(), prefix_filter);
+      iter.compare(rk, validLoudsDense(), validLoudsSparse(), prefix_filter);
   if (std::is_same<T, uint64_t>::value) {
     // If Proteus is a full trie, we know we are comparing full keys for
     // integers and hence we shouldn't return a positive if the right query
@@ -153,6 +189,111 @@ auto Proteus::Query(const T& left_key, const T& right_key) -> bool {
   }
 }
 
+/*
+    The lookups of a batch are interleaved as in AMAC: each of up to
+   kQueryBatch slots holds a lookup, and every round steps each slot through
+   one trie level. A step ends by prefetching what the slot's next step reads,
+   which the steps of the other slots leave time to arrive. A finished slot
+   takes the next key, so the batch stays full until the keys run out.
+*/
+template <typename T>
+void Proteus::QueryBatch(const T* keys, const size_t n, bool* out) const {
+  if (trie_depth_ == 0) {
+    for (size_t i = 0; i < n; i++) {
+      out[i] = prefix_filter->Query(keys[i]);
+      OASIS_STAT_STAGE(oasis::QueryStats::kPrefixBF);
+    }
+    return;
+  }
+
+  TrieLookup lookups[kQueryBatch];
+  size_t next = 0;
+  auto start = [&](TrieLookup& lookup) {
+    lookup.idx = next++;
+    lookup.edited_key = editAndStringify(keys[lookup.idx], trie_depth_, true);
+    lookup.node_num = 0;
+#ifdef OASIS_QUERY_STATS
+    lookup.pbf_probed = false;
+#endif
+    if (validLoudsDense()) {
+      lookup.stage = TrieLookup::kDense;
+      lookup.level = 0;
+      louds_dense_->prefetchLabel(0,
+                                  static_cast<label_t>(lookup.edited_key[0]));
+    } else {
+      lookup.stage = TrieLookup::kSparseNode;
+      lookup.level = louds_sparse_->getStartLevel();
+      louds_sparse_->prefetchNode(0);
+    }
+  };
+
+  size_t nactive = 0;
+  for (; nactive < kQueryBatch && next < n; nactive++) {
+    start(lookups[nactive]);
+  }
+
+  while (nactive > 0) {
+    for (size_t i = 0; i < nactive;) {
+      TrieLookup& lookup = lookups[i];
+      const T& key = keys[lookup.idx];
+      LookupStep step = LookupStep::kNext;
+#ifdef OASIS_QUERY_STATS
+      uint64_t pbf_probes = oasis::QueryStats::local().pbf_probes;
+#endif
+      switch (lookup.stage) {
+        case TrieLookup::kDense:
+          step = louds_dense_->lookupLevel(key, lookup.edited_key, lookup.level,
+                                           lookup.node_num, prefix_filter);
+          if (step == LookupStep::kNext &&
+              ++lookup.level == louds_dense_->getHeight()) {
+            // node_num == 0 means search terminates in louds-dense
+            if (lookup.node_num == 0) {
+              step = LookupStep::kFound;
+            } else {
+              assert(validLoudsSparse());
+              lookup.stage = TrieLookup::kSparseNode;
+              louds_sparse_->prefetchNode(lookup.node_num);
+            }
+          }
+          break;
+        case TrieLookup::kSparseNode:
+          lookup.pos = louds_sparse_->seekNode(lookup.node_num);
+          lookup.stage = TrieLookup::kSparseLabel;
+          break;
+        case TrieLookup::kSparseLabel:
+          step = louds_sparse_->lookupLevel(key, lookup.edited_key,
+                                            lookup.level, lookup.pos,
+                                            lookup.node_num, prefix_filter);
+          if (step == LookupStep::kNext) {
+            lookup.stage = TrieLookup::kSparseNode;
+            if (++lookup.level == lookup.edited_key.length()) {
+              step = LookupStep::kNotFound;
+            }
+          }
+          break;
+      }
+
+#ifdef OASIS_QUERY_STATS
+      lookup.pbf_probed |= oasis::QueryStats::local().pbf_probes != pbf_probes;
+#endif
+
+      if (step == LookupStep::kNext) {
+        i++;
+        continue;
+      }
+      out[lookup.idx] = step == LookupStep::kFound;
+      OASIS_STAT_STAGE(lookup.pbf_probed ? oasis::QueryStats::kPrefixBF
+                                         : oasis::QueryStats::kTrie);
+      if (next < n) {
+        start(lookup);
+        i++;
+      } else {
+        std::swap(lookup, lookups[--nactive]);
+      }
+    }
+  }
+}
+
 auto Proteus::trieSerializedSize() const -> uint64_t {
   if (trie_depth_ == 0) {
     return 0;
@@ -164,24 +305,27 @@ auto Proteus::trieSerializedSize() const -> uint64_t {
   }
 }
 
-auto Proteus::serialize() const -> std::pair<uint8_t*, size_t> {
+auto Proteus::serializedSize() const -> uint64_t {
   uint64_t metadata_size = sizeof(uint32_t) * 2;
   sizeAlign(metadata_size);
+  return metadata_size + trieSerializedSize() + sizeof(char) +
+         (prefix_filter != nullptr ? prefix_filter->serializedSize() : 0);
+}
 
-  uint64_t trie_size = 0;
-  if (trie_depth_ > 0) {
-    trie_size = trieSerializedSize();
-  }
+auto Proteus::serialize() const -> std::pair<uint8_t*, size_t> {
+  uint64_t size = serializedSize();
+  // zeroed, so that the alignment padding is deterministic
+  uint8_t* data = new uint8_t[size]();
+  serializeInto(data);
+  return {data, size};
+}
 
-  char has_prefix_filter = '\0';
-  std::pair<uint8_t*, size_t> pbf_ser = {nullptr, 0};
-  if (prefix_filter != nullptr) {
-    has_prefix_filter = '1';
-    pbf_ser = prefix_filter->serialize();
-  }
+void Proteus::serializeInto(uint8_t* dst) const {
+  uint64_t metadata_size = sizeof(uint32_t) * 2;
+  sizeAlign(metadata_size);
+  char has_prefix_filter = prefix_filter != nullptr ? '1' : '\0';
 
-  char* data =
-      new char[metadata_size + trie_size + sizeof(char) + pbf_ser.second];
+  char* data = reinterpret_cast<char*>(dst);
   char* cur_data = data;
 
   memcpy(cur_data, &trie_depth_, sizeof(uint32_t));
@@ -199,25 +343,21 @@ auto Proteus::serialize() const -> std::pair<uint8_t*, size_t> {
     }
   }
 
-  assert(cur_data - data == static_cast<int64_t>(metadata_size + trie_size));
+  assert(cur_data - data ==
+         static_cast<int64_t>(metadata_size + trieSerializedSize()));
 
   memcpy(cur_data, &has_prefix_filter, sizeof(char));
   cur_data += sizeof(char);
 
   if (prefix_filter != nullptr) {
-    memcpy(cur_data, pbf_ser.first, pbf_ser.second);
-    delete[] pbf_ser.first;
-    cur_data += pbf_ser.second;
-    assert(cur_data - data ==
-           static_cast<int64_t>(metadata_size + trie_size + sizeof(char) +
-                                pbf_ser.second));
+    prefix_filter->serializeInto(reinterpret_cast<uint8_t*>(cur_data));
+    cur_data += prefix_filter->serializedSize();
   }
-
-  return {reinterpret_cast<uint8_t*>(data),
-          metadata_size + trie_size + sizeof(char) + pbf_ser.second};
+  assert(cur_data - data == static_cast<int64_t>(serializedSize()));
 }
 
-auto Proteus::deSerialize(char* src) -> std::pair<Proteus*, size_t> {
+auto Proteus::deSerialize(char* src, bool borrowed)
+    -> std::pair<Proteus*, size_t> {
   char* pos = src;
   Proteus* proteus = new Proteus();
 
@@ -230,13 +370,12 @@ auto Proteus::deSerialize(char* src) -> std::pair<Proteus*, size_t> {
   if (proteus->trie_depth_ > 0) {
     if (proteus->validLoudsDense()) {
       proteus->louds_dense_ =
-          LoudsDense::deSerialize(pos, proteus->trie_depth_);
+          LoudsDense::deSerialize(pos, proteus->trie_depth_, borrowed);
     }
     if (proteus->validLoudsSparse()) {
       proteus->louds_sparse_ =
-          LoudsSparse::deSerialize(pos, proteus->trie_depth_);
+          LoudsSparse::deSerialize(pos, proteus->trie_depth_, borrowed);
     }
-    proteus->iter_ = Proteus::Iter(proteus);
   }
 
   char has_prefix_filter;
@@ -246,12 +385,13 @@ auto Proteus::deSerialize(char* src) -> std::pair<Proteus*, size_t> {
   if (has_prefix_filter == '\0') {
     proteus->prefix_filter = nullptr;
   } else {
-    auto deser = PrefixBF::deserialize(reinterpret_cast<uint8_t*>(pos));
+    auto deser =
+        PrefixBF::deserialize(reinterpret_cast<uint8_t*>(pos), borrowed);
     proteus->prefix_filter = deser.first;
     pos += deser.second;
   }
 
-  return {proteus, src - pos};
+  return {proteus, pos - src};
 }
 
 void Proteus::destroy() {
@@ -316,7 +456,7 @@ auto Proteus::Iter::isValid(bool valid_dense, bool valid_sparse) const -> bool {
 
 template <typename T>
 auto Proteus::Iter::compare(const T& key, bool valid_dense, bool valid_sparse,
-                            PrefixBF* prefix_filter) const -> int {
+                            const PrefixBF* prefix_filter) const -> int {
   if (valid_dense) {
     int dense_compare = dense_iter_.compare(key, prefix_filter);
     if (dense_iter_.isComplete() || dense_compare != 0) {
@@ -356,15 +496,20 @@ auto Proteus::Iter::incrementDenseIter() -> bool {
 
 template auto Proteus::Iter::compare(const uint64_t& key, bool valid_dense,
                                      bool valid_sparse,
-                                     PrefixBF* prefix_filter) const -> int;
+                                     const PrefixBF* prefix_filter) const
+    -> int;
 
 template Proteus::Proteus(const std::vector<uint64_t>& keys,
                           const size_t trie_depth,
                           const size_t sparse_dense_cutoff,
-                          const size_t prefix_length, const double bpk);
+                          const size_t prefix_length, const double bpk,
+                          const uint32_t pbf_levels, const bool pbf_blocked);
 
 template auto Proteus::Query(const uint64_t& key) const -> bool;
 
 template auto Proteus::Query(const uint64_t& left_key,
-                             const uint64_t& right_key) -> bool;
+                             const uint64_t& right_key) const -> bool;
+
+template void Proteus::QueryBatch(const uint64_t* keys, const size_t n,
+                                  bool* out) const;
 }  // namespace oasis_plus
\ No newline at end of file
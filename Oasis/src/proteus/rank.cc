@@ -58,7 +58,7 @@ void BitvectorRank::serialize(char*& dst) const {
   align(dst);
 }
 
-auto BitvectorRank::deSerialize(char*& src) -> BitvectorRank* {
+auto BitvectorRank::deSerialize(char*& src, bool borrowed) -> BitvectorRank* {
   BitvectorRank* bv_rank = new BitvectorRank();
 
   memcpy(&(bv_rank->num_bits_), src, sizeof(bv_rank->num_bits_));
@@ -67,13 +67,22 @@ auto BitvectorRank::deSerialize(char*& src) -> BitvectorRank* {
          sizeof(bv_rank->basic_block_size_));
   src += sizeof(bv_rank->basic_block_size_);
 
-  bv_rank->bits_ = new word_t[bv_rank->numWords()];
-  memcpy(bv_rank->bits_, src, bv_rank->bitsSize());
+  bv_rank->borrowed_ = borrowed;
+  if (borrowed) {
+    bv_rank->bits_ = reinterpret_cast<word_t*>(src);
+  } else {
+    bv_rank->bits_ = new word_t[bv_rank->numWords()];
+    memcpy(bv_rank->bits_, src, bv_rank->bitsSize());
+  }
   src += bv_rank->bitsSize();
 
-  bv_rank->rank_lut_ =
-      new position_t[bv_rank->rankLutSize() / sizeof(position_t)];
-  memcpy(bv_rank->rank_lut_, src, bv_rank->rankLutSize());
+  if (borrowed) {
+    bv_rank->rank_lut_ = reinterpret_cast<position_t*>(src);
+  } else {
+    bv_rank->rank_lut_ =
+        new position_t[bv_rank->rankLutSize() / sizeof(position_t)];
+    memcpy(bv_rank->rank_lut_, src, bv_rank->rankLutSize());
+  }
   src += bv_rank->rankLutSize();
 
   align(src);
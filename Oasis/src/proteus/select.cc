@@ -49,13 +49,20 @@ auto BitvectorSelect::select(position_t rank) const -> position_t {
   return (word_id * kWordSize + select64_popcount_search(word, rank_left));
 }
 
+void BitvectorSelect::prefetch(position_t rank) const {
+  __builtin_prefetch(select_lut_ + rank / sample_interval_);
+}
+
 auto BitvectorSelect::selectLutSize() const -> position_t {
   return ((num_ones_ / sample_interval_ + 1) * sizeof(position_t));
 }
 
 auto BitvectorSelect::serializedSize() const -> position_t {
-  position_t size = sizeof(num_bits_) + sizeof(sample_interval_) +
-                    sizeof(num_ones_) + bitsSize() + selectLutSize();
+  // bits_ start on a word boundary, to be read in place
+  position_t size =
+      sizeof(num_bits_) + sizeof(sample_interval_) + sizeof(num_ones_);
+  sizeAlign(size);
+  size += bitsSize() + selectLutSize();
   sizeAlign(size);
   return size;
 }
@@ -71,6 +78,7 @@ void BitvectorSelect::serialize(char*& dst) const {
   dst += sizeof(sample_interval_);
   memcpy(dst, &num_ones_, sizeof(num_ones_));
   dst += sizeof(num_ones_);
+  align(dst);
   memcpy(dst, bits_, bitsSize());
   dst += bitsSize();
   memcpy(dst, select_lut_, selectLutSize());
@@ -78,7 +86,8 @@ void BitvectorSelect::serialize(char*& dst) const {
   align(dst);
 }
 
-auto BitvectorSelect::deSerialize(char*& src) -> BitvectorSelect* {
+auto BitvectorSelect::deSerialize(char*& src, bool borrowed)
+    -> BitvectorSelect* {
   BitvectorSelect* bv_select = new BitvectorSelect();
 
   memcpy(&(bv_select->num_bits_), src, sizeof(bv_select->num_bits_));
@@ -88,14 +97,24 @@ auto BitvectorSelect::deSerialize(char*& src) -> BitvectorSelect* {
   src += sizeof(bv_select->sample_interval_);
   memcpy(&(bv_select->num_ones_), src, sizeof(bv_select->num_ones_));
   src += sizeof(bv_select->num_ones_);
+  align(src);
 
-  bv_select->bits_ = new word_t[bv_select->numWords()];
-  memcpy(bv_select->bits_, src, bv_select->bitsSize());
+  bv_select->borrowed_ = borrowed;
+  if (borrowed) {
+    bv_select->bits_ = reinterpret_cast<word_t*>(src);
+  } else {
+    bv_select->bits_ = new word_t[bv_select->numWords()];
+    memcpy(bv_select->bits_, src, bv_select->bitsSize());
+  }
   src += bv_select->bitsSize();
 
-  bv_select->select_lut_ =
-      new position_t[bv_select->selectLutSize() / sizeof(position_t)];
-  memcpy(bv_select->select_lut_, src, bv_select->selectLutSize());
+  if (borrowed) {
+    bv_select->select_lut_ = reinterpret_cast<position_t*>(src);
+  } else {
+    bv_select->select_lut_ =
+        new position_t[bv_select->selectLutSize() / sizeof(position_t)];
+    memcpy(bv_select->select_lut_, src, bv_select->selectLutSize());
+  }
   src += bv_select->selectLutSize();
 
   align(src);
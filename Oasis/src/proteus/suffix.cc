@@ -60,10 +60,13 @@ auto BitvectorSuffix::getSuffixLen(const level_t level,
 }
 
 auto BitvectorSuffix::serializedSize() const -> position_t {
-  position_t size = sizeof(num_bits_) + bitsSize() + sizeof(start_level_) +
+  // bits_ start on a word boundary, to be read in place
+  position_t size = sizeof(num_bits_) + sizeof(start_level_) +
                     sizeof(position_t) +
                     sizeof(position_t) * num_suffixes_per_level_.size();
   sizeAlign(size);
+  size += bitsSize();
+  sizeAlign(size);
   return size;
 }
 
@@ -79,8 +82,9 @@ auto BitvectorSuffix::read(const position_t bit_pos, const level_t level,
   position_t word_id = bit_pos / kWordSize;
   position_t offset = bit_pos & (kWordSize - 1);
   word_t ret_word = (bits_[word_id] << offset) >> (kWordSize - suffix_len);
+  // the rest of the suffix, at the top of the next word
   if (offset + suffix_len > kWordSize)
-    ret_word += (bits_[word_id + 1] >> (kWordSize - offset - suffix_len));
+    ret_word += (bits_[word_id + 1] >> (2 * kWordSize - offset - suffix_len));
   return ret_word;
 }
 
@@ -142,12 +146,14 @@ void BitvectorSuffix::serialize(char*& dst) const {
   dst += sizeof(position_t) * nlevels;
   memcpy(dst, &num_bits_, sizeof(num_bits_));
   dst += sizeof(num_bits_);
+  align(dst);
   memcpy(dst, bits_, bitsSize());
   dst += bitsSize();
   align(dst);
 }
 
-auto BitvectorSuffix::deSerialize(char*& src) -> BitvectorSuffix* {
+auto BitvectorSuffix::deSerialize(char*& src, bool borrowed)
+    -> BitvectorSuffix* {
   BitvectorSuffix* sv = new BitvectorSuffix();
   level_t start_level = 0;
   memcpy(&start_level, src, sizeof(start_level));
@@ -163,9 +169,15 @@ auto BitvectorSuffix::deSerialize(char*& src) -> BitvectorSuffix* {
 
   memcpy(&(sv->num_bits_), src, sizeof(sv->num_bits_));
   src += sizeof(sv->num_bits_);
+  align(src);
 
-  sv->bits_ = new word_t[sv->numWords()];
-  memcpy(sv->bits_, src, sv->bitsSize());
+  sv->borrowed_ = borrowed;
+  if (borrowed) {
+    sv->bits_ = reinterpret_cast<word_t*>(src);
+  } else {
+    sv->bits_ = new word_t[sv->numWords()];
+    memcpy(sv->bits_, src, sv->bitsSize());
+  }
   src += sv->bitsSize();
 
   align(src);
@@ -173,7 +185,7 @@ auto BitvectorSuffix::deSerialize(char*& src) -> BitvectorSuffix* {
 }
 
 void BitvectorSuffix::destroy() {
-  if (bits_) delete[] bits_;
+  if (bits_ && !borrowed_) delete[] bits_;
 }
 
 }  // namespace oasis_plus
\ No newline at end of file
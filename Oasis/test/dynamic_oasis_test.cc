@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <random>
+#include <set>
+
+#include "gtest/gtest.h"
+#include "oasis/dynamic_oasis.hpp"
+#include "test_util.hpp"
+
+namespace oasis_test {
+namespace {
+
+const double kBpk = 12;
+const size_t kBlockSz = 128;
+const size_t kNumKeys = 20000;
+const size_t kNumRanges = 20000;
+
+/* filter finds every live key, alone and in the ranges holding it */
+void expect_finds(const oasis::DynamicOasis &filter,
+                  const std::set<uint64_t> &live) {
+  std::vector<uint64_t> keys(live.begin(), live.end());
+  for (uint64_t key : keys) {
+    ASSERT_TRUE(filter.query(key)) << key;
+  }
+  for (const auto &[left, right] : make_ranges(keys, kNumRanges, 1000, 19)) {
+    ASSERT_TRUE(!holds_key(keys, left, right) || filter.query(left, right))
+        << left << ", " << right;
+  }
+}
+
+}  // namespace
+
+TEST(DynamicOasisTest, InsertEraseRebuild) {
+  for (Dist dist : kDists) {
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 9);
+    std::mt19937_64 rng(10);
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+    /* inserted in any order, through rebuilds once the delta outgrows them */
+    oasis::DynamicOasis filter(kBpk, kBlockSz);
+    std::set<uint64_t> live;
+    for (uint64_t key : keys) {
+      filter.insert(key);
+      live.insert(key);
+    }
+    EXPECT_EQ(filter.nkeys(), live.size());
+    expect_finds(filter, live);
+
+    /* erased keys only leave tombstones, an insert after an erase undoes it */
+    std::vector<uint64_t> erased;
+    for (size_t i = 0; i < keys.size(); i += 3) {
+      filter.erase(keys[i]);
+      live.erase(keys[i]);
+      erased.emplace_back(keys[i]);
+    }
+    for (size_t i = 0; i < erased.size(); i += 10) {
+      filter.insert(erased[i]);
+      live.insert(erased[i]);
+    }
+    expect_finds(filter, live);
+
+    /* a rebuild drops the erased keys: only a filter over the live ones is
+       left, which answers like one built from scratch */
+    filter.rebuild();
+    EXPECT_EQ(filter.nkeys(), live.size());
+    expect_finds(filter, live);
+    std::vector<uint64_t> live_keys(live.begin(), live.end());
+    oasis::Oasis fresh(kBpk, kBlockSz, live_keys);
+    EXPECT_EQ(filter.size(), fresh.size());
+    for (uint64_t key : erased) {
+      ASSERT_EQ(filter.query(key), fresh.query(key)) << key;
+    }
+  }
+}
+
+TEST(DynamicOasisTest, EmptiedFilterFindsNothing) {
+  oasis::DynamicOasis filter(kBpk, kBlockSz);
+  EXPECT_FALSE(filter.query(0, UINT64_MAX));
+  std::vector<uint64_t> keys = make_keys(100, Dist::kUniform, 11);
+  for (uint64_t key : keys) {
+    filter.insert(key);
+  }
+  EXPECT_TRUE(filter.query(0, UINT64_MAX));
+  for (uint64_t key : keys) {
+    filter.erase(key);
+  }
+  filter.rebuild();
+  EXPECT_EQ(filter.nkeys(), 0U);
+  EXPECT_FALSE(filter.query(0, UINT64_MAX));
+}
+
+}  // namespace oasis_test
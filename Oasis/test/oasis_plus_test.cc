@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "oasis_plus.h"
+#include "proteus/modeling.h"
+#include "test_util.hpp"
+
+namespace oasis_test {
+namespace {
+
+using oasis_plus::OasisPlus;
+
+const double kBpk = 12;
+const size_t kBlockSz = 128;
+const size_t kNumKeys = 20000;
+const size_t kNumRanges = 20000;
+
+/* no false negative on the keys and on the ranges holding them */
+void expect_no_false_negatives(const OasisPlus &filter,
+                               const std::vector<uint64_t> &keys) {
+  size_t misses = 0;
+  for (uint64_t key : keys) {
+    misses += !filter.query(key);
+  }
+  EXPECT_EQ(misses, 0U);
+
+  misses = 0;
+  for (const auto &[left, right] : make_ranges(keys, kNumRanges, 1000, 7)) {
+    misses += left < right && holds_key(keys, left, right) &&
+              !filter.query(left, right);
+  }
+  EXPECT_EQ(misses, 0U);
+}
+
+/* a and b answer every point and range query alike */
+void expect_same_answers(const OasisPlus &a, const OasisPlus &b,
+                         const std::vector<uint64_t> &keys) {
+  for (const auto &[left, right] : make_ranges(keys, kNumRanges, 1000, 11)) {
+    ASSERT_EQ(a.query(left), b.query(left)) << left;
+    if (left < right) {
+      ASSERT_EQ(a.query(left, right), b.query(left, right))
+          << left << ", " << right;
+    }
+  }
+}
+
+}  // namespace
+
+TEST(OasisPlusTest, NoFalseNegatives) {
+  for (Dist dist : kDists) {
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 1);
+    OasisPlus filter(kBpk, kBlockSz, keys);
+    expect_no_false_negatives(filter, keys);
+  }
+}
+
+TEST(OasisPlusTest, SerializeRoundTrip) {
+  for (Dist dist : kDists) {
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 2);
+    OasisPlus filter(kBpk, kBlockSz, keys);
+    std::pair<uint8_t *, size_t> ser = filter.serialize();
+    EXPECT_EQ(ser.second, filter.serialized_size());
+
+    std::unique_ptr<OasisPlus> copy(OasisPlus::deserialize(ser.first));
+    delete[] ser.first;
+    expect_same_answers(filter, *copy, keys);
+    expect_no_false_negatives(*copy, keys);
+  }
+}
+
+TEST(OasisPlusTest, QueryBatchAnswersAsQuery) {
+  for (Dist dist : kDists) {
+    SCOPED_TRACE(::testing::Message() << "dist " << static_cast<int>(dist));
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 7);
+    OasisPlus filter(kBpk, kBlockSz, keys);
+
+    /* near keys and anywhere, not a multiple of the batch size */
+    std::vector<uint64_t> queries;
+    for (const auto &range : make_ranges(keys, kNumRanges + 7, 1000, 17)) {
+      queries.emplace_back(range.first);
+    }
+    std::unique_ptr<bool[]> out(new bool[queries.size()]);
+    filter.query_batch(queries.data(), queries.size(), out.get());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      ASSERT_EQ(out[i], filter.query(queries[i])) << queries[i];
+    }
+  }
+}
+
+#ifdef OASIS_QUERY_STATS
+/* the batch path counts the same stages and probes as one query at a time */
+TEST(OasisPlusTest, QueryBatchCountsStatsAsQuery) {
+  for (Dist dist : kDists) {
+    SCOPED_TRACE(::testing::Message() << "dist " << static_cast<int>(dist));
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 8);
+    OasisPlus filter(kBpk, kBlockSz, keys);
+    std::vector<uint64_t> queries;
+    for (const auto &range : make_ranges(keys, kNumRanges, 1000, 19)) {
+      queries.emplace_back(range.first);
+    }
+
+    oasis::QueryStats begin = filter.query_stats();
+    for (uint64_t key : queries) {
+      filter.query(key);
+    }
+    oasis::QueryStats single = filter.query_stats() - begin;
+
+    begin = filter.query_stats();
+    std::unique_ptr<bool[]> out(new bool[queries.size()]);
+    filter.query_batch(queries.data(), queries.size(), out.get());
+    oasis::QueryStats batch = filter.query_stats() - begin;
+
+    for (size_t stage = 0; stage < oasis::QueryStats::kNumStages; ++stage) {
+      EXPECT_EQ(batch.answered[stage], single.answered[stage]) << stage;
+    }
+    EXPECT_EQ(batch.pbf_probes, single.pbf_probes);
+  }
+}
+#endif
+
+/* a borrowed filter reads the 8-byte aligned bytes it was given in place */
+TEST(OasisPlusTest, BorrowedDeserialize) {
+  for (Dist dist : kDists) {
+    SCOPED_TRACE(::testing::Message() << "dist " << static_cast<int>(dist));
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 3);
+    OasisPlus filter(kBpk, kBlockSz, keys);
+    std::unique_ptr<uint64_t[]> ser(
+        new uint64_t[(filter.serialized_size() + 7) / 8]);
+    filter.serialize_into(reinterpret_cast<uint8_t *>(ser.get()));
+
+    std::unique_ptr<OasisPlus> copy(
+        OasisPlus::deserialize(reinterpret_cast<uint8_t *>(ser.get()), true));
+    expect_same_answers(filter, *copy, keys);
+    expect_no_false_negatives(*copy, keys);
+  }
+}
+
+/* learned filters keep how their keys were positioned across serialization:
+ * by a fixed-point multiplier as built, or in double as in older filters */
+TEST(OasisPlusTest, LearnedRFReadsBothPositionings) {
+  using oasis_plus::BitSet;
+  using oasis_plus::LearnedRF;
+  std::vector<uint64_t> keys = make_keys(1000, Dist::kUniform, 8);
+  uint64_t low = keys.front();
+  uint64_t up = keys.back();
+  uint64_t nlocations = 4 * keys.size();
+  for (bool fixed : {false, true}) {
+    SCOPED_TRACE(fixed ? "fixed" : "double");
+    std::vector<uint64_t> locations;
+    for (size_t i = 1; i + 1 < keys.size(); ++i) {
+      uint64_t delta = keys[i] - low;
+      locations.emplace_back(
+          fixed ? oasis::mul_hi(delta, oasis::pos_multiplier(up - low,
+                                                             nlocations))
+                : static_cast<uint64_t>(static_cast<double>(delta) *
+                                        nlocations / (up - low)));
+    }
+    locations.erase(std::unique(locations.begin(), locations.end()),
+                    locations.end());
+
+    /* a single block between the first and the last location */
+    std::vector<uint64_t> block_bias = {locations.front(), locations.back()};
+    std::vector<uint64_t> block_keys;
+    for (uint64_t location : locations) {
+      block_keys.emplace_back(location - block_bias[0]);
+    }
+    uint64_t max_range = block_bias[1] - block_bias[0];
+    std::vector<uint8_t> block = BitSet::build(block_keys, max_range);
+    auto *bitmap = new uint8_t[block.size()];
+    std::copy(block.begin(), block.end(), bitmap);
+    std::vector<BitSet> block_lists;
+    block_lists.emplace_back(block_keys.size(), max_range, bitmap);
+    std::vector<uint64_t> accumulate_interval_sz = {0, nlocations};
+    auto nblock_keys = static_cast<uint16_t>(block_keys.size());
+    LearnedRF filter(nblock_keys, nblock_keys, block.size(), bitmap,
+                     accumulate_interval_sz, block_lists, block_bias, fixed);
+
+    std::pair<uint8_t *, size_t> ser = filter.serialize();
+    std::unique_ptr<LearnedRF> copy(LearnedRF::deserialize(ser.first).first);
+    delete[] ser.first;
+    size_t misses = 0;
+    for (size_t i = 1; i + 1 < keys.size(); ++i) {
+      misses += !filter.query(keys[i], 1, low, up);
+      misses += !copy->query(keys[i], 1, low, up);
+    }
+    EXPECT_EQ(misses, 0U);
+  }
+}
+
+/* with the prefix Bloom filter of Proteus at several levels */
+TEST(OasisPlusTest, MultiLevelPrefixFilter) {
+  for (Dist dist : kDists) {
+    for (uint32_t levels : {2, 4}) {
+      SCOPED_TRACE(::testing::Message() << "dist " << static_cast<int>(dist)
+                                        << ", " << levels << " levels");
+      std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 4);
+      OasisPlus filter(kBpk, kBlockSz, keys, 10, {}, levels);
+      expect_no_false_negatives(filter, keys);
+
+      std::pair<uint8_t *, size_t> ser = filter.serialize();
+      std::unique_ptr<OasisPlus> copy(OasisPlus::deserialize(ser.first));
+      delete[] ser.first;
+      expect_same_answers(filter, *copy, keys);
+    }
+  }
+}
+
+/* with a cache-line-blocked prefix Bloom filter in Proteus */
+TEST(OasisPlusTest, BlockedPrefixFilter) {
+  for (Dist dist : kDists) {
+    SCOPED_TRACE(::testing::Message() << "dist " << static_cast<int>(dist));
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 6);
+    OasisPlus filter(kBpk, kBlockSz, keys, 10, {}, 1, true);
+    expect_no_false_negatives(filter, keys);
+
+    std::pair<uint8_t *, size_t> ser = filter.serialize();
+    std::unique_ptr<OasisPlus> copy(OasisPlus::deserialize(ser.first));
+    delete[] ser.first;
+    expect_same_answers(filter, *copy, keys);
+  }
+}
+
+/* the modeled FPRs of the prefix Bloom filter layouts the filter builds */
+TEST(OasisPlusTest, ModelsPrefixFilterLayouts) {
+  /* 1M prefixes at every length, 16 bits each */
+  std::vector<size_t> key_prefixes(65, 1000000);
+  long double nbits = 16.0L * 1000000;
+  long double standard = oasis_plus::pbfProbeFPR(nbits, key_prefixes, 48, 1);
+  EXPECT_NEAR(standard, 0.00046, 0.00005);
+
+  /* the load of the lines varies, about doubling the FPR at 16 bits */
+  long double blocked =
+      oasis_plus::pbfProbeFPR(nbits, key_prefixes, 48, 1, true);
+  EXPECT_GT(blocked, 1.5 * standard);
+  EXPECT_LT(blocked, 3 * standard);
+
+  /* two levels share the bits */
+  long double two_levels = oasis_plus::pbfProbeFPR(nbits, key_prefixes, 48, 2);
+  EXPECT_GT(two_levels, standard);
+
+  /* one level probes every prefix of a range, more levels fewer pieces */
+  EXPECT_NEAR(oasis_plus::pbfRangeFPR(standard, 1, 64),
+              1 - std::pow(1 - standard, 64), 1e-12);
+  EXPECT_LT(oasis_plus::pbfRangeFPR(two_levels, 2, 64),
+            1 - std::pow(1 - two_levels, 64));
+}
+
+/* few keys, whose intervals and model outweigh their blocks, at any budget */
+TEST(OasisPlusTest, NoFalseNegativesOnFewKeys) {
+  for (Dist dist : {Dist::kUniform, Dist::kNormal, Dist::kClustered}) {
+    for (size_t nkeys : {3, 10, 50}) {
+      for (double bpk : {8.0, 14.0, 20.0}) {
+        SCOPED_TRACE(::testing::Message()
+                     << "dist " << static_cast<int>(dist) << ", " << nkeys
+                     << " keys, bpk " << bpk);
+        std::vector<uint64_t> keys = make_keys(nkeys, dist, 5);
+        OasisPlus filter(bpk, kBlockSz, keys);
+        expect_no_false_negatives(filter, keys);
+      }
+    }
+  }
+}
+
+}  // namespace oasis_test
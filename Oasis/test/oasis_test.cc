@@ -0,0 +1,252 @@
+#include <memory>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "oasis/oasis.hpp"
+#include "oasis/oasis_builder.hpp"
+#include "oasis/oasis_view.hpp"
+#include "test_util.hpp"
+
+namespace oasis_test {
+namespace {
+
+const double kBpk = 12;
+const size_t kBlockSz = 128;
+const size_t kNumKeys = 20000;
+const size_t kNumRanges = 20000;
+
+/* no false negative on the keys and on the ranges holding them */
+void expect_no_false_negatives(const oasis::Oasis &filter,
+                               const std::vector<uint64_t> &keys) {
+  size_t misses = 0;
+  for (uint64_t key : keys) {
+    misses += !filter.query(key);
+  }
+  EXPECT_EQ(misses, 0U);
+
+  misses = 0;
+  for (const auto &[left, right] : make_ranges(keys, kNumRanges, 1000, 7)) {
+    misses += holds_key(keys, left, right) && !filter.query(left, right);
+  }
+  EXPECT_EQ(misses, 0U);
+}
+
+/* a and b answer every point and range query alike */
+template <typename A, typename B>
+void expect_same_answers(const A &a, const B &b,
+                         const std::vector<uint64_t> &keys) {
+  for (const auto &[left, right] : make_ranges(keys, kNumRanges, 1000, 11)) {
+    ASSERT_EQ(a.query(left), b.query(left)) << left;
+    ASSERT_EQ(a.query(left, right), b.query(left, right))
+        << left << ", " << right;
+  }
+}
+
+}  // namespace
+
+TEST(OasisTest, NoFalseNegatives) {
+  for (Dist dist : kDists) {
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 1);
+    oasis::Oasis filter(kBpk, kBlockSz, keys);
+    expect_no_false_negatives(filter, keys);
+  }
+}
+
+TEST(OasisTest, SerializeRoundTrip) {
+  for (Dist dist : kDists) {
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 2);
+    oasis::Oasis filter(kBpk, kBlockSz, keys);
+    std::pair<uint8_t *, size_t> ser = filter.serialize();
+    EXPECT_EQ(ser.second, filter.size());
+
+    std::unique_ptr<oasis::Oasis> copy(oasis::Oasis::deserialize(ser.first));
+    delete[] ser.first;
+    EXPECT_EQ(copy->size(), filter.size());
+    expect_same_answers(filter, *copy, keys);
+    expect_no_false_negatives(*copy, keys);
+  }
+}
+
+TEST(OasisTest, ViewAnswersAsFilter) {
+  for (Dist dist : kDists) {
+    for (bool search_tree : {false, true}) {
+      std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 3);
+      oasis::Oasis filter(kBpk, kBlockSz, keys, search_tree);
+      expect_same_answers(filter, filter.view(), keys);
+
+      /* a view queries the serialized filter in place */
+      std::pair<uint8_t *, size_t> ser = filter.serialize();
+      oasis::OasisView view(ser.first);
+      expect_same_answers(filter, view, keys);
+      delete[] ser.first;
+    }
+  }
+}
+
+TEST(OasisTest, QueryBatchAnswersAsQuery) {
+  for (Dist dist : kDists) {
+    for (bool search_tree : {false, true}) {
+      std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 4);
+      oasis::Oasis filter(kBpk, kBlockSz, keys, search_tree);
+
+      /* not a multiple of the batch size, so that the last batch is partial */
+      auto ranges = make_ranges(keys, kNumRanges + 7, 1000, 13);
+      std::vector<uint64_t> lefts, rights;
+      for (const auto &[left, right] : ranges) {
+        lefts.emplace_back(left);
+        rights.emplace_back(right);
+      }
+      std::unique_ptr<bool[]> out(new bool[ranges.size()]);
+
+      filter.query_batch(lefts.data(), ranges.size(), out.get());
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        ASSERT_EQ(out[i], filter.query(lefts[i])) << lefts[i];
+      }
+      filter.query_batch(lefts.data(), rights.data(), ranges.size(),
+                         out.get());
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        ASSERT_EQ(out[i], filter.query(lefts[i], rights[i]))
+            << lefts[i] << ", " << rights[i];
+      }
+    }
+  }
+}
+
+TEST(OasisTest, BuilderMatchesBudget) {
+  for (Dist dist : kDists) {
+    std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 5);
+    oasis::Oasis filter(kBpk, kBlockSz, keys);
+
+    oasis::OasisBuilder builder(kBpk, kBlockSz);
+    for (uint64_t key : keys) {
+      builder.add(key);
+      builder.add(key);
+    }
+    EXPECT_EQ(builder.nkeys(), keys.size());
+    std::unique_ptr<oasis::Oasis> built(builder.finish());
+    EXPECT_EQ(builder.nkeys(), 0U);
+
+    /* the gaps kept on the fly may differ slightly from the exact ones */
+    EXPECT_LE(built->size(), filter.size() * 21 / 20);
+    expect_no_false_negatives(*built, keys);
+  }
+}
+
+/* the packed keys go to a file, and are read back from any key */
+TEST(OasisTest, KeySpillReadsSpilledKeys) {
+  std::vector<uint64_t> keys = make_keys(20 * kNumKeys, Dist::kUniform, 9);
+  oasis::KeySpill spill;
+  for (uint64_t key : keys) {
+    spill.append(key);
+  }
+  /* gaps of about 45 bits, and a header per kChunk keys */
+  EXPECT_LT(spill.memory_usage(), keys.size());
+
+  oasis::KeySpill moved = std::move(spill);
+  EXPECT_TRUE(spill.empty());
+  for (size_t idx : {size_t{0}, keys.size() / 3, keys.size() - 1}) {
+    auto cursor = moved.cursor(idx);
+    for (size_t i = idx; i < keys.size(); ++i) {
+      ASSERT_EQ(cursor.next(), keys[i]) << i;
+    }
+  }
+}
+
+TEST(OasisTest, MergeKeepsSinglePositionParts) {
+  std::vector<std::vector<uint64_t>> keys = {
+      {28664, 61116}, {807964, 908120, 1053164}, {1253999, 1903925, 1915992}};
+  std::vector<std::unique_ptr<oasis::Oasis>> owned;
+  std::vector<const oasis::Oasis *> parts;
+  for (const auto &part_keys : keys) {
+    owned.emplace_back(new oasis::Oasis(kBpk, kBlockSz, part_keys));
+    parts.emplace_back(owned.back().get());
+  }
+  std::unique_ptr<oasis::Oasis> merged(oasis::Oasis::merge(parts));
+  ASSERT_NE(merged, nullptr);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    for (uint64_t key : keys[i]) {
+      ASSERT_TRUE(parts[i]->query(key)) << key;
+      ASSERT_TRUE(merged->query(key)) << key;
+    }
+  }
+}
+
+/* key-disjoint parts of all sizes, down to the one-key ones without blocks */
+TEST(OasisTest, MergeAnswersAsParts) {
+  for (Dist dist : kDists) {
+    for (bool search_tree : {false, true}) {
+      std::vector<uint64_t> keys = make_keys(kNumKeys, dist, 6);
+      std::mt19937_64 rng(7);
+      std::vector<std::unique_ptr<oasis::Oasis>> owned;
+      std::vector<const oasis::Oasis *> parts;
+      for (size_t begin = 0; begin < keys.size();) {
+        size_t nkeys = rng() % 4 == 0 ? 1 + rng() % 3 : 1 + rng() % 3000;
+        size_t end = std::min(keys.size(), begin + nkeys);
+        std::vector<uint64_t> part_keys(keys.begin() + begin,
+                                        keys.begin() + end);
+        owned.emplace_back(
+            new oasis::Oasis(kBpk, kBlockSz, part_keys, search_tree));
+        parts.emplace_back(owned.back().get());
+        begin = end;
+      }
+
+      std::unique_ptr<oasis::Oasis> merged(oasis::Oasis::merge(parts));
+      ASSERT_NE(merged, nullptr);
+      expect_no_false_negatives(*merged, keys);
+      /* nothing a part finds is lost */
+      for (const auto &[left, right] : make_ranges(keys, kNumRanges, 1000, 17)) {
+        bool found = false;
+        bool found_left = false;
+        for (const oasis::Oasis *part : parts) {
+          found = found || part->query(left, right);
+          found_left = found_left || part->query(left);
+        }
+        ASSERT_TRUE(!found_left || merged->query(left)) << left;
+        ASSERT_TRUE(!found || merged->query(left, right))
+            << left << ", " << right;
+      }
+    }
+  }
+}
+
+/* a merge is only worth it for few large parts built for about the budget */
+TEST(OasisTest, ShouldMergeWeighsWorkAndFalsePositives) {
+  std::vector<uint64_t> keys = make_keys(kNumKeys, Dist::kUniform, 9);
+  size_t half = keys.size() / 2;
+  std::vector<uint64_t> low(keys.begin(), keys.begin() + half);
+  std::vector<uint64_t> high(keys.begin() + half, keys.end());
+
+  /* the low half gets few positions, a rebuild would spread them evenly */
+  oasis::Oasis sparse(kBpk - 6, kBlockSz, low);
+  oasis::Oasis dense(kBpk + 6, kBlockSz, high);
+  EXPECT_FALSE(oasis::Oasis::should_merge({&sparse, &dense}, kBpk,
+                                          keys.size()));
+
+  /* one-key parts take more than the budget, and more work than a rebuild */
+  std::vector<std::unique_ptr<oasis::Oasis>> owned;
+  std::vector<const oasis::Oasis *> parts;
+  for (size_t i = 0; i < 100; ++i) {
+    owned.emplace_back(new oasis::Oasis(kBpk, kBlockSz,
+                                        std::vector<uint64_t>{keys[i]}));
+    parts.emplace_back(owned.back().get());
+  }
+  EXPECT_FALSE(oasis::Oasis::should_merge(parts, kBpk, parts.size()));
+}
+
+TEST(OasisTest, MergeRejectsMixedBlockSizes) {
+  std::vector<uint64_t> keys = make_keys(kNumKeys, Dist::kUniform, 8);
+  size_t half = keys.size() / 2;
+  std::vector<uint64_t> low(keys.begin(), keys.begin() + half);
+  std::vector<uint64_t> high(keys.begin() + half, keys.end());
+  oasis::Oasis a(kBpk, kBlockSz, low);
+  oasis::Oasis b(kBpk, kBlockSz, high);
+  oasis::Oasis c(kBpk, kBlockSz * 2, high);
+
+  EXPECT_TRUE(oasis::Oasis::should_merge({&a, &b}, kBpk, keys.size()));
+  EXPECT_FALSE(oasis::Oasis::should_merge({&a, &c}, kBpk, keys.size()));
+  EXPECT_EQ(oasis::Oasis::merge({&a, &c}), nullptr);
+  /* out of order parts overlap */
+  EXPECT_EQ(oasis::Oasis::merge({&b, &a}), nullptr);
+}
+
+}  // namespace oasis_test
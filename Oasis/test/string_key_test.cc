@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "oasis/string_key.hpp"
+
+namespace oasis_test {
+namespace {
+
+const size_t kNumKeys = 20000;
+const size_t kSegmentKeys = 64;
+
+/* sorted distinct composite keys tenant|table|ts, and short ones */
+auto make_string_keys(size_t n, uint64_t seed) -> std::vector<std::string> {
+  std::mt19937_64 rng(seed);
+  const char *tables[] = {"a", "ab", "orders", "orders_archive", "users"};
+  std::vector<std::string> keys = {"", "a", "ab", "abc"};
+  for (size_t i = 0; i < n; ++i) {
+    std::string key(4, '\0');
+    uint32_t tenant = rng() % 16;
+    memcpy(&key[0], &tenant, sizeof(tenant));
+    key += tables[rng() % 5];
+    key += '|';
+    uint64_t ts = rng() % (n * 8);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      key += static_cast<char>(ts >> shift);
+    }
+    keys.emplace_back(key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+}  // namespace
+
+/* the map never decreases, and sends every key to one of the mapped keys */
+TEST(StringKeyTest, EncodePreservesOrder) {
+  std::vector<std::string> keys = make_string_keys(kNumKeys, 1);
+  oasis::StringKeyBuilder builder(kSegmentKeys);
+  for (const std::string &key : keys) {
+    builder.add(key.data(), key.size());
+    builder.add(key.data(), key.size());
+  }
+  EXPECT_EQ(builder.nkeys(), keys.size());
+
+  std::vector<uint64_t> mapped;
+  std::pair<uint8_t *, size_t> ser = builder.finish(mapped);
+  EXPECT_EQ(ser.second % sizeof(uint64_t), 0U);
+  EXPECT_TRUE(std::is_sorted(mapped.begin(), mapped.end()));
+  EXPECT_EQ(std::adjacent_find(mapped.begin(), mapped.end()), mapped.end());
+
+  const uint8_t *pos = ser.first;
+  oasis::StringKeyView view(pos);
+  EXPECT_EQ(view.nsegments(), (keys.size() + kSegmentKeys - 1) / kSegmentKeys);
+  EXPECT_EQ(static_cast<size_t>(pos - ser.first), ser.second);
+
+  /* keys, and queries next to them: prefixes, extensions and successors */
+  std::vector<std::string> queries = keys;
+  std::mt19937_64 rng(2);
+  for (const std::string &key : keys) {
+    queries.emplace_back(key.substr(0, rng() % (key.size() + 1)));
+    queries.emplace_back(key + '\0');
+    queries.emplace_back(key + static_cast<char>(rng()));
+    if (!key.empty()) {
+      std::string next = key;
+      next.back() = static_cast<char>(next.back() + 1);
+      queries.emplace_back(next);
+    }
+  }
+  std::sort(queries.begin(), queries.end());
+
+  uint64_t last = 0;
+  for (const std::string &query : queries) {
+    uint64_t value = view.encode(query.data(), query.size());
+    ASSERT_GE(value, last) << query;
+    ASSERT_NE(value, UINT64_MAX) << query;
+    last = value;
+  }
+  for (const std::string &key : keys) {
+    ASSERT_TRUE(std::binary_search(mapped.begin(), mapped.end(),
+                                   view.encode(key.data(), key.size())))
+        << key;
+  }
+  delete[] ser.first;
+}
+
+}  // namespace oasis_test
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace oasis_test {
+
+enum class Dist { kUniform, kNormal, kClustered, kMixed };
+
+const Dist kDists[] = {Dist::kUniform, Dist::kNormal, Dist::kClustered,
+                       Dist::kMixed};
+
+/* about n sorted distinct keys, fewer if some collide */
+inline auto make_keys(size_t n, Dist dist, uint64_t seed)
+    -> std::vector<uint64_t> {
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<double> normal(1e18, 1e15);
+  std::vector<uint64_t> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    switch (dist) {
+      case Dist::kUniform:
+        keys.emplace_back(rng());
+        break;
+      case Dist::kNormal:
+        keys.emplace_back(static_cast<uint64_t>(normal(rng)));
+        break;
+      case Dist::kClustered:
+        /* a few dense runs far apart */
+        keys.emplace_back((rng() % 16) << 58 | rng() % (n * 64));
+        break;
+      case Dist::kMixed:
+        /* dense runs among uniform keys */
+        keys.emplace_back(i % 2 == 0 ? rng()
+                                     : (rng() % 4) << 62 | rng() % (n * 4));
+        break;
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+/**
+ * n ranges [l, r] of up to max_len, half of them around keys and half
+ * anywhere, so that both non-empty and empty ranges are queried
+ */
+inline auto make_ranges(const std::vector<uint64_t> &keys, size_t n,
+                        uint64_t max_len, uint64_t seed)
+    -> std::vector<std::pair<uint64_t, uint64_t>> {
+  std::mt19937_64 rng(seed);
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  ranges.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t len = rng() % max_len;
+    uint64_t left = rng();
+    if (i % 2 == 0) {
+      uint64_t key = keys[rng() % keys.size()];
+      left = key - std::min(key, rng() % (len + 1));
+    }
+    ranges.emplace_back(left, left + std::min(len, UINT64_MAX - left));
+  }
+  return ranges;
+}
+
+/* whether [left, right] holds one of the sorted keys */
+inline auto holds_key(const std::vector<uint64_t> &keys, uint64_t left,
+                      uint64_t right) -> bool {
+  auto it = std::lower_bound(keys.begin(), keys.end(), left);
+  return it != keys.end() && *it <= right;
+}
+
+}  // namespace oasis_test
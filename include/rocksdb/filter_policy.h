@@ -33,6 +33,7 @@
 namespace ROCKSDB_NAMESPACE {
 
 class Slice;
+class Statistics;
 struct BlockBasedTableOptions;
 struct ConfigOptions;
 
@@ -96,6 +97,14 @@ class FilterBitsReader {
     (void)right;
     return true;
   }
+
+  // RangeQuery() adding its costs to the RANGE_FILTER_* tickers of stats,
+  // if the filter counts them
+  virtual bool RangeQuery(const Slice& left, const Slice& right,
+                          Statistics* stats) {
+    (void)stats;
+    return RangeQuery(left, right);
+  }
 };
 
 // Contextual information passed to BloomFilterPolicy at filter building time.
@@ -246,8 +255,50 @@ extern const FilterPolicy* NewBloomFilterPolicy(
 extern const FilterPolicy* NewExperimentalRibbonFilterPolicy(
     double bloom_equivalent_bits_per_key);
 
-extern const FilterPolicy* NewOasisFilterPolicy(double bpk, size_t block_sz);
-extern const FilterPolicy* NewOasisPlusFilterPolicy(double bpk, size_t block_sz,
-                                                    size_t max_qlen);
+// A sample of the range queries [left, right) OasisPlus filters serve. The
+// filters built while it is set choose their segments and their split between
+// the learned filter and Proteus for expected false positives over it, rather
+// than over the key space. Queries may be loaded from a trace with Add(), or
+// recorded by the filters' own range queries. A uniform sample of at most
+// `capacity` of the queries offered is kept. Thread-safe.
+class OasisQuerySample {
+ public:
+  // record_every: the filters offer one in that many of their range queries
+  explicit OasisQuerySample(size_t capacity = 4096, size_t record_every = 64);
+  ~OasisQuerySample();
+
+  void Add(const Slice& left, const Slice& right);
+  // Called by the filters on each range query
+  void Record(const Slice& left, const Slice& right);
+
+  std::vector<std::pair<std::string, std::string>> Queries() const;
+
+ private:
+  struct Rep;
+  std::unique_ptr<Rep> rep_;
+};
+
+// build_threads: # threads building each filter, with the same result as one
+// string_keys: filter whole keys of any length, mapped to integers in order,
+// rather than their first 8 bytes read as a big-endian integer
+// pla_epsilon: if not 0, model skewed keys by linear pieces that place every
+// key within pla_epsilon of its rank, rather than by key range
+// rice_blocks: Golomb-Rice code the blocks where it is smaller, for a lower
+// FPR at the same bpk, at the cost of a slower probe of those blocks
+extern const FilterPolicy* NewOasisFilterPolicy(double bpk, size_t block_sz,
+                                                size_t build_threads = 1,
+                                                bool string_keys = false,
+                                                size_t pla_epsilon = 0,
+                                                bool rice_blocks = false);
+// query_sample: tune the filters for the queries in it, and record theirs
+// pbf_levels: if > 1, the prefix Bloom filter of Proteus also holds the key
+// prefixes up to pbf_levels - 1 bits shorter, so that a wide range query
+// probes O(pbf_levels) aligned pieces rather than every prefix in it
+// pbf_blocked: set all the bits of a prefix in one cache line of the prefix
+// Bloom filter of Proteus, one cache miss per probe for a slightly higher FPR
+extern const FilterPolicy* NewOasisPlusFilterPolicy(
+    double bpk, size_t block_sz, size_t max_qlen, bool string_keys = false,
+    std::shared_ptr<OasisQuerySample> query_sample = nullptr,
+    uint32_t pbf_levels = 1, bool pbf_blocked = false);
 
 }  // namespace ROCKSDB_NAMESPACE
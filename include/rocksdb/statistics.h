@@ -183,6 +183,22 @@ enum Tickers : uint32_t {
   RANGE_FILTER_HIT,
   RANGE_FILTER_MISS,
   RANGE_FILTER_USE,
+  // Costs of range filter queries, only counted when built with
+  // WITH_OASIS_QUERY_STATS. The first six count the queries answered by each
+  // stage: the learned model's intervals, without or with a key in the range,
+  // the block biases, a block probe, and Proteus' trie, without or after a
+  // prefix Bloom filter lookup.
+  RANGE_FILTER_MODEL_OUT_OF_SCOPE,
+  RANGE_FILTER_MODEL_EXIST,
+  RANGE_FILTER_BLOCK_BIAS,
+  RANGE_FILTER_BLOCK_PROBE,
+  RANGE_FILTER_TRIE,
+  RANGE_FILTER_PREFIX_BF,
+  // Upper-bit words scanned and lower-bit entries decoded by block probes
+  RANGE_FILTER_UPPER_WORDS,
+  RANGE_FILTER_LOWER_ENTRIES,
+  // Prefix Bloom filter lookups
+  RANGE_FILTER_PBF_PROBES,
 
   // Number of times we had to reseek inside an iteration to skip
   // over large number of keys with same userkey.
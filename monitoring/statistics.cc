@@ -92,6 +92,16 @@ const std::vector<std::pair<Tickers, std::string>> TickersNameMap = {
     {RANGE_FILTER_HIT, "rocksdb.range.filter.hit"},
     {RANGE_FILTER_MISS, "rocksdb.range.filter.miss"},
     {RANGE_FILTER_USE, "rocksdb.range.filter.use"},
+    {RANGE_FILTER_MODEL_OUT_OF_SCOPE,
+     "rocksdb.range.filter.model.out.of.scope"},
+    {RANGE_FILTER_MODEL_EXIST, "rocksdb.range.filter.model.exist"},
+    {RANGE_FILTER_BLOCK_BIAS, "rocksdb.range.filter.block.bias"},
+    {RANGE_FILTER_BLOCK_PROBE, "rocksdb.range.filter.block.probe"},
+    {RANGE_FILTER_TRIE, "rocksdb.range.filter.trie"},
+    {RANGE_FILTER_PREFIX_BF, "rocksdb.range.filter.prefix.bf"},
+    {RANGE_FILTER_UPPER_WORDS, "rocksdb.range.filter.upper.words"},
+    {RANGE_FILTER_LOWER_ENTRIES, "rocksdb.range.filter.lower.entries"},
+    {RANGE_FILTER_PBF_PROBES, "rocksdb.range.filter.pbf.probes"},
     // end Range Filter Status
     {NUMBER_OF_RESEEKS_IN_ITERATION, "rocksdb.number.reseeks.iteration"},
     {GET_UPDATES_SINCE_CALLS, "rocksdb.getupdatessince.calls"},
@@ -324,8 +324,9 @@ bool FullFilterBlockReader::RangeMayExist(
 
     if (filter_bits_reader) {
       *filter_checked = true;
-      return filter_bits_reader->RangeQuery(user_key_without_ts,
-                                            *iterate_upper_bound);
+      return filter_bits_reader->RangeQuery(
+          user_key_without_ts, *iterate_upper_bound,
+          table()->get_rep()->ioptions.statistics);
     }
 
     return true;
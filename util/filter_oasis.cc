@@ -1,88 +1,188 @@
 #include <algorithm>
-#include <atomic>
+#include <cstring>
 #include <iostream>
-#include <map>
+#include <memory>
 
 #include "filter_test_util.h"
 #include "oasis/oasis.hpp"
+#include "oasis/oasis_builder.hpp"
+#include "oasis/string_key.hpp"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/slice.h"
+#include "util/filter_oasis_stats.h"
 
 namespace rocksdb {
-static std::map<uint64_t, oasis::Oasis*> cache;
-static std::atomic<uint64_t> timestamp;
 
 class OasisFilterBitsBuilder : public FilterBitsBuilder {
  private:
   double bpk_;
   size_t block_sz_;
-  std::vector<uint64_t> keys_;
+  size_t build_threads_;
+  size_t pla_epsilon_;
+  bool rice_blocks_;
+  // Keys arrive sorted; they are packed and their gaps sampled as they come
+  // instead of being buffered as 64-bit integers until Finish().
+  oasis::OasisBuilder builder_;
+  // Set for whole variable-length keys, which are mapped to integers first
+  std::unique_ptr<oasis::StringKeyBuilder> string_keys_;
 
  public:
-  OasisFilterBitsBuilder(double bpk, uint16_t block_sz)
-      : bpk_(bpk), block_sz_(block_sz) {}
-
-  ~OasisFilterBitsBuilder() { keys_.clear(); }
+  OasisFilterBitsBuilder(double bpk, uint16_t block_sz, size_t build_threads,
+                         bool string_keys, size_t pla_epsilon,
+                         bool rice_blocks)
+      : bpk_(bpk),
+        block_sz_(block_sz),
+        build_threads_(build_threads),
+        pla_epsilon_(pla_epsilon),
+        rice_blocks_(rice_blocks),
+        builder_(bpk, block_sz, false, build_threads, pla_epsilon,
+                 rice_blocks) {
+    if (string_keys) {
+      string_keys_.reset(new oasis::StringKeyBuilder());
+    }
+  }
 
-  void AddKey(const Slice& key) { keys_.push_back(sliceToUint64(key.data())); }
+  void AddKey(const Slice& key) {
+    if (string_keys_) {
+      string_keys_->add(key.data(), key.size());
+    } else {
+      builder_.add(sliceToUint64(key.data()));
+    }
+  }
 
   Slice Finish(std::unique_ptr<const char[]>* buf) {
-    oasis::Oasis* filter = new oasis::Oasis(bpk_, block_sz_, keys_);
-
-    uint64_t key = ++timestamp;
-    cache[key] = filter;
+    if (string_keys_) {
+      return FinishStringKeys(buf);
+    }
+    oasis::Oasis* filter = builder_.finish();
 
-    uint8_t* data = new uint8_t[sizeof(uint64_t)];
-    memcpy(data, &key, sizeof(uint64_t));
+    // The filter block carries the whole serialized filter so that it survives
+    // DB reopen and is charged to the block cache like any other filter.
+    std::pair<uint8_t*, size_t> ser = filter->serialize();
+    delete filter;
 
-    buf->reset((const char*)data);
-    Slice out((const char*)data, sizeof(uint64_t));
+    buf->reset((const char*)ser.first);
+    Slice out((const char*)ser.first, ser.second);
 
     return out;
   }
+
+ private:
+  // The block holds the key map, then the filter over the mapped keys, which
+  // gets what the map leaves of the bits per key.
+  Slice FinishStringKeys(std::unique_ptr<const char[]>* buf) {
+    size_t nkeys = string_keys_->nkeys();
+    std::vector<uint64_t> keys;
+    std::pair<uint8_t*, size_t> map_ser = string_keys_->finish(keys);
+    double bpk = nkeys == 0 ? bpk_ : bpk_ - 8.0 * map_ser.second / nkeys;
+
+    oasis::Oasis* filter =
+        new oasis::Oasis(bpk, block_sz_, keys, false, build_threads_,
+                         pla_epsilon_, rice_blocks_);
+    std::pair<uint8_t*, size_t> ser = filter->serialize();
+    delete filter;
+
+    char* out = new char[map_ser.second + ser.second];
+    memcpy(out, map_ser.first, map_ser.second);
+    memcpy(out + map_ser.second, ser.first, ser.second);
+    delete[] map_ser.first;
+    delete[] ser.first;
+
+    buf->reset(out);
+    return Slice(out, map_ser.second + ser.second);
+  }
 };
 
 class OasisFilterBitsReader : public FilterBitsReader {
  protected:
-  oasis::Oasis* filter_ = nullptr;
+  // Queries run in place over the filter block, which the owning
+  // ParsedFullFilterBlock keeps alive for the lifetime of this reader.
+  oasis::OasisView filter_;
+  // Only used when the block is not 8-byte aligned, e.g. with mmap reads
+  std::unique_ptr<uint64_t[]> aligned_copy_;
+  // Maps whole keys to the filter's integers, when built with string keys
+  oasis::StringKeyView string_keys_;
+  bool use_string_keys_;
+
+  uint64_t ToUint64(const Slice& key) const {
+    return use_string_keys_ ? string_keys_.encode(key.data(), key.size())
+                            : sliceToUint64(key.data());
+  }
 
  public:
-  explicit OasisFilterBitsReader(const Slice& contents) {
-    uint8_t* ser = (uint8_t*)contents.data();
-    uint64_t key = ((uint64_t*)ser)[0];
-
-    auto iter = cache.find(key);
-    filter_ = reinterpret_cast<oasis::Oasis*>(iter->second);
+  OasisFilterBitsReader(const Slice& contents, bool string_keys)
+      : use_string_keys_(string_keys) {
+    const uint8_t* ser = reinterpret_cast<const uint8_t*>(contents.data());
+    if (reinterpret_cast<uintptr_t>(ser) % sizeof(uint64_t) != 0) {
+      aligned_copy_.reset(
+          new uint64_t[(contents.size() + 7) / sizeof(uint64_t)]);
+      memcpy(aligned_copy_.get(), contents.data(), contents.size());
+      ser = reinterpret_cast<const uint8_t*>(aligned_copy_.get());
+    }
+    if (use_string_keys_) {
+      string_keys_ = oasis::StringKeyView(ser);
+    }
+    filter_ = oasis::OasisView(ser);
   }
 
-  // ~OasisFilterBitsReader() { printf("delete %lu\n", ++delete_cnt); }
-
   using FilterBitsReader::MayMatch;
   void MayMatch(int num_keys, Slice** keys, bool* may_match) override {
-    (void)num_keys;
-    (void)keys;
-    (void)may_match;
-    return;
+    constexpr int kBatch = static_cast<int>(oasis::OasisView::kQueryBatch);
+    uint64_t int_keys[kBatch];
+    for (int begin = 0; begin < num_keys; begin += kBatch) {
+      int cnt = std::min(kBatch, num_keys - begin);
+      for (int i = 0; i < cnt; ++i) {
+        int_keys[i] = ToUint64(*keys[begin + i]);
+      }
+      filter_.query_batch(int_keys, cnt, may_match + begin);
+    }
   }
 
   bool MayMatch(const Slice& entry) override {
-    return filter_->query(sliceToUint64(entry.data()));
+    return filter_.query(ToUint64(entry));
   }
 
   bool RangeQuery(const Slice& left, const Slice& right) override {
-    return filter_->query(sliceToUint64(left.data()),
-                          sliceToUint64(right.data()) - 1);
+    if (!use_string_keys_) {
+      return filter_.query(sliceToUint64(left.data()),
+                           sliceToUint64(right.data()) - 1);
+    }
+    // Keys below right may map to the same integer, so it stays in the range
+    uint64_t l_key = ToUint64(left);
+    uint64_t r_key = ToUint64(right);
+    return l_key == r_key ? filter_.query(l_key)
+                          : filter_.query(l_key, r_key);
   }
+
+  using FilterBitsReader::RangeQuery;
+#ifdef OASIS_QUERY_STATS
+  bool RangeQuery(const Slice& left, const Slice& right,
+                  Statistics* stats) override {
+    oasis::QueryStats begin = oasis::QueryStats::local();
+    bool result = RangeQuery(left, right);
+    RecordRangeQueryStats(stats, oasis::QueryStats::local() - begin);
+    return result;
+  }
+#endif
 };
 
 class OasisFilterPolicy : public FilterPolicy {
  public:
-  explicit OasisFilterPolicy(double bpk, size_t block_sz)
-      : bpk_(bpk), block_sz_(block_sz) {}
+  OasisFilterPolicy(double bpk, size_t block_sz, size_t build_threads,
+                    bool string_keys, size_t pla_epsilon, bool rice_blocks)
+      : bpk_(bpk),
+        block_sz_(block_sz),
+        build_threads_(build_threads),
+        string_keys_(string_keys),
+        pla_epsilon_(pla_epsilon),
+        rice_blocks_(rice_blocks) {}
 
   ~OasisFilterPolicy() {}
 
-  const char* Name() const { return "Oasis"; }
+  // Tables are only read with the kind of keys they were built with
+  const char* Name() const {
+    return string_keys_ ? "OasisStringKeys" : "Oasis";
+  }
 
   void CreateFilter(const Slice* keys, int n, std::string* dst) const override {
     (void)keys;
@@ -100,21 +200,31 @@ class OasisFilterPolicy : public FilterPolicy {
   }
 
   OasisFilterBitsBuilder* GetFilterBitsBuilder() const override {
-    return new OasisFilterBitsBuilder(bpk_, block_sz_);
+    return new OasisFilterBitsBuilder(bpk_, block_sz_, build_threads_,
+                                      string_keys_, pla_epsilon_,
+                                      rice_blocks_);
   }
 
   OasisFilterBitsReader* GetFilterBitsReader(
       const Slice& contents) const override {
-    return new OasisFilterBitsReader(contents);
+    return new OasisFilterBitsReader(contents, string_keys_);
   }
 
  private:
   double bpk_;
   size_t block_sz_;
+  size_t build_threads_;
+  bool string_keys_;
+  size_t pla_epsilon_;
+  bool rice_blocks_;
 };
 
-const FilterPolicy* NewOasisFilterPolicy(double bpk, size_t block_sz) {
-  return new OasisFilterPolicy(bpk, block_sz);
+const FilterPolicy* NewOasisFilterPolicy(double bpk, size_t block_sz,
+                                         size_t build_threads, bool string_keys,
+                                         size_t pla_epsilon,
+                                         bool rice_blocks) {
+  return new OasisFilterPolicy(bpk, block_sz, build_threads, string_keys,
+                               pla_epsilon, rice_blocks);
 }
 
 }  // namespace rocksdb
\ No newline at end of file
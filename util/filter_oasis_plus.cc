@@ -1,17 +1,65 @@
 #include <algorithm>
 #include <atomic>
+#include <cstring>
 #include <iostream>
-#include <map>
+#include <memory>
 
 #include "filter_test_util.h"
+#include "oasis/string_key.hpp"
 #include "oasis_plus.h"
+#include "port/port.h"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/slice.h"
+#include "util/filter_oasis_stats.h"
+#include "util/mutexlock.h"
+#include "util/random.h"
 
 namespace rocksdb {
 
-static std::map<uint64_t, oasis_plus::OasisPlus*> cache;
-static std::atomic<uint64_t> timestamp;
+struct OasisQuerySample::Rep {
+  size_t capacity;
+  size_t record_every;
+  std::atomic<uint64_t> nrecords{0};
+
+  mutable port::Mutex mutex;
+  // # queries offered, of which `queries` is a uniform sample
+  uint64_t noffered = 0;
+  std::vector<std::pair<std::string, std::string>> queries;
+  Random64 rnd{0x5eed};
+};
+
+OasisQuerySample::OasisQuerySample(size_t capacity, size_t record_every)
+    : rep_(new Rep()) {
+  rep_->capacity = capacity;
+  rep_->record_every = std::max<size_t>(1, record_every);
+}
+
+OasisQuerySample::~OasisQuerySample() {}
+
+void OasisQuerySample::Add(const Slice& left, const Slice& right) {
+  MutexLock lock(&rep_->mutex);
+  // reservoir sampling
+  uint64_t idx = rep_->noffered++;
+  if (rep_->queries.size() < rep_->capacity) {
+    rep_->queries.emplace_back(left.ToString(), right.ToString());
+  } else if ((idx = rep_->rnd.Uniform(idx + 1)) < rep_->capacity) {
+    rep_->queries[idx] = {left.ToString(), right.ToString()};
+  }
+}
+
+void OasisQuerySample::Record(const Slice& left, const Slice& right) {
+  if (rep_->nrecords.fetch_add(1, std::memory_order_relaxed) %
+          rep_->record_every ==
+      0) {
+    Add(left, right);
+  }
+}
+
+std::vector<std::pair<std::string, std::string>> OasisQuerySample::Queries()
+    const {
+  MutexLock lock(&rep_->mutex);
+  return rep_->queries;
+}
 
 class OasisPlusFilterBitsBuilder : public FilterBitsBuilder {
  private:
@@ -19,74 +67,220 @@ class OasisPlusFilterBitsBuilder : public FilterBitsBuilder {
   size_t block_sz_;
   size_t max_qlen_;
   std::vector<uint64_t> keys_;
+  // Set for whole variable-length keys, which are mapped to integers first
+  std::unique_ptr<oasis::StringKeyBuilder> string_keys_;
+  std::shared_ptr<OasisQuerySample> query_sample_;
+  uint32_t pbf_levels_;
+  bool pbf_blocked_;
 
  public:
-  OasisPlusFilterBitsBuilder(double bpk, uint16_t block_sz,
-                             size_t max_qlen = 10)
-      : bpk_(bpk), block_sz_(block_sz), max_qlen_(max_qlen) {}
+  OasisPlusFilterBitsBuilder(
+      double bpk, uint16_t block_sz, size_t max_qlen = 10,
+      bool string_keys = false,
+      std::shared_ptr<OasisQuerySample> query_sample = nullptr,
+      uint32_t pbf_levels = 1, bool pbf_blocked = false)
+      : bpk_(bpk),
+        block_sz_(block_sz),
+        max_qlen_(max_qlen),
+        query_sample_(std::move(query_sample)),
+        pbf_levels_(pbf_levels),
+        pbf_blocked_(pbf_blocked) {
+    if (string_keys) {
+      string_keys_.reset(new oasis::StringKeyBuilder());
+    }
+  }
 
   ~OasisPlusFilterBitsBuilder() { keys_.clear(); }
 
-  void AddKey(const Slice& key) { keys_.push_back(sliceToUint64(key.data())); }
+  void AddKey(const Slice& key) {
+    if (string_keys_) {
+      string_keys_->add(key.data(), key.size());
+    } else {
+      keys_.push_back(sliceToUint64(key.data()));
+    }
+  }
+
   Slice Finish(std::unique_ptr<const char[]>* buf) {
-    oasis_plus::OasisPlus* filter =
-        new oasis_plus::OasisPlus(bpk_, block_sz_, keys_, max_qlen_);
+    // With string keys the block holds the key map, then the filter over the
+    // mapped keys, which gets what the map leaves of the bits per key.
+    std::pair<uint8_t*, size_t> map_ser{nullptr, 0};
+    double bpk = bpk_;
+    if (string_keys_) {
+      size_t nkeys = string_keys_->nkeys();
+      map_ser = string_keys_->finish(keys_);
+      bpk = nkeys == 0 ? bpk_ : bpk_ - 8.0 * map_ser.second / nkeys;
+    }
 
-    uint64_t key = ++timestamp;
-    cache[key] = filter;
+    oasis_plus::OasisPlus* filter = new oasis_plus::OasisPlus(
+        bpk, block_sz_, keys_, max_qlen_, SampleQueries(map_ser.first),
+        pbf_levels_, pbf_blocked_);
 
-    uint8_t* data = new uint8_t[sizeof(uint64_t)];
-    memcpy(data, &key, sizeof(uint64_t));
+    // The filter block carries the whole serialized filter so that it survives
+    // DB reopen and is charged to the block cache like any other filter. The
+    // filter is written in place after the key map, whose size keeps it 8-byte
+    // aligned. It is zeroed so that the padding is deterministic.
+    size_t size = map_ser.second + filter->serialized_size();
+    uint8_t* out = new uint8_t[size]();
+    if (map_ser.first != nullptr) {
+      memcpy(out, map_ser.first, map_ser.second);
+      delete[] map_ser.first;
+    }
+    filter->serialize_into(out + map_ser.second);
+    delete filter;
 
-    buf->reset((const char*)data);
-    Slice out((const char*)data, sizeof(uint64_t));
+    buf->reset((const char*)out);
+    return Slice((const char*)out, size);
+  }
 
-    return out;
+ private:
+  // The sampled queries as the filter sees them, through the key map if any
+  std::vector<std::pair<uint64_t, uint64_t>> SampleQueries(
+      const uint8_t* string_keys) const {
+    std::vector<std::pair<uint64_t, uint64_t>> queries;
+    if (!query_sample_) {
+      return queries;
+    }
+    oasis::StringKeyView view;
+    if (string_keys != nullptr) {
+      view = oasis::StringKeyView(string_keys);
+    }
+    for (const auto& [left, right] : query_sample_->Queries()) {
+      if (string_keys != nullptr) {
+        queries.emplace_back(view.encode(left.data(), left.size()),
+                             view.encode(right.data(), right.size()));
+      } else if (left.size() >= sizeof(uint64_t) &&
+                 right.size() >= sizeof(uint64_t)) {
+        uint64_t l_key = sliceToUint64(left.data());
+        uint64_t r_key = sliceToUint64(right.data());
+        if (l_key < r_key) {
+          queries.emplace_back(l_key, r_key - 1);
+        }
+      }
+    }
+    return queries;
   }
 };
 
 class OasisPlusFilterBitsReader : public FilterBitsReader {
  protected:
-  oasis_plus::OasisPlus* filter_;
-
- public:
-  explicit OasisPlusFilterBitsReader(const Slice& contents) {
-    uint8_t* ser = (uint8_t*)contents.data();
-    uint64_t key = ((uint64_t*)ser)[0];
+  // Queries do not modify the filter, so a reader shared through the block
+  // cache can serve concurrent lookups without locking.
+  std::unique_ptr<const oasis_plus::OasisPlus> filter_;
+  // The block, if it is not 8-byte aligned, which the filter reads in place
+  std::unique_ptr<uint64_t[]> aligned_copy_;
+  // Maps whole keys to the filter's integers, when built with string keys
+  oasis::StringKeyView string_keys_;
+  bool use_string_keys_;
+  std::shared_ptr<OasisQuerySample> query_sample_;
+  // Whether MultiGet looks keys up together, see MayMatch()
+  bool batch_lookups_;
 
-    auto iter = cache.find(key);
+  uint64_t ToUint64(const Slice& key) const {
+    return use_string_keys_ ? string_keys_.encode(key.data(), key.size())
+                            : sliceToUint64(key.data());
+  }
 
-    filter_ = iter->second;
+ public:
+  OasisPlusFilterBitsReader(const Slice& contents, bool string_keys,
+                            std::shared_ptr<OasisQuerySample> query_sample)
+      : use_string_keys_(string_keys),
+        query_sample_(std::move(query_sample)),
+        batch_lookups_(contents.size() >= kMinBatchFilterSize) {
+    // deserialize() aligns its cursor on absolute addresses, so the block has
+    // to start on an 8-byte boundary to be parsed with the builder's layout.
+    const uint8_t* ser = reinterpret_cast<const uint8_t*>(contents.data());
+    if (reinterpret_cast<uintptr_t>(ser) % sizeof(uint64_t) != 0) {
+      aligned_copy_.reset(
+          new uint64_t[(contents.size() + 7) / sizeof(uint64_t)]);
+      memcpy(aligned_copy_.get(), contents.data(), contents.size());
+      ser = reinterpret_cast<const uint8_t*>(aligned_copy_.get());
+    }
+    if (use_string_keys_) {
+      string_keys_ = oasis::StringKeyView(ser);
+    }
+    // Borrowed, so the tries and bit arrays are not copied out of the block,
+    // which the parsed filter block holds as long as this reader.
+    filter_.reset(oasis_plus::OasisPlus::deserialize(const_cast<uint8_t*>(ser),
+                                                     /*borrowed=*/true));
   }
 
-  // ~OasisPlusFilterBitsReader() { delete filter_; }
+  // Batched Proteus lookups only pay off once their cache misses do: they were
+  // measured 7-14% faster on a filter of 4M keys, but no faster and up to a
+  // few percent slower on a 1.5 MB filter that stays in cache
+  static constexpr size_t kMinBatchFilterSize = 4 << 20;
 
+  using FilterBitsReader::MayMatch;
   void MayMatch(int num_keys, Slice** keys, bool* may_match) override {
-    (void)num_keys;
-    (void)keys;
-    (void)may_match;
-    return;
+    if (!batch_lookups_) {
+      for (int i = 0; i < num_keys; ++i) {
+        may_match[i] = filter_->query(ToUint64(*keys[i]));
+      }
+      return;
+    }
+    constexpr int kBatch =
+        static_cast<int>(oasis_plus::Proteus::kQueryBatch);
+    uint64_t int_keys[kBatch];
+    for (int begin = 0; begin < num_keys; begin += kBatch) {
+      int cnt = std::min(kBatch, num_keys - begin);
+      for (int i = 0; i < cnt; ++i) {
+        int_keys[i] = ToUint64(*keys[begin + i]);
+      }
+      filter_->query_batch(int_keys, cnt, may_match + begin);
+    }
   }
 
   bool MayMatch(const Slice& entry) override {
-    return filter_->query(sliceToUint64(entry.data()));
+    return filter_->query(ToUint64(entry));
   }
 
   bool RangeQuery(const Slice& left, const Slice& right) override {
-    return filter_->query(sliceToUint64(left.data()),
-                          sliceToUint64(right.data()) - 1);
+    if (query_sample_) {
+      query_sample_->Record(left, right);
+    }
+    if (!use_string_keys_) {
+      return filter_->query(sliceToUint64(left.data()),
+                            sliceToUint64(right.data()) - 1);
+    }
+    // Keys below right may map to the same integer, so it stays in the range
+    uint64_t l_key = ToUint64(left);
+    uint64_t r_key = ToUint64(right);
+    return l_key == r_key ? filter_->query(l_key)
+                          : filter_->query(l_key, r_key);
   }
+
+  using FilterBitsReader::RangeQuery;
+#ifdef OASIS_QUERY_STATS
+  bool RangeQuery(const Slice& left, const Slice& right,
+                  Statistics* stats) override {
+    oasis::QueryStats begin = oasis::QueryStats::local();
+    bool result = RangeQuery(left, right);
+    RecordRangeQueryStats(stats, oasis::QueryStats::local() - begin);
+    return result;
+  }
+#endif
 };
 
 class OasisPlusFilterPolicy : public FilterPolicy {
  public:
-  explicit OasisPlusFilterPolicy(double bpk, size_t block_sz,
-                                 size_t max_qlen = 10)
-      : bpk_(bpk), block_sz_(block_sz), max_qlen_(max_qlen) {}
+  explicit OasisPlusFilterPolicy(
+      double bpk, size_t block_sz, size_t max_qlen = 10,
+      bool string_keys = false,
+      std::shared_ptr<OasisQuerySample> query_sample = nullptr,
+      uint32_t pbf_levels = 1, bool pbf_blocked = false)
+      : bpk_(bpk),
+        block_sz_(block_sz),
+        max_qlen_(max_qlen),
+        string_keys_(string_keys),
+        query_sample_(std::move(query_sample)),
+        pbf_levels_(pbf_levels),
+        pbf_blocked_(pbf_blocked) {}
 
   ~OasisPlusFilterPolicy() {}
 
-  const char* Name() const { return "OasisPlus"; }
+  // Tables are only read with the kind of keys they were built with
+  const char* Name() const {
+    return string_keys_ ? "OasisPlusStringKeys" : "OasisPlus";
+  }
 
   void CreateFilter(const Slice* keys, int n, std::string* dst) const override {
     (void)keys;
@@ -104,22 +298,34 @@ class OasisPlusFilterPolicy : public FilterPolicy {
   }
 
   FilterBitsBuilder* GetFilterBitsBuilder() const override {
-    return new OasisPlusFilterBitsBuilder(bpk_, block_sz_, max_qlen_);
+    return new OasisPlusFilterBitsBuilder(bpk_, block_sz_, max_qlen_,
+                                          string_keys_, query_sample_,
+                                          pbf_levels_, pbf_blocked_);
   }
 
   FilterBitsReader* GetFilterBitsReader(const Slice& contents) const override {
-    return new OasisPlusFilterBitsReader(contents);
+    return new OasisPlusFilterBitsReader(contents, string_keys_,
+                                         query_sample_);
   }
 
  private:
   double bpk_;
   size_t block_sz_;
   size_t max_qlen_;
+  bool string_keys_;
+  std::shared_ptr<OasisQuerySample> query_sample_;
+  // Read back from the filters, the readers need not know them
+  uint32_t pbf_levels_;
+  bool pbf_blocked_;
 };
 
-const FilterPolicy* NewOasisPlusFilterPolicy(double bpk, size_t block_sz,
-                                             size_t max_qlen = 10) {
-  return new OasisPlusFilterPolicy(bpk, block_sz, max_qlen);
+const FilterPolicy* NewOasisPlusFilterPolicy(
+    double bpk, size_t block_sz, size_t max_qlen, bool string_keys,
+    std::shared_ptr<OasisQuerySample> query_sample, uint32_t pbf_levels,
+    bool pbf_blocked) {
+  return new OasisPlusFilterPolicy(bpk, block_sz, max_qlen, string_keys,
+                                   std::move(query_sample), pbf_levels,
+                                   pbf_blocked);
 }
 
 }  // namespace rocksdb
\ No newline at end of file
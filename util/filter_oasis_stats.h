@@ -0,0 +1,26 @@
+#pragma once
+
+#include "monitoring/statistics.h"
+#include "oasis/query_stats.hpp"
+
+namespace rocksdb {
+
+// Adds the costs counted by the Oasis filters, see oasis/query_stats.hpp, to
+// the RANGE_FILTER_* tickers of stats
+inline void RecordRangeQueryStats(Statistics* stats,
+                                  const oasis::QueryStats& costs) {
+  static constexpr Tickers kStageTickers[oasis::QueryStats::kNumStages] = {
+      RANGE_FILTER_MODEL_OUT_OF_SCOPE, RANGE_FILTER_MODEL_EXIST,
+      RANGE_FILTER_BLOCK_BIAS,         RANGE_FILTER_BLOCK_PROBE,
+      RANGE_FILTER_TRIE,               RANGE_FILTER_PREFIX_BF};
+  for (size_t i = 0; i < oasis::QueryStats::kNumStages; ++i) {
+    if (costs.answered[i] != 0) {
+      RecordTick(stats, kStageTickers[i], costs.answered[i]);
+    }
+  }
+  RecordTick(stats, RANGE_FILTER_UPPER_WORDS, costs.upper_words);
+  RecordTick(stats, RANGE_FILTER_LOWER_ENTRIES, costs.lower_entries);
+  RecordTick(stats, RANGE_FILTER_PBF_PROBES, costs.pbf_probes);
+}
+
+}  // namespace rocksdb
@@ -0,0 +1,296 @@
+// Tests of the Oasis and OasisPlus filter policies: the filter blocks they
+// write must answer like the filters they serialize, including once a DB is
+// reopened and the filters are only read from its SST files.
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "filter_test_util.h"
+#include "oasis/oasis_builder.hpp"
+#include "oasis_plus.h"
+#include "rocksdb/db.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/statistics.h"
+#include "rocksdb/table.h"
+#include "test_util/testharness.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+enum class Policy { kOasis, kOasisPlus };
+
+namespace {
+const double kBpk = 12;
+const size_t kBlockSz = 128;
+const size_t kMaxQlen = 10;
+const size_t kNumKeys = 20000;
+const size_t kNumQueries = 20000;
+
+const FilterPolicy* NewPolicy(Policy policy) {
+  return policy == Policy::kOasis
+             ? NewOasisFilterPolicy(kBpk, kBlockSz)
+             : NewOasisPlusFilterPolicy(kBpk, kBlockSz, kMaxQlen);
+}
+
+// Sorted distinct keys, dense runs and isolated ones, so that both the
+// learned part and Proteus of OasisPlus get some
+std::vector<uint64_t> MakeKeys(size_t n, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<uint64_t> keys;
+  for (size_t i = 0; i < n; ++i) {
+    keys.push_back(i % 2 == 0 ? rng() : (rng() % 8) << 60 | rng() % (n * 16));
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+// [left, right) around keys or anywhere, with 1 < right - left <= 1000
+std::vector<std::pair<uint64_t, uint64_t>> MakeRanges(
+    const std::vector<uint64_t>& keys, size_t n, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t len = 2 + rng() % 999;
+    uint64_t left = rng();
+    if (i % 2 == 0) {
+      uint64_t key = keys[rng() % keys.size()];
+      left = key - std::min(key, rng() % len);
+    }
+    left = std::min(left, UINT64_MAX - len);
+    ranges.emplace_back(left, left + len);
+  }
+  return ranges;
+}
+
+std::string Key(uint64_t key) { return util_uint64ToString(key); }
+}  // namespace
+
+class OasisFilterBlockTest : public testing::Test {
+ protected:
+  // The filter block the policy writes for keys
+  static std::string BuildBlock(const FilterPolicy& policy,
+                                const std::vector<uint64_t>& keys) {
+    std::unique_ptr<FilterBitsBuilder> builder(policy.GetFilterBitsBuilder());
+    for (uint64_t key : keys) {
+      builder->AddKey(Key(key));
+    }
+    std::unique_ptr<const char[]> buf;
+    return builder->Finish(&buf).ToString();
+  }
+
+  // A reader of block at offset bytes past an 8-byte boundary, which must
+  // outlive the reader
+  static FilterBitsReader* NewReader(const FilterPolicy& policy,
+                                     const std::string& block, size_t offset,
+                                     std::unique_ptr<uint64_t[]>* buf) {
+    buf->reset(new uint64_t[(block.size() + offset + 7) / 8]);
+    char* data = reinterpret_cast<char*>(buf->get()) + offset;
+    memcpy(data, block.data(), block.size());
+    return policy.GetFilterBitsReader(Slice(data, block.size()));
+  }
+
+  // reader answers every point and range query like filter, whose ranges
+  // are [left, right], and a MultiGet like its keys one by one
+  template <typename Filter>
+  static void ExpectSameAnswers(FilterBitsReader* reader, const Filter& filter,
+                                const std::vector<uint64_t>& keys) {
+    for (uint64_t key : keys) {
+      ASSERT_TRUE(reader->MayMatch(Key(key)));
+    }
+    std::vector<std::string> lefts;
+    for (const auto& [left, right] : MakeRanges(keys, kNumQueries, 3)) {
+      ASSERT_EQ(reader->MayMatch(Key(left)), filter.query(left)) << left;
+      ASSERT_EQ(reader->RangeQuery(Key(left), Key(right)),
+                filter.query(left, right - 1))
+          << left << ", " << right;
+      lefts.push_back(Key(left));
+    }
+
+    std::vector<Slice> slices(lefts.begin(), lefts.end());
+    std::vector<Slice*> slice_ptrs;
+    for (Slice& slice : slices) {
+      slice_ptrs.push_back(&slice);
+    }
+    std::unique_ptr<bool[]> may_match(new bool[lefts.size()]);
+    reader->MayMatch(static_cast<int>(lefts.size()), slice_ptrs.data(),
+                     may_match.get());
+    for (size_t i = 0; i < lefts.size(); ++i) {
+      ASSERT_EQ(may_match[i], reader->MayMatch(lefts[i])) << i;
+    }
+  }
+};
+
+TEST_F(OasisFilterBlockTest, OasisBlockAnswersAsFilter) {
+  std::unique_ptr<const FilterPolicy> policy(NewPolicy(Policy::kOasis));
+  std::vector<uint64_t> keys = MakeKeys(kNumKeys, 1);
+  std::string block = BuildBlock(*policy, keys);
+
+  oasis::OasisBuilder builder(kBpk, kBlockSz);
+  for (uint64_t key : keys) {
+    builder.add(key);
+  }
+  std::unique_ptr<oasis::Oasis> filter(builder.finish());
+
+  for (size_t offset : {0, 1}) {
+    std::unique_ptr<uint64_t[]> buf;
+    std::unique_ptr<FilterBitsReader> reader(
+        NewReader(*policy, block, offset, &buf));
+    ExpectSameAnswers(reader.get(), *filter, keys);
+  }
+}
+
+// Also with the prefix Bloom filter of Proteus at several levels or blocked,
+// which the readers learn from the blocks
+TEST_F(OasisFilterBlockTest, OasisPlusBlockAnswersAsFilter) {
+  std::vector<uint64_t> keys = MakeKeys(kNumKeys, 2);
+  for (const auto& [pbf_levels, pbf_blocked] :
+       {std::make_pair(1U, false), std::make_pair(3U, false),
+        std::make_pair(1U, true)}) {
+    std::unique_ptr<const FilterPolicy> policy(NewOasisPlusFilterPolicy(
+        kBpk, kBlockSz, kMaxQlen, false, nullptr, pbf_levels, pbf_blocked));
+    std::string block = BuildBlock(*policy, keys);
+    oasis_plus::OasisPlus filter(kBpk, kBlockSz, keys, kMaxQlen, {},
+                                 pbf_levels, pbf_blocked);
+
+    for (size_t offset : {0, 1}) {
+      std::unique_ptr<uint64_t[]> buf;
+      std::unique_ptr<FilterBitsReader> reader(
+          NewReader(*policy, block, offset, &buf));
+      ExpectSameAnswers(reader.get(), filter, keys);
+    }
+  }
+}
+
+// With string keys, whole keys rather than their first 8 bytes are filtered:
+// keys sharing those differ only past them
+TEST_F(OasisFilterBlockTest, StringKeyBlocksHaveNoFalseNegatives) {
+  std::vector<std::string> keys;
+  for (uint64_t key : MakeKeys(kNumKeys, 6)) {
+    keys.push_back("tenant|" + Key(key));
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::unique_ptr<const FilterPolicy> policies[] = {
+      std::unique_ptr<const FilterPolicy>(
+          NewOasisFilterPolicy(kBpk, kBlockSz, 1, true)),
+      std::unique_ptr<const FilterPolicy>(
+          NewOasisPlusFilterPolicy(kBpk, kBlockSz, kMaxQlen, true))};
+  for (const auto& policy : policies) {
+    std::unique_ptr<FilterBitsBuilder> builder(policy->GetFilterBitsBuilder());
+    for (const std::string& key : keys) {
+      builder->AddKey(key);
+    }
+    std::unique_ptr<const char[]> buf;
+    std::string block = builder->Finish(&buf).ToString();
+
+    std::unique_ptr<uint64_t[]> aligned;
+    std::unique_ptr<FilterBitsReader> reader(
+        NewReader(*policy, block, 0, &aligned));
+    for (size_t i = 0; i < keys.size(); ++i) {
+      const std::string& key = keys[i];
+      ASSERT_TRUE(reader->MayMatch(key)) << key;
+      // [a prefix of key, key + '\0') and up to the next key
+      std::string left = key.substr(0, key.size() - i % 8);
+      ASSERT_TRUE(reader->RangeQuery(left, key + '\0')) << key;
+      if (i + 1 < keys.size()) {
+        ASSERT_TRUE(reader->RangeQuery(key, keys[i + 1] + '\0')) << key;
+      }
+    }
+    // absent keys are mostly filtered out
+    size_t absent = 0;
+    size_t positives = 0;
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i < kNumQueries; ++i) {
+      std::string key = "tenant|" + Key(rng());
+      if (!std::binary_search(keys.begin(), keys.end(), key)) {
+        absent++;
+        positives += reader->MayMatch(key);
+      }
+    }
+    EXPECT_LT(positives, absent / 4);
+  }
+}
+
+class OasisFilterDBTest : public testing::TestWithParam<Policy> {
+ protected:
+  OasisFilterDBTest() {
+    dbname_ = test::PerThreadDBPath("filter_oasis_test");
+    options_.create_if_missing = true;
+    options_.statistics = CreateDBStatistics();
+    BlockBasedTableOptions table_options;
+    table_options.filter_policy.reset(NewPolicy(GetParam()));
+    options_.table_factory.reset(NewBlockBasedTableFactory(table_options));
+    EXPECT_OK(DestroyDB(dbname_, options_));
+  }
+
+  ~OasisFilterDBTest() override {
+    delete db_;
+    EXPECT_OK(DestroyDB(dbname_, options_));
+  }
+
+  Status Reopen() {
+    delete db_;
+    db_ = nullptr;
+    return DB::Open(options_, dbname_, &db_);
+  }
+
+  std::string dbname_;
+  Options options_;
+  DB* db_ = nullptr;
+};
+
+// The filters survive a reopen: they are read back from the filter blocks,
+// with no false negative for Get() nor for bounded seeks
+TEST_P(OasisFilterDBTest, ReopenServesFilterBlocks) {
+  std::vector<uint64_t> keys = MakeKeys(kNumKeys, 3);
+  ASSERT_OK(Reopen());
+  for (uint64_t key : keys) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(key), "v"));
+  }
+  ASSERT_OK(db_->Flush(FlushOptions()));
+  ASSERT_OK(Reopen());
+
+  std::string value;
+  for (uint64_t key : keys) {
+    ASSERT_OK(db_->Get(ReadOptions(), Key(key), &value));
+  }
+  uint64_t useful = options_.statistics->getTickerCount(BLOOM_FILTER_USEFUL);
+  for (const auto& [left, right] : MakeRanges(keys, kNumQueries, 4)) {
+    bool exists = std::binary_search(keys.begin(), keys.end(), left);
+    ASSERT_EQ(db_->Get(ReadOptions(), Key(left), &value).ok(), exists);
+  }
+  // the absent keys are mostly filtered out
+  EXPECT_GT(options_.statistics->getTickerCount(BLOOM_FILTER_USEFUL),
+            useful + kNumQueries / 4);
+
+  for (const auto& [left, right] : MakeRanges(keys, kNumQueries, 5)) {
+    std::string upper = Key(right);
+    Slice upper_bound(upper);
+    ReadOptions read_options;
+    read_options.iterate_upper_bound = &upper_bound;
+    std::unique_ptr<Iterator> iter(db_->NewIterator(read_options));
+    iter->Seek(Key(left));
+    ASSERT_OK(iter->status());
+
+    auto it = std::lower_bound(keys.begin(), keys.end(), left);
+    bool holds_key = it != keys.end() && *it < right;
+    ASSERT_EQ(iter->Valid(), holds_key) << left << ", " << right;
+    if (holds_key) {
+      ASSERT_EQ(iter->key().ToString(), Key(*it));
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(OasisFilterDBTest, OasisFilterDBTest,
+                        testing::Values(Policy::kOasis, Policy::kOasisPlus));
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}